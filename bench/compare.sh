@@ -0,0 +1,31 @@
+#!/bin/sh
+
+# Compare the bytecode VM with the LLVM JIT (and the tiered mode) on the benchmark programs.
+# Usage: sh compare.sh [path to lox]   (default ../src/lox, run from the bench directory)
+
+LOX="${1:-../src/lox}"
+
+# Wall clock time of a command in milliseconds (the output of the program is discarded), or
+# "failed" if it exits with an error: the VM and the interpreter of the tiered mode reject the
+# programs that use classes, lists, maps or closures (exit 65).
+measure()
+{
+    start=`date +%s%N`
+    if "$@" > /dev/null 2>&1
+    then
+        end=`date +%s%N`
+        echo "$(( (end - start) / 1000000 )) ms"
+    else
+        echo "failed ($?)"
+    fi
+}
+
+printf "%-14s %12s %12s %12s %12s\n" "program" "vm" "jit -O0" "jit -O2" "tiered -O2"
+for program in *.lox
+do
+    vm=`measure "$LOX" run --vm "$program"`
+    jit0=`measure "$LOX" run -O0 "$program"`
+    jit2=`measure "$LOX" run -O2 "$program"`
+    tiered=`measure "$LOX" run --tiered -O2 "$program"`
+    printf "%-14s %12s %12s %12s %12s\n" "$program" "$vm" "$jit0" "$jit2" "$tiered"
+done
@@ -0,0 +1,150 @@
+#include "aot.hpp"
+
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/SmallVectorMemoryBuffer.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <cstdlib>
+#include <vector>
+
+namespace lox
+{
+    AOT::AOT(OptLevel level_, bool native_cpu) :
+        level{level_}
+    {
+        using namespace llvm;
+
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+
+        triple = sys::getDefaultTargetTriple();
+        std::string error;
+        llvm_target = TargetRegistry::lookupTarget(triple, error);
+        if (!llvm_target)
+        {
+            throw AOTError{error};
+        }
+
+        if (native_cpu)
+        {
+            cpu = sys::getHostCPUName().str();
+
+            StringMap<bool> host_features;
+            if (sys::getHostCPUFeatures(host_features))
+            {
+                SubtargetFeatures subtarget;
+                for (const auto& feature : host_features)
+                {
+                    subtarget.AddFeature(feature.first(), feature.second);
+                }
+                features = subtarget.getString();
+            }
+        }
+
+        target = CreateTargetMachine();
+    }
+
+
+    auto AOT::CreateTargetMachine() const
+        -> std::unique_ptr<llvm::TargetMachine>
+    {
+        using namespace llvm;
+
+        // PIC, because the compiler drivers link position independent executables by default.
+        std::unique_ptr<llvm::TargetMachine> machine{llvm_target->createTargetMachine(triple, cpu,
+            features, TargetOptions{}, Reloc::PIC_, None, CodeGenLevel(level))};
+        if (!machine)
+        {
+            throw AOTError{"Could not create the target machine for " + triple};
+        }
+        return machine;
+    }
+
+
+    auto AOT::EmitObject(llvm::Module& mod, const std::string& path)
+        -> void
+    {
+        using namespace llvm;
+
+        std::error_code ec;
+        raw_fd_ostream out{path, ec, sys::fs::OF_None};
+        if (ec)
+        {
+            throw AOTError{"Could not open " + path + ": " + ec.message()};
+        }
+
+        // The code generator still uses the legacy pass manager.
+        legacy::PassManager pm;
+        if (target->addPassesToEmitFile(pm, out, nullptr, CGFT_ObjectFile))
+        {
+            throw AOTError{"The target can't emit object files"};
+        }
+        pm.run(mod);
+        out.flush();
+    }
+
+
+    auto AOT::Compile(llvm::TargetMachine& target, llvm::Module& mod)
+        -> std::unique_ptr<llvm::MemoryBuffer>
+    {
+        using namespace llvm;
+
+        SmallVector<char, 0> buffer;
+        raw_svector_ostream out{buffer};
+        legacy::PassManager pm;
+        if (target.addPassesToEmitFile(pm, out, nullptr, CGFT_ObjectFile))
+        {
+            throw AOTError{"The target can't emit object files"};
+        }
+        pm.run(mod);
+        return std::make_unique<SmallVectorMemoryBuffer>(std::move(buffer), mod.getModuleIdentifier());
+    }
+
+
+    auto AOT::WriteObject(const llvm::MemoryBuffer& object, const std::string& path)
+        -> void
+    {
+        using namespace llvm;
+
+        std::error_code ec;
+        raw_fd_ostream out{path, ec, sys::fs::OF_None};
+        if (ec)
+        {
+            throw AOTError{"Could not open " + path + ": " + ec.message()};
+        }
+        out << object.getBuffer();
+    }
+
+
+    auto AOT::Link(const std::vector<std::string>& objects, const std::string& runtime,
+        const std::string& output)
+        -> void
+    {
+        using namespace llvm;
+
+        const char* linker_name = std::getenv("LOX_LINKER");
+        auto linker = sys::findProgramByName(linker_name ? linker_name : "c++");
+        if (!linker)
+        {
+            throw AOTError{"Could not find the linker: " + linker.getError().message()};
+        }
+
+        std::vector<StringRef> args{*linker};
+        args.insert(args.end(), objects.begin(), objects.end());
+        args.insert(args.end(), {runtime, "-o", output});
+        std::string error;
+        auto status = sys::ExecuteAndWait(*linker, args, None, {}, 0, 0, &error);
+        if (status != 0)
+        {
+            throw AOTError{"Link failed" + (error.empty() ? std::string{} : ": " + error)};
+        }
+    }
+} // namespace lox
@@ -0,0 +1,98 @@
+#ifndef LOX_AOT_HPP
+#define LOX_AOT_HPP
+
+/*
+aot.hpp
+
+PURPOSE: Compile the program ahead of time to a native executable.
+
+CLASSES:
+    AOTError: Exception raised when the object file can't be emitted or linked.
+    AOT: Lower the module to an object file with llvm::TargetMachine and link it with the runtime.
+
+DESCRIPTION:
+    The target is the default triple of the host. By default the code runs on any CPU of the
+    architecture (generic CPU); with native_cpu the name and the features of the host CPU are used,
+    like -march=native. As for the JIT, the modules must be prepared and optimized with the
+    target machine returned by TargetMachine().
+    The object file is linked with the static runtime (liblox_rt.a) by the system compiler driver
+    (c++, or the program in the LOX_LINKER environment variable), which adds the C/C++ libraries.
+*/
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "common.hpp"
+#include "optimizer.hpp"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lox
+{
+    class AOTError : public std::runtime_error
+    {
+    public:
+        explicit AOTError(const std::string& msg) : std::runtime_error(msg) { }
+    };
+
+
+    class AOT : private NonCopyable
+    {
+    public:
+        // Create the target machine. Throw AOTError on failure.
+        AOT(OptLevel level, bool native_cpu);
+
+        auto TargetMachine() noexcept
+            -> llvm::TargetMachine&
+        {
+            return *target;
+        }
+
+        // Set the data layout and the triple of the module to the ones of the target.
+        // Must be done before optimizing the module.
+        auto Prepare(llvm::Module& mod) const
+            -> void
+        {
+            mod.setDataLayout(target->createDataLayout());
+            mod.setTargetTriple(target->getTargetTriple().str());
+        }
+
+        // Create another target machine with the same options, for a thread that compiles in
+        // parallel (a target machine can't be shared by the threads).
+        auto CreateTargetMachine() const
+            -> std::unique_ptr<llvm::TargetMachine>;
+
+        // Write the machine code of the module in an object file.
+        auto EmitObject(llvm::Module& mod, const std::string& path)
+            -> void;
+
+        // Return the object file with the machine code of the module.
+        static auto Compile(llvm::TargetMachine& target, llvm::Module& mod)
+            -> std::unique_ptr<llvm::MemoryBuffer>;
+
+        // Write the object file returned by Compile().
+        static auto WriteObject(const llvm::MemoryBuffer& object, const std::string& path)
+            -> void;
+
+        // Link the object files with the runtime library in an executable.
+        static auto Link(const std::vector<std::string>& objects, const std::string& runtime,
+            const std::string& output)
+            -> void;
+
+    private:
+        std::unique_ptr<llvm::TargetMachine> target;
+
+        non_owned_ptr<const llvm::Target> llvm_target{nullptr};
+        std::string triple;
+        std::string cpu{"generic"};
+        std::string features;
+        OptLevel level;
+    };
+} // namespace lox
+
+#endif
@@ -1 +1,783 @@
+#include "node.hpp"
 #include "ast_printer.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+namespace lox
+{
+    auto ASTPrinter::Print(const StmtNode& node)
+        -> void
+    {
+        Visit(node);
+        if (format == ASTFormat::SExpr)
+        {
+            Write('\n');
+        }
+    }
+
+
+    auto ASTPrinter::Print(const std::vector<StmtNode>& nodes)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            for (const auto& node : nodes)
+            {
+                Print(node);
+            }
+            return;
+        }
+
+        Write('[');
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+        {
+            if (i != 0)
+            {
+                Write(',');
+            }
+            Visit(nodes[i]);
+        }
+        Write("]\n");
+    }
+
+
+    auto ASTPrinter::Flush()
+        -> void
+    {
+        if (out_file && size != 0)
+        {
+            std::fwrite(buffer.data(), 1, size, out_file);
+            size = 0;
+        }
+    }
+
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+
+    auto ASTPrinter::operator()(const BinaryExprNodePtr& n)
+        -> void
+    {
+        Binary("Binary", n->op.Lexeme(), n->left, n->right);
+    }
+
+
+    auto ASTPrinter::operator()(const UnaryExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Unary(n->op.Lexeme(), n->right);
+            return;
+        }
+
+        BeginObject("Unary");
+        Key("op");
+        WriteQuoted(n->op.Lexeme());
+        Key("right");
+        Visit(n->right);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const LiteralNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::Json)
+        {
+            BeginObject("Literal");
+            Key("value");
+        }
+
+        switch (n->literal.index())
+        {
+        case 0: // LoxNil
+            Write(format == ASTFormat::Json ? "null" : LoxNil::value);
+            break;
+        case 1: // StringId
+            WriteQuoted(strings->Get(*std::get_if<1>(&n->literal)));
+            break;
+        case 2: // f64
+            WriteNumber(*std::get_if<2>(&n->literal));
+            break;
+        case 3: // bool
+            Write(*std::get_if<3>(&n->literal) ? "true" : "false");
+            break;
+        default:
+            break;
+        }
+
+        if (format == ASTFormat::Json)
+        {
+            Write('}');
+        }
+    }
+
+
+    auto ASTPrinter::operator()(const GroupingNodePtr& n)
+        -> void
+    {
+        Unary(format == ASTFormat::Json ? "Grouping" : "group", n->expr);
+    }
+
+
+    auto ASTPrinter::operator()(const AssignExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(= ");
+            Write(n->name.Lexeme());
+            Write(' ');
+            Visit(n->expr);
+            Write(')');
+            return;
+        }
+
+        BeginObject("Assign");
+        Key("name");
+        WriteQuoted(n->name.Lexeme());
+        Key("value");
+        Visit(n->expr);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const VarExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write(n->name.Lexeme());
+            return;
+        }
+
+        BeginObject("Var");
+        Key("name");
+        WriteQuoted(n->name.Lexeme());
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const LogicalExprNodePtr& n)
+        -> void
+    {
+        Binary("Logical", n->op.Lexeme(), n->left, n->right);
+    }
+
+
+    auto ASTPrinter::operator()(const CallExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(call ");
+            Write(n->callee.Lexeme());
+            for (const auto& arg : n->arguments)
+            {
+                Write(' ');
+                Visit(arg);
+            }
+            Write(')');
+            return;
+        }
+
+        BeginObject("Call");
+        Key("callee");
+        WriteQuoted(n->callee.Lexeme());
+        Key("arguments");
+        Write('[');
+        for (std::size_t i = 0; i < n->arguments.size(); ++i)
+        {
+            if (i != 0)
+            {
+                Write(',');
+            }
+            Visit(n->arguments[i]);
+        }
+        Write("]}");
+    }
+
+
+    auto ASTPrinter::operator()(const CmpExprNodePtr& n)
+        -> void
+    {
+        Binary("Cmp", n->op.Lexeme(), n->left, n->right);
+    }
+
+
+    auto ASTPrinter::operator()(const GetExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(. ");
+            Visit(n->object);
+            Write(' ');
+            Write(n->name.Lexeme());
+            Write(')');
+            return;
+        }
+
+        BeginObject("Get");
+        Key("object");
+        Visit(n->object);
+        Key("name");
+        WriteQuoted(n->name.Lexeme());
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const SetExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(.= ");
+            Visit(n->object);
+            Write(' ');
+            Write(n->name.Lexeme());
+            Write(' ');
+            Visit(n->value);
+            Write(')');
+            return;
+        }
+
+        BeginObject("Set");
+        Key("object");
+        Visit(n->object);
+        Key("name");
+        WriteQuoted(n->name.Lexeme());
+        Key("value");
+        Visit(n->value);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const InvokeExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(invoke ");
+            Visit(n->object);
+            Write(' ');
+            Write(n->name.Lexeme());
+            Arguments(n->arguments);
+            Write(')');
+            return;
+        }
+
+        BeginObject("Invoke");
+        Key("object");
+        Visit(n->object);
+        Key("name");
+        WriteQuoted(n->name.Lexeme());
+        Arguments(n->arguments);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const SuperInvokeExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(super ");
+            Write(n->method.Lexeme());
+            Arguments(n->arguments);
+            Write(')');
+            return;
+        }
+
+        BeginObject("SuperInvoke");
+        Key("class");
+        WriteQuoted(n->klass.Lexeme());
+        Key("name");
+        WriteQuoted(n->method.Lexeme());
+        Arguments(n->arguments);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const ListExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(list");
+            Arguments(n->elements);
+            Write(')');
+            return;
+        }
+
+        BeginObject("List");
+        Key("elements");
+        Write('[');
+        for (std::size_t i = 0; i < n->elements.size(); ++i)
+        {
+            if (i != 0)
+            {
+                Write(',');
+            }
+            Visit(n->elements[i]);
+        }
+        Write("]}");
+    }
+
+
+    auto ASTPrinter::operator()(const IndexExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("([] ");
+            Visit(n->object);
+            Write(' ');
+            Visit(n->index);
+            Write(')');
+            return;
+        }
+
+        BeginObject("Index");
+        Key("object");
+        Visit(n->object);
+        Key("index");
+        Visit(n->index);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const IndexSetExprNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("([]= ");
+            Visit(n->object);
+            Write(' ');
+            Visit(n->index);
+            Write(' ');
+            Visit(n->value);
+            Write(')');
+            return;
+        }
+
+        BeginObject("IndexSet");
+        Key("object");
+        Visit(n->object);
+        Key("index");
+        Visit(n->index);
+        Key("value");
+        Visit(n->value);
+        Write('}');
+    }
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+    auto ASTPrinter::operator()(const ExprStmtNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Visit(n->expr);
+            return;
+        }
+
+        Unary("ExprStmt", n->expr);
+    }
+
+
+    auto ASTPrinter::operator()(const PrintStmtNodePtr& n)
+        -> void
+    {
+        Unary(format == ASTFormat::Json ? "Print" : "print", n->expr);
+    }
+
+
+    auto ASTPrinter::operator()(const VarStmtNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(var ");
+            Write(n->name.Lexeme());
+            Write(' ');
+            Visit(n->initializer);
+            Write(')');
+            return;
+        }
+
+        BeginObject("VarStmt");
+        Key("name");
+        WriteQuoted(n->name.Lexeme());
+        Key("initializer");
+        Visit(n->initializer);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const BlockStmtNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(block");
+            for (const auto& s : n->statements)
+            {
+                Write(' ');
+                Visit(s);
+            }
+            Write(')');
+            return;
+        }
+
+        BeginObject("Block");
+        Key("statements");
+        Write('[');
+        for (std::size_t i = 0; i < n->statements.size(); ++i)
+        {
+            if (i != 0)
+            {
+                Write(',');
+            }
+            Visit(n->statements[i]);
+        }
+        Write("]}");
+    }
+
+
+    auto ASTPrinter::operator()(const FunStmtNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(fun ");
+            Write(n->name.Lexeme());
+            Write(" (");
+            for (std::size_t i = 0; i < n->parameters.size(); ++i)
+            {
+                if (i != 0)
+                {
+                    Write(' ');
+                }
+                Write(n->parameters[i].Lexeme());
+            }
+            Write(") ");
+            (*this)(n->body);
+            Write(')');
+            return;
+        }
+
+        BeginObject("Fun");
+        Key("name");
+        WriteQuoted(n->name.Lexeme());
+        Key("parameters");
+        Write('[');
+        for (std::size_t i = 0; i < n->parameters.size(); ++i)
+        {
+            if (i != 0)
+            {
+                Write(',');
+            }
+            WriteQuoted(n->parameters[i].Lexeme());
+        }
+        Write(']');
+        Key("body");
+        (*this)(n->body);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const ReturnStmtNodePtr& n)
+        -> void
+    {
+        Unary(format == ASTFormat::Json ? "Return" : "return", n->value);
+    }
+
+
+    auto ASTPrinter::operator()(const IfStmtNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(if ");
+            Visit(n->condition);
+            Write(' ');
+            Visit(n->then_branch);
+            if (n->else_branch)
+            {
+                Write(' ');
+                Visit(*n->else_branch);
+            }
+            Write(')');
+            return;
+        }
+
+        BeginObject("If");
+        Key("condition");
+        Visit(n->condition);
+        Key("then");
+        Visit(n->then_branch);
+        if (n->else_branch)
+        {
+            Key("else");
+            Visit(*n->else_branch);
+        }
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const WhileStmtNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(while ");
+            Visit(n->condition);
+            Write(' ');
+            Visit(n->body);
+            Write(')');
+            return;
+        }
+
+        BeginObject("While");
+        Key("condition");
+        Visit(n->condition);
+        Key("body");
+        Visit(n->body);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::operator()(const ClassStmtNodePtr& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write("(class ");
+            Write(n->name.Lexeme());
+            if (n->superclass)
+            {
+                Write(" < ");
+                Write(n->superclass->Lexeme());
+            }
+            for (const auto& method : n->methods)
+            {
+                Write(' ');
+                (*this)(method);
+            }
+            Write(')');
+            return;
+        }
+
+        BeginObject("Class");
+        Key("name");
+        WriteQuoted(n->name.Lexeme());
+        if (n->superclass)
+        {
+            Key("superclass");
+            WriteQuoted(n->superclass->Lexeme());
+        }
+        Key("methods");
+        Write('[');
+        for (std::size_t i = 0; i < n->methods.size(); ++i)
+        {
+            if (i != 0)
+            {
+                Write(',');
+            }
+            (*this)(n->methods[i]);
+        }
+        Write("]}");
+    }
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+
+    // ********************************* UTILITY *********************************
+
+    auto ASTPrinter::Arguments(const std::vector<ExprNode>& args)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            for (const auto& arg : args)
+            {
+                Write(' ');
+                Visit(arg);
+            }
+            return;
+        }
+
+        Key("arguments");
+        Write('[');
+        for (std::size_t i = 0; i < args.size(); ++i)
+        {
+            if (i != 0)
+            {
+                Write(',');
+            }
+            Visit(args[i]);
+        }
+        Write(']');
+    }
+
+
+    auto ASTPrinter::Unary(const std::string_view name, const ExprNode& n)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write('(');
+            Write(name);
+            Write(' ');
+            Visit(n);
+            Write(')');
+            return;
+        }
+
+        BeginObject(name);
+        Key("expr");
+        Visit(n);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::Binary(const std::string_view kind, const std::string_view op,
+        const ExprNode& n1, const ExprNode& n2)
+        -> void
+    {
+        if (format == ASTFormat::SExpr)
+        {
+            Write('(');
+            Write(op);
+            Write(' ');
+            Visit(n1);
+            Write(' ');
+            Visit(n2);
+            Write(')');
+            return;
+        }
+
+        BeginObject(kind);
+        Key("op");
+        WriteQuoted(op);
+        Key("left");
+        Visit(n1);
+        Key("right");
+        Visit(n2);
+        Write('}');
+    }
+
+
+    auto ASTPrinter::BeginObject(const std::string_view kind)
+        -> void
+    {
+        Write("{\"kind\":\"");
+        Write(kind);
+        Write('"');
+    }
+
+
+    auto ASTPrinter::Key(const std::string_view key)
+        -> void
+    {
+        Write(",\"");
+        Write(key);
+        Write("\":");
+    }
+
+
+    auto ASTPrinter::WriteNumber(f64 value)
+        -> void
+    {
+        if (!std::isfinite(value))
+        {
+            // JSON has no representation for inf and nan.
+            Write(format == ASTFormat::Json ? "null" : (std::isnan(value) ? "nan" : "inf"));
+            return;
+        }
+
+        // Shortest representation that round trips.
+        std::array<char, 32> digits;
+        auto r = std::to_chars(digits.data(), digits.data() + digits.size(), value);
+        Write(std::string_view{digits.data(), static_cast<std::size_t>(r.ptr - digits.data())});
+    }
+
+
+    auto ASTPrinter::WriteQuoted(const std::string_view s)
+        -> void
+    {
+        Write('"');
+        if (format == ASTFormat::SExpr)
+        {
+            Write(s);
+            Write('"');
+            return;
+        }
+
+        // Escape the string in JSON format. Lox strings have no escape sequences, so
+        // only quotes, backslashes and control characters need to be handled.
+        constexpr std::string_view hex = "0123456789abcdef";
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i < s.size(); ++i)
+        {
+            auto c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x20 && c != '"' && c != '\\')
+            {
+                continue;
+            }
+
+            Write(s.substr(begin, i - begin));
+            begin = i + 1;
+            switch (c)
+            {
+            case '"':  Write("\\\""); break;
+            case '\\': Write("\\\\"); break;
+            case '\n': Write("\\n"); break;
+            case '\r': Write("\\r"); break;
+            case '\t': Write("\\t"); break;
+            default:
+                Write("\\u00");
+                Write(hex[c >> 4]);
+                Write(hex[c & 0xf]);
+                break;
+            }
+        }
+        Write(s.substr(begin));
+        Write('"');
+    }
+
+
+    auto ASTPrinter::Write(const std::string_view s)
+        -> void
+    {
+        if (out_string)
+        {
+            out_string->append(s);
+            return;
+        }
+
+        // Copy the string in chunks, flushing the buffer every time it is full.
+        std::size_t written = 0;
+        while (written < s.size())
+        {
+            if (size == buffer.size())
+            {
+                Flush();
+            }
+            auto n = std::min(buffer.size() - size, s.size() - written);
+            s.copy(buffer.data() + size, n, written);
+            size += n;
+            written += n;
+        }
+    }
+
+    // ********************************* UTILITY *********************************
+
+} // namespace lox
@@ -7,234 +7,226 @@ ast_printer.hpp
 PURPOSE: Implementation of a printer for the AST.
 
 CLASSES:
+    ASTFormat: Enum for the output format of the printer.
     ASTPrinter: implement visit for the traversal of the AST.
 
 DESCRIPTION:
-    The implementation is slow and bad, each operation returns a string, it would be better 
-    to have an internal stringstream to build strings but for now it works for visualizing the
-    AST.
+    The printer streams the AST into a single output sink instead of building a string for
+    each node. The sink is either a buffer provided by the caller (the output is appended to it)
+    or a FILE*; in the latter case the output goes through a fixed size internal buffer that is
+    flushed when full, so the traversal never allocates.
+    Two formats are supported: S-expressions (one line per statement) for debugging and a compact
+    JSON dump (an array of statements) for offline tooling.
 */
 
 #include "node.hpp"
+#include "common.hpp"
+#include "string_pool.hpp"
+
+#include <array>
 #include <variant>
+#include <vector>
 #include <string_view>
 #include <string>
-#include <sstream>
+#include <cstdio>
 
 namespace lox
 {
-    // TODO: use a strinstream private variable instaed of returing a string from operator().
-    class ASTPrinter
+    enum class ASTFormat : u8
+    {
+        SExpr, Json
+    };
+
+
+    class ASTPrinter : private NonCopyable
     {
     public:
-        // auto operator()(const std::monostate& n) const
-        //     -> std::string
-        // {
-        //     return "variant monostate";
-        // }
-
-        auto operator()(const BinaryExprNodePtr& n) const
-            -> std::string
-        {
-            // auto op = std::string{b->op.Lexeme()};
-            return Parenthesize(n->op.Lexeme(), n->left, n->right);
-        }
+        // Append the output to the buffer. The buffer must outlive the printer.
+        // The pool is the one used to parse the AST (for string literals).
+        explicit ASTPrinter(std::string& buffer, const StringPool& strings_,
+            ASTFormat format_ = ASTFormat::SExpr) :
+            out_string(&buffer), strings(&strings_), format(format_) { }
 
+        // Write the output to the file. The file is not closed by the printer.
+        explicit ASTPrinter(std::FILE* file, const StringPool& strings_,
+            ASTFormat format_ = ASTFormat::SExpr) :
+            out_file(file), strings(&strings_), format(format_) { }
 
-        auto operator()(const UnaryExprNodePtr& n) const
-            -> std::string
+        ~ASTPrinter()
         {
-            return Parenthesize(n->op.Lexeme(), n->right);
+            Flush();
         }
 
 
-        auto operator()(const LiteralNodePtr& n) const 
-            -> std::string
-        {
-            switch (n->literal.index())
-            {
-            case 0: // LoxNil
-                return LoxNil::value;
-            case 1: // std::string
-                return *std::get_if<1>(&n->literal);
-            case 2: // f64
-                return std::to_string(*std::get_if<2>(&n->literal));
-            case 3: // bool
-                return *std::get_if<3>(&n->literal) ? "true" : "false";
-            default:
-                return "";
-            }   
-        }
+        // Print a single statement. In S-expression format the statement is terminated by a newline.
+        auto Print(const StmtNode& node)
+            -> void;
 
+        // Print a whole program. In JSON format the program is an array of statements.
+        auto Print(const std::vector<StmtNode>& nodes)
+            -> void;
 
-        auto operator()(const GroupingNodePtr& n) const
-            -> std::string
-        {
-            return Parenthesize("group", n->expr);
-        }
+        // Write the content of the internal buffer to the file (no-op for string output).
+        auto Flush()
+            -> void;
 
 
-        auto operator()(const AssignExprNodePtr& n) const
-            -> std::string
-        {
-            std::stringstream ss;
-            ss << n->name.Lexeme() << " = " << Visit(n->expr) << "\n";
-            return ss.str();
-        }
+    public:
+        // Visitor for expressions.
 
-        auto operator()(const VarExprNodePtr& n) const
-            -> std::string
-        {
-            return std::string{n->name.Lexeme()};
-        }
+        auto operator()(const BinaryExprNodePtr& n)
+            -> void;
 
-        auto operator()(const LogicalExprNodePtr& n) const
-            -> std::string
-        {
-            return Parenthesize(n->op.Lexeme(), n->left, n->right);
-        }
+        auto operator()(const UnaryExprNodePtr& n)
+            -> void;
 
-        auto operator()(const CallExprNodePtr& n) const
-            -> std::string 
-        {
-            std::stringstream ss;
-            ss << n->callee;
-            ss << "(";
-            for (const auto& p : n->arguments)
-            {
-                ss << Visit(p) << ", ";
-            }
-            ss.seekp(-2, ss.cur);
-            ss << ")";
+        auto operator()(const LiteralNodePtr& n)
+            -> void;
 
-            return ss.str();
-        }
+        auto operator()(const GroupingNodePtr& n)
+            -> void;
 
-        auto operator()(const CmpExprNodePtr& n) const
-            -> std::string
-        {
-            return Parenthesize(n->op.Lexeme(), n->left, n->right);
-        }
+        auto operator()(const AssignExprNodePtr& n)
+            -> void;
 
-        auto operator()(const ExprStmtNodePtr& n) const
-            -> std::string 
-        {
-            return Visit(n->expr);
-        }
+        auto operator()(const VarExprNodePtr& n)
+            -> void;
 
-        auto operator()(const PrintStmtNodePtr& n) const
-            -> std::string
-        {
-            return Parenthesize("Print", n->expr);
-        }
+        auto operator()(const LogicalExprNodePtr& n)
+            -> void;
 
-        auto operator()(const VarStmtNodePtr& n) const 
-            -> std::string
-        {
-            std::stringstream ss;
-            ss << "var " << n->name.Lexeme() << " = " << Visit(n->initializer) << "\n";
-            return ss.str(); 
-        }
+        auto operator()(const CallExprNodePtr& n)
+            -> void;
 
-        auto operator()(const BlockStmtNodePtr& n) const 
-            -> std::string
-        {
-            std::stringstream ss;
-            for (const auto& s : n->statements)
-            {
-                ss << Visit(s) << "\n";
-            }
-            return ss.str();
-        }
+        auto operator()(const CmpExprNodePtr& n)
+            -> void;
+
+        auto operator()(const GetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const InvokeExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SuperInvokeExprNodePtr& n)
+            -> void;
 
-        auto operator()(const FunStmtNodePtr& n) const 
-            -> std::string
+        auto operator()(const ListExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexSetExprNodePtr& n)
+            -> void;
+
+
+        // Visitor for statements.
+
+        auto operator()(const ExprStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const PrintStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const VarStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const BlockStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const FunStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ReturnStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const IfStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const WhileStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ClassStmtNodePtr& n)
+            -> void;
+
+
+    private:
+        auto Visit(const ExprNode& n)
+            -> void
         {
-            std::stringstream ss;
-            ss << n->name.Lexeme();
-            ss << "(";
-            for (const auto& p : n->parameters)
-            {
-                ss << p.Lexeme() << ", ";
-            }
-            if (n->parameters.size() != 0)
-            {
-                ss.seekp(-2, ss.cur);
-            }
-            ss << ")\nBody:\n";
-            ss << (*this)(n->body);
-            return ss.str();
+            std::visit(*this, n);
         }
 
-        auto operator()(const ReturnStmtNodePtr& n) const 
-            -> std::string
+        auto Visit(const StmtNode& n)
+            -> void
         {
-            return Parenthesize("Return", n->value);
+            std::visit(*this, n);
         }
 
 
-        auto operator()(const IfStmtNodePtr& n) const
-            -> std::string
+        // Write "(name n)" or {"kind":"name","expr":n}.
+        auto Unary(const std::string_view name, const ExprNode& n)
+            -> void;
+
+        // Write "(op n1 n2)" or {"kind":"kind","op":"op","left":n1,"right":n2}.
+        auto Binary(const std::string_view kind, const std::string_view op, const ExprNode& n1,
+            const ExprNode& n2)
+            -> void;
+
+        // Write " a1 a2" or ,"arguments":[a1,a2].
+        auto Arguments(const std::vector<ExprNode>& args)
+            -> void;
+
+        // Write the start of a JSON object: {"kind":"kind".
+        auto BeginObject(const std::string_view kind)
+            -> void;
+
+        // Write ,"key": inside a JSON object.
+        auto Key(const std::string_view key)
+            -> void;
+
+        auto WriteNumber(f64 value)
+            -> void;
+
+        // Write a string between quotes, escaping it in JSON format.
+        auto WriteQuoted(const std::string_view s)
+            -> void;
+
+        auto Write(const std::string_view s)
+            -> void;
+
+        auto Write(char c)
+            -> void
         {
-            std::stringstream ss;
-            ss << "if (";
-            ss << Visit(n->condition);
-            ss << ") then {\n";
-            ss << Visit(n->then_branch);
-            ss << "}\n";
-
-            if (n->else_branch)
+            if (out_string)
             {
-                ss << "else {\n";
-                ss << Visit(*n->else_branch);
-                ss << "}\n";
+                out_string->push_back(c);
+                return;
             }
-            return ss.str();
+            if (size == buffer.size())
+            {
+                Flush();
+            }
+            buffer[size++] = c;
         }
 
-        auto operator()(const WhileStmtNodePtr& n) const
-            -> std::string
-        {
-            std::stringstream ss;
-            ss << "while (";
-            ss << Visit(n->condition) << ") {\n";
-            ss << Visit(n->body);
-            ss << "}\n";
-            return ss.str();
-        }
+    private:
+        static constexpr std::size_t buffer_size = 4096;
 
-        auto Parenthesize(const std::string_view name, const ExprNode& n) const 
-            -> std::string
-        {
-            std::stringstream ss;
-            ss << "(" << name << " ";
-            ss << Visit(n);
-            ss << ")";
-            return ss.str();
-        }
+        // Exactly one of the two outputs is set.
+        non_owned_ptr<std::string> out_string{nullptr};
+        non_owned_ptr<std::FILE> out_file{nullptr};
 
-        auto Parenthesize(const std::string_view name, const ExprNode& n1, const ExprNode& n2) const
-            -> std::string
-        {
-            std::stringstream ss;
-            ss << "(" << name << " ";
-            ss << Visit(n1) << "  ";
-            ss << Visit(n2);
-            ss << ")";
-            return ss.str();
-        }
+        // Used only for the FILE* output.
+        std::array<char, buffer_size> buffer;
+        std::size_t size{0};
 
-        auto Visit(const ExprNode& n) const
-            -> std::string
-        {
-            return std::visit(*this, n);
-        }
+        non_owned_ptr<const StringPool> strings;
 
-        auto Visit(const StmtNode& n) const 
-            -> std::string
-        {
-            return std::visit(*this, n);
-        }
+        ASTFormat format;
     };
 } // namespace lox
 
@@ -0,0 +1,333 @@
+#include "ast_stats.hpp"
+
+namespace lox
+{
+    template <typename T>
+    static auto HeapBytes(const std::vector<T>& v)
+        -> std::size_t
+    {
+        return v.capacity() * sizeof(T);
+    }
+
+
+    auto ASTStats::Collect(const std::vector<StmtNode>& nodes)
+        -> void
+    {
+        root_bytes += HeapBytes(nodes);
+        for (const auto& node : nodes)
+        {
+            Visit(node);
+        }
+    }
+
+
+    auto ASTStats::Report(std::FILE* file) const
+        -> void
+    {
+        u64 total_count = 0;
+        u64 total_node_bytes = 0;
+        u64 total_extra_bytes = 0;
+
+        std::fprintf(file, "%-12s %12s %14s %14s\n", "kind", "count", "node bytes", "extra bytes");
+        for (std::size_t i = 0; i < kinds.size(); ++i)
+        {
+            const auto& k = kinds[i];
+            total_count += k.count;
+            total_node_bytes += k.node_bytes;
+            total_extra_bytes += k.extra_bytes;
+            if (k.count == 0)
+            {
+                continue;
+            }
+            std::fprintf(file, "%-12s %12llu %14llu %14llu\n", kind_names[i].data(),
+                static_cast<unsigned long long>(k.count),
+                static_cast<unsigned long long>(k.node_bytes),
+                static_cast<unsigned long long>(k.extra_bytes));
+        }
+        std::fprintf(file, "%-12s %12llu %14llu %14llu\n\n", "total",
+            static_cast<unsigned long long>(total_count),
+            static_cast<unsigned long long>(total_node_bytes),
+            static_cast<unsigned long long>(total_extra_bytes));
+
+        auto total_bytes = total_node_bytes + total_extra_bytes + root_bytes;
+        std::fprintf(file, "bytes allocated: %llu (%.2f per node, %llu for the top level vector)\n",
+            static_cast<unsigned long long>(total_bytes),
+            total_count == 0 ? 0.0 : static_cast<f64>(total_bytes) / static_cast<f64>(total_count),
+            static_cast<unsigned long long>(root_bytes));
+        std::fprintf(file, "string pool: %llu unique strings, %llu bytes\n",
+            static_cast<unsigned long long>(pool_strings),
+            static_cast<unsigned long long>(pool_bytes));
+        std::fprintf(file, "max depth: %llu\n", static_cast<unsigned long long>(max_depth));
+        std::fprintf(file, "average fan-out: %.2f\n",
+            internal_nodes == 0 ? 0.0 : static_cast<f64>(children) / static_cast<f64>(internal_nodes));
+    }
+
+
+    auto ASTStats::Record(NodeKind kind, std::size_t node_size, std::size_t n_children, std::size_t extra)
+        -> void
+    {
+        auto& k = kinds[static_cast<std::size_t>(kind)];
+        ++k.count;
+        k.node_bytes += node_size;
+        k.extra_bytes += extra;
+
+        if (n_children != 0)
+        {
+            ++internal_nodes;
+            children += n_children;
+        }
+    }
+
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+
+    auto ASTStats::operator()(const BinaryExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Binary, sizeof(*n), 2);
+        Visit(n->left);
+        Visit(n->right);
+    }
+
+
+    auto ASTStats::operator()(const UnaryExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Unary, sizeof(*n), 1);
+        Visit(n->right);
+    }
+
+
+    auto ASTStats::operator()(const LiteralNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Literal, sizeof(*n), 0);
+    }
+
+
+    auto ASTStats::operator()(const GroupingNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Grouping, sizeof(*n), 1);
+        Visit(n->expr);
+    }
+
+
+    auto ASTStats::operator()(const AssignExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Assign, sizeof(*n), 1);
+        Visit(n->expr);
+    }
+
+
+    auto ASTStats::operator()(const VarExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Var, sizeof(*n), 0);
+    }
+
+
+    auto ASTStats::operator()(const LogicalExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Logical, sizeof(*n), 2);
+        Visit(n->left);
+        Visit(n->right);
+    }
+
+
+    auto ASTStats::operator()(const CallExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Call, sizeof(*n), n->arguments.size(),
+            HeapBytes(n->arguments));
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+    }
+
+
+    auto ASTStats::operator()(const CmpExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Cmp, sizeof(*n), 2);
+        Visit(n->left);
+        Visit(n->right);
+    }
+
+
+    auto ASTStats::operator()(const GetExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Get, sizeof(*n), 1);
+        Visit(n->object);
+    }
+
+
+    auto ASTStats::operator()(const SetExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Set, sizeof(*n), 2);
+        Visit(n->object);
+        Visit(n->value);
+    }
+
+
+    auto ASTStats::operator()(const InvokeExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Invoke, sizeof(*n), n->arguments.size() + 1,
+            HeapBytes(n->arguments));
+        Visit(n->object);
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+    }
+
+
+    auto ASTStats::operator()(const SuperInvokeExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::SuperInvoke, sizeof(*n), n->arguments.size(),
+            HeapBytes(n->arguments));
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+    }
+
+
+    auto ASTStats::operator()(const ListExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::List, sizeof(*n), n->elements.size(), HeapBytes(n->elements));
+        for (const auto& element : n->elements)
+        {
+            Visit(element);
+        }
+    }
+
+
+    auto ASTStats::operator()(const IndexExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::Index, sizeof(*n), 2);
+        Visit(n->object);
+        Visit(n->index);
+    }
+
+
+    auto ASTStats::operator()(const IndexSetExprNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::IndexSet, sizeof(*n), 3);
+        Visit(n->object);
+        Visit(n->index);
+        Visit(n->value);
+    }
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+    auto ASTStats::operator()(const ExprStmtNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::ExprStmt, sizeof(*n), 1);
+        Visit(n->expr);
+    }
+
+
+    auto ASTStats::operator()(const PrintStmtNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::PrintStmt, sizeof(*n), 1);
+        Visit(n->expr);
+    }
+
+
+    auto ASTStats::operator()(const VarStmtNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::VarStmt, sizeof(*n), 1);
+        Visit(n->initializer);
+    }
+
+
+    auto ASTStats::operator()(const BlockStmtNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::BlockStmt, sizeof(*n), n->statements.size(), HeapBytes(n->statements));
+        for (const auto& s : n->statements)
+        {
+            Visit(s);
+        }
+    }
+
+
+    auto ASTStats::operator()(const FunStmtNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::FunStmt, sizeof(*n), 1, HeapBytes(n->parameters));
+
+        // The body is not stored inside a StmtNode, so the depth is updated here.
+        ++depth;
+        max_depth = std::max(max_depth, depth);
+        (*this)(n->body);
+        --depth;
+    }
+
+
+    auto ASTStats::operator()(const ReturnStmtNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::ReturnStmt, sizeof(*n), 1);
+        Visit(n->value);
+    }
+
+
+    auto ASTStats::operator()(const IfStmtNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::IfStmt, sizeof(*n), n->else_branch ? 3 : 2);
+        Visit(n->condition);
+        Visit(n->then_branch);
+        if (n->else_branch)
+        {
+            Visit(*n->else_branch);
+        }
+    }
+
+
+    auto ASTStats::operator()(const WhileStmtNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::WhileStmt, sizeof(*n), 2);
+        Visit(n->condition);
+        Visit(n->body);
+    }
+
+
+    auto ASTStats::operator()(const ClassStmtNodePtr& n)
+        -> void
+    {
+        Record(NodeKind::ClassStmt, sizeof(*n), n->methods.size(),
+            HeapBytes(n->methods) + HeapBytes(n->fields));
+
+        // The methods are not stored inside a StmtNode, so the depth is updated here.
+        ++depth;
+        max_depth = std::max(max_depth, depth);
+        for (const auto& method : n->methods)
+        {
+            (*this)(method);
+        }
+        --depth;
+    }
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+} // namespace lox
@@ -0,0 +1,202 @@
+#ifndef LOX_AST_STATS_HPP
+#define LOX_AST_STATS_HPP
+
+/*
+ast_stats.hpp
+
+PURPOSE: Collect memory and shape statistics of the AST.
+
+CLASSES:
+    ASTStats: visitor that counts nodes, bytes allocated, depth and fan-out of the AST.
+
+DESCRIPTION:
+    Every node of the AST is a separate heap allocation (the unique_ptr inside the variant), so the
+    bytes of a node are the size of its struct plus the out-of-line storage it owns: the capacity
+    of the vectors (CallExprNode::arguments, BlockStmtNode::statements, FunStmtNode::parameters, ...).
+    String literals live in the StringPool and are reported separately.
+    The overhead of the allocator is not counted.
+    The fan-out is the average number of children of the nodes that have at least one child.
+*/
+
+#include "node.hpp"
+#include "common.hpp"
+#include "string_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <variant>
+#include <vector>
+#include <string_view>
+#include <cstdio>
+
+namespace lox
+{
+    class ASTStats
+    {
+    public:
+        // Accumulate the statistics of the program. Can be called more than once.
+        auto Collect(const std::vector<StmtNode>& nodes)
+            -> void;
+
+        // Record the memory of the string literals interned by the parser.
+        auto Collect(const StringPool& strings)
+            -> void
+        {
+            pool_strings += strings.Size();
+            pool_bytes += strings.Bytes();
+        }
+
+        // Write a report of the statistics.
+        auto Report(std::FILE* file) const
+            -> void;
+
+
+    public:
+        // Visitor for expressions.
+
+        auto operator()(const BinaryExprNodePtr& n)
+            -> void;
+
+        auto operator()(const UnaryExprNodePtr& n)
+            -> void;
+
+        auto operator()(const LiteralNodePtr& n)
+            -> void;
+
+        auto operator()(const GroupingNodePtr& n)
+            -> void;
+
+        auto operator()(const AssignExprNodePtr& n)
+            -> void;
+
+        auto operator()(const VarExprNodePtr& n)
+            -> void;
+
+        auto operator()(const LogicalExprNodePtr& n)
+            -> void;
+
+        auto operator()(const CallExprNodePtr& n)
+            -> void;
+
+        auto operator()(const CmpExprNodePtr& n)
+            -> void;
+
+        auto operator()(const GetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const InvokeExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SuperInvokeExprNodePtr& n)
+            -> void;
+
+        auto operator()(const ListExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexSetExprNodePtr& n)
+            -> void;
+
+
+        // Visitor for statements.
+
+        auto operator()(const ExprStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const PrintStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const VarStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const BlockStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const FunStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ReturnStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const IfStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const WhileStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ClassStmtNodePtr& n)
+            -> void;
+
+
+    private:
+        enum class NodeKind : u8
+        {
+            Binary, Unary, Literal, Grouping, Assign, Var, Logical, Call, Cmp, Get, Set, Invoke,
+            SuperInvoke, List, Index, IndexSet,
+            ExprStmt, PrintStmt, VarStmt, BlockStmt, FunStmt, ReturnStmt, IfStmt, WhileStmt,
+            ClassStmt,
+
+            Count
+        };
+
+        struct KindStats
+        {
+            u64 count{0};
+
+            // Size of the node struct.
+            u64 node_bytes{0};
+
+            // Heap memory owned by the node (strings and vectors).
+            u64 extra_bytes{0};
+        };
+
+        static constexpr std::array<std::string_view, static_cast<std::size_t>(NodeKind::Count)> kind_names
+        {
+            "Binary", "Unary", "Literal", "Grouping", "Assign", "Var", "Logical", "Call", "Cmp",
+            "Get", "Set", "Invoke", "SuperInvoke", "List", "Index", "IndexSet",
+            "ExprStmt", "PrintStmt", "VarStmt", "BlockStmt", "FunStmt", "ReturnStmt", "IfStmt",
+            "WhileStmt", "ClassStmt"
+        };
+
+
+        template <typename T>
+            requires std::same_as<T, ExprNode> || std::same_as<T, StmtNode>
+        auto Visit(const T& node)
+            -> void
+        {
+            ++depth;
+            max_depth = std::max(max_depth, depth);
+            std::visit(*this, node);
+            --depth;
+        }
+
+        // Record a node of the kind with the number of children and the heap memory it owns.
+        auto Record(NodeKind kind, std::size_t node_size, std::size_t children, std::size_t extra = 0)
+            -> void;
+
+    private:
+        std::array<KindStats, static_cast<std::size_t>(NodeKind::Count)> kinds{};
+
+        // Capacity of the vectors of top level statements.
+        u64 root_bytes{0};
+
+        // Unique string literals and bytes of the StringPool arena.
+        u64 pool_strings{0};
+        u64 pool_bytes{0};
+
+        // Nodes with at least one child and total number of their children.
+        u64 internal_nodes{0};
+        u64 children{0};
+
+        u64 depth{0};
+        u64 max_depth{0};
+    };
+} // namespace lox
+
+#endif
@@ -0,0 +1,260 @@
+#include "background_compiler.hpp"
+#include "llvm_visitor.hpp"
+
+#include <llvm/ADT/StringMap.h>
+
+#include <iostream>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+namespace lox
+{
+    // The global variables are in the interpreter: the functions that use them stay interpreted.
+    static auto CompiledDeclarations(const std::vector<StmtNode>& program)
+        -> Declarations
+    {
+        auto declarations = DeclaredNames(program);
+        declarations.variables.clear();
+        return declarations;
+    }
+
+
+    // The Lox functions declared by the module are the ones it calls.
+    static auto CalledFunctions(const llvm::Module& module)
+        -> std::vector<std::string>
+    {
+        auto prefix = LLVMVisitor::FunctionSymbol("");
+        std::vector<std::string> called;
+        for (const auto& f : module)
+        {
+            if (f.isDeclaration() && f.getName().startswith(prefix))
+            {
+                called.push_back(f.getName().str());
+            }
+        }
+        return called;
+    }
+
+
+    BackgroundCompiler::BackgroundCompiler(non_owned_ptr<const StringPool> strings_,
+        const std::vector<StmtNode>& program_, OptLevel level_, non_owned_ptr<const ExprCSE> cse_) :
+        strings(strings_), program(program_), declared(CompiledDeclarations(program_)), level(level_),
+        cse(cse_), worker([this]() { Loop(); })
+    {
+    }
+
+
+    BackgroundCompiler::~BackgroundCompiler()
+    {
+        {
+            std::scoped_lock lock{mutex};
+            stop = true;
+        }
+        queue_changed.notify_all();
+        worker.join();
+    }
+
+
+    auto BackgroundCompiler::Enqueue(FunctionProfile& profile)
+        -> void
+    {
+        profile.tier.store(Tier::Queued, std::memory_order_relaxed);
+        {
+            std::scoped_lock lock{mutex};
+            queue.push_back(&profile);
+        }
+        queue_changed.notify_all();
+    }
+
+
+    auto BackgroundCompiler::Drain()
+        -> void
+    {
+        std::unique_lock lock{mutex};
+        queue_changed.wait(lock, [this]() { return queue.empty() && !busy; });
+    }
+
+
+    auto BackgroundCompiler::Loop()
+        -> void
+    {
+        std::unique_lock lock{mutex};
+        while (true)
+        {
+            queue_changed.wait(lock, [this]() { return stop || !queue.empty(); });
+            if (stop)
+            {
+                return;
+            }
+
+            auto profile = queue.front();
+            queue.pop_front();
+            busy = true;
+            lock.unlock();
+
+            auto begin = std::chrono::steady_clock::now();
+            Compile(*profile);
+            auto elapsed = std::chrono::steady_clock::now() - begin;
+            compile_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                std::memory_order_relaxed);
+
+            lock.lock();
+            busy = false;
+            queue_changed.notify_all();
+        }
+    }
+
+
+    auto BackgroundCompiler::CreateJIT()
+        -> void
+    {
+        jit = std::make_unique<JIT>(level);
+
+        // Functions defined twice are left to the interpreter.
+        llvm::StringMap<u32> definitions;
+        for (const auto& node : program)
+        {
+            if (auto function = std::get_if<FunStmtNodePtr>(&node))
+            {
+                ++definitions[(*function)->name.Lexeme()];
+            }
+        }
+
+        for (const auto& node : program)
+        {
+            auto function = std::get_if<FunStmtNodePtr>(&node);
+            if (!function || definitions[(*function)->name.Lexeme()] != 1)
+            {
+                continue;
+            }
+
+            auto node_ptr = function->get();
+            auto name = LLVMVisitor::FunctionSymbol(node_ptr->name.Lexeme());
+            jit->AddLazy(name, [this, node_ptr, name]()
+            {
+                LLVMVisitor visitor{strings, name};
+                visitor.SetDeclarations(&declared);
+                visitor.SetCSE(cse);
+                // The function stays in the interpreter, which reports its errors if it runs them.
+                visitor.SetReportErrors(false);
+                visitor.GenerateFunction(*node_ptr);
+                if (visitor.HadError())
+                {
+                    return llvm::orc::ThreadSafeModule{};
+                }
+
+                {
+                    std::scoped_lock lock{callees_mutex};
+                    callees[name] = CalledFunctions(visitor.Module());
+                }
+
+                jit->Prepare(visitor.Module());
+                Optimizer optimizer{level, false, &jit->TargetMachine()};
+                optimizer.Run(visitor.Module());
+                return visitor.TakeModule();
+            }, {}, LLVMVisitor::ValueSymbol(node_ptr->name.Lexeme()));
+        }
+    }
+
+
+    auto BackgroundCompiler::Compile(FunctionProfile& profile)
+        -> void
+    {
+        const auto& node = *profile.node;
+        std::optional<std::vector<std::string_view>> variables;
+        if (profile.loop)
+        {
+            variables = LLVMVisitor::LoopVariables(node, *profile.loop);
+            if (!variables)
+            {
+                profile.tier.store(Tier::Failed, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        try
+        {
+            if (!jit)
+            {
+                CreateJIT();
+            }
+
+            std::string entry;
+            if (profile.loop)
+            {
+                auto symbol = LLVMVisitor::LoopSymbol(node.name.Lexeme(), loops++);
+                LLVMVisitor visitor{strings, symbol};
+                visitor.SetReportErrors(false);
+                visitor.SetDeclarations(&declared);
+                visitor.SetCSE(cse);
+                visitor.GenerateLoopEntry(node, *profile.loop, symbol);
+                if (visitor.HadError())
+                {
+                    profile.tier.store(Tier::Failed, std::memory_order_relaxed);
+                    return;
+                }
+                CompileCalled(CalledFunctions(visitor.Module()));
+
+                jit->Prepare(visitor.Module());
+                Optimizer optimizer{level, false, &jit->TargetMachine()};
+                optimizer.Run(visitor.Module());
+                jit->Add(visitor.TakeModule());
+                entry = symbol + ".entry";
+                profile.variables = std::move(*variables);
+            }
+            else
+            {
+                CompileCalled({LLVMVisitor::FunctionSymbol(node.name.Lexeme())});
+
+                LLVMVisitor visitor{strings, LLVMVisitor::EntrySymbol(node.name.Lexeme())};
+                visitor.SetReportErrors(false);
+                visitor.SetDeclarations(&declared);
+                visitor.GenerateEntry(node);
+                if (visitor.HadError())
+                {
+                    profile.tier.store(Tier::Failed, std::memory_order_relaxed);
+                    return;
+                }
+                jit->Prepare(visitor.Module());
+                jit->Add(visitor.TakeModule());
+                entry = LLVMVisitor::EntrySymbol(node.name.Lexeme());
+            }
+            auto address = jit->Lookup(entry);
+
+            profile.native.store(reinterpret_cast<FunctionProfile::NativeEntry>(address),
+                std::memory_order_release);
+            profile.tier.store(Tier::Compiled, std::memory_order_relaxed);
+            compiled.fetch_add(1, std::memory_order_relaxed);
+        }
+        catch (const JITError& e)
+        {
+            profile.tier.store(Tier::Failed, std::memory_order_relaxed);
+        }
+    }
+
+
+    auto BackgroundCompiler::CompileCalled(std::vector<std::string> pending)
+        -> void
+    {
+        // The functions called by a compiled function are compiled on their first call: if one
+        // of them can't be compiled the program is aborted, so they are all compiled now.
+        std::unordered_set<std::string> visited{pending.begin(), pending.end()};
+        while (!pending.empty())
+        {
+            auto function = std::move(pending.back());
+            pending.pop_back();
+            jit->Compile(function);
+
+            std::scoped_lock lock{callees_mutex};
+            for (const auto& callee : callees[function])
+            {
+                if (visited.insert(callee).second)
+                {
+                    pending.push_back(callee);
+                }
+            }
+        }
+    }
+} // namespace lox
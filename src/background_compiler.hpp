@@ -0,0 +1,167 @@
+#ifndef LOX_BACKGROUND_COMPILER_HPP
+#define LOX_BACKGROUND_COMPILER_HPP
+
+/*
+background_compiler.hpp
+
+PURPOSE: Compile the hot functions of the interpreter with the JIT on a separate thread.
+
+CLASSES:
+    FunctionProfile: Counters and tier of a function, shared by the interpreter and the compiler.
+    BackgroundCompiler: Thread that compiles the functions queued by the interpreter.
+
+DESCRIPTION:
+    The interpreter counts the calls and the loop back edges of each function. When a function
+    crosses the threshold it is queued and the interpreter keeps executing it. The compiler
+    thread generates and optimizes the function with LLVMVisitor, compiles it and publishes the
+    address of its entry point with an atomic store: the next call of the interpreter loads it
+    and jumps to the native code.
+    A running loop of a hot function gets its own profile (FunctionProfile::loop), compiled
+    with LLVMVisitor::GenerateLoopEntry(): at a back edge the interpreter passes the variables
+    of its frame to the native code, which runs the rest of the loop and of the function
+    (on-stack replacement). The loops of the top-level code, the loops nested in an if or in
+    another loop (their enclosing loop is replaced) and the functions that use the global
+    variables stay in the interpreter.
+    The JIT is created on the compiler thread only when the first function gets hot, so short
+    scripts never pay for it. The functions called by a compiled function are compiled lazily
+    on their first call (see JIT::AddLazy()).
+    Only the functions the backend can compile are promoted: the others are marked as Failed
+    and stay in the interpreter.
+*/
+
+#include "common.hpp"
+#include "node.hpp"
+#include "string_pool.hpp"
+#include "expr_cse.hpp"
+#include "optimizer.hpp"
+#include "jit.hpp"
+
+#include <llvm/ADT/StringMap.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace lox
+{
+    enum class Tier : u8
+    {
+        Interpreted, Queued, Compiled, Failed
+    };
+
+
+    struct FunctionProfile
+    {
+        // Entry point of the compiled function: the arguments are passed in an array of boxed
+        // values (LoxValue, see value.hpp), like the result.
+        using NativeEntry = u64 (*)(const u64* args);
+
+        explicit FunctionProfile(non_owned_ptr<const FunStmtNode> node_,
+            non_owned_ptr<const WhileStmtNode> loop_ = nullptr) : node(node_), loop(loop_) { }
+
+        non_owned_ptr<const FunStmtNode> node;
+
+        // The entry of a loop of the function continues it from the header of the loop: its
+        // arguments are the values of the variables (written before native is published).
+        non_owned_ptr<const WhileStmtNode> loop;
+        std::vector<std::string_view> variables;
+
+        // Written only by the interpreter thread.
+        u64 calls{0};
+        u64 back_edges{0};
+
+        std::atomic<Tier> tier{Tier::Interpreted};
+
+        // Published by the compiler thread (release) after the code is ready.
+        std::atomic<NativeEntry> native{nullptr};
+    };
+
+
+    class BackgroundCompiler : private NonCopyable
+    {
+    public:
+        // The program must outlive the compiler (the functions are generated from its AST), like
+        // its CSE analysis (optional, see LLVMVisitor::SetCSE()).
+        BackgroundCompiler(non_owned_ptr<const StringPool> strings_,
+            const std::vector<StmtNode>& program_, OptLevel level_,
+            non_owned_ptr<const ExprCSE> cse_ = nullptr);
+
+        // Stop the thread. The queued functions that are not compiled yet are dropped.
+        ~BackgroundCompiler();
+
+        // Queue the function for compilation. Called by the interpreter thread.
+        auto Enqueue(FunctionProfile& profile)
+            -> void;
+
+        // Wait until all the queued functions are compiled (for deterministic tests and timing).
+        auto Drain()
+            -> void;
+
+        // Number of functions compiled and time spent compiling them (milliseconds).
+        auto Compiled() const noexcept
+            -> u64
+        {
+            return compiled.load(std::memory_order_relaxed);
+        }
+
+        auto CompileTime() const noexcept
+            -> double
+        {
+            return std::chrono::duration<double, std::milli>(
+                std::chrono::nanoseconds{compile_ns.load(std::memory_order_relaxed)}).count();
+        }
+
+    private:
+        auto Loop()
+            -> void;
+
+        // Create the JIT and register all the top level functions of the program as lazy.
+        auto CreateJIT()
+            -> void;
+
+        // Compile the function (or its loop) and publish its entry point.
+        auto Compile(FunctionProfile& profile)
+            -> void;
+
+        // Compile the functions and the functions they call, transitively.
+        auto CompileCalled(std::vector<std::string> pending)
+            -> void;
+
+    private:
+        non_owned_ptr<const StringPool> strings;
+        const std::vector<StmtNode>& program;
+        Declarations declared;
+        OptLevel level;
+        non_owned_ptr<const ExprCSE> cse;
+
+        // Used only by the compiler thread.
+        std::unique_ptr<JIT> jit;
+        u64 loops{0};
+
+        // Symbol of a function -> symbols of the functions it calls. Filled when the function
+        // is generated, which can happen on any thread that calls it.
+        std::mutex callees_mutex;
+        llvm::StringMap<std::vector<std::string>> callees;
+
+        std::mutex mutex;
+        std::condition_variable queue_changed;
+        std::deque<non_owned_ptr<FunctionProfile>> queue;
+        bool busy{false};
+        bool stop{false};
+
+        std::atomic<u64> compiled{0};
+        std::atomic<i64> compile_ns{0};
+
+        // Started last, after all the other members are initialized.
+        std::thread worker;
+    };
+} // namespace lox
+
+#endif
@@ -2,9 +2,18 @@
 
 set -xe
 
-LFLAGS="`llvm-config --cxxflags --ldflags --system-libs --libs core`"
-CFILES="main.cpp scanner.cpp parser.cpp types.cpp token.cpp node.cpp ast_printer.cpp"
-TEMP="llvm_visitor.cpp  -Wall -Wextra -Wconversion -Wpedantic -Werror"
-CFLAGS="-std=c++20 -fexceptions"
+# llvm-config --cxxflags sets -std=c++14 and -fno-exceptions, so they must come before CFLAGS.
+LLVM_CFLAGS="`llvm-config --cxxflags`"
+LFLAGS="`llvm-config --ldflags --system-libs --libs core passes orcjit native`"
+CFILES="main.cpp scanner.cpp parser.cpp types.cpp token.cpp node.cpp ast_printer.cpp ast_stats.cpp string_pool.cpp expr_cse.cpp llvm_visitor.cpp optimizer.cpp jit.cpp aot.cpp runtime.cpp gc.cpp shape.cpp interpreter.cpp background_compiler.cpp parallel_codegen.cpp object_cache.cpp numeric_loop.cpp closure_analysis.cpp output.cpp string_object.cpp list_object.cpp map_object.cpp bytecode.cpp bytecode_compiler.cpp vm.cpp"
+RTFILES="runtime.cpp gc.cpp shape.cpp output.cpp string_object.cpp list_object.cpp map_object.cpp runtime_main.cpp"
+TEMP="-Wall -Wextra -Wconversion -Wpedantic -Werror"
+CFLAGS="-std=c++20 -fexceptions -O2"
 
-clang++  $CFLAGS $CFILES -o lox
\ No newline at end of file
+# Runtime linked by the executables of `lox build`.
+clang++ -std=c++20 -O2 -fPIC -c $RTFILES
+ar rcs liblox_rt.a runtime.o gc.o shape.o output.o string_object.o list_object.o map_object.o runtime_main.o
+rm -f runtime.o gc.o shape.o output.o string_object.o list_object.o map_object.o runtime_main.o
+
+# -rdynamic exports the runtime functions to the code compiled by the JIT.
+clang++ $LLVM_CFLAGS $CFLAGS $CFILES $LFLAGS -rdynamic -o lox
@@ -0,0 +1,67 @@
+#include "bytecode.hpp"
+
+#include <array>
+
+namespace lox
+{
+    static constexpr std::array<std::string_view, static_cast<std::size_t>(OpCode::Count)> op_names
+    {
+        "Constant", "Nil", "True", "False", "Pop",
+        "GetLocal", "SetLocal", "GetGlobal", "SetGlobal", "DefineGlobal",
+        "Add", "Subtract", "Multiply", "Divide", "Negate", "Not",
+        "Equal", "NotEqual", "Less", "LessEqual", "Greater", "GreaterEqual",
+        "Print", "Jump", "JumpIfFalse", "Loop", "DefineFunction", "Call", "Return"
+    };
+
+
+    auto Disassemble(const Chunk& chunk, std::string_view name, std::FILE* file)
+        -> void
+    {
+        std::fprintf(file, "== %.*s ==\n", static_cast<int>(name.size()), name.data());
+
+        auto read16 = [&](std::size_t offset) -> u32
+        {
+            return static_cast<u32>(chunk.code[offset] | (chunk.code[offset + 1] << 8));
+        };
+
+        std::size_t offset = 0;
+        while (offset < chunk.code.size())
+        {
+            auto op = static_cast<OpCode>(chunk.code[offset]);
+            auto op_name = op_names[static_cast<std::size_t>(op)];
+            std::fprintf(file, "%04zu %4u %-14.*s", offset, chunk.lines[offset],
+                static_cast<int>(op_name.size()), op_name.data());
+
+            switch (op)
+            {
+            case OpCode::Constant:
+            case OpCode::GetLocal:
+            case OpCode::SetLocal:
+            case OpCode::GetGlobal:
+            case OpCode::SetGlobal:
+            case OpCode::DefineGlobal:
+            case OpCode::DefineFunction:
+                std::fprintf(file, " %u", read16(offset + 1));
+                offset += 3;
+                break;
+            case OpCode::Jump:
+            case OpCode::JumpIfFalse:
+                std::fprintf(file, " -> %zu", offset + 3 + read16(offset + 1));
+                offset += 3;
+                break;
+            case OpCode::Loop:
+                std::fprintf(file, " -> %zu", offset + 3 - read16(offset + 1));
+                offset += 3;
+                break;
+            case OpCode::Call:
+                std::fprintf(file, " %u (%u args)", read16(offset + 1), chunk.code[offset + 3]);
+                offset += 4;
+                break;
+            default:
+                offset += 1;
+                break;
+            }
+            std::fputc('\n', file);
+        }
+    }
+} // namespace lox
@@ -0,0 +1,108 @@
+#ifndef LOX_BYTECODE_HPP
+#define LOX_BYTECODE_HPP
+
+/*
+bytecode.hpp
+
+PURPOSE: Compact bytecode executed by the VM.
+
+CLASSES:
+    OpCode: Instructions of the VM.
+    Chunk: Code and constants of a function.
+    BytecodeFunction: A compiled function.
+    BytecodeProgram: The functions and the global variables of a program.
+
+DESCRIPTION:
+    The VM is a stack machine. An instruction is a 1 byte opcode followed by its operands:
+    the operands are little endian 16 bit values (u8 for the number of arguments of a call).
+    The jumps are 16 bit offsets relative to the instruction after the jump.
+    The variables are resolved by the compiler: the local variables are slots of the frame of
+    the function (the arguments are the first slots), the global variables are indexes in the
+    table of the globals. The calls are resolved by name to the index of the function.
+    The values are the literals (see types.hpp); each function has its own constant pool.
+*/
+
+#include "common.hpp"
+#include "types.hpp"
+
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <deque>
+
+namespace lox
+{
+    enum class OpCode : u8
+    {
+        Constant,       // u16 index:       push constants[index]
+        Nil,            //                  push nil
+        True,           //                  push true
+        False,          //                  push false
+        Pop,            //                  pop
+
+        GetLocal,       // u16 slot:        push slots[slot]
+        SetLocal,       // u16 slot:        slots[slot] = top (not popped)
+        GetGlobal,      // u16 index:       push globals[index]
+        SetGlobal,      // u16 index:       globals[index] = top (not popped)
+        DefineGlobal,   // u16 index:       globals[index] = pop
+
+        Add, Subtract, Multiply, Divide,        // pop b, pop a, push a op b (numbers)
+        Negate,         //                  push -pop (number)
+        Not,            //                  push !pop
+
+        Equal, NotEqual,                        // pop b, pop a, push a op b
+        Less, LessEqual, Greater, GreaterEqual, // pop b, pop a, push a op b (numbers)
+
+        Print,          //                  print pop
+
+        Jump,           // u16 offset:      ip += offset
+        JumpIfFalse,    // u16 offset:      if top is falsey ip += offset (not popped)
+        Loop,           // u16 offset:      ip -= offset
+
+        DefineFunction, // u16 index:       the function can be called
+        Call,           // u16 index, u8 argc: call functions[index] with the argc values on top
+        Return,         //                  return pop to the caller
+
+        Count
+    };
+
+
+    struct Chunk
+    {
+        std::vector<u8> code;
+
+        // Line of each byte of the code, for the runtime errors.
+        std::vector<u32> lines;
+
+        std::vector<Literal> constants;
+    };
+
+
+    struct BytecodeFunction
+    {
+        std::string_view name;
+        u32 arity{0};
+        Chunk chunk;
+    };
+
+
+    struct BytecodeProgram
+    {
+        // The top level code, called with no arguments.
+        BytecodeFunction script;
+
+        // Indexed by the operand of Call and DefineFunction.
+        // A deque, so the compiler can keep a pointer to a function while adding others.
+        std::deque<BytecodeFunction> functions;
+
+        // Names of the global variables, indexed by the operand of the global instructions.
+        std::vector<std::string_view> globals;
+    };
+
+
+    // Write the instructions of the chunk in a human readable form.
+    auto Disassemble(const Chunk& chunk, std::string_view name, std::FILE* file)
+        -> void;
+} // namespace lox
+
+#endif
@@ -0,0 +1,605 @@
+#include "bytecode_compiler.hpp"
+#include "list_object.hpp"
+
+#include <bit>
+#include <iostream>
+#include <limits>
+#include <string>
+
+namespace lox
+{
+    auto BytecodeCompiler::Compile(const std::vector<StmtNode>& nodes)
+        -> void
+    {
+        for (const auto& node : nodes)
+        {
+            try
+            {
+                Visit(node);
+            }
+            catch (const CompileError& e)
+            {
+                had_error = true;
+                // Drop the state of the functions and of the blocks opened by the statement.
+                function = &script_state;
+                script_state.depth = 0;
+                script_state.locals.clear();
+            }
+        }
+
+        // A function read as a value (the global isn't a variable once the program is parsed).
+        for (const auto& name : global_reads)
+        {
+            if (function_indexes.contains(name.Lexeme()) && !defined_globals.contains(name.Lexeme()))
+            {
+                try
+                {
+                    Unsupported(name, "Function values");
+                }
+                catch (const CompileError& e)
+                {
+                    had_error = true;
+                    break;
+                }
+            }
+        }
+        Emit(OpCode::Nil);
+        Emit(OpCode::Return);
+    }
+
+
+    // ********************************* UTILITY *********************************
+
+    auto BytecodeCompiler::Emit(OpCode op, u32 operand)
+        -> void
+    {
+        if (operand > std::numeric_limits<u16>::max())
+        {
+            Error("Too many constants, variables or functions.");
+        }
+        Emit(op);
+        Emit(static_cast<u8>(operand & 0xff));
+        Emit(static_cast<u8>(operand >> 8));
+    }
+
+
+    auto BytecodeCompiler::EmitConstant(const Literal& value)
+        -> void
+    {
+        auto& constants = function->function->chunk.constants;
+        auto index = static_cast<u32>(constants.size());
+
+        if (auto number = std::get_if<f64>(&value))
+        {
+            auto [it, inserted] = function->numbers.try_emplace(std::bit_cast<u64>(*number),
+                static_cast<u16>(index));
+            index = it->second;
+            if (inserted)
+            {
+                constants.push_back(value);
+            }
+        }
+        else if (auto id = std::get_if<StringId>(&value))
+        {
+            auto [it, inserted] = function->strings.try_emplace(id->value, static_cast<u16>(index));
+            index = it->second;
+            if (inserted)
+            {
+                constants.push_back(value);
+            }
+        }
+        Emit(OpCode::Constant, index);
+    }
+
+
+    auto BytecodeCompiler::EmitJump(OpCode op)
+        -> std::size_t
+    {
+        Emit(op);
+        Emit(u8{0xff});
+        Emit(u8{0xff});
+        return function->function->chunk.code.size() - 2;
+    }
+
+
+    auto BytecodeCompiler::PatchJump(std::size_t offset)
+        -> void
+    {
+        auto& code = function->function->chunk.code;
+        auto jump = code.size() - offset - 2;
+        if (jump > std::numeric_limits<u16>::max())
+        {
+            Error("Too much code to jump over.");
+        }
+        code[offset] = static_cast<u8>(jump & 0xff);
+        code[offset + 1] = static_cast<u8>(jump >> 8);
+    }
+
+
+    auto BytecodeCompiler::EmitLoop(std::size_t start)
+        -> void
+    {
+        // The offset is relative to the end of the Loop instruction.
+        auto jump = function->function->chunk.code.size() + 3 - start;
+        if (jump > std::numeric_limits<u16>::max())
+        {
+            Error("Loop body too large.");
+        }
+        Emit(OpCode::Loop, static_cast<u32>(jump));
+    }
+
+
+    auto BytecodeCompiler::EndScope()
+        -> void
+    {
+        --function->depth;
+        auto& locals = function->locals;
+        while (!locals.empty() && locals.back().depth > function->depth)
+        {
+            Emit(OpCode::Pop);
+            locals.pop_back();
+        }
+    }
+
+
+    auto BytecodeCompiler::ResolveLocal(std::string_view name) const
+        -> i64
+    {
+        const auto& locals = function->locals;
+        for (auto i = locals.size(); i > 0; --i)
+        {
+            if (locals[i - 1].name == name)
+            {
+                return static_cast<i64>(i - 1);
+            }
+        }
+        return -1;
+    }
+
+
+    auto BytecodeCompiler::GlobalIndex(std::string_view name)
+        -> u32
+    {
+        auto [it, inserted] = global_indexes.try_emplace(name, static_cast<u32>(program.globals.size()));
+        if (inserted)
+        {
+            program.globals.push_back(name);
+        }
+        return it->second;
+    }
+
+
+    auto BytecodeCompiler::FunctionIndex(std::string_view name)
+        -> u32
+    {
+        auto [it, inserted] = function_indexes.try_emplace(name, static_cast<u32>(program.functions.size()));
+        if (inserted)
+        {
+            program.functions.emplace_back().name = name;
+        }
+        return it->second;
+    }
+
+
+    auto BytecodeCompiler::ErrorAt(const Token& t, std::string_view msg)
+        -> void
+    {
+        std::cout << "[line " << t.Line() << "] Error at " << t.Lexeme() << ": " << msg << std::endl;
+        throw CompileError{};
+    }
+
+
+    auto BytecodeCompiler::Error(std::string_view msg)
+        -> void
+    {
+        std::cout << "[line " << line << "] Error: " << msg << std::endl;
+        throw CompileError{};
+    }
+
+
+    auto BytecodeCompiler::Unsupported(const Token& t, std::string_view what)
+        -> void
+    {
+        ErrorAt(t, std::string{what} + " are not supported by " + std::string{backend} + ".");
+    }
+
+    // ********************************* UTILITY *********************************
+
+
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+    auto BytecodeCompiler::operator()(const ExprStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+        Emit(OpCode::Pop);
+    }
+
+
+    auto BytecodeCompiler::operator()(const PrintStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+        Emit(OpCode::Print);
+    }
+
+
+    auto BytecodeCompiler::operator()(const VarStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->initializer);
+        SetLine(n->name);
+        if (function == &script_state && function->depth == 0)
+        {
+            defined_globals.insert(n->name.Lexeme());
+            Emit(OpCode::DefineGlobal, GlobalIndex(n->name.Lexeme()));
+            return;
+        }
+
+        // The value of the initializer is the slot of the variable.
+        if (function->locals.size() > std::numeric_limits<u16>::max())
+        {
+            ErrorAt(n->name, "Too many local variables in function.");
+        }
+        function->locals.push_back(Local{n->name.Lexeme(), function->depth});
+    }
+
+
+    auto BytecodeCompiler::operator()(const BlockStmtNodePtr& n)
+        -> void
+    {
+        BeginScope();
+        for (const auto& s : n->statements)
+        {
+            Visit(s);
+        }
+        EndScope();
+    }
+
+
+    auto BytecodeCompiler::operator()(const FunStmtNodePtr& n)
+        -> void
+    {
+        SetLine(n->name);
+        // The functions are global: a nested one would see neither the variables around it
+        // nor its own scope.
+        if (function != &script_state)
+        {
+            Unsupported(n->name, "Nested functions");
+        }
+        auto index = FunctionIndex(n->name.Lexeme());
+        auto& compiled = program.functions[index];
+        if (!compiled.chunk.code.empty())
+        {
+            ErrorAt(n->name, "Redefinition of functions is not supported.");
+        }
+        if (n->parameters.size() > std::numeric_limits<u8>::max())
+        {
+            ErrorAt(n->name, "Too many parameters.");
+        }
+        compiled.arity = static_cast<u32>(n->parameters.size());
+
+        FunctionState state{&compiled, {}, 1, {}, {}};
+        for (const auto& param : n->parameters)
+        {
+            state.locals.push_back(Local{param.Lexeme(), 1});
+        }
+
+        auto enclosing = function;
+        function = &state;
+        for (const auto& s : n->body->statements)
+        {
+            Visit(s);
+        }
+        // Implicit return nil.
+        Emit(OpCode::Nil);
+        Emit(OpCode::Return);
+        function = enclosing;
+
+        SetLine(n->name);
+        Emit(OpCode::DefineFunction, index);
+    }
+
+
+    auto BytecodeCompiler::operator()(const ReturnStmtNodePtr& n)
+        -> void
+    {
+        if (function == &script_state)
+        {
+            ErrorAt(n->keyword, "Can't return from top-level code.");
+        }
+        Visit(n->value);
+        SetLine(n->keyword);
+        Emit(OpCode::Return);
+    }
+
+
+    auto BytecodeCompiler::operator()(const IfStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->condition);
+        auto else_jump = EmitJump(OpCode::JumpIfFalse);
+        Emit(OpCode::Pop);
+        Visit(n->then_branch);
+        auto end_jump = EmitJump(OpCode::Jump);
+
+        PatchJump(else_jump);
+        Emit(OpCode::Pop);
+        if (n->else_branch)
+        {
+            Visit(*n->else_branch);
+        }
+        PatchJump(end_jump);
+    }
+
+
+    auto BytecodeCompiler::operator()(const WhileStmtNodePtr& n)
+        -> void
+    {
+        auto start = function->function->chunk.code.size();
+        Visit(n->condition);
+        auto exit_jump = EmitJump(OpCode::JumpIfFalse);
+        Emit(OpCode::Pop);
+        Visit(n->body);
+        EmitLoop(start);
+
+        PatchJump(exit_jump);
+        Emit(OpCode::Pop);
+    }
+
+
+    auto BytecodeCompiler::operator()(const ClassStmtNodePtr& n)
+        -> void
+    {
+        Unsupported(n->name, "Classes");
+    }
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+
+    auto BytecodeCompiler::operator()(const BinaryExprNodePtr& n)
+        -> void
+    {
+        Visit(n->left);
+        Visit(n->right);
+        SetLine(n->op);
+
+        switch (n->op.Type())
+        {
+        case TokenType::Plus:
+            Emit(OpCode::Add);
+            break;
+        case TokenType::Minus:
+            Emit(OpCode::Subtract);
+            break;
+        case TokenType::Star:
+            Emit(OpCode::Multiply);
+            break;
+        case TokenType::Slash:
+            Emit(OpCode::Divide);
+            break;
+        default:
+            ErrorAt(n->op, "Unsupported binary operation.");
+        }
+    }
+
+
+    auto BytecodeCompiler::operator()(const UnaryExprNodePtr& n)
+        -> void
+    {
+        Visit(n->right);
+        SetLine(n->op);
+
+        switch (n->op.Type())
+        {
+        case TokenType::Bang:
+            Emit(OpCode::Not);
+            break;
+        case TokenType::Minus:
+            Emit(OpCode::Negate);
+            break;
+        default:
+            ErrorAt(n->op, "Unsupported unary operation.");
+        }
+    }
+
+
+    auto BytecodeCompiler::operator()(const LiteralNodePtr& n)
+        -> void
+    {
+        const auto& literal = n->literal;
+        if (std::holds_alternative<LoxNil>(literal))
+        {
+            Emit(OpCode::Nil);
+        }
+        else if (auto b = std::get_if<bool>(&literal))
+        {
+            Emit(*b ? OpCode::True : OpCode::False);
+        }
+        else
+        {
+            EmitConstant(literal);
+        }
+    }
+
+
+    auto BytecodeCompiler::operator()(const GroupingNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+    }
+
+
+    auto BytecodeCompiler::operator()(const AssignExprNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+        SetLine(n->name);
+
+        if (auto slot = ResolveLocal(n->name.Lexeme()); slot >= 0)
+        {
+            Emit(OpCode::SetLocal, static_cast<u32>(slot));
+        }
+        else
+        {
+            Emit(OpCode::SetGlobal, GlobalIndex(n->name.Lexeme()));
+        }
+    }
+
+
+    auto BytecodeCompiler::operator()(const VarExprNodePtr& n)
+        -> void
+    {
+        SetLine(n->name);
+        if (auto slot = ResolveLocal(n->name.Lexeme()); slot >= 0)
+        {
+            Emit(OpCode::GetLocal, static_cast<u32>(slot));
+        }
+        else
+        {
+            global_reads.push_back(n->name);
+            Emit(OpCode::GetGlobal, GlobalIndex(n->name.Lexeme()));
+        }
+    }
+
+
+    auto BytecodeCompiler::operator()(const LogicalExprNodePtr& n)
+        -> void
+    {
+        Visit(n->left);
+        SetLine(n->op);
+
+        // The left value is the result if it decides the expression, otherwise it is popped
+        // and the right value is the result.
+        if (n->op.Type() == TokenType::Or)
+        {
+            auto else_jump = EmitJump(OpCode::JumpIfFalse);
+            auto end_jump = EmitJump(OpCode::Jump);
+            PatchJump(else_jump);
+            Emit(OpCode::Pop);
+            Visit(n->right);
+            PatchJump(end_jump);
+        }
+        else
+        {
+            auto end_jump = EmitJump(OpCode::JumpIfFalse);
+            Emit(OpCode::Pop);
+            Visit(n->right);
+            PatchJump(end_jump);
+        }
+    }
+
+
+    auto BytecodeCompiler::operator()(const CallExprNodePtr& n)
+        -> void
+    {
+        if (n->arguments.size() > std::numeric_limits<u8>::max())
+        {
+            ErrorAt(n->paren, "Too many arguments.");
+        }
+        // A call is resolved by name, not through a variable.
+        if (ResolveLocal(n->callee.Lexeme()) >= 0)
+        {
+            Unsupported(n->callee, "Function values");
+        }
+        if (IsNativeName(n->callee.Lexeme()))
+        {
+            Unsupported(n->callee, "Lists and maps");
+        }
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+        SetLine(n->callee);
+        Emit(OpCode::Call, FunctionIndex(n->callee.Lexeme()));
+        Emit(static_cast<u8>(n->arguments.size()));
+    }
+
+
+    auto BytecodeCompiler::operator()(const CmpExprNodePtr& n)
+        -> void
+    {
+        Visit(n->left);
+        Visit(n->right);
+        SetLine(n->op);
+
+        switch (n->op.Type())
+        {
+        case TokenType::EqualEqual:
+            Emit(OpCode::Equal);
+            break;
+        case TokenType::BangEqual:
+            Emit(OpCode::NotEqual);
+            break;
+        case TokenType::Less:
+            Emit(OpCode::Less);
+            break;
+        case TokenType::LessEqual:
+            Emit(OpCode::LessEqual);
+            break;
+        case TokenType::Greater:
+            Emit(OpCode::Greater);
+            break;
+        case TokenType::GreaterEqual:
+            Emit(OpCode::GreaterEqual);
+            break;
+        default:
+            ErrorAt(n->op, "Unsupported comparison.");
+        }
+    }
+
+
+    auto BytecodeCompiler::operator()(const GetExprNodePtr& n)
+        -> void
+    {
+        Unsupported(n->name, "Classes");
+    }
+
+
+    auto BytecodeCompiler::operator()(const SetExprNodePtr& n)
+        -> void
+    {
+        Unsupported(n->name, "Classes");
+    }
+
+
+    auto BytecodeCompiler::operator()(const InvokeExprNodePtr& n)
+        -> void
+    {
+        Unsupported(n->name, "Classes");
+    }
+
+
+    auto BytecodeCompiler::operator()(const SuperInvokeExprNodePtr& n)
+        -> void
+    {
+        Unsupported(n->keyword, "Classes");
+    }
+
+
+    auto BytecodeCompiler::operator()(const ListExprNodePtr& n)
+        -> void
+    {
+        Unsupported(n->bracket, "Lists");
+    }
+
+
+    auto BytecodeCompiler::operator()(const IndexExprNodePtr& n)
+        -> void
+    {
+        Unsupported(n->bracket, "Lists and maps");
+    }
+
+
+    auto BytecodeCompiler::operator()(const IndexSetExprNodePtr& n)
+        -> void
+    {
+        Unsupported(n->bracket, "Lists and maps");
+    }
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+} // namespace lox
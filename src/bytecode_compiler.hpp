@@ -0,0 +1,291 @@
+#ifndef LOX_BYTECODE_COMPILER_HPP
+#define LOX_BYTECODE_COMPILER_HPP
+
+/*
+bytecode_compiler.hpp
+
+PURPOSE: Compile the AST to the bytecode of the VM.
+
+CLASSES:
+    BytecodeCompiler: visitor that emits the bytecode of each function in a single pass.
+
+DESCRIPTION:
+    The variables declared at the top level (outside any block) are globals, every other
+    variable is a slot of the frame of the function that declares it. Like in the interpreter,
+    a function sees its own variables and the globals, and the functions are global: a call is
+    resolved by name to the index of the function (the function can be declared later, the
+    VM checks that it is defined when it is called).
+    The constants are deduplicated inside each function.
+    The VM runs a subset of the language, checked here: the features it lacks (classes,
+    lists and maps, nested functions, functions as values) are compile errors, so a program
+    doesn't start if it can't finish. The strings are the literals of the StringPool and the
+    strings built by +. The tiered mode checks the program with this compiler too.
+*/
+
+#include "common.hpp"
+#include "node.hpp"
+#include "bytecode.hpp"
+
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+namespace lox
+{
+    class BytecodeCompiler
+    {
+    public:
+        // The backend is named by the errors of the unsupported features ("the VM", or "the
+        // interpreter", which runs the same subset).
+        explicit BytecodeCompiler(std::string_view backend_ = "the VM") :
+            backend(backend_) { }
+
+        // Compile the program. Errors are reported and the statement is skipped.
+        auto Compile(const std::vector<StmtNode>& nodes)
+            -> void;
+
+        // True if an error was reported: the program is not valid.
+        auto HadError() const noexcept
+            -> bool
+        {
+            return had_error;
+        }
+
+        auto Program() noexcept
+            -> BytecodeProgram&
+        {
+            return program;
+        }
+
+
+    public:
+        // Visitor for expressions. The value of the expression is pushed on the stack.
+
+        auto operator()(const BinaryExprNodePtr& n)
+            -> void;
+
+        auto operator()(const UnaryExprNodePtr& n)
+            -> void;
+
+        auto operator()(const LiteralNodePtr& n)
+            -> void;
+
+        auto operator()(const GroupingNodePtr& n)
+            -> void;
+
+        auto operator()(const AssignExprNodePtr& n)
+            -> void;
+
+        auto operator()(const VarExprNodePtr& n)
+            -> void;
+
+        auto operator()(const LogicalExprNodePtr& n)
+            -> void;
+
+        auto operator()(const CallExprNodePtr& n)
+            -> void;
+
+        auto operator()(const CmpExprNodePtr& n)
+            -> void;
+
+        auto operator()(const GetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const InvokeExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SuperInvokeExprNodePtr& n)
+            -> void;
+
+        auto operator()(const ListExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexSetExprNodePtr& n)
+            -> void;
+
+
+        // Visitor for statements. The stack is balanced after a statement.
+
+        auto operator()(const ExprStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const PrintStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const VarStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const BlockStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const FunStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ReturnStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const IfStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const WhileStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ClassStmtNodePtr& n)
+            -> void;
+
+
+    private:
+        auto Visit(const ExprNode& n)
+            -> void
+        {
+            std::visit(*this, n);
+        }
+
+        auto Visit(const StmtNode& n)
+            -> void
+        {
+            std::visit(*this, n);
+        }
+
+
+        // Emit. The instructions get the line of the last token visited.
+
+        auto Emit(OpCode op)
+            -> void
+        {
+            Emit(static_cast<u8>(op));
+        }
+
+        auto Emit(u8 byte)
+            -> void
+        {
+            auto& chunk = function->function->chunk;
+            chunk.code.push_back(byte);
+            chunk.lines.push_back(line);
+        }
+
+        // Emit an instruction with a 16 bit operand.
+        auto Emit(OpCode op, u32 operand)
+            -> void;
+
+        auto EmitConstant(const Literal& value)
+            -> void;
+
+        // Emit a forward jump and return the offset of its operand, to patch it later.
+        auto EmitJump(OpCode op)
+            -> std::size_t;
+
+        // Make the jump at offset go to the current end of the code.
+        auto PatchJump(std::size_t offset)
+            -> void;
+
+        // Emit a backward jump to the offset.
+        auto EmitLoop(std::size_t start)
+            -> void;
+
+        auto SetLine(const Token& t) noexcept
+            -> void
+        {
+            line = static_cast<u32>(t.Line());
+        }
+
+
+        // Variables.
+
+        auto BeginScope()
+            -> void
+        {
+            ++function->depth;
+        }
+
+        // Pop the local variables of the innermost scope.
+        auto EndScope()
+            -> void;
+
+        // Slot of the local variable, or -1 if it is not a local of the current function.
+        auto ResolveLocal(std::string_view name) const
+            -> i64;
+
+        // Index of the global variable (created the first time the name is used).
+        auto GlobalIndex(std::string_view name)
+            -> u32;
+
+        // Index of the function (created the first time the name is used).
+        auto FunctionIndex(std::string_view name)
+            -> u32;
+
+
+        // Report the error and abort the compilation of the current statement.
+        [[noreturn]] auto ErrorAt(const Token& t, std::string_view msg)
+            -> void;
+
+        // Report the error at the current line.
+        [[noreturn]] auto Error(std::string_view msg)
+            -> void;
+
+        // Report a feature that only the compiled code has ("Classes are not supported by...").
+        [[noreturn]] auto Unsupported(const Token& t, std::string_view what)
+            -> void;
+
+    private:
+        struct Local
+        {
+            std::string_view name;
+            u32 depth;
+        };
+
+        // State of the function being compiled.
+        struct FunctionState
+        {
+            non_owned_ptr<BytecodeFunction> function;
+            std::vector<Local> locals;
+
+            // 0 at the top level of the script.
+            u32 depth{0};
+
+            // Deduplication of the constants: bits of the number or string id -> index.
+            std::unordered_map<u64, u16> numbers;
+            std::unordered_map<u32, u16> strings;
+        };
+
+        class CompileError : public std::exception
+        {
+        public:
+            const char* what() const noexcept override
+            {
+                return "Compile error.";
+            }
+        };
+
+    private:
+        BytecodeProgram program;
+
+        FunctionState script_state{&program.script, {}, 0, {}, {}};
+        non_owned_ptr<FunctionState> function{&script_state};
+
+        std::string_view backend;
+
+        std::unordered_map<std::string_view, u32> global_indexes;
+        std::unordered_map<std::string_view, u32> function_indexes;
+
+        // Globals declared by the top-level code, and the names read as globals (checked at the
+        // end: the functions can't be read as values).
+        std::unordered_set<std::string_view> defined_globals;
+        std::vector<Token> global_reads;
+
+        // Line of the last token visited.
+        u32 line{0};
+
+        bool had_error{false};
+    };
+} // namespace lox
+
+#endif
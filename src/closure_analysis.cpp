@@ -0,0 +1,427 @@
+#include "closure_analysis.hpp"
+
+namespace lox
+{
+    ClosureAnalysis::ClosureAnalysis(const FunStmtNode& function, std::span<const std::string_view> outer)
+    {
+        scopes.emplace_back();
+        for (auto name : outer)
+        {
+            Declare(name, nullptr);
+        }
+        outer_count = static_cast<u32>(declarations.size());
+
+        scopes.emplace_back();
+        for (const auto& param : function.parameters)
+        {
+            Declare(param.Lexeme(), &param);
+        }
+
+        // The body is a block, but its scope is the one of the parameters.
+        for (const auto& s : function.body->statements)
+        {
+            Visit(s);
+        }
+
+        Finish();
+    }
+
+
+    auto ClosureAnalysis::OuterUse(std::string_view name) const
+        -> FreeVariable
+    {
+        auto it = outer_uses.find(name);
+        return it == outer_uses.end() ? FreeVariable{name} : it->second;
+    }
+
+
+    auto ClosureAnalysis::SharedNames() const
+        -> std::unordered_set<std::string_view>
+    {
+        std::unordered_set<std::string_view> names;
+        for (const auto& decl : declarations)
+        {
+            if (decl.captured && decl.assigned)
+            {
+                names.insert(decl.name);
+            }
+        }
+        return names;
+    }
+
+
+    auto ClosureAnalysis::Declare(std::string_view name, const Token* token)
+        -> u32
+    {
+        auto id = static_cast<u32>(declarations.size());
+        declarations.push_back(Declaration{name});
+        scopes.back()[name] = id;
+        if (token)
+        {
+            by_token[token] = id;
+        }
+        return id;
+    }
+
+
+    auto ClosureAnalysis::Resolve(std::string_view name) const
+        -> const u32*
+    {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope)
+        {
+            if (auto it = scope->find(name); it != scope->end())
+            {
+                return &it->second;
+            }
+        }
+        return nullptr;
+    }
+
+
+    auto ClosureAnalysis::Use(const FreeVariable& use)
+        -> void
+    {
+        if (auto id = Resolve(use.name))
+        {
+            auto& decl = declarations[*id];
+            decl.assigned = decl.assigned || use.assigned;
+            UseOuter(*id, use);
+            return;
+        }
+
+        auto [it, inserted] = free_index.try_emplace(use.name, free.size());
+        if (inserted)
+        {
+            free.push_back(FreeVariable{use.name});
+        }
+        auto& variable = free[it->second];
+        variable.assigned = variable.assigned || use.assigned;
+        variable.value = variable.value || use.value;
+        variable.nested = variable.nested || use.nested;
+    }
+
+
+    auto ClosureAnalysis::UseOuter(u32 id, const FreeVariable& use)
+        -> void
+    {
+        if (id >= outer_count)
+        {
+            return;
+        }
+        auto& outer = outer_uses.try_emplace(use.name, FreeVariable{use.name}).first->second;
+        outer.assigned = outer.assigned || use.assigned;
+        outer.value = outer.value || use.value;
+        outer.nested = outer.nested || use.nested;
+    }
+
+
+    auto ClosureAnalysis::Finish()
+        -> void
+    {
+        // A closure used as a value, or assigned, escapes.
+        for (auto& [function, closure] : closures)
+        {
+            for (const auto& decl : declarations)
+            {
+                if (decl.closure == function && decl.assigned)
+                {
+                    closure.escapes = true;
+                }
+            }
+        }
+
+        // The closures captured by a closure that escapes escape too.
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto& [function, closure] : closures)
+            {
+                if (!closure.escapes)
+                {
+                    continue;
+                }
+                for (auto id : captured_declarations[function])
+                {
+                    if (auto captured = declarations[id].closure)
+                    {
+                        auto& other = closures[captured];
+                        changed = changed || !other.escapes;
+                        other.escapes = true;
+                    }
+                }
+            }
+        }
+
+        // The shared variables outlive the frame if a closure that escapes captures them.
+        for (auto& [function, closure] : closures)
+        {
+            if (!closure.escapes)
+            {
+                continue;
+            }
+            for (auto id : captured_declarations[function])
+            {
+                declarations[id].boxed = true;
+            }
+        }
+    }
+
+
+    // Visitor for expressions.
+
+    auto ClosureAnalysis::operator()(const BinaryExprNodePtr& n)
+        -> void
+    {
+        Visit(n->left);
+        Visit(n->right);
+    }
+
+
+    auto ClosureAnalysis::operator()(const UnaryExprNodePtr& n)
+        -> void
+    {
+        Visit(n->right);
+    }
+
+
+    auto ClosureAnalysis::operator()(const LiteralNodePtr&)
+        -> void
+    {
+    }
+
+
+    auto ClosureAnalysis::operator()(const GroupingNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+    }
+
+
+    auto ClosureAnalysis::operator()(const AssignExprNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+        Use(FreeVariable{n->name.Lexeme(), true});
+    }
+
+
+    auto ClosureAnalysis::operator()(const VarExprNodePtr& n)
+        -> void
+    {
+        auto name = n->name.Lexeme();
+        if (auto id = Resolve(name))
+        {
+            // A closure used as a value escapes.
+            if (auto function = declarations[*id].closure)
+            {
+                closures[function].escapes = true;
+            }
+        }
+        Use(FreeVariable{name, false, true});
+    }
+
+
+    auto ClosureAnalysis::operator()(const LogicalExprNodePtr& n)
+        -> void
+    {
+        Visit(n->left);
+        Visit(n->right);
+    }
+
+
+    auto ClosureAnalysis::operator()(const CallExprNodePtr& n)
+        -> void
+    {
+        Use(FreeVariable{n->callee.Lexeme()});
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+    }
+
+
+    auto ClosureAnalysis::operator()(const CmpExprNodePtr& n)
+        -> void
+    {
+        Visit(n->left);
+        Visit(n->right);
+    }
+
+
+    auto ClosureAnalysis::operator()(const GetExprNodePtr& n)
+        -> void
+    {
+        Visit(n->object);
+    }
+
+
+    auto ClosureAnalysis::operator()(const SetExprNodePtr& n)
+        -> void
+    {
+        Visit(n->object);
+        Visit(n->value);
+    }
+
+
+    auto ClosureAnalysis::operator()(const InvokeExprNodePtr& n)
+        -> void
+    {
+        Visit(n->object);
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+    }
+
+
+    auto ClosureAnalysis::operator()(const SuperInvokeExprNodePtr& n)
+        -> void
+    {
+        // The method is called on this.
+        Use(FreeVariable{"this", false, true});
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+    }
+
+
+    auto ClosureAnalysis::operator()(const ListExprNodePtr& n)
+        -> void
+    {
+        for (const auto& element : n->elements)
+        {
+            Visit(element);
+        }
+    }
+
+
+    auto ClosureAnalysis::operator()(const IndexExprNodePtr& n)
+        -> void
+    {
+        Visit(n->object);
+        Visit(n->index);
+    }
+
+
+    auto ClosureAnalysis::operator()(const IndexSetExprNodePtr& n)
+        -> void
+    {
+        Visit(n->object);
+        Visit(n->index);
+        Visit(n->value);
+    }
+
+
+    // Visitor for statements.
+
+    auto ClosureAnalysis::operator()(const ExprStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+    }
+
+
+    auto ClosureAnalysis::operator()(const PrintStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+    }
+
+
+    auto ClosureAnalysis::operator()(const VarStmtNodePtr& n)
+        -> void
+    {
+        // The initializer can't see the new variable.
+        Visit(n->initializer);
+        Declare(n->name.Lexeme(), &n->name);
+    }
+
+
+    auto ClosureAnalysis::operator()(const BlockStmtNodePtr& n)
+        -> void
+    {
+        scopes.emplace_back();
+        for (const auto& s : n->statements)
+        {
+            Visit(s);
+        }
+        scopes.pop_back();
+    }
+
+
+    auto ClosureAnalysis::operator()(const FunStmtNodePtr& n)
+        -> void
+    {
+        // Its own name is not a free variable of the nested function.
+        std::string_view outer[] = {n->name.Lexeme()};
+        ClosureAnalysis nested{*n, outer};
+
+        Closure closure;
+        std::vector<u32> captured;
+        for (const auto& variable : nested.FreeVariables())
+        {
+            auto id = Resolve(variable.name);
+            if (!id)
+            {
+                // Maybe a variable of an enclosing function: this one captures it too.
+                Use(FreeVariable{variable.name, variable.assigned, variable.value, true});
+                continue;
+            }
+
+            UseOuter(*id, FreeVariable{variable.name, variable.assigned, variable.value, true});
+            auto& decl = declarations[*id];
+            decl.captured = true;
+            decl.assigned = decl.assigned || variable.assigned;
+            decl.boxed = decl.boxed || variable.nested;
+            if (decl.closure && (variable.value || variable.assigned || variable.nested))
+            {
+                closures[decl.closure].escapes = true;
+            }
+            closure.captured.push_back(variable);
+            captured.push_back(*id);
+        }
+
+        // A closure that uses itself as a value (or in a nested function) escapes.
+        auto self = nested.OuterUse(n->name.Lexeme());
+        closure.escapes = self.value || self.assigned || self.nested;
+        closures[n.get()] = std::move(closure);
+        captured_declarations[n.get()] = std::move(captured);
+        declarations[Declare(n->name.Lexeme(), &n->name)].closure = n.get();
+    }
+
+
+    auto ClosureAnalysis::operator()(const ReturnStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->value);
+    }
+
+
+    auto ClosureAnalysis::operator()(const IfStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->condition);
+        Visit(n->then_branch);
+        if (n->else_branch)
+        {
+            Visit(*n->else_branch);
+        }
+    }
+
+
+    auto ClosureAnalysis::operator()(const WhileStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->condition);
+        Visit(n->body);
+    }
+
+
+    auto ClosureAnalysis::operator()(const ClassStmtNodePtr&)
+        -> void
+    {
+        // The classes are declared at the top level only.
+    }
+} // namespace lox
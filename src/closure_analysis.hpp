@@ -0,0 +1,282 @@
+#ifndef LOX_CLOSURE_ANALYSIS_HPP
+#define LOX_CLOSURE_ANALYSIS_HPP
+
+/*
+closure_analysis.hpp
+
+PURPOSE: Closure conversion of the functions declared inside other functions: which variables
+    they capture, which variables are shared and which closures escape.
+
+CLASSES:
+    ClosureAnalysis: visitor that analyzes the body of a function and the functions declared in it.
+
+DESCRIPTION:
+    A function declared inside a function is a closure, a variable of the enclosing function. It
+    captures the variables of the enclosing function it uses: the local variables, the
+    parameters, the variables the enclosing function captured and the closures declared before
+    it (maybe none). The functions of the top-level code are global functions: they never
+    capture the variables of the top-level code. Inside a closure its own name is the closure
+    itself.
+
+    Flat closures: the record of a closure holds the captured values, copied when the closure
+    is created. A closure that uses a variable of a function two levels up makes the function
+    in between capture it too, so the analysis works one function at a time: the variables a
+    nested function uses and doesn't declare (its free variables, found by the analysis of the
+    nested function itself) are resolved in the scopes of the function.
+
+    Shared variables: a captured variable that is also assigned after its declaration (by the
+    function or by a closure) lives in memory, and the closures capture its address. The other
+    captured variables are copied, so they cost nothing to the function that declares them.
+
+    Escape analysis: a closure escapes if it is used as a value (not only called by name), is
+    assigned, is captured by a closure that escapes, or is used by a function nested in a
+    closure that captures it. The record of a closure that doesn't escape is allocated in the
+    stack frame of the function and its calls are direct. A shared variable lives in its GC slot
+    of the frame (the closures capture the address of the slot) if only closures that don't
+    escape capture it, and none of the functions nested in them; otherwise it is boxed on the
+    heap.
+
+    The declarations of the function are identified by the address of their name token.
+*/
+
+#include "node.hpp"
+#include "common.hpp"
+
+#include <concepts>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+namespace lox
+{
+    class ClosureAnalysis
+    {
+    public:
+        // How a function uses a variable it doesn't declare.
+        struct FreeVariable
+        {
+            std::string_view name;
+            bool assigned{false};
+
+            // Read as a value, not only called.
+            bool value{false};
+
+            // Used by a function nested in the function.
+            bool nested{false};
+        };
+
+        struct Closure
+        {
+            // Captured variables, in the order of the record.
+            std::vector<FreeVariable> captured;
+            bool escapes{false};
+        };
+
+        // Analyze the function: outer are the names bound when it starts, besides the
+        // parameters (the captured variables and its own name if it is a closure).
+        ClosureAnalysis(const FunStmtNode& function, std::span<const std::string_view> outer);
+
+        // The variables used and not declared by the function, in the order of their first use.
+        auto FreeVariables() const noexcept
+            -> const std::vector<FreeVariable>&
+        {
+            return free;
+        }
+
+        // How the function uses a name of outer (assigned, value and nested are all false if
+        // it doesn't).
+        auto OuterUse(std::string_view name) const
+            -> FreeVariable;
+
+        // The closure of the nested function.
+        auto FindClosure(const FunStmtNode& function) const
+            -> const Closure*
+        {
+            auto it = closures.find(&function);
+            return it == closures.end() ? nullptr : &it->second;
+        }
+
+        // True if the variable (a parameter, a variable or a closure of the function) is shared.
+        auto IsShared(const Token& declaration) const
+            -> bool
+        {
+            auto decl = Find(declaration);
+            return decl && decl->captured && decl->assigned;
+        }
+
+        // True if the shared variable must be boxed on the heap.
+        auto IsBoxed(const Token& declaration) const
+            -> bool
+        {
+            auto decl = Find(declaration);
+            return decl && decl->captured && decl->assigned && decl->boxed;
+        }
+
+        // True if the variable of the closure is assigned (its calls can't be direct).
+        auto IsAssigned(const Token& declaration) const
+            -> bool
+        {
+            auto decl = Find(declaration);
+            return decl && decl->assigned;
+        }
+
+        // Names of the shared variables of the function.
+        auto SharedNames() const
+            -> std::unordered_set<std::string_view>;
+
+
+    public:
+        // Visitor for expressions.
+
+        auto operator()(const BinaryExprNodePtr& n)
+            -> void;
+
+        auto operator()(const UnaryExprNodePtr& n)
+            -> void;
+
+        auto operator()(const LiteralNodePtr& n)
+            -> void;
+
+        auto operator()(const GroupingNodePtr& n)
+            -> void;
+
+        auto operator()(const AssignExprNodePtr& n)
+            -> void;
+
+        auto operator()(const VarExprNodePtr& n)
+            -> void;
+
+        auto operator()(const LogicalExprNodePtr& n)
+            -> void;
+
+        auto operator()(const CallExprNodePtr& n)
+            -> void;
+
+        auto operator()(const CmpExprNodePtr& n)
+            -> void;
+
+        auto operator()(const GetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const InvokeExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SuperInvokeExprNodePtr& n)
+            -> void;
+
+        auto operator()(const ListExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexSetExprNodePtr& n)
+            -> void;
+
+
+        // Visitor for statements.
+
+        auto operator()(const ExprStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const PrintStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const VarStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const BlockStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const FunStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ReturnStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const IfStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const WhileStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ClassStmtNodePtr& n)
+            -> void;
+
+    private:
+        struct Declaration
+        {
+            std::string_view name;
+
+            // Captured by a closure, assigned after the declaration.
+            bool captured{false};
+            bool assigned{false};
+
+            // Shared with a closure that escapes or with a function nested in a closure.
+            bool boxed{false};
+
+            // The nested function if the variable is a closure.
+            const FunStmtNode* closure{nullptr};
+        };
+
+        template <typename T>
+            requires std::same_as<T, ExprNode> || std::same_as<T, StmtNode>
+        auto Visit(const T& node)
+            -> void
+        {
+            std::visit(*this, node);
+        }
+
+        auto Declare(std::string_view name, const Token* token)
+            -> u32;
+
+        auto Resolve(std::string_view name) const
+            -> const u32*;
+
+        auto Find(const Token& declaration) const
+            -> const Declaration*
+        {
+            auto it = by_token.find(&declaration);
+            return it == by_token.end() ? nullptr : &declarations[it->second];
+        }
+
+        // A use of the name by the function (nested: by a function nested in it).
+        auto Use(const FreeVariable& use)
+            -> void;
+
+        // Merge the use of a declaration of outer.
+        auto UseOuter(u32 id, const FreeVariable& use)
+            -> void;
+
+        // Propagate the escapes and decide where the shared variables live.
+        auto Finish()
+            -> void;
+
+    private:
+        std::vector<Declaration> declarations;
+        std::unordered_map<const Token*, u32> by_token;
+
+        // The declarations of outer are the first ones.
+        u32 outer_count{0};
+        std::unordered_map<std::string_view, FreeVariable> outer_uses;
+
+        // Name -> declaration of each scope (the innermost is the last).
+        std::vector<std::unordered_map<std::string_view, u32>> scopes;
+
+        std::vector<FreeVariable> free;
+        std::unordered_map<std::string_view, std::size_t> free_index;
+
+        std::unordered_map<const FunStmtNode*, Closure> closures;
+
+        // Declarations captured by each closure (the declarations of closure.captured).
+        std::unordered_map<const FunStmtNode*, std::vector<u32>> captured_declarations;
+    };
+} // namespace lox
+
+#endif
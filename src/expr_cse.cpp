@@ -0,0 +1,699 @@
+#include "expr_cse.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace lox
+{
+    // Distinguish the kinds of node in the hash.
+    enum class HashTag : u64
+    {
+        Literal = 1, Var, Unary, Binary, Logical, Cmp, Assign, Call, Get, Set, Invoke, SuperInvoke, List,
+        Index, IndexSet
+    };
+
+
+    static auto HashCombine(u64 seed, u64 value)
+        -> u64
+    {
+        // Same mixing of boost::hash_combine, extended to 64 bits.
+        return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 12) + (seed >> 4));
+    }
+
+
+    static auto HashNode(HashTag tag, const Token& op)
+        -> u64
+    {
+        return HashCombine(static_cast<u64>(tag), op.TypeInt());
+    }
+
+
+    // Skip the grouping nodes.
+    static auto Unwrap(const ExprNode& node)
+        -> const ExprNode&
+    {
+        const ExprNode* n = &node;
+        while (auto g = std::get_if<GroupingNodePtr>(n))
+        {
+            n = &(*g)->expr;
+        }
+        return *n;
+    }
+
+
+    // Call f on each operand of the expression.
+    template <typename F>
+    static auto ForEachOperand(const ExprNode& node, F&& f)
+        -> void
+    {
+        std::visit([&f](const auto& n)
+        {
+            using T = std::decay_t<decltype(n)>;
+            if constexpr (std::is_same_v<T, BinaryExprNodePtr> || std::is_same_v<T, LogicalExprNodePtr> ||
+                std::is_same_v<T, CmpExprNodePtr>)
+            {
+                f(n->left);
+                f(n->right);
+            }
+            else if constexpr (std::is_same_v<T, UnaryExprNodePtr>)
+            {
+                f(n->right);
+            }
+            else if constexpr (std::is_same_v<T, GroupingNodePtr> || std::is_same_v<T, AssignExprNodePtr>)
+            {
+                f(n->expr);
+            }
+            else if constexpr (std::is_same_v<T, CallExprNodePtr> || std::is_same_v<T, SuperInvokeExprNodePtr>)
+            {
+                for (const auto& arg : n->arguments)
+                {
+                    f(arg);
+                }
+            }
+            else if constexpr (std::is_same_v<T, GetExprNodePtr>)
+            {
+                f(n->object);
+            }
+            else if constexpr (std::is_same_v<T, SetExprNodePtr>)
+            {
+                f(n->object);
+                f(n->value);
+            }
+            else if constexpr (std::is_same_v<T, InvokeExprNodePtr>)
+            {
+                f(n->object);
+                for (const auto& arg : n->arguments)
+                {
+                    f(arg);
+                }
+            }
+            else if constexpr (std::is_same_v<T, ListExprNodePtr>)
+            {
+                for (const auto& element : n->elements)
+                {
+                    f(element);
+                }
+            }
+            else if constexpr (std::is_same_v<T, IndexExprNodePtr>)
+            {
+                f(n->object);
+                f(n->index);
+            }
+            else if constexpr (std::is_same_v<T, IndexSetExprNodePtr>)
+            {
+                f(n->object);
+                f(n->index);
+                f(n->value);
+            }
+        }, node);
+    }
+
+
+    static auto LiteralEqual(const Literal& l1, const Literal& l2)
+        -> bool
+    {
+        if (l1.index() != l2.index())
+        {
+            return false;
+        }
+
+        switch (l1.index())
+        {
+        case 0: // LoxNil
+            return true;
+        case 1: // StringId
+            return *std::get_if<1>(&l1) == *std::get_if<1>(&l2);
+        case 2: // f64
+            // Compare the bits: 0.0 and -0.0 are different expressions.
+            return std::bit_cast<u64>(*std::get_if<2>(&l1)) == std::bit_cast<u64>(*std::get_if<2>(&l2));
+        case 3: // bool
+            return *std::get_if<3>(&l1) == *std::get_if<3>(&l2);
+        default:
+            return false;
+        }
+    }
+
+
+    auto StructuralEqual(const ExprNode& n1, const ExprNode& n2)
+        -> bool
+    {
+        const auto& e1 = Unwrap(n1);
+        const auto& e2 = Unwrap(n2);
+        if (e1.index() != e2.index())
+        {
+            return false;
+        }
+
+        return std::visit([&e2](const auto& a) -> bool
+        {
+            using T = std::decay_t<decltype(a)>;
+            const auto& b = *std::get_if<T>(&e2);
+
+            if constexpr (std::is_same_v<T, BinaryExprNodePtr> || std::is_same_v<T, LogicalExprNodePtr> ||
+                std::is_same_v<T, CmpExprNodePtr>)
+            {
+                return a->op.Type() == b->op.Type() && StructuralEqual(a->left, b->left) &&
+                    StructuralEqual(a->right, b->right);
+            }
+            else if constexpr (std::is_same_v<T, UnaryExprNodePtr>)
+            {
+                return a->op.Type() == b->op.Type() && StructuralEqual(a->right, b->right);
+            }
+            else if constexpr (std::is_same_v<T, LiteralNodePtr>)
+            {
+                return LiteralEqual(a->literal, b->literal);
+            }
+            else if constexpr (std::is_same_v<T, VarExprNodePtr>)
+            {
+                return a->name.Lexeme() == b->name.Lexeme();
+            }
+            else if constexpr (std::is_same_v<T, AssignExprNodePtr>)
+            {
+                return a->name.Lexeme() == b->name.Lexeme() && StructuralEqual(a->expr, b->expr);
+            }
+            else if constexpr (std::is_same_v<T, CallExprNodePtr>)
+            {
+                return a->callee.Lexeme() == b->callee.Lexeme() &&
+                    std::equal(a->arguments.begin(), a->arguments.end(),
+                        b->arguments.begin(), b->arguments.end(),
+                        [](const ExprNode& x, const ExprNode& y) { return StructuralEqual(x, y); });
+            }
+            else if constexpr (std::is_same_v<T, GetExprNodePtr> || std::is_same_v<T, SetExprNodePtr> ||
+                std::is_same_v<T, InvokeExprNodePtr> || std::is_same_v<T, SuperInvokeExprNodePtr> ||
+                std::is_same_v<T, ListExprNodePtr> || std::is_same_v<T, IndexExprNodePtr> ||
+                std::is_same_v<T, IndexSetExprNodePtr>)
+            {
+                // Never in the table: they read or write the heap (a list literal allocates a
+                // new list).
+                return false;
+            }
+            else // GroupingNodePtr, removed by Unwrap.
+            {
+                return StructuralEqual(a->expr, b->expr);
+            }
+        }, e1);
+    }
+
+
+    auto ExprCSE::Analyze(const std::vector<StmtNode>& nodes)
+        -> void
+    {
+        Clear();
+        for (const auto& node : nodes)
+        {
+            Visit(node);
+        }
+        Clear();
+    }
+
+
+    auto ExprCSE::Report(std::FILE* file) const
+        -> void
+    {
+        std::fprintf(file, "side-effect-free compound expressions: %llu\n",
+            static_cast<unsigned long long>(candidates));
+        std::fprintf(file, "duplicates found: %llu\n",
+            static_cast<unsigned long long>(duplicates.size()));
+        std::fprintf(file, "nodes not evaluated: %llu\n",
+            static_cast<unsigned long long>(saved_nodes));
+    }
+
+
+    // ********************************* UTILITY *********************************
+
+    auto ExprCSE::Visit(const ExprNode& n)
+        -> ExprInfo
+    {
+        auto info = std::visit(*this, n);
+        if (info.compound && info.pure)
+        {
+            ++candidates;
+            LookUp(n, info);
+        }
+        return info;
+    }
+
+
+    auto ExprCSE::Compound(u64 hash, std::initializer_list<const ExprInfo*> operands)
+        -> ExprInfo
+    {
+        ExprInfo info;
+        info.compound = true;
+        for (const auto op : operands)
+        {
+            hash = HashCombine(hash, op->hash);
+            info.size += op->size;
+            info.pure = info.pure && op->pure;
+
+            std::vector<std::string_view> reads;
+            reads.reserve(info.reads.size() + op->reads.size());
+            std::set_union(info.reads.begin(), info.reads.end(), op->reads.begin(), op->reads.end(),
+                std::back_inserter(reads));
+            info.reads = std::move(reads);
+        }
+        info.hash = hash;
+        return info;
+    }
+
+
+    auto ExprCSE::LookUp(const ExprNode& node, const ExprInfo& info)
+        -> void
+    {
+        auto [begin, end] = table.equal_range(info.hash);
+        for (auto it = begin; it != end; ++it)
+        {
+            const auto& entry = entries[it->second];
+            if (!entry.valid || !StructuralEqual(*entry.node, node))
+            {
+                continue;
+            }
+
+            // The operands are duplicates of the operands of the canonical node: keep only
+            // the largest duplicate.
+            ForEachOperand(node, [this](const ExprNode& op)
+            {
+                if (auto d = duplicates.find(NodeId(Unwrap(op))); d != duplicates.end())
+                {
+                    saved_nodes -= d->second.size;
+                    duplicates.erase(d);
+                }
+            });
+
+            auto canonical = NodeId(*entry.node);
+            duplicates.emplace(NodeId(node), Duplicate{canonical, info.size});
+            shared.insert(canonical);
+            saved_nodes += info.size;
+            return;
+        }
+
+        auto idx = static_cast<u32>(entries.size());
+        entries.push_back(Entry{&node, true, !info.reads.empty()});
+        table.emplace(info.hash, idx);
+        for (auto name : info.reads)
+        {
+            readers[name].push_back(idx);
+        }
+    }
+
+
+    auto ExprCSE::Write(std::string_view name)
+        -> void
+    {
+        if (auto it = readers.find(name); it != readers.end())
+        {
+            for (auto idx : it->second)
+            {
+                entries[idx].valid = false;
+            }
+            readers.erase(it);
+        }
+    }
+
+
+    auto ExprCSE::WriteAll()
+        -> void
+    {
+        for (auto& entry : entries)
+        {
+            if (entry.reads_vars)
+            {
+                entry.valid = false;
+            }
+        }
+        readers.clear();
+    }
+
+
+    auto ExprCSE::Drop(std::size_t begin)
+        -> void
+    {
+        for (auto i = begin; i < entries.size(); ++i)
+        {
+            entries[i].valid = false;
+        }
+    }
+
+
+    auto ExprCSE::Clear()
+        -> void
+    {
+        entries.clear();
+        table.clear();
+        readers.clear();
+    }
+
+    // ********************************* UTILITY *********************************
+
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+
+    auto ExprCSE::operator()(const BinaryExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto left = Visit(n->left);
+        auto right = Visit(n->right);
+        return Compound(HashNode(HashTag::Binary, n->op), {&left, &right});
+    }
+
+
+    auto ExprCSE::operator()(const UnaryExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto right = Visit(n->right);
+        return Compound(HashNode(HashTag::Unary, n->op), {&right});
+    }
+
+
+    auto ExprCSE::operator()(const LiteralNodePtr& n)
+        -> ExprInfo
+    {
+        u64 value = 0;
+        switch (n->literal.index())
+        {
+        case 1: // StringId
+            value = std::get_if<1>(&n->literal)->value;
+            break;
+        case 2: // f64
+            value = std::bit_cast<u64>(*std::get_if<2>(&n->literal));
+            break;
+        case 3: // bool
+            value = *std::get_if<3>(&n->literal) ? 1 : 0;
+            break;
+        default: // LoxNil
+            break;
+        }
+
+        ExprInfo info;
+        info.hash = HashCombine(HashCombine(static_cast<u64>(HashTag::Literal), n->literal.index()), value);
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const GroupingNodePtr& n)
+        -> ExprInfo
+    {
+        // The grouping node is transparent, only its expression is looked up.
+        auto info = Visit(n->expr);
+        info.compound = false;
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const AssignExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto value = Visit(n->expr);
+        Write(n->name.Lexeme());
+
+        auto info = Compound(HashCombine(static_cast<u64>(HashTag::Assign),
+            std::hash<std::string_view>{}(n->name.Lexeme())), {&value});
+        info.pure = false;
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const VarExprNodePtr& n)
+        -> ExprInfo
+    {
+        ExprInfo info;
+        info.hash = HashCombine(static_cast<u64>(HashTag::Var), std::hash<std::string_view>{}(n->name.Lexeme()));
+        info.reads.push_back(n->name.Lexeme());
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const LogicalExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto left = Visit(n->left);
+
+        // The right operand is not always evaluated.
+        auto begin = entries.size();
+        auto right = Visit(n->right);
+        Drop(begin);
+
+        return Compound(HashNode(HashTag::Logical, n->op), {&left, &right});
+    }
+
+
+    auto ExprCSE::operator()(const CallExprNodePtr& n)
+        -> ExprInfo
+    {
+        ExprInfo info;
+        info.compound = true;
+        info.pure = false;
+        info.hash = HashCombine(static_cast<u64>(HashTag::Call), std::hash<std::string_view>{}(n->callee.Lexeme()));
+        for (const auto& arg : n->arguments)
+        {
+            auto a = Visit(arg);
+            info.hash = HashCombine(info.hash, a.hash);
+            info.size += a.size;
+        }
+
+        // The callee can write any global variable.
+        WriteAll();
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const CmpExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto left = Visit(n->left);
+        auto right = Visit(n->right);
+        return Compound(HashNode(HashTag::Cmp, n->op), {&left, &right});
+    }
+
+
+    auto ExprCSE::operator()(const GetExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto object = Visit(n->object);
+
+        // The field can be changed by any set or call.
+        auto info = Compound(HashCombine(static_cast<u64>(HashTag::Get),
+            std::hash<std::string_view>{}(n->name.Lexeme())), {&object});
+        info.pure = false;
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const SetExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto object = Visit(n->object);
+        auto value = Visit(n->value);
+
+        auto info = Compound(HashCombine(static_cast<u64>(HashTag::Set),
+            std::hash<std::string_view>{}(n->name.Lexeme())), {&object, &value});
+        info.pure = false;
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const InvokeExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto info = Visit(n->object);
+        info.compound = true;
+        info.pure = false;
+        info.hash = HashCombine(HashCombine(static_cast<u64>(HashTag::Invoke), info.hash),
+            std::hash<std::string_view>{}(n->name.Lexeme()));
+        for (const auto& arg : n->arguments)
+        {
+            auto a = Visit(arg);
+            info.hash = HashCombine(info.hash, a.hash);
+            info.size += a.size;
+        }
+        info.size += 1;
+
+        // The method can write any global variable, like a function.
+        WriteAll();
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const SuperInvokeExprNodePtr& n)
+        -> ExprInfo
+    {
+        ExprInfo info;
+        info.compound = true;
+        info.pure = false;
+        info.hash = HashCombine(static_cast<u64>(HashTag::SuperInvoke), std::hash<std::string_view>{}(n->method.Lexeme()));
+        for (const auto& arg : n->arguments)
+        {
+            auto a = Visit(arg);
+            info.hash = HashCombine(info.hash, a.hash);
+            info.size += a.size;
+        }
+
+        WriteAll();
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const ListExprNodePtr& n)
+        -> ExprInfo
+    {
+        ExprInfo info;
+        info.compound = true;
+        info.pure = false;
+        info.hash = static_cast<u64>(HashTag::List);
+        for (const auto& element : n->elements)
+        {
+            auto e = Visit(element);
+            info.hash = HashCombine(info.hash, e.hash);
+            info.size += e.size;
+        }
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const IndexExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto object = Visit(n->object);
+        auto index = Visit(n->index);
+
+        // The element can be changed by any index set or call, like a field.
+        auto info = Compound(static_cast<u64>(HashTag::Index), {&object, &index});
+        info.pure = false;
+        return info;
+    }
+
+
+    auto ExprCSE::operator()(const IndexSetExprNodePtr& n)
+        -> ExprInfo
+    {
+        auto object = Visit(n->object);
+        auto index = Visit(n->index);
+        auto value = Visit(n->value);
+
+        auto info = Compound(static_cast<u64>(HashTag::IndexSet), {&object, &index, &value});
+        info.pure = false;
+        return info;
+    }
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+    auto ExprCSE::operator()(const ExprStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+    }
+
+
+    auto ExprCSE::operator()(const PrintStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+    }
+
+
+    auto ExprCSE::operator()(const VarStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->initializer);
+        Write(n->name.Lexeme());
+    }
+
+
+    auto ExprCSE::operator()(const BlockStmtNodePtr& n)
+        -> void
+    {
+        for (const auto& s : n->statements)
+        {
+            Visit(s);
+        }
+
+        // After the block the names declared inside it refer to the outer variables.
+        for (const auto& s : n->statements)
+        {
+            if (auto v = std::get_if<VarStmtNodePtr>(&s))
+            {
+                Write((*v)->name.Lexeme());
+            }
+            else if (auto f = std::get_if<FunStmtNodePtr>(&s))
+            {
+                Write((*f)->name.Lexeme());
+            }
+        }
+    }
+
+
+    auto ExprCSE::operator()(const FunStmtNodePtr& n)
+        -> void
+    {
+        Write(n->name.Lexeme());
+
+        // The body is a different function, analyze it in its own region and continue
+        // the current one after it.
+        auto outer_entries = std::exchange(entries, {});
+        auto outer_table = std::exchange(table, {});
+        auto outer_readers = std::exchange(readers, {});
+
+        (*this)(n->body);
+
+        entries = std::move(outer_entries);
+        table = std::move(outer_table);
+        readers = std::move(outer_readers);
+    }
+
+
+    auto ExprCSE::operator()(const ReturnStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->value);
+        Clear();
+    }
+
+
+    auto ExprCSE::operator()(const IfStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->condition);
+
+        Clear();
+        Visit(n->then_branch);
+        Clear();
+        if (n->else_branch)
+        {
+            Visit(*n->else_branch);
+            Clear();
+        }
+    }
+
+
+    auto ExprCSE::operator()(const WhileStmtNodePtr& n)
+        -> void
+    {
+        // The condition and the body are evaluated more than once.
+        Clear();
+        Visit(n->condition);
+        Clear();
+        Visit(n->body);
+        Clear();
+    }
+
+
+    auto ExprCSE::operator()(const ClassStmtNodePtr& n)
+        -> void
+    {
+        // The class declares its constructor, and the methods are functions.
+        Write(n->name.Lexeme());
+        for (const auto& method : n->methods)
+        {
+            (*this)(method);
+        }
+    }
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+} // namespace lox
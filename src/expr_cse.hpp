@@ -0,0 +1,262 @@
+#ifndef LOX_EXPR_CSE_HPP
+#define LOX_EXPR_CSE_HPP
+
+/*
+expr_cse.hpp
+
+PURPOSE: Find structurally identical expressions that can be computed once (common subexpression
+    elimination).
+
+CLASSES:
+    ExprCSE: visitor that hashes the expressions of the AST and marks the duplicates.
+
+DESCRIPTION:
+    The pass is optional and does not modify the AST. Each expression is hashed bottom-up
+    (the hash depends only on the structure: operators, literals and variable names) and looked up
+    in a table of the expressions already evaluated in the same region. When an identical
+    side-effect-free expression is found, the node is recorded as a duplicate of the first one
+    (the canonical node) and the backend can reuse the value of the canonical node instead of
+    evaluating the duplicate again.
+
+    A region is a straight-line sequence of code: the table is cleared at every control flow
+    boundary (if, while, return, function body), so the canonical node always dominates
+    its duplicates. Inside a region the entries are invalidated when a variable they read is
+    assigned or declared, and every call invalidates all the entries that read a variable (the
+    callee can write globals, and a closure the variables it shares with the function). The
+    fields of the instances and the elements of the lists are not tracked: property accesses,
+    indexing, list literals and method calls are never pure, and a method call is a call. The right operand of and/or is evaluated conditionally, so
+    what it adds to the table is dropped after it.
+
+    Only compound expressions are considered: reusing a literal or a variable read saves nothing.
+    Grouping nodes are transparent, (a + b) and a + b are the same expression.
+*/
+
+#include "node.hpp"
+#include "common.hpp"
+
+#include <variant>
+#include <initializer_list>
+#include <vector>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdio>
+
+namespace lox
+{
+    // Identity of an expression node (the address of the node owned by the variant).
+    inline auto NodeId(const ExprNode& node) noexcept
+        -> const void*
+    {
+        return std::visit([](const auto& p) -> const void* { return p.get(); }, node);
+    }
+
+
+    // Structural equality of two expressions. Grouping nodes are transparent.
+    auto StructuralEqual(const ExprNode& n1, const ExprNode& n2)
+        -> bool;
+
+
+    class ExprCSE
+    {
+    public:
+        // Analyze the program. Must be called once for each program.
+        auto Analyze(const std::vector<StmtNode>& nodes)
+            -> void;
+
+        // Return the canonical node if the expression is a duplicate, nullptr otherwise.
+        auto Canonical(const ExprNode& node) const
+            -> const void*
+        {
+            auto it = duplicates.find(NodeId(node));
+            return it == duplicates.end() ? nullptr : it->second.canonical;
+        }
+
+        // Return true if the value of the expression is reused by some duplicate.
+        auto IsShared(const ExprNode& node) const
+            -> bool
+        {
+            return shared.contains(NodeId(node));
+        }
+
+        // Write a report of the duplicates found.
+        auto Report(std::FILE* file) const
+            -> void;
+
+
+    public:
+        // Info computed bottom-up for each expression.
+        struct ExprInfo
+        {
+            u64 hash{0};
+
+            // Number of nodes of the subtree.
+            u64 size{1};
+
+            // True if the evaluation of the expression has no side effects.
+            bool pure{true};
+
+            // False for leaves (literals, variables) and grouping nodes.
+            bool compound{false};
+
+            // Variables read by the expression (sorted, without duplicates).
+            std::vector<std::string_view> reads;
+        };
+
+        // Visitor for expressions.
+
+        auto operator()(const BinaryExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const UnaryExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const LiteralNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const GroupingNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const AssignExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const VarExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const LogicalExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const CallExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const CmpExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const GetExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const SetExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const InvokeExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const SuperInvokeExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const ListExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const IndexExprNodePtr& n)
+            -> ExprInfo;
+
+        auto operator()(const IndexSetExprNodePtr& n)
+            -> ExprInfo;
+
+
+        // Visitor for statements.
+
+        auto operator()(const ExprStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const PrintStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const VarStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const BlockStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const FunStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ReturnStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const IfStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const WhileStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ClassStmtNodePtr& n)
+            -> void;
+
+
+    private:
+        // Hash the expression and look it up in the table if it is compound and side-effect-free.
+        auto Visit(const ExprNode& n)
+            -> ExprInfo;
+
+        auto Visit(const StmtNode& n)
+            -> void
+        {
+            std::visit(*this, n);
+        }
+
+
+        // Combine the info of the operands of a compound expression.
+        static auto Compound(u64 hash, std::initializer_list<const ExprInfo*> operands)
+            -> ExprInfo;
+
+        // Look up the expression in the table: mark it as duplicate or add it to the table.
+        auto LookUp(const ExprNode& node, const ExprInfo& info)
+            -> void;
+
+        // Invalidate the entries that read the variable.
+        auto Write(std::string_view name)
+            -> void;
+
+        // Invalidate the entries that read any variable.
+        auto WriteAll()
+            -> void;
+
+        // Invalidate the entries added after the first `begin` entries.
+        auto Drop(std::size_t begin)
+            -> void;
+
+        // Start a new region.
+        auto Clear()
+            -> void;
+
+    private:
+        struct Duplicate
+        {
+            const void* canonical;
+
+            // Number of nodes of the duplicate subtree.
+            u64 size;
+        };
+
+        struct Entry
+        {
+            const ExprNode* node;
+            bool valid;
+            bool reads_vars;
+        };
+
+        // Entries of the current region. The invalid entries are removed only when the region ends.
+        std::vector<Entry> entries;
+
+        // Hash -> index of the entries with that hash.
+        std::unordered_multimap<u64, u32> table;
+
+        // Variable -> index of the entries that read it.
+        std::unordered_map<std::string_view, std::vector<u32>> readers;
+
+        // Duplicate node -> canonical node.
+        std::unordered_map<const void*, Duplicate> duplicates;
+
+        // Canonical nodes with at least one duplicate.
+        std::unordered_set<const void*> shared;
+
+        // Compound side-effect-free expressions examined.
+        u64 candidates{0};
+
+        // Nodes that don't need to be evaluated thanks to the duplicates.
+        u64 saved_nodes{0};
+    };
+} // namespace lox
+
+#endif
@@ -0,0 +1,546 @@
+#include "gc.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+extern "C"
+{
+    lox::GCFrame* lox_gc_top = nullptr;
+
+
+    auto lox_gc_remember(lox::Obj* obj)
+        -> void
+    {
+        lox::GlobalHeap().Remember(obj);
+    }
+
+
+    auto lox_gc_add_root(lox::u64* slot)
+        -> void
+    {
+        lox::GlobalHeap().AddRoot(slot);
+    }
+
+
+    auto lox_gc_report()
+        -> void
+    {
+        lox::GlobalHeap().Report(stderr);
+    }
+}
+
+
+namespace lox
+{
+    // Size of the object, header included, rounded to the alignment of the objects.
+    static auto ObjectSize(const Obj* obj) noexcept
+        -> std::size_t
+    {
+        std::size_t size = 0;
+        switch (obj->type)
+        {
+        case ObjType::String:
+            // The characters follow the object.
+            size = sizeof(ObjString) + reinterpret_cast<const ObjString*>(obj)->length;
+            break;
+        case ObjType::Instance:
+            size = sizeof(ObjInstance) + reinterpret_cast<const ObjInstance*>(obj)->capacity * sizeof(u64);
+            break;
+        case ObjType::Slots:
+        case ObjType::Doubles:
+            size = sizeof(ObjSlots) + reinterpret_cast<const ObjSlots*>(obj)->capacity * sizeof(u64);
+            break;
+        case ObjType::Closure:
+        case ObjType::Class:
+            size = sizeof(ObjClosure) + reinterpret_cast<const ObjClosure*>(obj)->count * sizeof(u64);
+            break;
+        case ObjType::Rope:
+            size = sizeof(ObjRope);
+            break;
+        case ObjType::List:
+            size = sizeof(ObjList);
+            break;
+        case ObjType::Map:
+            size = sizeof(ObjMap);
+            break;
+        case ObjType::Table:
+            // A control byte and an entry (key and value) for each slot.
+            size = sizeof(ObjTable) + reinterpret_cast<const ObjTable*>(obj)->capacity * (1 + 2 * sizeof(u64));
+            break;
+        case ObjType::Free:
+            size = reinterpret_cast<const ObjFree*>(obj)->size;
+            break;
+        }
+        return (size + 7) & ~std::size_t{7};
+    }
+
+
+    // Make the bytes a free chunk (the smallest objects have 8 bytes).
+    static auto MakeFree(char* begin, char* end) noexcept
+        -> void
+    {
+        static_assert(sizeof(ObjFree) == 8);
+        if (begin != end)
+        {
+            auto chunk = reinterpret_cast<ObjFree*>(begin);
+            chunk->obj.type = ObjType::Free;
+            chunk->obj.gc = Obj::gc_heap;
+            chunk->size = static_cast<u32>(end - begin);
+        }
+    }
+
+
+    auto GlobalHeap()
+        -> Heap&
+    {
+        static Heap heap;
+        return heap;
+    }
+
+
+    Heap::Heap(std::size_t nursery_blocks_) :
+        nursery_blocks{nursery_blocks_},
+        next_major{nursery_blocks_ * block_size * 4}
+    {
+    }
+
+
+    Heap::~Heap()
+    {
+        for (auto list : {&blocks, &free_blocks})
+        {
+            for (auto block : *list)
+            {
+                std::free(block);
+            }
+        }
+        for (auto obj : large_objects)
+        {
+            std::free(obj);
+        }
+    }
+
+
+    auto Heap::Allocate(ObjType type, std::size_t size)
+        -> Obj*
+    {
+        size = (size + 7) & ~std::size_t{7};
+        if (size > large_object_size)
+        {
+            return AllocateLarge(type, size);
+        }
+
+        if (young_bytes + size > nursery_blocks * block_size)
+        {
+            Collect(old_bytes > next_major);
+        }
+
+        char* address = nullptr;
+        if (static_cast<std::size_t>(limit - cursor) >= size)
+        {
+            address = cursor;
+            cursor += size;
+        }
+        else if (size > hole_min)
+        {
+            address = AllocateOverflow(size);
+        }
+        else
+        {
+            NextHole();
+            address = cursor;
+            cursor += size;
+        }
+
+        auto obj = reinterpret_cast<Obj*>(address);
+        obj->type = type;
+        obj->gc = Obj::gc_heap;
+        young_bytes += size;
+        stats.allocated_bytes += size;
+        return obj;
+    }
+
+
+    auto Heap::NextHole()
+        -> void
+    {
+        MakeFree(cursor, limit);
+        if (!holes.empty())
+        {
+            auto hole = holes.back();
+            holes.pop_back();
+            hole.block->young = true;
+            cursor = hole.begin;
+            limit = hole.end;
+            return;
+        }
+
+        auto block = reinterpret_cast<char*>(NewBlock());
+        cursor = block + block_header;
+        limit = block + block_size;
+    }
+
+
+    auto Heap::AllocateOverflow(std::size_t size)
+        -> char*
+    {
+        if (static_cast<std::size_t>(overflow_limit - overflow_cursor) < size)
+        {
+            MakeFree(overflow_cursor, overflow_limit);
+            auto block = reinterpret_cast<char*>(NewBlock());
+            overflow_cursor = block + block_header;
+            overflow_limit = block + block_size;
+        }
+        auto address = overflow_cursor;
+        overflow_cursor += size;
+        return address;
+    }
+
+
+    auto Heap::AllocateLarge(ObjType type, std::size_t size)
+        -> Obj*
+    {
+        if (old_bytes + size > next_major)
+        {
+            Collect(true);
+        }
+
+        auto obj = static_cast<Obj*>(std::malloc(size));
+        if (!obj)
+        {
+            throw std::bad_alloc{};
+        }
+        large_objects.push_back(obj);
+        obj->type = type;
+        obj->gc = Obj::gc_heap | Obj::gc_large | Obj::gc_old;
+        old_bytes += size;
+        stats.allocated_bytes += size;
+        Grow(size);
+        return obj;
+    }
+
+
+    auto Heap::NewBlock()
+        -> Block*
+    {
+        Block* block = nullptr;
+        if (!free_blocks.empty())
+        {
+            block = free_blocks.back();
+            free_blocks.pop_back();
+        }
+        else
+        {
+            // Aligned to its size, so the block of an object is found by masking its address.
+            block = static_cast<Block*>(std::aligned_alloc(block_size, block_size));
+            if (!block)
+            {
+                throw std::bad_alloc{};
+            }
+            Grow(block_size);
+        }
+        block->young = true;
+        blocks.push_back(block);
+        return block;
+    }
+
+
+    auto Heap::Collect(bool major)
+        -> void
+    {
+        auto begin = std::chrono::steady_clock::now();
+
+        MarkRoots(major);
+        if (!major)
+        {
+            // The young objects referenced by the old ones.
+            for (auto obj : remembered)
+            {
+                gray.push_back(obj);
+            }
+            Trace(major);
+        }
+
+        // Every young object that survives becomes old: no old object refers to a young one.
+        for (auto obj : remembered)
+        {
+            obj->gc &= static_cast<u8>(~Obj::gc_remembered);
+        }
+        remembered.clear();
+
+        // The current regions end: the blocks must be walkable.
+        MakeFree(cursor, limit);
+        MakeFree(overflow_cursor, overflow_limit);
+        cursor = limit = overflow_cursor = overflow_limit = nullptr;
+
+        // The holes of the blocks swept are found again.
+        if (major)
+        {
+            holes.clear();
+            old_bytes = 0;
+        }
+        else
+        {
+            std::erase_if(holes, [](const Hole& hole)
+            {
+                return hole.block->young;
+            });
+        }
+
+        std::erase_if(blocks, [this, major](Block* block)
+        {
+            if (!major && !block->young)
+            {
+                return false;
+            }
+            block->young = false;
+            if (Sweep(block, major))
+            {
+                return false;
+            }
+            // Its holes were not added: it is free as a whole.
+            free_blocks.push_back(block);
+            return true;
+        });
+
+        if (major)
+        {
+            std::erase_if(large_objects, [this](Obj* obj)
+            {
+                if (obj->gc & Obj::gc_marked)
+                {
+                    obj->gc &= static_cast<u8>(~Obj::gc_marked);
+                    old_bytes += ObjectSize(obj);
+                    return false;
+                }
+                stats.heap_bytes -= ObjectSize(obj);
+                std::free(obj);
+                return true;
+            });
+
+            // Keep only the free blocks needed by the nursery.
+            while (free_blocks.size() > nursery_blocks)
+            {
+                std::free(free_blocks.back());
+                free_blocks.pop_back();
+                stats.heap_bytes -= block_size;
+            }
+
+            next_major = std::max(next_major, 2 * old_bytes);
+            ++stats.major_collections;
+        }
+        else
+        {
+            ++stats.minor_collections;
+        }
+        young_bytes = 0;
+
+        auto pause = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        stats.total_pause_ms += pause;
+        stats.max_pause_ms = std::max(stats.max_pause_ms, pause);
+    }
+
+
+    auto Heap::Mark(LoxValue value, bool major)
+        -> void
+    {
+        Shade(value, major);
+        Trace(major);
+    }
+
+
+    auto Heap::Shade(LoxValue value, bool major)
+        -> void
+    {
+        if (!value.IsObject())
+        {
+            return;
+        }
+
+        auto obj = const_cast<Obj*>(value.AsObject());
+        if (!(obj->gc & Obj::gc_heap) || (obj->gc & Obj::gc_marked))
+        {
+            return;
+        }
+        // The old objects are live for a minor collection.
+        if (!major && (obj->gc & Obj::gc_old))
+        {
+            return;
+        }
+
+        obj->gc |= Obj::gc_marked;
+        gray.push_back(obj);
+    }
+
+
+    auto Heap::Trace(bool major)
+        -> void
+    {
+        while (!gray.empty())
+        {
+            auto obj = gray.back();
+            gray.pop_back();
+            switch (obj->type)
+            {
+            case ObjType::String:
+            case ObjType::Doubles:
+            case ObjType::Free:
+                // No references.
+                break;
+            case ObjType::Instance:
+            {
+                auto instance = reinterpret_cast<ObjInstance*>(obj);
+                if (instance->overflow)
+                {
+                    Shade(LoxValue::Object(&instance->overflow->obj), major);
+                }
+                // The fields not assigned yet are nil.
+                for (u32 i = 0; i < instance->capacity; ++i)
+                {
+                    Shade(LoxValue{instance->Fields()[i]}, major);
+                }
+                break;
+            }
+            case ObjType::Slots:
+            {
+                auto slots = reinterpret_cast<ObjSlots*>(obj);
+                for (u32 i = 0; i < slots->capacity; ++i)
+                {
+                    Shade(LoxValue{slots->Values()[i]}, major);
+                }
+                break;
+            }
+            case ObjType::Closure:
+            case ObjType::Class:
+            {
+                auto closure = reinterpret_cast<ObjClosure*>(obj);
+                for (u32 i = 0; i < closure->count; ++i)
+                {
+                    Shade(LoxValue{closure->Captured()[i]}, major);
+                }
+                break;
+            }
+            case ObjType::Rope:
+            {
+                auto rope = reinterpret_cast<ObjRope*>(obj);
+                Shade(LoxValue{rope->left}, major);
+                Shade(LoxValue{rope->right}, major);
+                break;
+            }
+            case ObjType::List:
+                Shade(LoxValue::Object(&reinterpret_cast<ObjList*>(obj)->elements->obj), major);
+                break;
+            case ObjType::Map:
+                Shade(LoxValue::Object(&reinterpret_cast<ObjMap*>(obj)->table->obj), major);
+                break;
+            case ObjType::Table:
+            {
+                // The entries not in use are nil.
+                auto table = reinterpret_cast<ObjTable*>(obj);
+                for (u32 i = 0; i < 2 * table->capacity; ++i)
+                {
+                    Shade(LoxValue{table->Entries()[i]}, major);
+                }
+                break;
+            }
+            }
+        }
+    }
+
+
+    auto Heap::MarkRoots(bool major)
+        -> void
+    {
+        for (auto slot : roots)
+        {
+            Mark(LoxValue{*slot}, major);
+        }
+        for (auto frame = lox_gc_top; frame; frame = frame->prev)
+        {
+            auto slots = reinterpret_cast<const u64*>(frame + 1);
+            for (u64 i = 0; i < frame->count; ++i)
+            {
+                Mark(LoxValue{slots[i]}, major);
+            }
+        }
+    }
+
+
+    auto Heap::Sweep(Block* block, bool major)
+        -> bool
+    {
+        bool live = false;
+        auto begin = reinterpret_cast<char*>(block);
+        auto end = begin + block_size;
+        // The run of dead objects before the current one.
+        char* run = begin + block_header;
+        auto close_run = [this, block, &run](char* at)
+        {
+            MakeFree(run, at);
+            if (static_cast<std::size_t>(at - run) >= hole_min)
+            {
+                holes.push_back(Hole{block, run, at});
+            }
+        };
+
+        for (auto at = begin + block_header; at < end; )
+        {
+            auto obj = reinterpret_cast<Obj*>(at);
+            auto size = ObjectSize(obj);
+            bool alive = false;
+            if (obj->gc & Obj::gc_marked)
+            {
+                // The old objects are marked only by a major collection.
+                if (major || !(obj->gc & Obj::gc_old))
+                {
+                    old_bytes += size;
+                }
+                obj->gc = static_cast<u8>((obj->gc & ~Obj::gc_marked) | Obj::gc_old);
+                alive = true;
+            }
+            else
+            {
+                // A minor collection doesn't know which old objects are dead.
+                alive = !major && (obj->gc & Obj::gc_old);
+            }
+
+            at += size;
+            if (alive)
+            {
+                close_run(at - size);
+                run = at;
+                live = true;
+            }
+        }
+        if (live)
+        {
+            close_run(end);
+        }
+        return live;
+    }
+
+
+    auto Heap::Grow(std::size_t bytes) noexcept
+        -> void
+    {
+        stats.heap_bytes += bytes;
+        stats.peak_heap_bytes = std::max(stats.peak_heap_bytes, stats.heap_bytes);
+    }
+
+
+    auto Heap::Report(std::FILE* file) const
+        -> void
+    {
+        std::fprintf(file, "gc:           %llu minor, %llu major collections\n",
+            static_cast<unsigned long long>(stats.minor_collections),
+            static_cast<unsigned long long>(stats.major_collections));
+        std::fprintf(file, "gc pause:     %10.3f ms total, %.3f ms max\n",
+            stats.total_pause_ms, stats.max_pause_ms);
+        std::fprintf(file, "heap:         %llu KiB, peak %llu KiB, %llu KiB allocated\n",
+            static_cast<unsigned long long>(stats.heap_bytes / 1024),
+            static_cast<unsigned long long>(stats.peak_heap_bytes / 1024),
+            static_cast<unsigned long long>(stats.allocated_bytes / 1024));
+    }
+} // namespace lox
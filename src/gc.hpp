@@ -0,0 +1,290 @@
+#ifndef LOX_GC_HPP
+#define LOX_GC_HPP
+
+/*
+gc.hpp
+
+PURPOSE: Garbage collected heap of the objects allocated by the compiled code.
+
+CLASSES:
+    GCFrame: Frame of the shadow stack (the roots of a function of the generated code).
+    LocalRoots: Frame of the shadow stack of a runtime function.
+    GCStats: Statistics of the heap and of the collections.
+    Heap: Generational mark-sweep heap, bump allocated in the holes of its blocks.
+
+DESCRIPTION:
+    The collector is precise and never moves the objects, so the generated code can keep the
+    values in registers across the calls that allocate.
+
+    Roots: each function of the generated code has a frame on a shadow stack (a linked list of
+    frames in its stack, the top is lox_gc_top). The frame holds one slot for each variable and
+    for each temporary that can be an allocated object (the results of the calls and of lox_add):
+    LLVMVisitor stores the value in the slot when it is produced, so every object the function
+    can still use is in a slot. The slots are cleared when the function is entered. A runtime
+    function that allocates an object while it holds another one not reachable yet pushes its
+    own frame (LocalRoots). The global variables of the generated code are slots of their own,
+    added once by lox_main (lox_gc_add_root()).
+
+    Allocation: the objects are bump allocated in the holes of the blocks (block_size bytes):
+    the runs of free bytes found by the last sweep of a block, then new blocks. An object bigger
+    than hole_min that doesn't fit the current hole goes to an overflow block instead, so the
+    holes are never skipped. A block is walked object by object: its free runs are ObjFree
+    chunks.
+
+    Young objects: the objects allocated since the last collection (without gc_old), wherever
+    they are. When nursery_blocks blocks of bytes were allocated, a minor collection marks the
+    young objects reachable from the roots and sweeps the young blocks (the ones allocated in
+    since the last collection): the survivors become old in place, the dead young objects and
+    the free chunks next to them merge, and the runs of at least hole_min bytes are the next
+    holes. The blocks without live objects are free again.
+    The strings and the closures are immutable, but the fields of an old instance (or an old
+    box of a shared variable, or an old list and its elements) can be set to a young object:
+    every store of an object into an instance, its slots, a box, a list or its elements goes
+    through a write barrier that adds the old ones to the remembered set (the inline check of
+    LLVMVisitor, then lox_gc_remember()). The maps and their tables are only changed by the
+    runtime, which remembers them the same way. A rope gets a young flat string when it is
+    flattened, with the same barrier. A minor collection marks the children of the remembered
+    objects too. After a collection every young survivor is old, so the remembered set is
+    emptied.
+
+    Old generation: the old objects, in the blocks, and the large objects (allocated
+    individually, always old). When their bytes grow over a threshold, a major collection marks
+    all the reachable objects and sweeps every block, so the holes left by the dead old objects
+    are reused too, and frees the dead large objects. The threshold is then set to twice the
+    bytes that survived.
+
+    Objects not allocated by the heap (the constant strings of the generated code) are ignored.
+*/
+
+#include "common.hpp"
+#include "value.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+namespace lox
+{
+    struct GCFrame
+    {
+        GCFrame* prev;
+
+        // Number of the slots (boxed values) that follow the frame.
+        u64 count;
+    };
+
+
+    struct GCStats
+    {
+        u64 minor_collections{0};
+        u64 major_collections{0};
+
+        // Bytes of all the objects allocated.
+        u64 allocated_bytes{0};
+
+        // Memory owned by the heap (blocks, free or not, and large objects).
+        u64 heap_bytes{0};
+        u64 peak_heap_bytes{0};
+
+        f64 total_pause_ms{0.0};
+        f64 max_pause_ms{0.0};
+    };
+
+
+    class Heap : private NonCopyable
+    {
+    public:
+        static constexpr std::size_t block_size = 64 * 1024;
+
+        // The objects bigger than this are allocated individually in the old generation.
+        static constexpr std::size_t large_object_size = 8 * 1024;
+
+        explicit Heap(std::size_t nursery_blocks_ = 16);
+        ~Heap();
+
+        // Allocate an object of the type, of size bytes (header included). The header is
+        // initialized, the rest is not. Can run a collection: the objects used by the caller
+        // must be reachable from the roots.
+        auto Allocate(ObjType type, std::size_t size)
+            -> Obj*;
+
+        // Write barrier: the old object may now refer to a young one.
+        auto Remember(Obj* obj)
+            -> void
+        {
+            if ((obj->gc & (Obj::gc_old | Obj::gc_remembered)) == Obj::gc_old)
+            {
+                obj->gc |= Obj::gc_remembered;
+                remembered.push_back(obj);
+            }
+        }
+
+        // The slot is a root until the end of the program.
+        auto AddRoot(u64* slot)
+            -> void
+        {
+            roots.push_back(slot);
+        }
+
+        // Run a minor or a major collection.
+        auto Collect(bool major)
+            -> void;
+
+        auto Stats() const noexcept
+            -> const GCStats&
+        {
+            return stats;
+        }
+
+        // Write a report of the statistics.
+        auto Report(std::FILE* file) const
+            -> void;
+
+    private:
+        struct Block
+        {
+            // Allocated in since the last collection: swept by the next minor collection.
+            bool young;
+        };
+
+        // Free bytes of a block to allocate in.
+        struct Hole
+        {
+            Block* block;
+            char* begin;
+            char* end;
+        };
+
+        static constexpr std::size_t block_header = 16;
+        static_assert(sizeof(Block) <= block_header);
+
+        // The smaller runs of free bytes are not holes (they are reused once their block is
+        // empty). The objects up to this size fit in any hole.
+        static constexpr std::size_t hole_min = 128;
+
+        // A new young block, with no objects.
+        auto NewBlock()
+            -> Block*;
+
+        // Continue the allocation in the next hole, or in a new block.
+        auto NextHole()
+            -> void;
+
+        // Allocate the object in the overflow block, a new one if it doesn't fit.
+        auto AllocateOverflow(std::size_t size)
+            -> char*;
+
+        auto AllocateLarge(ObjType type, std::size_t size)
+            -> Obj*;
+
+        // Mark the object of the value and the objects reachable from it.
+        auto Mark(LoxValue value, bool major)
+            -> void;
+
+        // Mark the object of the value and add it to the gray objects.
+        auto Shade(LoxValue value, bool major)
+            -> void;
+
+        // Mark the children of the gray objects until there are none.
+        auto Trace(bool major)
+            -> void;
+
+        auto MarkRoots(bool major)
+            -> void;
+
+        // Clear the marks of the objects of the block, make the live young objects old and
+        // merge the dead ones (the old ones too if major) into free chunks. The holes are
+        // added and old_bytes counts the objects that became old (every live object if
+        // major). Return false if no object is live.
+        auto Sweep(Block* block, bool major)
+            -> bool;
+
+        auto Grow(std::size_t bytes) noexcept
+            -> void;
+
+    private:
+        std::size_t nursery_blocks;
+
+        // Bytes allocated since the last collection.
+        std::size_t young_bytes{0};
+
+        // The free bytes of the current hole and of the overflow block.
+        char* cursor{nullptr};
+        char* limit{nullptr};
+        char* overflow_cursor{nullptr};
+        char* overflow_limit{nullptr};
+
+        // The blocks with objects, the next holes (the last one first) and the empty blocks.
+        std::vector<Block*> blocks;
+        std::vector<Hole> holes;
+        std::vector<Block*> free_blocks;
+        std::vector<Obj*> large_objects;
+
+        // Bytes of the old objects and threshold of the next major collection.
+        std::size_t old_bytes{0};
+        std::size_t next_major;
+
+        // Slots outside the shadow stack (see AddRoot()).
+        std::vector<u64*> roots;
+
+        // Marked objects whose children are not marked yet.
+        std::vector<Obj*> gray;
+
+        // Old objects that may refer to young ones.
+        std::vector<Obj*> remembered;
+
+        GCStats stats;
+    };
+
+
+    // Heap used by the runtime.
+    auto GlobalHeap()
+        -> Heap&;
+} // namespace lox
+
+
+extern "C"
+{
+    // Top of the shadow stack, updated by the generated code.
+    extern lox::GCFrame* lox_gc_top;
+
+    // Slow path of the write barrier of the generated code (Heap::Remember).
+    auto lox_gc_remember(lox::Obj* obj)
+        -> void;
+
+    // Add a global variable of the generated code to the roots (Heap::AddRoot()).
+    auto lox_gc_add_root(lox::u64* slot)
+        -> void;
+
+    // Write the statistics of the heap to stderr.
+    auto lox_gc_report()
+        -> void;
+}
+
+
+namespace lox
+{
+    template <std::size_t count>
+    class LocalRoots : private NonCopyable
+    {
+    public:
+        LocalRoots() noexcept :
+            frame{lox_gc_top, count}
+        {
+            slots.fill(LoxValue::nil_bits);
+            lox_gc_top = &frame;
+        }
+
+        ~LocalRoots()
+        {
+            lox_gc_top = frame.prev;
+        }
+
+        // The slots follow the frame, like the ones of the generated code.
+        GCFrame frame;
+        std::array<u64, count> slots;
+    };
+} // namespace lox
+
+#endif
@@ -0,0 +1,633 @@
+#include "interpreter.hpp"
+#include "runtime.hpp"
+#include "value.hpp"
+#include "string_object.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#if __has_include(<sys/resource.h>)
+#include <sys/resource.h>
+#endif
+
+namespace lox
+{
+    // Size of the native stack the interpreted calls can use: the limit of the stack of the
+    // thread (the main one), minus a margin for the runtime and the native code they call.
+    static auto StackBudget() noexcept
+        -> std::size_t
+    {
+        constexpr std::size_t margin = 512 * 1024;
+        std::size_t limit = 8 * 1024 * 1024;
+#if __has_include(<sys/resource.h>)
+        rlimit rl{};
+        if (getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        {
+            limit = static_cast<std::size_t>(rl.rlim_cur);
+        }
+#endif
+        return limit > 2 * margin ? limit - margin : limit / 2;
+    }
+
+
+    auto Interpreter::Run(const std::vector<StmtNode>& nodes)
+        -> bool
+    {
+        char base;
+        stack_base = reinterpret_cast<std::uintptr_t>(&base);
+        stack_budget = StackBudget();
+        try
+        {
+            for (const auto& node : nodes)
+            {
+                Execute(node);
+            }
+        }
+        catch (const RuntimeError& e)
+        {
+            return false;
+        }
+        return true;
+    }
+
+
+    // ********************************* UTILITY *********************************
+
+    auto Interpreter::ExecuteBlock(const std::vector<StmtNode>& statements)
+        -> void
+    {
+        auto base = stack.size();
+        ++depth;
+        for (const auto& s : statements)
+        {
+            Execute(s);
+            if (returning)
+            {
+                break;
+            }
+        }
+        --depth;
+        stack.resize(base);
+    }
+
+
+    auto Interpreter::Resolve(const Token& name)
+        -> Value&
+    {
+        auto lexeme = name.Lexeme();
+        for (auto i = stack.size(); i > frame; --i)
+        {
+            if (stack[i - 1].first == lexeme)
+            {
+                return stack[i - 1].second;
+            }
+        }
+
+        // Inside a function, the globals.
+        if (frame > 0)
+        {
+            for (auto i = globals; i > 0; --i)
+            {
+                if (stack[i - 1].first == lexeme)
+                {
+                    return stack[i - 1].second;
+                }
+            }
+        }
+        RuntimeErrorAt(name, "Undefined variable.");
+    }
+
+
+    auto Interpreter::Number(const Token& op, const Value& value)
+        -> f64
+    {
+        if (auto number = std::get_if<f64>(&value))
+        {
+            return *number;
+        }
+        RuntimeErrorAt(op, "Operands must be numbers.");
+    }
+
+
+    auto Interpreter::Equal(const Value& left, const Value& right)
+        -> bool
+    {
+        auto left_id = std::get_if<StringId>(&left);
+        auto right_id = std::get_if<StringId>(&right);
+        return left_id && right_id ? strings.Equal(*left_id, *right_id) : lox::Equal(left, right);
+    }
+
+
+    auto Interpreter::CallNative(FunctionProfile& profile, std::size_t base, Value& result)
+        -> bool
+    {
+        auto native = profile.native.load(std::memory_order_acquire);
+        if (!native)
+        {
+            return false;
+        }
+
+        // Only the values without objects are passed to the native code: the strings of the
+        // interpreter are ids of the pool, not ObjString.
+        native_args.clear();
+        for (auto i = base; i < stack.size(); ++i)
+        {
+            const auto& value = stack[i].second;
+            if (auto number = std::get_if<f64>(&value))
+            {
+                native_args.push_back(LoxValue::Number(*number).Bits());
+            }
+            else if (auto b = std::get_if<bool>(&value))
+            {
+                native_args.push_back(LoxValue::Bool(*b).Bits());
+            }
+            else if (std::holds_alternative<LoxNil>(value))
+            {
+                native_args.push_back(LoxValue::Nil().Bits());
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        LoxValue native_result{native(native_args.data())};
+        if (native_result.IsNumber())
+        {
+            result = native_result.AsNumber();
+        }
+        else if (native_result.IsBool())
+        {
+            result = native_result.AsBool();
+        }
+        else if (native_result.IsNil())
+        {
+            result = LoxNil{};
+        }
+        else if (native_result.IsString())
+        {
+            // Copied: it can be a small string or a rope.
+            result = strings.Intern(CopyString(native_result));
+        }
+        else
+        {
+            RuntimeErrorAt(profile.node->name, "Unsupported value returned by compiled code.");
+        }
+        ++native_calls;
+        return true;
+    }
+
+
+    auto Interpreter::EnterLoop(const WhileStmtNode& loop)
+        -> bool
+    {
+        if (!compiler || current->calls + current->back_edges < threshold ||
+            current->tier.load(std::memory_order_relaxed) == Tier::Failed)
+        {
+            return false;
+        }
+
+        auto& profile = loops[&loop];
+        if (!profile)
+        {
+            profile = &profiles.emplace_back(current->node, &loop);
+        }
+        switch (profile->tier.load(std::memory_order_relaxed))
+        {
+        case Tier::Interpreted:
+            compiler->Enqueue(*profile);
+            return false;
+        case Tier::Failed:
+            return false;
+        default:
+            break;
+        }
+
+        // The variables are published with the entry point.
+        if (!profile->native.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        const auto& variables = profile->variables;
+        if (stack.size() - frame != variables.size() || !std::equal(variables.begin(), variables.end(),
+            stack.begin() + static_cast<std::ptrdiff_t>(frame), [](std::string_view name, const auto& slot)
+            {
+                return name == slot.first;
+            }))
+        {
+            profile->tier.store(Tier::Failed, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (!CallNative(*profile, frame, return_value))
+        {
+            return false;
+        }
+        returning = true;
+        return true;
+    }
+
+
+    auto Interpreter::StackExhausted() const noexcept
+        -> bool
+    {
+        char top;
+        return stack_base - reinterpret_cast<std::uintptr_t>(&top) > stack_budget;
+    }
+
+
+    auto Interpreter::RuntimeErrorAt(const Token& t, std::string_view msg)
+        -> void
+    {
+        lox_flush();
+        std::fflush(stdout);
+        std::cout << "[line " << t.Line() << "] Error at " << t.Lexeme() << ": " << msg << std::endl;
+        throw RuntimeError{};
+    }
+
+    // ********************************* UTILITY *********************************
+
+
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+    auto Interpreter::operator()(const ExprStmtNodePtr& n)
+        -> void
+    {
+        Evaluate(n->expr);
+    }
+
+
+    auto Interpreter::operator()(const PrintStmtNodePtr& n)
+        -> void
+    {
+        auto value = Evaluate(n->expr);
+        if (auto number = std::get_if<f64>(&value))
+        {
+            lox_print_number(*number);
+        }
+        else if (auto b = std::get_if<bool>(&value))
+        {
+            lox_print_bool(*b);
+        }
+        else if (auto id = std::get_if<StringId>(&value))
+        {
+            // The chars are not null terminated.
+            auto s = strings.Chars(*id);
+            lox_print_chars(s.data(), s.size());
+        }
+        else
+        {
+            lox_print_string(nullptr);
+        }
+    }
+
+
+    auto Interpreter::operator()(const VarStmtNodePtr& n)
+        -> void
+    {
+        auto value = Evaluate(n->initializer);
+        stack.emplace_back(n->name.Lexeme(), value);
+        if (depth == 0 && frame == 0)
+        {
+            globals = stack.size();
+        }
+    }
+
+
+    auto Interpreter::operator()(const BlockStmtNodePtr& n)
+        -> void
+    {
+        ExecuteBlock(n->statements);
+    }
+
+
+    auto Interpreter::operator()(const FunStmtNodePtr& n)
+        -> void
+    {
+        // The functions are global (the backend doesn't support closures).
+        auto& function = functions[n->name.Lexeme()];
+        if (!function || function->node != n.get())
+        {
+            function = &profiles.emplace_back(n.get());
+        }
+    }
+
+
+    auto Interpreter::operator()(const ReturnStmtNodePtr& n)
+        -> void
+    {
+        if (!current)
+        {
+            RuntimeErrorAt(n->keyword, "Can't return from top-level code.");
+        }
+        return_value = Evaluate(n->value);
+        returning = true;
+    }
+
+
+    auto Interpreter::operator()(const IfStmtNodePtr& n)
+        -> void
+    {
+        if (IsTruthy(Evaluate(n->condition)))
+        {
+            Execute(n->then_branch);
+        }
+        else if (n->else_branch)
+        {
+            Execute(*n->else_branch);
+        }
+    }
+
+
+    auto Interpreter::operator()(const WhileStmtNodePtr& n)
+        -> void
+    {
+        while (IsTruthy(Evaluate(n->condition)))
+        {
+            Execute(n->body);
+            if (returning)
+            {
+                break;
+            }
+
+            if (current)
+            {
+                ++current->back_edges;
+                Profile(*current);
+                if (EnterLoop(*n))
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+
+
+    auto Interpreter::operator()(const ClassStmtNodePtr& n)
+        -> void
+    {
+        RuntimeErrorAt(n->name, "Classes are not supported by the interpreter.");
+    }
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+
+    auto Interpreter::operator()(const BinaryExprNodePtr& n)
+        -> Value
+    {
+        auto left_value = Evaluate(n->left);
+        auto right_value = Evaluate(n->right);
+        if (n->op.Type() == TokenType::Plus)
+        {
+            auto left_id = std::get_if<StringId>(&left_value);
+            auto right_id = std::get_if<StringId>(&right_value);
+            if (left_id && right_id)
+            {
+                return strings.Concatenate(*left_id, *right_id);
+            }
+            if (!std::holds_alternative<f64>(left_value) || !std::holds_alternative<f64>(right_value))
+            {
+                RuntimeErrorAt(n->op, "Operands must be two numbers or two strings.");
+            }
+        }
+        auto left = Number(n->op, left_value);
+        auto right = Number(n->op, right_value);
+
+        switch (n->op.Type())
+        {
+        case TokenType::Plus:
+            return left + right;
+        case TokenType::Minus:
+            return left - right;
+        case TokenType::Star:
+            return left * right;
+        case TokenType::Slash:
+            return left / right;
+        default:
+            RuntimeErrorAt(n->op, "Unsupported binary operation.");
+        }
+    }
+
+
+    auto Interpreter::operator()(const UnaryExprNodePtr& n)
+        -> Value
+    {
+        auto right = Evaluate(n->right);
+        switch (n->op.Type())
+        {
+        case TokenType::Bang:
+            return !IsTruthy(right);
+        case TokenType::Minus:
+            return -Number(n->op, right);
+        default:
+            RuntimeErrorAt(n->op, "Unsupported unary operation.");
+        }
+    }
+
+
+    auto Interpreter::operator()(const LiteralNodePtr& n)
+        -> Value
+    {
+        return std::visit([](const auto& literal) -> Value { return literal; }, n->literal);
+    }
+
+
+    auto Interpreter::operator()(const GroupingNodePtr& n)
+        -> Value
+    {
+        return Evaluate(n->expr);
+    }
+
+
+    auto Interpreter::operator()(const AssignExprNodePtr& n)
+        -> Value
+    {
+        auto value = Evaluate(n->expr);
+        Resolve(n->name) = value;
+        return value;
+    }
+
+
+    auto Interpreter::operator()(const VarExprNodePtr& n)
+        -> Value
+    {
+        return Resolve(n->name);
+    }
+
+
+    auto Interpreter::operator()(const LogicalExprNodePtr& n)
+        -> Value
+    {
+        auto left = Evaluate(n->left);
+        if (n->op.Type() == TokenType::Or)
+        {
+            return IsTruthy(left) ? left : Evaluate(n->right);
+        }
+        return IsTruthy(left) ? Evaluate(n->right) : left;
+    }
+
+
+    auto Interpreter::operator()(const CallExprNodePtr& n)
+        -> Value
+    {
+        auto it = functions.find(n->callee.Lexeme());
+        if (it == functions.end())
+        {
+            RuntimeErrorAt(n->callee, "Undefined function.");
+        }
+        auto& profile = *it->second;
+        const auto& params = profile.node->parameters;
+        if (params.size() != n->arguments.size())
+        {
+            RuntimeErrorAt(n->paren, "Wrong number of arguments.");
+        }
+
+        // The arguments are pushed without name until they are all evaluated, so the
+        // expressions of the arguments can't see the parameters.
+        auto base = stack.size();
+        for (const auto& arg : n->arguments)
+        {
+            auto value = Evaluate(arg);
+            stack.emplace_back(std::string_view{}, value);
+        }
+
+        ++profile.calls;
+        Profile(profile);
+
+        Value result;
+        if (CallNative(profile, base, result))
+        {
+            stack.resize(base);
+            return result;
+        }
+
+        if (StackExhausted())
+        {
+            // The native code uses much less stack: wait for it if the function is queued.
+            if (profile.tier.load(std::memory_order_relaxed) == Tier::Queued)
+            {
+                compiler->Drain();
+                if (CallNative(profile, base, result))
+                {
+                    stack.resize(base);
+                    return result;
+                }
+            }
+            RuntimeErrorAt(n->paren, "Stack overflow.");
+        }
+        ++interpreted_calls;
+        for (std::size_t i = 0; i < params.size(); ++i)
+        {
+            stack[base + i].first = params[i].Lexeme();
+        }
+
+        auto enclosing_frame = std::exchange(frame, base);
+        auto enclosing_depth = std::exchange(depth, 1);
+        auto enclosing = std::exchange(current, &profile);
+
+        for (const auto& s : profile.node->body->statements)
+        {
+            Execute(s);
+            if (returning)
+            {
+                result = return_value;
+                returning = false;
+                break;
+            }
+        }
+
+        stack.resize(base);
+        frame = enclosing_frame;
+        depth = enclosing_depth;
+        current = enclosing;
+        return result;
+    }
+
+
+    auto Interpreter::operator()(const CmpExprNodePtr& n)
+        -> Value
+    {
+        auto left = Evaluate(n->left);
+        auto right = Evaluate(n->right);
+
+        switch (n->op.Type())
+        {
+        case TokenType::EqualEqual:
+            return Equal(left, right);
+        case TokenType::BangEqual:
+            return !Equal(left, right);
+        case TokenType::LessEqual:
+            return Number(n->op, left) <= Number(n->op, right);
+        case TokenType::Less:
+            return Number(n->op, left) < Number(n->op, right);
+        case TokenType::GreaterEqual:
+            return Number(n->op, left) >= Number(n->op, right);
+        case TokenType::Greater:
+            return Number(n->op, left) > Number(n->op, right);
+        default:
+            RuntimeErrorAt(n->op, "Unsupported comparison.");
+        }
+    }
+
+
+    // Without classes no value is an instance.
+
+    auto Interpreter::operator()(const GetExprNodePtr& n)
+        -> Value
+    {
+        Evaluate(n->object);
+        RuntimeErrorAt(n->name, "Only instances have properties.");
+    }
+
+
+    auto Interpreter::operator()(const SetExprNodePtr& n)
+        -> Value
+    {
+        Evaluate(n->object);
+        RuntimeErrorAt(n->name, "Only instances have fields.");
+    }
+
+
+    auto Interpreter::operator()(const InvokeExprNodePtr& n)
+        -> Value
+    {
+        Evaluate(n->object);
+        RuntimeErrorAt(n->name, "Only instances have methods.");
+    }
+
+
+    auto Interpreter::operator()(const SuperInvokeExprNodePtr& n)
+        -> Value
+    {
+        RuntimeErrorAt(n->keyword, "Classes are not supported by the interpreter.");
+    }
+
+
+    auto Interpreter::operator()(const ListExprNodePtr& n)
+        -> Value
+    {
+        RuntimeErrorAt(n->bracket, "Lists are not supported by the interpreter.");
+    }
+
+
+    auto Interpreter::operator()(const IndexExprNodePtr& n)
+        -> Value
+    {
+        RuntimeErrorAt(n->bracket, "Lists and maps are not supported by the interpreter.");
+    }
+
+
+    auto Interpreter::operator()(const IndexSetExprNodePtr& n)
+        -> Value
+    {
+        RuntimeErrorAt(n->bracket, "Lists and maps are not supported by the interpreter.");
+    }
+
+    // ******************************** VISIT EXPRESSIONS *************************************
+} // namespace lox
@@ -0,0 +1,271 @@
+#ifndef LOX_INTERPRETER_HPP
+#define LOX_INTERPRETER_HPP
+
+/*
+interpreter.hpp
+
+PURPOSE: Baseline tier: execute the AST directly.
+
+CLASSES:
+    Interpreter: tree-walking interpreter that promotes the hot functions to the JIT.
+
+DESCRIPTION:
+    The interpreter starts executing immediately, so short scripts don't pay the startup of the
+    JIT. Each function has a profile (see background_compiler.hpp) with the number of calls and
+    of loop back edges executed inside it; when their sum crosses the threshold the function is
+    queued for the background compiler. Once its native code is published, the calls with
+    only number arguments (the compiled functions take numbers) jump to it. A hot function that
+    is still running enters the native code of its loop at a back edge (see EnterLoop()).
+    The interpreted calls recurse on the native stack: their depth is bounded by the limit of
+    the stack (a deeper call is a stack overflow, unless the native code of the function is
+    ready, which uses much less of it).
+
+    The variables live in a single stack of (name, value) pairs: a scope is a range of the stack
+    and a lookup scans it from the top. A function sees its own frame and the globals (the
+    variables declared at the top level, always at the bottom of the stack).
+    The values are the literals (see types.hpp): strings are ids of the StringPool, extended by
+    the strings built by + (see RuntimeStrings).
+    There are no instances: a class declaration is a runtime error (the classes need the JIT).
+    The print statement uses the functions of the runtime, so the output of the interpreter and
+    of the compiled code is the same.
+*/
+
+#include "common.hpp"
+#include "node.hpp"
+#include "types.hpp"
+#include "string_pool.hpp"
+#include "background_compiler.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace lox
+{
+    class Interpreter : private NonCopyable
+    {
+    public:
+        // The values of the interpreter are the same of the literals.
+        using Value = Literal;
+
+        // Without a compiler every function stays in the interpreter.
+        Interpreter(non_owned_ptr<const StringPool> strings_,
+            non_owned_ptr<BackgroundCompiler> compiler_ = nullptr, u64 threshold_ = 1000) :
+            strings(strings_), compiler(compiler_), threshold(threshold_) { }
+
+        // Execute the program. Return false if there was a runtime error.
+        auto Run(const std::vector<StmtNode>& nodes)
+            -> bool;
+
+        // Number of calls executed by the interpreter and by the native code.
+        auto InterpretedCalls() const noexcept
+            -> u64
+        {
+            return interpreted_calls;
+        }
+
+        auto NativeCalls() const noexcept
+            -> u64
+        {
+            return native_calls;
+        }
+
+
+    public:
+        // Visitor for expressions.
+
+        auto operator()(const BinaryExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const UnaryExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const LiteralNodePtr& n)
+            -> Value;
+
+        auto operator()(const GroupingNodePtr& n)
+            -> Value;
+
+        auto operator()(const AssignExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const VarExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const LogicalExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const CallExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const CmpExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const GetExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const SetExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const InvokeExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const SuperInvokeExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const ListExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const IndexExprNodePtr& n)
+            -> Value;
+
+        auto operator()(const IndexSetExprNodePtr& n)
+            -> Value;
+
+
+        // Visitor for statements.
+
+        auto operator()(const ExprStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const PrintStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const VarStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const BlockStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const FunStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ReturnStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const IfStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const WhileStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ClassStmtNodePtr& n)
+            -> void;
+
+
+    private:
+        auto Evaluate(const ExprNode& n)
+            -> Value
+        {
+            return std::visit(*this, n);
+        }
+
+        auto Execute(const StmtNode& n)
+            -> void
+        {
+            std::visit(*this, n);
+        }
+
+        // Execute the statements in a new scope.
+        auto ExecuteBlock(const std::vector<StmtNode>& statements)
+            -> void;
+
+        // Return the slot of the variable visible with this name.
+        auto Resolve(const Token& name)
+            -> Value&;
+
+        // Return the number or raise an error.
+        auto Number(const Token& op, const Value& value)
+            -> f64;
+
+        // ==, comparing the chars of the strings built by the program.
+        auto Equal(const Value& left, const Value& right)
+            -> bool;
+
+        // Count the work done by the current function and queue it when it gets hot.
+        auto Profile(FunctionProfile& profile)
+            -> void
+        {
+            if (compiler && profile.calls + profile.back_edges >= threshold &&
+                profile.tier.load(std::memory_order_relaxed) == Tier::Interpreted)
+            {
+                compiler->Enqueue(profile);
+            }
+        }
+
+        // Call the native code of the function if it is available and the arguments (the
+        // slots of the stack from base) are numbers, booleans or nil.
+        auto CallNative(FunctionProfile& profile, std::size_t base, Value& result)
+            -> bool;
+
+        // On-stack replacement: when the current function is hot, compile the loop and, once
+        // it is compiled, call it with the variables of the frame. The native code runs the
+        // rest of the function: return true with its result in return_value.
+        auto EnterLoop(const WhileStmtNode& loop)
+            -> bool;
+
+        // True if an interpreted call would use more native stack than the budget.
+        auto StackExhausted() const noexcept
+            -> bool;
+
+        // Report the error and abort the execution.
+        [[noreturn]] auto RuntimeErrorAt(const Token& t, std::string_view msg)
+            -> void;
+
+    private:
+        class RuntimeError : public std::exception
+        {
+        public:
+            const char* what() const noexcept override
+            {
+                return "Runtime error.";
+            }
+        };
+
+    private:
+        RuntimeStrings strings;
+        non_owned_ptr<BackgroundCompiler> compiler;
+        u64 threshold;
+
+        // Variables of all the active scopes.
+        std::vector<std::pair<std::string_view, Value>> stack;
+
+        // Number of variables declared at the top level (they are at the bottom of the stack).
+        std::size_t globals{0};
+
+        // Depth of the nested blocks, 0 at the top level.
+        std::size_t depth{0};
+
+        // First slot of the frame of the current function (0 at the top level).
+        std::size_t frame{0};
+
+        // Address of the native stack at the start of Run() and size the interpreted calls
+        // can use from there (the limit of the stack, minus a margin for the native code).
+        std::uintptr_t stack_base{0};
+        std::size_t stack_budget{0};
+
+        // Profile of the current function (nullptr at the top level).
+        non_owned_ptr<FunctionProfile> current{nullptr};
+
+        // Set by return, the statements are skipped until the function returns.
+        bool returning{false};
+        Value return_value;
+
+        // Profiles have a stable address (they are shared with the compiler thread).
+        std::deque<FunctionProfile> profiles;
+        std::unordered_map<std::string_view, non_owned_ptr<FunctionProfile>> functions;
+        std::unordered_map<const WhileStmtNode*, non_owned_ptr<FunctionProfile>> loops;
+
+        // Arguments of the native calls (reused).
+        std::vector<u64> native_args;
+
+        u64 interpreted_calls{0};
+        u64 native_calls{0};
+    };
+} // namespace lox
+
+#endif
@@ -0,0 +1,243 @@
+#include "jit.hpp"
+
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/Error.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <type_traits>
+#include <utility>
+
+namespace lox
+{
+    // Convert the LLVM error in a JITError.
+    static auto Check(llvm::Error err)
+        -> void
+    {
+        if (err)
+        {
+            throw JITError{llvm::toString(std::move(err))};
+        }
+    }
+
+    template <typename T>
+    static auto Check(llvm::Expected<T> value)
+        -> T
+    {
+        if (!value)
+        {
+            throw JITError{llvm::toString(value.takeError())};
+        }
+        if constexpr (std::is_reference_v<T>)
+        {
+            return *value;
+        }
+        else
+        {
+            return std::move(*value);
+        }
+    }
+
+
+    // Called by the trampoline when a lazy function can't be compiled: its errors are reported,
+    // the exit status is the one of a compile error.
+    static auto LazyCompileFailed()
+        -> void
+    {
+        std::fputs("Could not compile a function, exiting.\n", stderr);
+        std::exit(65);
+    }
+
+
+    // Materialize the symbol of a lazy function generating and compiling its module.
+    class JIT::LazyFunctionUnit : public llvm::orc::MaterializationUnit
+    {
+    public:
+        LazyFunctionUnit(JIT& jit_, llvm::orc::SymbolFlagsMap symbols, ModuleGenerator generate_,
+            std::string cache_key_) :
+            MaterializationUnit(Interface{std::move(symbols), nullptr}),
+            jit(jit_), generate(std::move(generate_)), cache_key(std::move(cache_key_)) { }
+
+        auto getName() const
+            -> llvm::StringRef override
+        {
+            return "LazyFunctionUnit";
+        }
+
+        auto materialize(std::unique_ptr<llvm::orc::MaterializationResponsibility> r)
+            -> void override
+        {
+            auto begin = std::chrono::steady_clock::now();
+            std::unique_ptr<llvm::MemoryBuffer> object;
+            if (jit.cache && !cache_key.empty())
+            {
+                object = jit.cache->Load(cache_key);
+            }
+
+            if (object)
+            {
+                jit.jit->getObjLinkingLayer().emit(std::move(r), std::move(object));
+            }
+            else
+            {
+                auto tsm = generate();
+                if (!tsm)
+                {
+                    r->failMaterialization();
+                    return;
+                }
+                if (jit.cache && !cache_key.empty())
+                {
+                    // The compiler stores the object of the module named by the key.
+                    tsm.withModuleDo([this](llvm::Module& mod)
+                    {
+                        mod.setModuleIdentifier(ObjectCache::ModuleName(cache_key));
+                    });
+                }
+                jit.jit->getIRCompileLayer().emit(std::move(r), std::move(tsm));
+            }
+            auto elapsed = std::chrono::steady_clock::now() - begin;
+            jit.lazy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                std::memory_order_relaxed);
+            jit.lazy_compiled.fetch_add(1, std::memory_order_relaxed);
+        }
+
+    private:
+        auto discard(const llvm::orc::JITDylib&, const llvm::orc::SymbolStringPtr&)
+            -> void override
+        {
+        }
+
+    private:
+        JIT& jit;
+        ModuleGenerator generate;
+        std::string cache_key;
+    };
+
+
+    JIT::JIT(OptLevel level, const std::string& cache_directory) :
+        target_builder{llvm::Triple{}}
+    {
+        using namespace llvm;
+        using namespace llvm::orc;
+
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+        InitializeNativeTargetAsmParser();
+
+        // detectHost() uses the name and the features of the host CPU.
+        auto jtmb = Check(JITTargetMachineBuilder::detectHost());
+        jtmb.setCodeGenOptLevel(CodeGenLevel(level));
+        target = Check(jtmb.createTargetMachine());
+        target_builder = jtmb;
+
+        LLJITBuilder builder;
+        builder.setJITTargetMachineBuilder(std::move(jtmb));
+        if (!cache_directory.empty())
+        {
+            cache = std::make_unique<ObjectCache>(cache_directory, *target, level);
+
+            // Like the default compiler of LLJIT, with the cache.
+            builder.setCompileFunctionCreator([this](JITTargetMachineBuilder machine_builder)
+                -> Expected<std::unique_ptr<IRCompileLayer::IRCompiler>>
+            {
+                auto machine = machine_builder.createTargetMachine();
+                if (!machine)
+                {
+                    return machine.takeError();
+                }
+                return std::make_unique<TMOwningSimpleCompiler>(std::move(*machine), cache.get());
+            });
+        }
+        jit = Check(builder.create());
+
+        // Resolve the symbols not defined by the modules in the current process.
+        jit->getMainJITDylib().addGenerator(Check(
+            DynamicLibrarySearchGenerator::GetForCurrentProcess(jit->getDataLayout().getGlobalPrefix())));
+
+        // The lazy functions call the other functions through the stubs of the main JITDylib.
+        lazy_dylib = &Check(jit->createJITDylib("lox.lazy"));
+        lazy_dylib->addToLinkOrder(jit->getMainJITDylib());
+
+        const auto& triple = jit->getTargetTriple();
+        call_through = Check(createLocalLazyCallThroughManager(triple, jit->getExecutionSession(),
+            pointerToJITTargetAddress(&LazyCompileFailed)));
+        auto stubs_builder = createLocalIndirectStubsManagerBuilder(triple);
+        if (!stubs_builder)
+        {
+            throw JITError{"Lazy compilation is not supported for " + triple.str()};
+        }
+        stubs = stubs_builder();
+    }
+
+
+    auto JIT::AddLazy(const std::string& name, ModuleGenerator generate, std::string cache_key,
+        const std::string& value_name)
+        -> void
+    {
+        using namespace llvm;
+        using namespace llvm::orc;
+
+        auto symbol = jit->mangleAndIntern(name);
+        auto flags = JITSymbolFlags::Exported | JITSymbolFlags::Callable;
+        SymbolFlagsMap symbols{{symbol, flags}};
+        if (!value_name.empty())
+        {
+            symbols[jit->mangleAndIntern(value_name)] = JITSymbolFlags::Exported;
+        }
+        Check(lazy_dylib->define(std::make_unique<LazyFunctionUnit>(*this, symbols, std::move(generate),
+            std::move(cache_key))));
+
+        SymbolAliasMap aliases{{symbol, SymbolAliasMapEntry{symbol, flags}}};
+        Check(jit->getMainJITDylib().define(lazyReexports(*call_through, *stubs, *lazy_dylib,
+            std::move(aliases))));
+        if (!value_name.empty())
+        {
+            // Data can't go through a stub: looking it up materializes the function.
+            auto value = jit->mangleAndIntern(value_name);
+            Check(jit->getMainJITDylib().define(reexports(*lazy_dylib,
+                SymbolAliasMap{{value, SymbolAliasMapEntry{value, JITSymbolFlags::Exported}}})));
+        }
+    }
+
+
+    auto JIT::Add(llvm::orc::ThreadSafeModule tsm)
+        -> void
+    {
+        Check(jit->addIRModule(std::move(tsm)));
+    }
+
+
+    auto JIT::AddObject(std::unique_ptr<llvm::MemoryBuffer> object)
+        -> void
+    {
+        Check(jit->addObjectFile(std::move(object)));
+    }
+
+
+    auto JIT::CreateTargetMachine()
+        -> std::unique_ptr<llvm::TargetMachine>
+    {
+        return Check(target_builder.createTargetMachine());
+    }
+
+
+    auto JIT::Lookup(std::string_view name)
+        -> u64
+    {
+        auto symbol = Check(jit->lookup(llvm::StringRef{name.data(), name.size()}));
+        return symbol.getAddress();
+    }
+
+
+    auto JIT::Compile(const std::string& name)
+        -> void
+    {
+        // Looking up the symbol in the main JITDylib returns the stub: the implementation
+        // is materialized only when it is looked up in its own JITDylib.
+        Check(jit->lookup(*lazy_dylib, name));
+    }
+} // namespace lox
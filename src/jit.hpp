@@ -0,0 +1,176 @@
+#ifndef LOX_JIT_HPP
+#define LOX_JIT_HPP
+
+/*
+jit.hpp
+
+PURPOSE: Execute the generated code in process.
+
+CLASSES:
+    JITError: Exception raised when the JIT can't be created or a symbol can't be compiled.
+    JIT: Wrapper around llvm::orc::LLJIT for the host target, with lazily compiled functions.
+
+DESCRIPTION:
+    The JIT compiles for the host CPU with all its features (like -march=native). The modules
+    must be optimized (with the target machine returned by TargetMachine(), so the passes use the
+    cost model of the host) before being added: the JIT only lowers them to machine code, which
+    happens the first time one of their symbols is looked up.
+    The symbols not defined by the modules are resolved in the lox process itself.
+
+    The lazy functions live in a separate JITDylib. The main JITDylib only contains a lazy
+    re-export of each of them: a stub that jumps to a trampoline the first time it is called.
+    The trampoline asks ORC for the real symbol, which runs the generator of the function
+    (codegen and optimization of the module of that single function) and compiles it, then
+    updates the stub so the next calls go directly to the machine code. The functions that
+    are never called are never generated. The module of a function can also define the value
+    of the function (its constant closure, see LLVMVisitor::ValueSymbol()): the main JITDylib
+    re-exports it as it is, so the function is compiled when a module that uses it as a value
+    is linked.
+
+    With an object cache, the compiler stores the object of the modules named by
+    ObjectCache::ModuleName(), and a lazy function added with a key is loaded from the cache
+    when its object is there: it is then neither generated nor compiled.
+*/
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/LazyReexports.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/ADT/Triple.h>
+
+#include "common.hpp"
+#include "optimizer.hpp"
+#include "object_cache.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace lox
+{
+    class JITError : public std::runtime_error
+    {
+    public:
+        explicit JITError(const std::string& msg) : std::runtime_error(msg) { }
+    };
+
+
+    class JIT : private NonCopyable
+    {
+    public:
+        // Create the JIT for the host CPU. Throw JITError on failure.
+        // The compiled functions are cached in the directory, if not empty.
+        explicit JIT(OptLevel level, const std::string& cache_directory = {});
+
+        // The object cache, or nullptr.
+        auto Cache() noexcept
+            -> non_owned_ptr<ObjectCache>
+        {
+            return cache.get();
+        }
+
+        auto DataLayout() const
+            -> const llvm::DataLayout&
+        {
+            return jit->getDataLayout();
+        }
+
+        auto TargetTriple() const
+            -> const llvm::Triple&
+        {
+            return jit->getTargetTriple();
+        }
+
+        // Target machine of the host, used by the optimizer.
+        auto TargetMachine() noexcept
+            -> llvm::TargetMachine&
+        {
+            return *target;
+        }
+
+        // Create another target machine for the host, for a thread that compiles in parallel
+        // (a target machine can't be shared by the threads).
+        auto CreateTargetMachine()
+            -> std::unique_ptr<llvm::TargetMachine>;
+
+        // Set the data layout and the triple of the module to the ones of the host.
+        // Must be done before optimizing the module.
+        auto Prepare(llvm::Module& mod) const
+            -> void
+        {
+            mod.setDataLayout(DataLayout());
+            mod.setTargetTriple(TargetTriple().str());
+        }
+
+        // Add the module to the JIT. The code is compiled when one of its symbols is looked up.
+        auto Add(llvm::orc::ThreadSafeModule tsm)
+            -> void;
+
+        // Add an object file compiled with a target machine of CreateTargetMachine().
+        auto AddObject(std::unique_ptr<llvm::MemoryBuffer> object)
+            -> void;
+
+        // Add a function compiled the first time it is called. The generator returns the
+        // (prepared and optimized) module with the code of the function, or an empty module
+        // on error. With a key (see ObjectCache::Key()) the object of the function is loaded
+        // from the cache, or stored in it after compiling the module. value_name is the data
+        // symbol of the value of the function defined by the module too, if not empty.
+        using ModuleGenerator = std::function<llvm::orc::ThreadSafeModule()>;
+
+        auto AddLazy(const std::string& name, ModuleGenerator generate, std::string cache_key = {},
+            const std::string& value_name = {})
+            -> void;
+
+        // Compile the code of the symbol (if needed) and return its address.
+        auto Lookup(std::string_view name)
+            -> u64;
+
+        // Compile the lazy function now, instead of on its first call.
+        auto Compile(const std::string& name)
+            -> void;
+
+        // Number of lazy functions compiled until now.
+        auto LazyCompiled() const noexcept
+            -> u64
+        {
+            return lazy_compiled.load(std::memory_order_relaxed);
+        }
+
+        // Time spent compiling the lazy functions (generation included), in milliseconds.
+        auto LazyCompileTime() const noexcept
+            -> double
+        {
+            return std::chrono::duration<double, std::milli>(
+                std::chrono::nanoseconds{lazy_ns.load(std::memory_order_relaxed)}).count();
+        }
+
+    private:
+        class LazyFunctionUnit;
+
+        // Destroyed after the JIT, which uses it.
+        std::unique_ptr<ObjectCache> cache;
+
+        std::unique_ptr<llvm::orc::LLJIT> jit;
+        std::unique_ptr<llvm::TargetMachine> target;
+        llvm::orc::JITTargetMachineBuilder target_builder;
+
+        // Implementation of the lazy functions.
+        non_owned_ptr<llvm::orc::JITDylib> lazy_dylib{nullptr};
+        std::unique_ptr<llvm::orc::LazyCallThroughManager> call_through;
+        std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+
+        // The lazy functions can be compiled by any thread that calls them.
+        std::atomic<u64> lazy_compiled{0};
+        std::atomic<i64> lazy_ns{0};
+    };
+} // namespace lox
+
+#endif
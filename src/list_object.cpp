@@ -0,0 +1,69 @@
+#include "list_object.hpp"
+#include "gc.hpp"
+
+#include <algorithm>
+
+namespace lox
+{
+    // A buffer of capacity values, the first count copied from values and the others 0.
+    static auto NewElements(ObjType type, u32 capacity, const u64* values, u32 count)
+        -> ObjSlots*
+    {
+        auto& heap = GlobalHeap();
+        auto elements = reinterpret_cast<ObjSlots*>(heap.Allocate(type,
+            sizeof(ObjSlots) + u64{capacity} * sizeof(u64)));
+        elements->capacity = capacity;
+        std::copy(values, values + count, elements->Values());
+        std::fill(elements->Values() + count, elements->Values() + capacity, u64{0});
+        // A large buffer is old from the start.
+        if (type == ObjType::Slots)
+        {
+            heap.Remember(&elements->obj);
+        }
+        return elements;
+    }
+
+
+    auto NewList(const u64* values, u32 count)
+        -> ObjList*
+    {
+        bool numbers = std::all_of(values, values + count, [](u64 value)
+        {
+            return LoxValue{value}.IsNumber();
+        });
+
+        // The buffer is not reachable while the list is allocated.
+        LocalRoots<1> roots;
+        auto elements = NewElements(numbers ? ObjType::Doubles : ObjType::Slots, count, values, count);
+        roots.slots[0] = LoxValue::Object(&elements->obj).Bits();
+
+        auto list = reinterpret_cast<ObjList*>(GlobalHeap().Allocate(ObjType::List, sizeof(ObjList)));
+        list->length = count;
+        list->elements = elements;
+        return list;
+    }
+
+
+    auto Append(ObjList* list, LoxValue value)
+        -> void
+    {
+        auto& heap = GlobalHeap();
+        auto elements = list->elements;
+        auto type = value.IsNumber() ? elements->obj.type : ObjType::Slots;
+        if (list->length == elements->capacity)
+        {
+            auto capacity = static_cast<u32>(std::clamp<u64>(u64{elements->capacity} * 2,
+                list_min_capacity, UINT32_MAX));
+            elements = NewElements(type, capacity, elements->Values(), list->length);
+            list->elements = elements;
+            heap.Remember(&list->obj);
+        }
+
+        elements->obj.type = type;
+        elements->Values()[list->length++] = value.Bits();
+        if (value.IsObject())
+        {
+            heap.Remember(&elements->obj);
+        }
+    }
+} // namespace lox
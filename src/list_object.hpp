@@ -0,0 +1,63 @@
+#ifndef LOX_LIST_OBJECT_HPP
+#define LOX_LIST_OBJECT_HPP
+
+/*
+list_object.hpp
+
+PURPOSE: Lists of the compiled code: packed doubles or generic values.
+
+CLASSES:
+
+DESCRIPTION:
+    A list ([1, 2, 3], see value.hpp) has a length and a buffer of capacity values, an ObjSlots
+    whose type is the storage of the elements:
+    - Doubles: every element is a number. The values are the doubles themselves (the numbers
+      are not boxed, see value.hpp), so the buffer is a plain array of f64 that the GC doesn't
+      scan, and a loop that only stores numbers in the lists reads them without checking them.
+    - Slots: the elements can be any value, the GC scans the buffer.
+    Storing a value that is not a number in a Doubles buffer changes its type to Slots in place:
+    no copy, since the numbers are already valid values. The storage never goes back to
+    Doubles.
+
+    The generated code (LLVMVisitor) reads and writes the elements inline: it checks that the
+    value is a list and that the index is an integer within the length, then loads or stores
+    buffer + 8 + index * 8 (with the write barrier of the buffer for the objects). Only the
+    literals, append() and the errors call the runtime. The buffer grows by doubling when
+    append() finds it full: the list then points to a new buffer, so the generated code never
+    keeps the address of a buffer across an append (or any call, which could append).
+
+    len() and append() are native functions: a call of a global function with one of these
+    names (a local variable with the name is called as usual).
+*/
+
+#include "common.hpp"
+#include "value.hpp"
+
+#include <string_view>
+
+namespace lox
+{
+    // Names of the native functions: len() and append(), and those of the maps (see
+    // map_object.hpp).
+    constexpr auto IsNativeName(std::string_view name) noexcept
+        -> bool
+    {
+        return name == "len" || name == "append" || name == "map" || name == "has" ||
+            name == "remove" || name == "keys";
+    }
+
+    // Initial capacity of the buffer of a list that grows.
+    constexpr u32 list_min_capacity = 8;
+
+    // A list with the count values. Can run a collection: the values must be reachable from
+    // the roots.
+    auto NewList(const u64* values, u32 count)
+        -> ObjList*;
+
+    // Add the value at the end of the list, which must not be full (length < UINT32_MAX). Can
+    // run a collection: the list and the value must be reachable from the roots.
+    auto Append(ObjList* list, LoxValue value)
+        -> void;
+} // namespace lox
+
+#endif
@@ -3,21 +3,34 @@
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Type.h> // Type
 #include <llvm/IR/Verifier.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/ADT/StringRef.h>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <utility>
 
 #include "log.hpp"
+#include "shape.hpp"
 #include "token.hpp"
 
 namespace lox
 {
-    LLVMVisitor::LLVMVisitor() : 
+    LLVMVisitor::LLVMVisitor(non_owned_ptr<const StringPool> strings_, std::string_view module_name) : 
         context{ std::make_unique<llvm::LLVMContext>() },
-        mod{ std::make_unique<llvm::Module>("MyLoxCompiler", *context) },
-        builder{ std::make_unique<llvm::IRBuilder<>>(*context) }
+        mod{ std::make_unique<llvm::Module>(llvm::StringRef{module_name.data(), module_name.size()}, *context) },
+        builder{ std::make_unique<llvm::IRBuilder<>>(*context) },
+        strings{ strings_ },
+        string_constants(strings_->Size(), nullptr)
     {
-        // Create (the implicit) main function.
+    }
+
+
+    LLVMVisitor::LLVMVisitor(non_owned_ptr<const StringPool> strings_) : 
+        LLVMVisitor(strings_, "MyLoxCompiler")
+    {
+        // Create (the implicit) main function. The C main function is in the runtime.
         using namespace llvm;
     
         FunctionType* main_proto = FunctionType::get(
@@ -29,7 +42,7 @@ namespace lox
         Function* main_func = Function::Create(
             main_proto, 
             GlobalValue::ExternalLinkage,
-            "main",
+            "lox_main",
             *mod 
         );
 
@@ -39,10 +52,14 @@ namespace lox
             main_func
         );
 
-        builder->SetInsertPoint(bb);
-
         current_func = main_func;
-        current_block = bb;
+        SetCurrentBlock(bb);
+        // The entry block has no predecessors.
+        SealBlock(bb);
+        StartFrame();
+
+        // Global scope.
+        BeginScope();
     }
 
 
@@ -50,7 +67,17 @@ namespace lox
     auto LLVMVisitor::Generate(const StmtNode& ast)
         -> void
     {
-        Visit(ast);
+        try
+        {
+            Visit(ast);
+        }
+        catch (const CodegenError& e)
+        {
+            had_error = true;
+            // Drop the scopes opened by the statement.
+            scopes.resize(1);
+            fast_loops.clear();
+        }
     }
 
 
@@ -58,109 +85,1868 @@ namespace lox
         -> void
     {
        // Create the void return value for main function.
+        PopFrame();
         builder->CreateRetVoid();
+        DefineGlobals();
+        FinishFrame();
+
+        if (!lazy_functions)
+        {
+            InternalizeFunctions();
+        }
+
+        if (!had_error && llvm::verifyFunction(*current_func, &llvm::errs()))
+        {
+            Error("Invalid IR generated for the main function.");
+            had_error = true;
+        }
     }
 
 
-    // ********************************* UTILITY *********************************
+    auto LLVMVisitor::GenerateFunction(const FunStmtNode& node)
+        -> void
+    {
+        try
+        {
+            DefineFunction(node);
+        }
+        catch (const CodegenError& e)
+        {
+            had_error = true;
+        }
+    }
 
-    // auto LLVMVisitor::ReadLocalVarRecursive(llvm::BasicBlock* bb, std::string_view name)
-    //     -> llvm::Value* 
-    // {
-    //     using namespace llvm;
 
-    //     Value* value {nullptr};
-        
-    //     // Create an empty phinode
-    //     if (!current_def[bb].sealed)
-    //     {
-    //         PHINode* phi = AddEmptyPhi(bb, name);
-    //         current_def[bb].incomplete_phis[phi] = name;
-    //         value = phi;
-    //     }
-    //     else if (auto pred_bb = bb->getSinglePredecessor())
-    //     {
-    //         value = ReadLocalVar(pred_bb, name);
-    //     }
-    //     else
-    //     {
-    //         PHINode* phi = AddEmptyPhi(bb, name);
-    //         value = phi;
-    //         WriteLocalVar(bb, name, value);
-    //         AddPhiOperands(bb, name, phi);
-    //     }
-
-    //     WriteLocalVar(bb, name, value);
-    //     return value;
-    // }
+    auto LLVMVisitor::GenerateEntry(const FunStmtNode& node)
+        -> void
+    {
+        try
+        {
+            DefineEntry(DeclareFunction(node.name, node.parameters.size()), EntrySymbol(node.name.Lexeme()));
+        }
+        catch (const CodegenError& e)
+        {
+            had_error = true;
+        }
+    }
+
+
+    // Return true if the statement is the loop or contains it.
+    static auto ContainsLoop(const StmtNode& statement, const WhileStmtNode& loop)
+        -> bool
+    {
+        if (auto block = std::get_if<BlockStmtNodePtr>(&statement))
+        {
+            return std::any_of((*block)->statements.begin(), (*block)->statements.end(),
+                [&loop](const StmtNode& s) { return ContainsLoop(s, loop); });
+        }
+        if (auto branch = std::get_if<IfStmtNodePtr>(&statement))
+        {
+            return ContainsLoop((*branch)->then_branch, loop) ||
+                ((*branch)->else_branch && ContainsLoop(*(*branch)->else_branch, loop));
+        }
+        if (auto other = std::get_if<WhileStmtNodePtr>(&statement))
+        {
+            return other->get() == &loop || ContainsLoop((*other)->body, loop);
+        }
+        return false;
+    }
+
+
+    auto LLVMVisitor::LoopVariables(const FunStmtNode& node, const WhileStmtNode& loop)
+        -> std::optional<std::vector<std::string_view>>
+    {
+        std::vector<std::string_view> names;
+        for (const auto& param : node.parameters)
+        {
+            names.push_back(param.Lexeme());
+        }
+
+        const auto* statements = &node.body->statements;
+        while (true)
+        {
+            auto path = std::find_if(statements->begin(), statements->end(),
+                [&loop](const StmtNode& s) { return ContainsLoop(s, loop); });
+            if (path == statements->end())
+            {
+                return std::nullopt;
+            }
+            for (auto s = statements->begin(); s != path; ++s)
+            {
+                if (auto var = std::get_if<VarStmtNodePtr>(&*s))
+                {
+                    names.push_back((*var)->name.Lexeme());
+                }
+                else if (std::holds_alternative<FunStmtNodePtr>(*s) || std::holds_alternative<ClassStmtNodePtr>(*s))
+                {
+                    return std::nullopt;
+                }
+            }
+
+            if (auto found = std::get_if<WhileStmtNodePtr>(&*path); found && found->get() == &loop)
+            {
+                return names;
+            }
+            auto block = std::get_if<BlockStmtNodePtr>(&*path);
+            if (!block)
+            {
+                return std::nullopt;
+            }
+            statements = &(*block)->statements;
+        }
+    }
+
+
+    auto LLVMVisitor::GenerateLoopEntry(const FunStmtNode& node, const WhileStmtNode& loop, const std::string& symbol)
+        -> void
+    {
+        using namespace llvm;
+
+        auto variables = LoopVariables(node, loop);
+        if (!variables)
+        {
+            had_error = true;
+            return;
+        }
+
+        std::vector<Type*> params(variables->size(), builder->getInt64Ty());
+        auto func = Function::Create(FunctionType::get(builder->getInt64Ty(), params, false),
+            GlobalValue::InternalLinkage, symbol, *mod);
+        func->setCallingConv(CallingConv::Tail);
+        func->addFnAttr(Attribute::NoUnwind);
+
+        LoopEntry entry{func, &loop, 0};
+        loop_entry = &entry;
+        try
+        {
+            DefineFunction(node);
+            DefineEntry(func, symbol + ".entry");
+        }
+        catch (const CodegenError& e)
+        {
+            loop_entry = nullptr;
+            had_error = true;
+        }
+    }
+
+
+    auto LLVMVisitor::DefineEntry(llvm::Function* func, const std::string& symbol)
+        -> void
+    {
+        using namespace llvm;
+
+        auto value_type = builder->getInt64Ty();
+        auto proto = FunctionType::get(value_type, {PointerType::getUnqual(value_type)}, false);
+        Function* entry = Function::Create(proto, GlobalValue::ExternalLinkage, symbol, *mod);
+
+        builder->SetInsertPoint(BasicBlock::Create(*context, "entry", entry));
+        SmallVector<Value*, 4> args;
+        for (unsigned i = 0; i < func->arg_size(); ++i)
+        {
+            auto ptr = builder->CreateConstInBoundsGEP1_32(value_type, entry->getArg(0), i);
+            args.push_back(builder->CreateLoad(value_type, ptr));
+        }
+        auto call = builder->CreateCall(func, args);
+        call->setCallingConv(CallingConv::Tail);
+        builder->CreateRet(call);
+        builder->ClearInsertionPoint();
+    }
+
 
     // ********************************* UTILITY *********************************
 
-    // ******************************** VISIT STATEMENTS *************************************
+    auto LLVMVisitor::VisitShared(const ExprNode& node)
+        -> void
+    {
+        if (auto canonical = cse->Canonical(node))
+        {
+            // The canonical node dominates the duplicate, so its value is already available.
+            if (auto it = shared_values.find(canonical); it != shared_values.end())
+            {
+                current_value = it->second;
+                return;
+            }
+        }
 
-    auto LLVMVisitor::operator()(const ExprStmtNodePtr& node)
+        std::visit(*this, node);
+
+        if (cse->IsShared(node))
+        {
+            shared_values[NodeId(node)] = current_value;
+        }
+    }
+
+    auto LLVMVisitor::ErrorAt(const Token& t, const std::string_view msg)
         -> void
     {
+        if (report_errors)
+        {
+            std::cout << "[line " << t.Line() << "] Error at " << t.Lexeme() << ": " << msg << std::endl;
+        }
+        throw CodegenError{};
+    }
+
 
+    auto LLVMVisitor::ToCondition(llvm::Value* value)
+        -> llvm::Value*
+    {
+        auto not_nil = builder->CreateICmpNE(value, BoxedConstant(LoxValue::Nil()), "not.nil");
+        auto not_false = builder->CreateICmpNE(value, BoxedConstant(LoxValue::Bool(false)), "not.false");
+        return builder->CreateAnd(not_nil, not_false, "truthy");
     }
 
 
-    auto LLVMVisitor::operator()(const PrintStmtNodePtr& node)
+    auto LLVMVisitor::CheckNumbers(std::initializer_list<llvm::Value*> values, const Token& t)
         -> void
     {
+        using namespace llvm;
+
+        Value* check = nullptr;
+        for (auto value : values)
+        {
+            auto is_number = IsNumber(value);
+            check = check ? builder->CreateAnd(check, is_number) : is_number;
+        }
+
+        BasicBlock* error_bb = BasicBlock::Create(*context, "num.error", current_func);
+        BasicBlock* ok_bb = BasicBlock::Create(*context, "num.ok", current_func);
+        builder->CreateCondBr(check, ok_bb, error_bb, Likely());
+
+        SetCurrentBlock(error_bb);
+        SealBlock(error_bb);
+        RuntimeError(values.size() == 1 ? "Operand must be a number." : "Operands must be numbers.", t);
 
+        SetCurrentBlock(ok_bb);
+        SealBlock(ok_bb);
     }
 
 
-    auto LLVMVisitor::operator()(const VarStmtNodePtr& node)
+    auto LLVMVisitor::RuntimeError(std::string_view msg, const Token& t)
         -> void
     {
-        // llvm::StringRef var{node->name.Lexeme()};
-        
-        // name_vars[var] = 
+        using namespace llvm;
+
+        auto& message = error_messages[StringRef{msg.data(), msg.size()}];
+        if (!message)
+        {
+            message = builder->CreateGlobalString(StringRef{msg.data(), msg.size()}, ".error", 0, mod.get());
+        }
+
+        auto error = RuntimeFunction("lox_error", FunctionType::get(builder->getVoidTy(),
+            {builder->getInt8PtrTy(), builder->getInt32Ty()}, false));
+        auto error_func = cast<Function>(error.getCallee());
+        error_func->setDoesNotReturn();
+        error_func->addFnAttr(Attribute::Cold);
+
+        auto chars = builder->CreateConstInBoundsGEP2_32(message->getValueType(), message, 0, 0);
+        builder->CreateCall(error, {chars, builder->getInt32(static_cast<u32>(t.Line()))});
+        builder->CreateUnreachable();
     }
 
 
-    auto LLVMVisitor::operator()(const BlockStmtNodePtr& node)
+    auto LLVMVisitor::DeclareFunction(const Token& name, std::size_t arity)
+        -> llvm::Function*
+    {
+        using namespace llvm;
+
+        // The calls of the native functions never declare them.
+        if (IsNativeName(name.Lexeme()))
+        {
+            ErrorAt(name, "Can't redefine a native function.");
+        }
+
+        auto symbol = FunctionSymbol(name.Lexeme());
+        if (auto func = mod->getFunction(symbol))
+        {
+            if (func->arg_size() != arity)
+            {
+                ErrorAt(name, "Wrong number of arguments.");
+            }
+            return func;
+        }
+
+        // Functions called before their declaration are declared with the arity of the call.
+        std::vector<Type*> params(arity, builder->getInt64Ty());
+        auto proto = FunctionType::get(builder->getInt64Ty(), params, false);
+        auto func = Function::Create(proto, GlobalValue::ExternalLinkage, symbol, *mod);
+        // The Lox functions are called only by the generated code (the entry points of the
+        // tiered mode included), so they don't need the C calling convention: tailcc makes
+        // every call in tail position a tail call. The runtime errors exit, nothing unwinds.
+        func->setCallingConv(CallingConv::Tail);
+        func->addFnAttr(Attribute::NoUnwind);
+        return func;
+    }
+
+
+    auto LLVMVisitor::DefineFunction(const FunStmtNode& node, const ClosureContext* closure_context)
         -> void
     {
+        using namespace llvm;
+
+        // The closures of the function generated from a loop are plain closures.
+        auto entering = std::exchange(loop_entry, nullptr);
+        Function* func = closure_context ? closure_context->function : entering ? entering->function :
+            DeclareFunction(node.name, node.parameters.size());
+        if (!func->empty())
+        {
+            ErrorAt(node.name, "Redefinition of functions is not supported.");
+        }
+        if (!closure_context && !entering && !ValueSymbol(node.name.Lexeme()).empty())
+        {
+            DefineFunctionValue(node.name.Lexeme(), func);
+        }
+
+        // The body can't see the variables of the enclosing code, only the ones captured by
+        // the closure (and the closure itself).
+        std::vector<std::string_view> outer;
+        if (closure_context)
+        {
+            for (const auto& variable : closure_context->closure->captured)
+            {
+                outer.push_back(variable.name);
+            }
+            outer.push_back(node.name.Lexeme());
+        }
+        ClosureAnalysis analysis{node, outer};
+
+        auto enclosing_func = current_func;
+        auto enclosing_block = current_block;
+        auto enclosing_scopes = std::move(scopes);
+        auto enclosing_frame = frame;
+        auto enclosing_frame_slots = frame_slots;
+        auto enclosing_fast_loops = std::move(fast_loops);
+        auto enclosing_closures = closures;
+        auto enclosing_shared_names = std::move(shared_names);
+        auto restore = [&]()
+        {
+            closures = enclosing_closures;
+            shared_names = std::move(enclosing_shared_names);
+            fast_loops = std::move(enclosing_fast_loops);
+            scopes = std::move(enclosing_scopes);
+            current_func = enclosing_func;
+            current_block = enclosing_block;
+            frame = enclosing_frame;
+            frame_slots = enclosing_frame_slots;
+            if (current_block)
+            {
+                builder->SetInsertPoint(current_block);
+            }
+            else
+            {
+                builder->ClearInsertionPoint();
+            }
+        };
+
+        // Hint the inlining of the one statement functions (return x * x;).
+        if (node.body->statements.size() == 1)
+        {
+            func->addFnAttr(Attribute::InlineHint);
+        }
+
+        scopes.clear();
+        fast_loops.clear();
+        closures = &analysis;
+        shared_names = analysis.SharedNames();
+        BasicBlock* bb = BasicBlock::Create(*context, "entry", func);
+        current_func = func;
+        SetCurrentBlock(bb);
+        SealBlock(bb);
+        StartFrame();
+
+        try
+        {
+            BeginScope();
+            // The global variables used by the function (the captured values, its own name and
+            // the parameters hide them).
+            for (const auto& variable : analysis.FreeVariables())
+            {
+                if (declarations && declarations->variables.contains(variable.name))
+                {
+                    BindGlobal(variable.name);
+                    shared_names.insert(variable.name);
+                }
+            }
+
+            unsigned first_param = 0;
+            if (closure_context)
+            {
+                // The captured values follow the record, with the storage they have in the
+                // enclosing function. They are rooted again: a tail call pops the frame of the
+                // caller, the only one that could keep the record alive.
+                auto record = func->getArg(0);
+                record->setName("closure");
+                for (std::size_t i = 0; i < closure_context->captured.size(); ++i)
+                {
+                    auto info = variables[closure_context->captured[i]];
+                    auto value = builder->CreateLoad(builder->getInt64Ty(), FieldAddress(record,
+                        builder->getInt64(sizeof(ObjClosure) + i * sizeof(u64)), builder->getInt64Ty()), info.name);
+                    auto var = AddVar(info.name, value, info.storage);
+                    if (info.known)
+                    {
+                        variables[var].known = info.known;
+                        variables[var].known->local = false;
+                    }
+                    if (info.storage != Storage::Pointer && (!info.known || info.known->escapes))
+                    {
+                        StoreRoot(variables[var].slot, value);
+                    }
+                }
+
+                // Its own name is the closure.
+                bool escapes = closure_context->closure->escapes;
+                Value* self = builder->CreatePtrToInt(record, builder->getInt64Ty());
+                if (escapes)
+                {
+                    self = builder->CreateOr(self, builder->getInt64(LoxValue::object_bits));
+                }
+                auto var = AddVar(node.name.Lexeme(), self, Storage::Value);
+                variables[var].known = KnownClosure{func, node.parameters.size(), escapes, false};
+                if (escapes)
+                {
+                    StoreRoot(variables[var].slot, self);
+                }
+                first_param = 1;
+            }
+
+            // Parameters. Allocating a box can run the GC: the arguments are rooted first.
+            bool boxed = std::any_of(node.parameters.begin(), node.parameters.end(), [&analysis](const Token& param)
+            {
+                return analysis.IsBoxed(param);
+            });
+            for (std::size_t i = 0; boxed && i < node.parameters.size(); ++i)
+            {
+                Root(func->getArg(first_param + static_cast<unsigned>(i)));
+            }
+            for (std::size_t i = 0; i < node.parameters.size(); ++i)
+            {
+                auto arg = func->getArg(first_param + static_cast<unsigned>(i));
+                arg->setName(node.parameters[i].Lexeme());
+                DeclareVar(node.parameters[i], arg);
+            }
+
+            if (entering)
+            {
+                entering->next_arg = first_param + static_cast<unsigned>(node.parameters.size());
+                if (!GenerateFromLoop(node.body->statements, *entering))
+                {
+                    ErrorAt(node.name, "Loop not found in the function.");
+                }
+            }
+            else
+            {
+                for (const auto& s : node.body->statements)
+                {
+                    Visit(s);
+                }
+            }
+
+            // Implicit return nil.
+            if (!current_block->getTerminator())
+            {
+                PopFrame();
+                builder->CreateRet(BoxedConstant(LoxValue::Nil()));
+            }
+            FinishFrame();
+
+            if (verifyFunction(*func, &errs()))
+            {
+                Error("Invalid IR generated for a function.");
+                throw CodegenError{};
+            }
+        }
+        catch (const CodegenError& e)
+        {
+            // Keep the declaration, the calls already generated refer to it.
+            func->deleteBody();
+            restore();
+            throw;
+        }
+        restore();
+    }
+
+
+    auto LLVMVisitor::GenerateFromLoop(const std::vector<StmtNode>& statements, LoopEntry& entry)
+        -> bool
+    {
+        auto path = std::find_if(statements.begin(), statements.end(),
+            [&entry](const StmtNode& s) { return ContainsLoop(s, *entry.loop); });
+        if (path == statements.end())
+        {
+            return false;
+        }
 
+        // The statements before the loop were executed by the interpreter.
+        for (auto s = statements.begin(); s != path; ++s)
+        {
+            if (auto var = std::get_if<VarStmtNodePtr>(&*s))
+            {
+                auto arg = current_func->getArg(entry.next_arg++);
+                arg->setName((*var)->name.Lexeme());
+                DeclareVar((*var)->name, arg);
+            }
+        }
+
+        if (auto block = std::get_if<BlockStmtNodePtr>(&*path))
+        {
+            BeginScope();
+            bool found = GenerateFromLoop((*block)->statements, entry);
+            EndScope();
+            if (!found)
+            {
+                return false;
+            }
+        }
+        else if (auto loop = std::get_if<WhileStmtNodePtr>(&*path); loop && loop->get() == entry.loop)
+        {
+            Visit(*path);
+        }
+        else
+        {
+            return false;
+        }
+
+        for (auto s = std::next(path); s != statements.end(); ++s)
+        {
+            Visit(*s);
+        }
+        return true;
     }
 
 
-    auto LLVMVisitor::operator()(const FunStmtNodePtr& node)
+    auto LLVMVisitor::GenerateCall(const CallExprNode& node, bool tail)
+        -> llvm::CallInst*
+    {
+        using namespace llvm;
+
+        // A local variable holds a closure, the other names are global functions.
+        if (auto var = FindVar(node.callee.Lexeme()))
+        {
+            return GenerateClosureCall(node, *var, tail);
+        }
+        if (declarations)
+        {
+            auto it = declarations->functions.find(node.callee.Lexeme());
+            if (it == declarations->functions.end())
+            {
+                ErrorAt(node.callee, "Undefined function.");
+            }
+            if (it->second != node.arguments.size())
+            {
+                ErrorAt(node.paren, "Wrong number of arguments.");
+            }
+        }
+        Function* func = DeclareFunction(node.callee, node.arguments.size());
+
+        // Reading a variable in an argument can replace a trivial phi used by a previous one.
+        SmallVector<TrackingVH<Value>, 4> tracked;
+        for (const auto& arg : node.arguments)
+        {
+            Visit(arg);
+            tracked.emplace_back(current_value);
+        }
+
+        SmallVector<Value*, 4> args{tracked.begin(), tracked.end()};
+        if (tail)
+        {
+            PopFrame();
+        }
+        auto call = builder->CreateCall(func, args, "call");
+        call->setCallingConv(CallingConv::Tail);
+        if (tail)
+        {
+            // tailcc allows musttail between different prototypes: the callee pops its
+            // arguments, so any number of them can replace the ones of the caller.
+            call->setTailCallKind(CallInst::TCK_MustTail);
+        }
+        return call;
+    }
+
+
+    auto LLVMVisitor::GenerateNative(const CallExprNode& node)
         -> void
     {
         using namespace llvm;
-    
-        FunctionType* proto = FunctionType::get(
-            Type::getVoidTy(*context),
-            {},
-            false 
-        );
 
-        Function* func = Function::Create(
-            proto, 
-            GlobalValue::ExternalLinkage,
-            node->name.Lexeme(),
-            *mod 
-        );
+        auto name = node.callee.Lexeme();
+        std::size_t arity = name == "map" ? 0 : name == "len" || name == "keys" ? 1 : 2;
+        if (node.arguments.size() != arity)
+        {
+            ErrorAt(node.callee, "Wrong number of arguments.");
+        }
+        auto line = builder->getInt32(static_cast<u32>(node.callee.Line()));
+
+        if (name == "map")
+        {
+            auto map_new = RuntimeFunction("lox_map_new", FunctionType::get(builder->getInt64Ty(), false));
+            current_value = builder->CreateCall(map_new, {}, "map");
+            current_number = false;
+            current_int = nullptr;
+            Root(current_value);
+            return;
+        }
+
+        if (name == "keys")
+        {
+            Visit(node.arguments[0]);
+            auto keys = RuntimeFunction("lox_map_keys", FunctionType::get(builder->getInt64Ty(),
+                {builder->getInt64Ty(), builder->getInt32Ty()}, false));
+            current_value = builder->CreateCall(keys, {current_value, line}, "keys");
+            current_number = false;
+            current_int = nullptr;
+            Root(current_value);
+            return;
+        }
+
+        if (name == "has" || name == "remove")
+        {
+            Visit(node.arguments[0]);
+            // Reading a variable in the key can replace a trivial phi.
+            TrackingVH<Value> map = current_value;
+            Visit(node.arguments[1]);
+            auto func = RuntimeFunction(name == "has" ? "lox_map_has" : "lox_map_remove",
+                FunctionType::get(builder->getInt64Ty(),
+                    {builder->getInt64Ty(), builder->getInt64Ty(), builder->getInt32Ty()}, false));
+            current_value = builder->CreateCall(func, {map, current_value, line}, StringRef{name.data(), name.size()});
+            current_number = false;
+            current_int = nullptr;
+            return;
+        }
+
+        if (name == "append")
+        {
+            Visit(node.arguments[0]);
+            // Reading a variable in the value can replace a trivial phi.
+            TrackingVH<Value> list = current_value;
+            Visit(node.arguments[1]);
+            auto append = RuntimeFunction("lox_list_append", FunctionType::get(builder->getInt64Ty(),
+                {builder->getInt64Ty(), builder->getInt64Ty(), builder->getInt32Ty()}, false));
+            current_value = builder->CreateCall(append, {list, current_value, line}, "append");
+            current_number = false;
+            current_int = nullptr;
+            return;
+        }
+
+        // The length of a packed list was loaded by the guard of the loop.
+        if (auto list = FindPackedList(NumericLoop::VarName(node.arguments[0])))
+        {
+            current_int = list->length;
+            current_value = FromNumber(builder->CreateUIToFP(list->length, builder->getDoubleTy()));
+            current_number = true;
+            return;
+        }
+
+        Visit(node.arguments[0]);
+        Value* value = current_value;
+
+        BasicBlock* object_bb = BasicBlock::Create(*context, "len.obj", current_func);
+        BasicBlock* list_bb = BasicBlock::Create(*context, "len.list", current_func);
+        BasicBlock* other_bb = BasicBlock::Create(*context, "len.other");
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "len.exit");
+
+        auto object_bits = builder->getInt64(LoxValue::object_bits);
+        auto is_object = builder->CreateICmpEQ(builder->CreateAnd(value, object_bits), object_bits, "is.obj");
+        builder->CreateCondBr(is_object, object_bb, other_bb, Likely());
+        SetCurrentBlock(object_bb);
+        SealBlock(object_bb);
+        auto ptr = builder->CreateIntToPtr(builder->CreateAnd(value, ~LoxValue::object_bits),
+            builder->getInt8PtrTy(), "obj");
+        auto type = builder->CreateLoad(builder->getInt8Ty(), ptr, "type");
+        type->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+        auto is_list = builder->CreateICmpEQ(type, builder->getInt8(static_cast<u8>(ObjType::List)), "is.list");
+        builder->CreateCondBr(is_list, list_bb, other_bb, Likely());
+
+        SetCurrentBlock(list_bb);
+        SealBlock(list_bb);
+        auto length = builder->CreateLoad(builder->getInt32Ty(),
+            FieldAddress(ptr, builder->getInt64(offsetof(ObjList, length)), builder->getInt32Ty()), "length");
+        length->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+        auto list_length = FromNumber(builder->CreateUIToFP(length, builder->getDoubleTy()));
+        builder->CreateBr(exit_bb);
+
+        // The strings and the errors.
+        other_bb->insertInto(current_func);
+        SetCurrentBlock(other_bb);
+        SealBlock(other_bb);
+        auto len = RuntimeFunction("lox_len", FunctionType::get(builder->getInt64Ty(),
+            {builder->getInt64Ty(), builder->getInt32Ty()}, false));
+        auto other_length = builder->CreateCall(len, {value, line}, "len");
+        builder->CreateBr(exit_bb);
+
+        exit_bb->insertInto(current_func);
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+        auto phi = builder->CreatePHI(builder->getInt64Ty(), 2, "len");
+        phi->addIncoming(list_length, list_bb);
+        phi->addIncoming(other_length, other_bb);
+        current_value = phi;
+        current_number = true;
+        current_int = nullptr;
+    }
+
+
+    auto LLVMVisitor::GenerateClosureCall(const CallExprNode& node, u32 var, bool tail)
+        -> llvm::CallInst*
+    {
+        using namespace llvm;
+
+        // The callee is read first: an argument can assign the variable.
+        auto known = variables[var].known;
+        TrackingVH<Value> callee = ReadVar(var);
+        SmallVector<TrackingVH<Value>, 4> tracked;
+        for (const auto& arg : node.arguments)
+        {
+            Visit(arg);
+            tracked.emplace_back(current_value);
+        }
+
+        auto argc = node.arguments.size();
+        auto type = ClosureFunctionType(argc);
+        auto object_bits = builder->getInt64(LoxValue::object_bits);
+        Value* record = nullptr;
+        Value* function = nullptr;
+        if (known)
+        {
+            if (known->arity != argc)
+            {
+                ErrorAt(node.paren, "Wrong number of arguments.");
+            }
+            // The record of a closure that doesn't escape is not a Lox value: its raw address.
+            Value* address = callee;
+            if (known->escapes)
+            {
+                address = builder->CreateAnd(address, ~LoxValue::object_bits);
+            }
+            record = builder->CreateIntToPtr(address, builder->getInt8PtrTy(), "closure");
+            function = known->function;
+        }
+        else
+        {
+            // The type and the arity are in the first 8 bytes of a closure (see value.hpp). The
+            // type of a class differs only in its lowest bit.
+            BasicBlock* object_bb = BasicBlock::Create(*context, "call.obj", current_func);
+            BasicBlock* error_bb = BasicBlock::Create(*context, "call.error", current_func);
+            BasicBlock* ok_bb = BasicBlock::Create(*context, "call.ok", current_func);
+            auto is_object = builder->CreateICmpEQ(builder->CreateAnd(callee, object_bits), object_bits, "is.obj");
+            builder->CreateCondBr(is_object, object_bb, error_bb, Likely());
+
+            SetCurrentBlock(object_bb);
+            SealBlock(object_bb);
+            record = builder->CreateIntToPtr(builder->CreateAnd(callee, ~LoxValue::object_bits),
+                builder->getInt8PtrTy(), "closure");
+            auto header = builder->CreateLoad(builder->getInt64Ty(),
+                builder->CreateBitCast(record, PointerType::getUnqual(builder->getInt64Ty())), "closure.header");
+            auto expected = static_cast<u64>(ObjType::Closure) | (u64{argc} << 32);
+            auto ok = builder->CreateICmpEQ(builder->CreateAnd(header, builder->getInt64(0xFFFFFFFF000000FE)),
+                builder->getInt64(expected), "closure.ok");
+            builder->CreateCondBr(ok, ok_bb, error_bb, Likely());
+
+            SetCurrentBlock(error_bb);
+            SealBlock(error_bb);
+            auto error = RuntimeFunction("lox_call_error", FunctionType::get(builder->getVoidTy(),
+                {builder->getInt64Ty(), builder->getInt32Ty(), builder->getInt32Ty()}, false));
+            auto error_func = cast<Function>(error.getCallee());
+            error_func->setDoesNotReturn();
+            error_func->addFnAttr(Attribute::Cold);
+            builder->CreateCall(error, {callee, builder->getInt32(static_cast<u32>(argc)),
+                builder->getInt32(static_cast<u32>(node.paren.Line()))});
+            builder->CreateUnreachable();
+
+            SetCurrentBlock(ok_bb);
+            SealBlock(ok_bb);
+            auto address = FieldAddress(record, builder->getInt64(offsetof(ObjClosure, function)),
+                PointerType::getUnqual(type));
+            function = builder->CreateLoad(PointerType::getUnqual(type), address, "closure.function");
+        }
+
+        SmallVector<Value*, 5> args{record};
+        args.append(tracked.begin(), tracked.end());
+
+        // The record of a closure of this function is in its stack frame: the call in tail
+        // position is a plain call, and the frame is popped after it.
+        bool local = tail && known && known->local;
+        tail = tail && !local;
+        if (tail)
+        {
+            PopFrame();
+        }
+        auto call = builder->CreateCall(type, function, args, "call");
+        call->setCallingConv(CallingConv::Tail);
+        if (tail)
+        {
+            call->setTailCallKind(CallInst::TCK_MustTail);
+        }
+        if (local)
+        {
+            PopFrame();
+        }
+        return call;
+    }
+
+
+    auto LLVMVisitor::TailCall(const ExprNode& node) noexcept
+        -> const CallExprNode*
+    {
+        if (auto grouping = std::get_if<GroupingNodePtr>(&node))
+        {
+            return TailCall((*grouping)->expr);
+        }
+        if (auto call = std::get_if<CallExprNodePtr>(&node))
+        {
+            return call->get();
+        }
+        return nullptr;
+    }
+
+
+    auto LLVMVisitor::InternalizeFunctions()
+        -> void
+    {
+        for (auto& func : *mod)
+        {
+            if (func.getName().startswith("lox.") && !func.isDeclaration())
+            {
+                func.setLinkage(llvm::GlobalValue::InternalLinkage);
+            }
+        }
+        for (auto& global : mod->globals())
+        {
+            if (global.getName().startswith("lox.fun.") && !global.isDeclaration())
+            {
+                global.setLinkage(llvm::GlobalValue::InternalLinkage);
+            }
+        }
+    }
+
+
+    auto LLVMVisitor::DeclareVar(const Token& name, llvm::Value* value, bool number)
+        -> u32
+    {
+        if (!closures || !closures->IsShared(name))
+        {
+            auto id = AddVar(name.Lexeme(), value, Storage::Value);
+            if (!number)
+            {
+                StoreRoot(variables[id].slot, value);
+            }
+            return id;
+        }
+
+        // The slot keeps the value alive while the box is allocated, or it is the storage.
+        bool boxed = closures->IsBoxed(name);
+        auto id = AddVar(name.Lexeme(), value, boxed ? Storage::Box : Storage::Pointer);
+        auto slot = variables[id].slot;
+        StoreRoot(slot, value);
+        if (boxed)
+        {
+            auto new_box = RuntimeFunction("lox_box_new", llvm::FunctionType::get(builder->getInt64Ty(),
+                {builder->getInt64Ty()}, false));
+            auto box = builder->CreateCall(new_box, {value}, "box");
+            WriteLocalVar(current_block, id, box);
+            StoreRoot(slot, box);
+        }
+        else
+        {
+            auto address = builder->CreateConstInBoundsGEP1_32(builder->getInt64Ty(), frame, 2 + slot);
+            WriteLocalVar(current_block, id, builder->CreatePtrToInt(address, builder->getInt64Ty(), name.Lexeme()));
+        }
+        return id;
+    }
+
+
+    auto LLVMVisitor::AddVar(std::string_view name, llvm::Value* value, Storage storage)
+        -> u32
+    {
+        auto id = static_cast<u32>(variables.size());
+        variables.push_back(VarInfo{name, frame_slots++, storage});
+        scopes.back()[name] = id;
+        WriteLocalVar(current_block, id, value);
+        return id;
+    }
+
+
+    auto LLVMVisitor::ReadVar(u32 var)
+        -> llvm::Value*
+    {
+        if (variables[var].storage == Storage::Value)
+        {
+            return ReadLocalVar(current_block, var);
+        }
+        return builder->CreateLoad(builder->getInt64Ty(), SharedAddress(var), variables[var].name);
+    }
+
+
+    auto LLVMVisitor::WriteVar(u32 var, llvm::Value* value, bool number)
+        -> void
+    {
+        switch (variables[var].storage)
+        {
+        case Storage::Value:
+            WriteLocalVar(current_block, var, value);
+            // A number doesn't keep anything alive: the slot can keep an older value.
+            if (!number)
+            {
+                StoreRoot(variables[var].slot, value);
+            }
+            break;
+        case Storage::Box:
+            builder->CreateStore(value, SharedAddress(var));
+            if (!number)
+            {
+                auto box = builder->CreateIntToPtr(
+                    builder->CreateAnd(ReadLocalVar(current_block, var), ~LoxValue::object_bits),
+                    builder->getInt8PtrTy());
+                WriteBarrier(box, value);
+            }
+            break;
+        case Storage::Pointer:
+            // The slot is the storage: it is scanned by the GC.
+            builder->CreateStore(value, SharedAddress(var));
+            break;
+        }
+    }
+
+
+    auto LLVMVisitor::SharedAddress(u32 var)
+        -> llvm::Value*
+    {
+        auto holder = ReadLocalVar(current_block, var);
+        auto type = llvm::PointerType::getUnqual(builder->getInt64Ty());
+        if (variables[var].storage == Storage::Pointer)
+        {
+            return builder->CreateIntToPtr(holder, type);
+        }
+        auto box = builder->CreateIntToPtr(builder->CreateAnd(holder, ~LoxValue::object_bits),
+            builder->getInt8PtrTy());
+        return FieldAddress(box, builder->getInt64(sizeof(ObjSlots)), builder->getInt64Ty());
+    }
+
+
+    auto LLVMVisitor::DefineGlobals()
+        -> void
+    {
+        using namespace llvm;
+
+        if (!declarations || declarations->variables.empty())
+        {
+            return;
+        }
+        // In order, so the module doesn't depend on the hash of the names.
+        std::vector<std::string_view> names{declarations->variables.begin(), declarations->variables.end()};
+        std::sort(names.begin(), names.end());
+
+        IRBuilder<> b{frame->getNextNode()};
+        auto add_root = RuntimeFunction("lox_gc_add_root", FunctionType::get(b.getVoidTy(),
+            {PointerType::getUnqual(b.getInt64Ty())}, false));
+        for (auto name : names)
+        {
+            auto global = cast<GlobalVariable>(mod->getOrInsertGlobal(GlobalSymbol(name), b.getInt64Ty()));
+            global->setInitializer(b.getInt64(LoxValue::nil_bits));
+            global->setAlignment(Align{8});
+            b.CreateCall(add_root, {global});
+        }
+    }
+
+
+    auto LLVMVisitor::BindGlobal(std::string_view name)
+        -> u32
+    {
+        auto global = mod->getOrInsertGlobal(GlobalSymbol(name), builder->getInt64Ty());
+        return AddVar(name, builder->CreatePtrToInt(global, builder->getInt64Ty(), name), Storage::Pointer);
+    }
+
+
+    auto LLVMVisitor::StartFrame()
+        -> void
+    {
+        frame = builder->CreateAlloca(builder->getInt64Ty(), builder->getInt32(0), "gc.frame");
+        frame_slots = 0;
+    }
+
+
+    auto LLVMVisitor::FinishFrame()
+        -> void
+    {
+        using namespace llvm;
+
+        // Layout of GCFrame: the previous frame, the number of slots, the slots.
+        frame->setOperand(0, builder->getInt32(2 + frame_slots));
+
+        IRBuilder<> b{frame->getNextNode()};
+        auto top = GCTop();
+        auto prev = b.CreateLoad(b.getInt8PtrTy(), top, "gc.prev");
+        b.CreateStore(b.CreatePtrToInt(prev, b.getInt64Ty()), frame);
+        b.CreateStore(b.getInt64(frame_slots), b.CreateConstInBoundsGEP1_32(b.getInt64Ty(), frame, 1));
+        if (frame_slots > 0)
+        {
+            b.CreateMemSet(b.CreateConstInBoundsGEP1_32(b.getInt64Ty(), frame, 2), b.getInt8(0),
+                u64{frame_slots} * sizeof(u64), MaybeAlign{8});
+        }
+        b.CreateStore(b.CreateBitCast(frame, b.getInt8PtrTy()), top);
+    }
+
+
+    auto LLVMVisitor::PopFrame()
+        -> void
+    {
+        auto prev = builder->CreateLoad(builder->getInt64Ty(), frame, "gc.prev");
+        builder->CreateStore(builder->CreateIntToPtr(prev, builder->getInt8PtrTy()), GCTop());
+    }
+
+
+    auto LLVMVisitor::StoreRoot(u32 slot, llvm::Value* value)
+        -> void
+    {
+        auto store = builder->CreateStore(value,
+            builder->CreateConstInBoundsGEP1_32(builder->getInt64Ty(), frame, 2 + slot));
+        store->setMetadata(llvm::LLVMContext::MD_tbaa, AccessTag("slot"));
+    }
+
+
+    auto LLVMVisitor::ResolveVar(const Token& name)
+        -> u32
+    {
+        if (auto var = FindVar(name.Lexeme()))
+        {
+            return *var;
+        }
+        ErrorAt(name, "Undefined variable.");
+    }
+
+
+    auto LLVMVisitor::FindVar(std::string_view name) const
+        -> std::optional<u32>
+    {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope)
+        {
+            if (auto it = scope->find(name); it != scope->end())
+            {
+                return it->second;
+            }
+        }
+        return std::nullopt;
+    }
+
+
+    auto LLVMVisitor::ReadLocalVarRecursive(llvm::BasicBlock* bb, u32 var)
+        -> llvm::Value* 
+    {
+        using namespace llvm;
+
+        Value* value {nullptr};
+        auto& def = current_def[bb];
+        
+        if (!def.sealed)
+        {
+            // Not all the predecessors are known: create an empty phi, completed when the
+            // block is sealed.
+            PHINode* phi = AddEmptyPhi(bb, var);
+            current_def[bb].incomplete_phis[phi] = var;
+            value = phi;
+        }
+        else if (auto pred_bb = bb->getSinglePredecessor())
+        {
+            // No phi needed.
+            value = ReadLocalVar(pred_bb, var);
+        }
+        else
+        {
+            // Break potential cycles with an operandless phi.
+            PHINode* phi = AddEmptyPhi(bb, var);
+            WriteLocalVar(bb, var, phi);
+            value = AddPhiOperands(var, phi);
+        }
+
+        WriteLocalVar(bb, var, value);
+        return value;
+    }
+
+
+    auto LLVMVisitor::AddEmptyPhi(llvm::BasicBlock* bb, u32 var)
+        -> llvm::PHINode*
+    {
+        using namespace llvm;
+
+        // All the values are boxed in an i64.
+        auto type = Type::getInt64Ty(*context);
+        const auto& info = variables[var];
+        // The phis must be at the beginning of the block.
+        return bb->empty() ?
+            PHINode::Create(type, 0, info.name, bb) :
+            PHINode::Create(type, 0, info.name, &bb->front());
+    }
+
+
+    auto LLVMVisitor::AddPhiOperands(u32 var, llvm::PHINode* phi)
+        -> llvm::Value*
+    {
+        using namespace llvm;
+
+        for (BasicBlock* pred : predecessors(phi->getParent()))
+        {
+            phi->addIncoming(ReadLocalVar(pred, var), pred);
+        }
+        return TryRemoveTrivialPhi(phi);
+    }
+
+
+    auto LLVMVisitor::TryRemoveTrivialPhi(llvm::PHINode* phi)
+        -> llvm::Value*
+    {
+        using namespace llvm;
+
+        Value* same{nullptr};
+        for (Value* op : phi->incoming_values())
+        {
+            if (op == same || op == phi)
+            {
+                // Unique value or self reference.
+                continue;
+            }
+            if (same)
+            {
+                // The phi merges at least two values: not trivial.
+                return phi;
+            }
+            same = op;
+        }
+
+        if (!same)
+        {
+            // The phi is unreachable or in the entry block.
+            same = UndefValue::get(phi->getType());
+        }
+
+        // Remember all the users except the phi itself. WeakVH becomes null if the user
+        // is removed by one of the recursive calls.
+        SmallVector<WeakVH, 8> users;
+        for (User* user : phi->users())
+        {
+            if (user != phi && isa<PHINode>(user))
+            {
+                users.emplace_back(user);
+            }
+        }
+
+        // Reroute all the uses of the phi to same (the definitions are TrackingVH, so they
+        // are updated too) and remove the phi.
+        // Incomplete phis have no operands, so they are never removed before their block is sealed.
+        phi->replaceAllUsesWith(same);
+        phi->eraseFromParent();
+
+        // same can be a phi that the recursive calls replace.
+        TrackingVH<Value> result = same;
+
+        // Try to recursively remove all the phi users, which might have become trivial. A phi
+        // still getting its operands (AddPhiOperands() reading the next predecessor) can look
+        // trivial: only the complete ones are removed.
+        for (auto& user : users)
+        {
+            if (auto user_phi = dyn_cast_or_null<PHINode>(user);
+                user_phi && user_phi->getNumIncomingValues() == pred_size(user_phi->getParent()))
+            {
+                TryRemoveTrivialPhi(user_phi);
+            }
+        }
+
+        return result;
+    }
+
+
+    auto LLVMVisitor::SealBlock(llvm::BasicBlock* bb)
+        -> void
+    {
+        auto& def = current_def[bb];
+        // Copy the incomplete phis: completing them can create new entries in current_def.
+        auto incomplete = std::move(def.incomplete_phis);
+        for (auto [phi, var] : incomplete)
+        {
+            AddPhiOperands(var, phi);
+        }
+        current_def[bb].sealed = true;
+    }
+
+
+    auto LLVMVisitor::ClassType()
+        -> llvm::StructType*
+    {
+        // name, superclass, methods, method_count, fields, info.
+        auto ptr = builder->getInt8PtrTy();
+        return llvm::StructType::get(ptr, ptr, ptr, builder->getInt32Ty(), builder->getInt32Ty(), ptr);
+    }
+
+
+    auto LLVMVisitor::CacheType()
+        -> llvm::StructType*
+    {
+        using namespace llvm;
+
+        // entries (shape, target, offset), name, symbol.
+        auto ptr = builder->getInt8PtrTy();
+        auto entry = StructType::get(ptr, ptr, builder->getInt64Ty());
+        return StructType::get(ArrayType::get(entry, InlineCache::size), ptr, ptr);
+    }
+
+
+    auto LLVMVisitor::ClassDescriptor(std::string_view name)
+        -> llvm::GlobalVariable*
+    {
+        using namespace llvm;
+
+        auto symbol = ClassSymbol(name);
+        if (auto global = mod->getNamedGlobal(symbol))
+        {
+            return global;
+        }
+        // Not constant: the runtime sets its info.
+        return new GlobalVariable(*mod, ClassType(), false, GlobalValue::ExternalLinkage, nullptr, symbol);
+    }
+
+
+    auto LLVMVisitor::GlobalName(std::string_view name)
+        -> llvm::Constant*
+    {
+        using namespace llvm;
+
+        auto& constant = names[StringRef{name.data(), name.size()}];
+        if (!constant)
+        {
+            auto chars = builder->CreateGlobalString(StringRef{name.data(), name.size()}, ".name", 0, mod.get());
+            constant = ConstantExpr::getBitCast(chars, builder->getInt8PtrTy());
+        }
+        return constant;
+    }
+
+
+    auto LLVMVisitor::NewInlineCache(std::string_view name)
+        -> llvm::GlobalVariable*
+    {
+        using namespace llvm;
+
+        auto type = CacheType();
+        auto init = ConstantStruct::get(type, {
+            ConstantAggregateZero::get(type->getElementType(0)),
+            GlobalName(name),
+            ConstantPointerNull::get(builder->getInt8PtrTy())
+        });
+        return new GlobalVariable(*mod, type, false, GlobalValue::PrivateLinkage, init, ".ic");
+    }
+
+
+    auto LLVMVisitor::CacheEntry(llvm::GlobalVariable* cache, unsigned field, llvm::Type* type)
+        -> llvm::Value*
+    {
+        // cache.entries[0].field
+        auto address = builder->CreateInBoundsGEP(CacheType(), cache,
+            {builder->getInt32(0), builder->getInt32(0), builder->getInt32(0), builder->getInt32(field)});
+        return builder->CreateLoad(type, address, "ic.entry");
+    }
+
+
+    auto LLVMVisitor::FieldAddress(llvm::Value* object, llvm::Value* offset, llvm::Type* type)
+        -> llvm::Value*
+    {
+        auto address = builder->CreateInBoundsGEP(builder->getInt8Ty(), object, offset);
+        return builder->CreateBitCast(address, llvm::PointerType::getUnqual(type));
+    }
+
+
+    auto LLVMVisitor::CheckShape(llvm::Value* value, llvm::GlobalVariable* cache, llvm::BasicBlock* miss_bb)
+        -> llvm::Value*
+    {
+        using namespace llvm;
+
+        auto object_bits = builder->getInt64(LoxValue::object_bits);
+        auto is_object = builder->CreateICmpEQ(builder->CreateAnd(value, object_bits), object_bits, "is.obj");
+        BasicBlock* object_bb = BasicBlock::Create(*context, "ic.obj", current_func);
+        builder->CreateCondBr(is_object, object_bb, miss_bb, Likely());
+        SetCurrentBlock(object_bb);
+        SealBlock(object_bb);
+
+        // Any object: the shape of the other types is never in a cache.
+        auto object = builder->CreateIntToPtr(builder->CreateAnd(value, ~LoxValue::object_bits),
+            builder->getInt8PtrTy(), "obj");
+        auto shape = builder->CreateLoad(builder->getInt8PtrTy(),
+            FieldAddress(object, builder->getInt64(offsetof(ObjInstance, shape)), builder->getInt8PtrTy()), "shape");
+        auto hit = builder->CreateICmpEQ(shape, CacheEntry(cache, 0, builder->getInt8PtrTy()), "ic.hit");
+        BasicBlock* hit_bb = BasicBlock::Create(*context, "ic.hit", current_func);
+        builder->CreateCondBr(hit, hit_bb, miss_bb, Likely());
+        SetCurrentBlock(hit_bb);
+        SealBlock(hit_bb);
+        return object;
+    }
+
+
+    auto LLVMVisitor::WriteBarrier(llvm::Value* object, llvm::Value* value)
+        -> void
+    {
+        using namespace llvm;
+
+        // Remember an old object the first time it gets a pointer (maybe to a young object).
+        auto object_bits = builder->getInt64(LoxValue::object_bits);
+        auto is_object = builder->CreateICmpEQ(builder->CreateAnd(value, object_bits), object_bits);
+        auto gc = builder->CreateLoad(builder->getInt8Ty(),
+            builder->CreateConstInBoundsGEP1_32(builder->getInt8Ty(), object, offsetof(Obj, gc)), "gc");
+        auto bits = builder->CreateAnd(gc, builder->getInt8(Obj::gc_old | Obj::gc_remembered));
+        auto remember = builder->CreateAnd(is_object, builder->CreateICmpEQ(bits, builder->getInt8(Obj::gc_old)));
+
+        BasicBlock* remember_bb = BasicBlock::Create(*context, "gc.remember", current_func);
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "gc.barrier.exit", current_func);
+        builder->CreateCondBr(remember, remember_bb, exit_bb, Unlikely());
+
+        SetCurrentBlock(remember_bb);
+        SealBlock(remember_bb);
+        auto remember_func = RuntimeFunction("lox_gc_remember", FunctionType::get(builder->getVoidTy(),
+            {builder->getInt8PtrTy()}, false));
+        builder->CreateCall(remember_func, {object});
+        builder->CreateBr(exit_bb);
+
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+    }
+
+
+    auto LLVMVisitor::AccessTag(llvm::StringRef name)
+        -> llvm::MDNode*
+    {
+        // The metadata nodes are uniqued by the context.
+        llvm::MDBuilder md{*context};
+        auto type = md.createTBAAScalarTypeNode(name, md.createTBAARoot("lox"));
+        return md.createTBAAStructTagNode(type, type, 0);
+    }
+
+
+    auto LLVMVisitor::ListIndex(llvm::Value* index, llvm::Value* index_int, llvm::Value* length)
+        -> std::pair<llvm::Value*, llvm::Value*>
+    {
+        using namespace llvm;
+
+        if (index_int)
+        {
+            return {index_int, builder->CreateICmpULT(index_int, length, "in.bounds")};
+        }
+        // A value that is not a number is a NaN, not equal to any integer. Poison when the
+        // number is out of range: frozen, the bounds check fails anyway (negative indexes too).
+        auto number = ToNumber(index);
+        auto integer = builder->CreateFreeze(builder->CreateFPToSI(number, builder->getInt64Ty()), "index");
+        auto exact = builder->CreateFCmpOEQ(builder->CreateSIToFP(integer, builder->getDoubleTy()),
+            number, "index.exact");
+        return {integer, builder->CreateAnd(exact, builder->CreateICmpULT(integer, length, "in.bounds"))};
+    }
+
+
+    auto LLVMVisitor::ElementAddress(llvm::Value* list, llvm::Value* index, llvm::Value* index_int,
+        llvm::BasicBlock* slow_bb)
+        -> std::pair<llvm::Value*, llvm::Value*>
+    {
+        using namespace llvm;
+
+        BasicBlock* object_bb = BasicBlock::Create(*context, "index.obj", current_func);
+        BasicBlock* ok_bb = BasicBlock::Create(*context, "index.ok", current_func);
+
+        auto object_bits = builder->getInt64(LoxValue::object_bits);
+        auto is_object = builder->CreateICmpEQ(builder->CreateAnd(list, object_bits), object_bits, "is.obj");
+        builder->CreateCondBr(is_object, object_bb, slow_bb, Likely());
+        SetCurrentBlock(object_bb);
+        SealBlock(object_bb);
+
+        // Every object has a u32 at offset 4: the length is loaded before the type is checked.
+        auto ptr = builder->CreateIntToPtr(builder->CreateAnd(list, ~LoxValue::object_bits),
+            builder->getInt8PtrTy(), "list");
+        auto type = builder->CreateLoad(builder->getInt8Ty(), ptr, "type");
+        type->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+        auto length = builder->CreateLoad(builder->getInt32Ty(),
+            FieldAddress(ptr, builder->getInt64(offsetof(ObjList, length)), builder->getInt32Ty()), "length");
+        length->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+        auto [integer, in_bounds] = ListIndex(index, index_int, builder->CreateZExt(length, builder->getInt64Ty()));
+        auto is_list = builder->CreateICmpEQ(type, builder->getInt8(static_cast<u8>(ObjType::List)), "is.list");
+        builder->CreateCondBr(builder->CreateAnd(is_list, in_bounds), ok_bb, slow_bb, Likely());
+
+        SetCurrentBlock(ok_bb);
+        SealBlock(ok_bb);
+        auto elements = builder->CreateLoad(builder->getInt8PtrTy(),
+            FieldAddress(ptr, builder->getInt64(offsetof(ObjList, elements)), builder->getInt8PtrTy()), "elements");
+        elements->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+        auto values = builder->CreateBitCast(
+            builder->CreateConstInBoundsGEP1_32(builder->getInt8Ty(), elements, sizeof(ObjSlots)),
+            PointerType::getUnqual(builder->getInt64Ty()));
+        return {builder->CreateInBoundsGEP(builder->getInt64Ty(), values, integer, "element"), elements};
+    }
+
+
+    auto LLVMVisitor::PackedAddress(const PackedList& list, std::string_view name, const ExprNode& index_node,
+        llvm::Value* index, llvm::Value* index_int, const Token& t)
+        -> llvm::Value*
+    {
+        using namespace llvm;
+
+        // The innermost fast loop with this counter knows if it stays within the length.
+        bool in_range = false;
+        auto index_name = NumericLoop::VarName(index_node);
+        for (auto fast = fast_loops.rbegin(); fast != fast_loops.rend(); ++fast)
+        {
+            if (fast->counter == index_name)
+            {
+                in_range = fast->in_range.contains(name);
+                break;
+            }
+        }
+
+        Value* integer = index_int;
+        if (!index_int || !in_range)
+        {
+            auto [checked, in_bounds] = ListIndex(index, index_int, list.length);
+            BasicBlock* error_bb = BasicBlock::Create(*context, "index.error", current_func);
+            BasicBlock* ok_bb = BasicBlock::Create(*context, "index.ok", current_func);
+            builder->CreateCondBr(in_bounds, ok_bb, error_bb, Likely());
+            SetCurrentBlock(error_bb);
+            SealBlock(error_bb);
+            IndexError(list.value, index, t);
+            SetCurrentBlock(ok_bb);
+            SealBlock(ok_bb);
+            integer = checked;
+        }
+        return builder->CreateInBoundsGEP(builder->getDoubleTy(), list.elements, integer, "element");
+    }
+
+
+    auto LLVMVisitor::GuardList(u32 var, llvm::BasicBlock* generic_bb)
+        -> PackedList
+    {
+        using namespace llvm;
+
+        auto value = ReadVar(var);
+        BasicBlock* object_bb = BasicBlock::Create(*context, "guard.obj", current_func);
+        BasicBlock* list_bb = BasicBlock::Create(*context, "guard.list", current_func);
+        BasicBlock* packed_bb = BasicBlock::Create(*context, "guard.packed", current_func);
+
+        auto object_bits = builder->getInt64(LoxValue::object_bits);
+        auto is_object = builder->CreateICmpEQ(builder->CreateAnd(value, object_bits), object_bits, "is.obj");
+        builder->CreateCondBr(is_object, object_bb, generic_bb, Likely());
+        SetCurrentBlock(object_bb);
+        SealBlock(object_bb);
+        auto ptr = builder->CreateIntToPtr(builder->CreateAnd(value, ~LoxValue::object_bits),
+            builder->getInt8PtrTy(), "list");
+        auto type = builder->CreateLoad(builder->getInt8Ty(), ptr, "type");
+        type->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+        auto is_list = builder->CreateICmpEQ(type, builder->getInt8(static_cast<u8>(ObjType::List)), "is.list");
+        builder->CreateCondBr(is_list, list_bb, generic_bb, Likely());
+
+        SetCurrentBlock(list_bb);
+        SealBlock(list_bb);
+        auto elements = builder->CreateLoad(builder->getInt8PtrTy(),
+            FieldAddress(ptr, builder->getInt64(offsetof(ObjList, elements)), builder->getInt8PtrTy()), "elements");
+        elements->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+        auto storage = builder->CreateLoad(builder->getInt8Ty(), elements, "storage");
+        storage->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+        auto length = builder->CreateLoad(builder->getInt32Ty(),
+            FieldAddress(ptr, builder->getInt64(offsetof(ObjList, length)), builder->getInt32Ty()), "length");
+        length->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+        auto is_packed = builder->CreateICmpEQ(storage, builder->getInt8(static_cast<u8>(ObjType::Doubles)), "is.packed");
+        builder->CreateCondBr(is_packed, packed_bb, generic_bb, Likely());
+
+        SetCurrentBlock(packed_bb);
+        SealBlock(packed_bb);
+        auto first = builder->CreateBitCast(
+            builder->CreateConstInBoundsGEP1_32(builder->getInt8Ty(), elements, sizeof(ObjSlots)),
+            PointerType::getUnqual(builder->getDoubleTy()), "doubles");
+        return PackedList{value, first, builder->CreateZExt(length, builder->getInt64Ty(), "length")};
+    }
+
+
+    auto LLVMVisitor::FindPackedList(std::string_view name) const
+        -> const PackedList*
+    {
+        if (name.empty())
+        {
+            return nullptr;
+        }
+        for (auto fast = fast_loops.rbegin(); fast != fast_loops.rend(); ++fast)
+        {
+            if (auto it = fast->lists.find(name); it != fast->lists.end())
+            {
+                return &it->second;
+            }
+        }
+        return nullptr;
+    }
+
+
+    auto LLVMVisitor::IndexError(llvm::Value* list, llvm::Value* index, const Token& t)
+        -> void
+    {
+        using namespace llvm;
+
+        auto error = RuntimeFunction("lox_index_error", FunctionType::get(builder->getVoidTy(),
+            {builder->getInt64Ty(), builder->getInt64Ty(), builder->getInt32Ty()}, false));
+        auto error_func = cast<Function>(error.getCallee());
+        error_func->setDoesNotReturn();
+        error_func->addFnAttr(Attribute::Cold);
+        builder->CreateCall(error, {list, index, builder->getInt32(static_cast<u32>(t.Line()))});
+        builder->CreateUnreachable();
+    }
+
+
+    auto LLVMVisitor::EqualObjects(llvm::Value* left, llvm::Value* right)
+        -> llvm::Value*
+    {
+        using namespace llvm;
+
+        // Only two different objects can be equal strings.
+        auto bits_eq = builder->CreateICmpEQ(left, right, "eq.bits");
+        auto object_bits = builder->getInt64(LoxValue::object_bits);
+        auto both_objects = builder->CreateICmpEQ(builder->CreateAnd(builder->CreateAnd(left, right), object_bits),
+            object_bits, "both.obj");
+        auto slow = builder->CreateAnd(both_objects, builder->CreateNot(bits_eq));
+
+        BasicBlock* entry_bb = builder->GetInsertBlock();
+        BasicBlock* slow_bb = BasicBlock::Create(*context, "eq.slow", current_func);
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "eq.exit", current_func);
+        builder->CreateCondBr(slow, slow_bb, exit_bb, Unlikely());
+
+        SetCurrentBlock(slow_bb);
+        SealBlock(slow_bb);
+        auto equal = RuntimeFunction("lox_equal", FunctionType::get(builder->getInt32Ty(),
+            {builder->getInt64Ty(), builder->getInt64Ty()}, false));
+        auto strings_eq = builder->CreateICmpNE(builder->CreateCall(equal, {left, right}), builder->getInt32(0));
+        builder->CreateBr(exit_bb);
+
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+        auto phi = builder->CreatePHI(builder->getInt1Ty(), 2, "eq");
+        phi->addIncoming(bits_eq, entry_bb);
+        phi->addIncoming(strings_eq, slow_bb);
+        return phi;
+    }
+
+
+    auto LLVMVisitor::CallMethod(llvm::Value* function, llvm::ArrayRef<llvm::Value*> args)
+        -> llvm::CallInst*
+    {
+        using namespace llvm;
+
+        std::vector<Type*> params(args.size(), builder->getInt64Ty());
+        auto proto = FunctionType::get(builder->getInt64Ty(), params, false);
+        auto callee = builder->CreateBitCast(function, PointerType::getUnqual(proto));
+        auto call = builder->CreateCall(proto, callee, args, "call");
+        call->setCallingConv(CallingConv::Tail);
+        return call;
+    }
+
+
+    auto LLVMVisitor::DefineConstructor(const ClassStmtNode& node, const FunStmtNode* init)
+        -> void
+    {
+        using namespace llvm;
+
+        // The parameters of init without this.
+        std::size_t arity = init ? init->parameters.size() - 1 : 0;
+        Function* func = DeclareFunction(node.name, arity);
+        if (!func->empty())
+        {
+            ErrorAt(node.name, "Redefinition of functions is not supported.");
+        }
+        DefineFunctionValue(node.name.Lexeme(), func, ObjType::Class);
+
+        auto enclosing_func = current_func;
+        auto enclosing_block = current_block;
+        auto enclosing_frame = frame;
+        auto enclosing_frame_slots = frame_slots;
+
+        current_func = func;
+        BasicBlock* bb = BasicBlock::Create(*context, "entry", func);
+        SetCurrentBlock(bb);
+        SealBlock(bb);
+        StartFrame();
+
+        auto new_instance = RuntimeFunction("lox_instance_new", FunctionType::get(builder->getInt64Ty(),
+            {builder->getInt8PtrTy()}, false));
+        Value* instance = builder->CreateCall(new_instance,
+            {ConstantExpr::getBitCast(ClassDescriptor(node.name.Lexeme()), builder->getInt8PtrTy())}, "instance");
+        Root(instance);
+        if (init)
+        {
+            // init returns this.
+            SmallVector<Value*, 4> args{instance};
+            for (auto& arg : func->args())
+            {
+                args.push_back(&arg);
+            }
+            auto call = builder->CreateCall(DeclareFunction(init->name, init->parameters.size()), args);
+            call->setCallingConv(CallingConv::Tail);
+        }
+        PopFrame();
+        builder->CreateRet(instance);
+        FinishFrame();
+
+        current_func = enclosing_func;
+        current_block = enclosing_block;
+        frame = enclosing_frame;
+        frame_slots = enclosing_frame_slots;
+        if (current_block)
+        {
+            builder->SetInsertPoint(current_block);
+        }
+        else
+        {
+            builder->ClearInsertionPoint();
+        }
+    }
+
+    auto LLVMVisitor::ClosureType()
+        -> llvm::StructType*
+    {
+        // type, gc, count, arity, function, name.
+        auto ptr = builder->getInt8PtrTy();
+        return llvm::StructType::get(builder->getInt8Ty(), builder->getInt8Ty(), builder->getInt16Ty(),
+            builder->getInt32Ty(), ptr, ptr);
+    }
+
+
+    auto LLVMVisitor::ClosureFunctionType(std::size_t arity)
+        -> llvm::FunctionType*
+    {
+        std::vector<llvm::Type*> params(arity + 1, builder->getInt64Ty());
+        params[0] = builder->getInt8PtrTy();
+        return llvm::FunctionType::get(builder->getInt64Ty(), params, false);
+    }
+
+
+    auto LLVMVisitor::FunctionValue(std::string_view name)
+        -> llvm::Constant*
+    {
+        using namespace llvm;
+
+        auto symbol = ValueSymbol(name);
+        auto global = mod->getNamedGlobal(symbol);
+        if (!global)
+        {
+            global = new GlobalVariable(*mod, ClosureType(), true, GlobalValue::ExternalLinkage, nullptr, symbol);
+            global->setAlignment(Align{8});
+        }
+        return ConstantExpr::getOr(ConstantExpr::getPtrToInt(global, builder->getInt64Ty()),
+            builder->getInt64(LoxValue::object_bits));
+    }
+
+
+    auto LLVMVisitor::DefineFunctionValue(std::string_view name, llvm::Function* func, ObjType type)
+        -> void
+    {
+        using namespace llvm;
+
+        auto arity = func->arg_size();
+        auto adapter = Function::Create(ClosureFunctionType(arity), GlobalValue::PrivateLinkage,
+            func->getName() + ".value", *mod);
+        adapter->setCallingConv(CallingConv::Tail);
+        adapter->addFnAttr(Attribute::NoUnwind);
+
+        // The record of a global function has no captured values: only the arguments are passed.
+        IRBuilder<> b{BasicBlock::Create(*context, "entry", adapter)};
+        SmallVector<Value*, 4> args;
+        for (unsigned i = 1; i < adapter->arg_size(); ++i)
+        {
+            args.push_back(adapter->getArg(i));
+        }
+        auto call = b.CreateCall(func, args);
+        call->setCallingConv(CallingConv::Tail);
+        call->setTailCallKind(CallInst::TCK_MustTail);
+        b.CreateRet(call);
+
+        FunctionValue(name);
+        auto global = mod->getNamedGlobal(ValueSymbol(name));
+        global->setInitializer(ConstantStruct::get(ClosureType(), {
+            builder->getInt8(static_cast<u8>(type)),
+            builder->getInt8(0),
+            builder->getInt16(0),
+            builder->getInt32(static_cast<u32>(arity)),
+            ConstantExpr::getBitCast(adapter, builder->getInt8PtrTy()),
+            GlobalName(name)
+        }));
+    }
+
+
+    auto LLVMVisitor::DefineClosure(const FunStmtNode& node, const ClosureAnalysis::Closure& closure)
+        -> void
+    {
+        using namespace llvm;
+
+        auto count = closure.captured.size();
+        if (count > std::numeric_limits<u16>::max())
+        {
+            ErrorAt(node.name, "Too many captured variables.");
+        }
+        ClosureContext closure_context{nullptr, &closure, {}};
+        for (const auto& variable : closure.captured)
+        {
+            auto var = FindVar(variable.name);
+            if (!var)
+            {
+                ErrorAt(node.name, "Undefined captured variable.");
+            }
+            closure_context.captured.push_back(*var);
+        }
+
+        auto func = Function::Create(ClosureFunctionType(node.parameters.size()), GlobalValue::InternalLinkage,
+            current_func->getName() + "." + node.name.Lexeme(), *mod);
+        func->setCallingConv(CallingConv::Tail);
+        func->addFnAttr(Attribute::NoUnwind);
+        closure_context.function = func;
+        DefineFunction(node, &closure_context);
+
+        // The record has the layout of ObjClosure: the one of a closure that doesn't escape
+        // lives in the frame of the function (only its captured values are used).
+        Value* value = nullptr;
+        Value* record = nullptr;
+        if (closure.escapes)
+        {
+            auto new_closure = RuntimeFunction("lox_closure_new", FunctionType::get(builder->getInt64Ty(),
+                {builder->getInt8PtrTy(), builder->getInt8PtrTy(), builder->getInt32Ty(), builder->getInt32Ty()}, false));
+            value = builder->CreateCall(new_closure, {
+                ConstantExpr::getBitCast(func, builder->getInt8PtrTy()),
+                GlobalName(node.name.Lexeme()),
+                builder->getInt32(static_cast<u32>(node.parameters.size())),
+                builder->getInt32(static_cast<u32>(count))
+            }, "closure");
+            record = builder->CreateIntToPtr(builder->CreateAnd(value, ~LoxValue::object_bits),
+                builder->getInt8PtrTy());
+        }
+        else
+        {
+            auto& entry = current_func->getEntryBlock();
+            IRBuilder<> b{&entry, entry.begin()};
+            auto slots = b.CreateAlloca(b.getInt64Ty(), b.getInt32(static_cast<u32>(3 + count)), "closure.record");
+            record = builder->CreateBitCast(slots, builder->getInt8PtrTy());
+            value = builder->CreatePtrToInt(slots, builder->getInt64Ty());
+        }
+
+        // The captured values are copied, the shared variables by their box or their address.
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto captured = ReadLocalVar(current_block, closure_context.captured[i]);
+            builder->CreateStore(captured, FieldAddress(record,
+                builder->getInt64(sizeof(ObjClosure) + i * sizeof(u64)), builder->getInt64Ty()));
+        }
+
+        // The address of a record in the frame is not a Lox value: it is not rooted.
+        auto var = DeclareVar(node.name, value, !closure.escapes);
+        if (!closures->IsAssigned(node.name))
+        {
+            variables[var].known = KnownClosure{func, node.parameters.size(), closure.escapes, !closure.escapes};
+        }
+    }
+
+    // ********************************* UTILITY *********************************
+
+    // ******************************** VISIT STATEMENTS *************************************
+
+    auto LLVMVisitor::operator()(const ExprStmtNodePtr& node)
+        -> void
+    {
+        Visit(node->expr);
+    }
+
+
+    auto LLVMVisitor::operator()(const PrintStmtNodePtr& node)
+        -> void
+    {
+        using namespace llvm;
+
+        Visit(node->expr);
+        auto print = RuntimeFunction("lox_print", FunctionType::get(builder->getVoidTy(),
+            {builder->getInt64Ty()}, false));
+        builder->CreateCall(print, {current_value});
+    }
+
+
+    auto LLVMVisitor::operator()(const VarStmtNodePtr& node)
+        -> void
+    {
+        Visit(node->initializer);
+        // A variable of the top-level code used by the functions (declaring it again reuses it).
+        auto name = node->name.Lexeme();
+        if (!closures && scopes.size() == 1 && declarations && declarations->variables.contains(name))
+        {
+            WriteVar(BindGlobal(name), current_value, current_number);
+            return;
+        }
+        DeclareVar(node->name, current_value, current_number);
+    }
+
+
+    auto LLVMVisitor::operator()(const BlockStmtNodePtr& node)
+        -> void
+    {
+        BeginScope();
+        for (const auto& s : node->statements)
+        {
+            Visit(s);
+        }
+        EndScope();
+    }
 
-        BasicBlock* bb = BasicBlock::Create(
-            *context,
-            "entry",
-            func
-        );
 
+    auto LLVMVisitor::operator()(const FunStmtNodePtr& node)
+        -> void
+    {
+        // A function declared in a function is a closure.
+        if (closures)
+        {
+            if (auto closure = closures->FindClosure(*node))
+            {
+                DefineClosure(*node, *closure);
+                return;
+            }
+        }
 
-        
+        if (lazy_functions)
+        {
+            // The constructors of the classes are functions too.
+            if (classes.contains(node->name.Lexeme()))
+            {
+                ErrorAt(node->name, "Redefinition of functions is not supported.");
+            }
+            for (auto declared : lazy_function_nodes)
+            {
+                if (declared->name.Lexeme() == node->name.Lexeme())
+                {
+                    ErrorAt(node->name, "Redefinition of functions is not supported.");
+                }
+            }
+            DeclareFunction(node->name, node->parameters.size());
+            lazy_function_nodes.push_back(node.get());
+            return;
+        }
+
+        DefineFunction(*node);
     }
 
 
     auto LLVMVisitor::operator()(const ReturnStmtNodePtr& node)
         -> void
     {
+        using namespace llvm;
+
+        // Only lox_main returns void.
+        if (current_func->getReturnType()->isVoidTy())
+        {
+            ErrorAt(node->keyword, "Can't return from top-level code.");
+        }
+
+        if (auto call = TailCall(node->value); call && !IsNative(*call))
+        {
+            // The frame is popped before the call: the callee roots its arguments.
+            builder->CreateRet(GenerateCall(*call, true));
+        }
+        else
+        {
+            Visit(node->value);
+            PopFrame();
+            builder->CreateRet(current_value);
+        }
 
+        // The code after the return is unreachable, but it still needs a block.
+        BasicBlock* dead_bb = BasicBlock::Create(*context, "return.dead", current_func);
+        SetCurrentBlock(dead_bb);
+        SealBlock(dead_bb);
     }
 
 
@@ -170,28 +1956,35 @@ namespace lox
         using namespace llvm;
 
         // Create basic blocks for the 3 block instructions of the if.
+        // The blocks are inserted in the function when they are reached, so the nested blocks
+        // come before the exit block.
         BasicBlock* true_bb = BasicBlock::Create(*context, "if.true", current_func);
-        BasicBlock* false_bb = BasicBlock::Create(*context, "if.false", current_func);
-        BasicBlock* exit_bb = BasicBlock::Create(*context, "if.exit", current_func);
+        BasicBlock* false_bb = node->else_branch ? 
+            BasicBlock::Create(*context, "if.false") : nullptr;
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "if.exit");
 
-
-        builder->SetInsertPoint(current_block);
         Visit(node->condition);
-        auto condition = current_value;
-        builder->CreateCondBr(condition, true_bb, false_bb);
+        auto condition = ToCondition(current_value);
+        builder->CreateCondBr(condition, true_bb, false_bb ? false_bb : exit_bb);
         
+        // The only predecessor of the branches is the condition block.
         SetCurrentBlock(true_bb);
+        SealBlock(true_bb);
         Visit(node->then_branch);
         builder->CreateBr(exit_bb);
 
         if (node->else_branch)
         {
+            false_bb->insertInto(current_func);
             SetCurrentBlock(false_bb);
+            SealBlock(false_bb);
             Visit(*node->else_branch);
             builder->CreateBr(exit_bb);
         }
 
+        exit_bb->insertInto(current_func);
         SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
     }
 
 
@@ -201,25 +1994,261 @@ namespace lox
     {
         using namespace llvm;
 
-        // Create basic blocks for the 3 block instructions of the while.
+        // The exit block is inserted in the function after the body.
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "while.exit");
+
+        // Limit the copies of the nested loops.
+        std::optional<NumericLoop> numeric;
+        if (fast_loops.size() < max_fast_depth)
+        {
+            numeric.emplace(*node, shared_names);
+        }
+        // The analysis assumes len() is the native function.
+        if (!numeric || numeric->Empty() || (numeric->CallsLength() && FindVar("len")))
+        {
+            GenerateLoop(*node, exit_bb);
+        }
+        else
+        {
+            // Guard: the packed lists hold lists with a Doubles buffer (they are not declared in
+            // the loop), whose buffer and length are loaded once.
+            BasicBlock* generic_bb = BasicBlock::Create(*context, "loop.generic");
+            FastLoop fast{&*numeric, {}, {}, {}, {}};
+            for (auto name : numeric->Lists())
+            {
+                if (auto var = FindVar(name))
+                {
+                    fast.lists.emplace(name, GuardList(*var, generic_bb));
+                }
+            }
+
+            // The numeric variables declared before the loop hold numbers (the ones declared in
+            // the loop are initialized with numbers).
+            Value* check = builder->getTrue();
+            for (auto name : numeric->Variables())
+            {
+                if (auto var = FindVar(name))
+                {
+                    check = builder->CreateAnd(check, IsNumber(ReadLocalVar(current_block, *var)));
+                }
+            }
+
+            // The counter and the variable of its bound hold integers.
+            if (const auto& counter = numeric->IntegerCounter())
+            {
+                auto var = FindVar(counter->name);
+                auto bound = counter->bound.empty() ? std::nullopt : FindVar(counter->bound);
+                auto length = fast.lists.find(counter->length);
+                if (var && (counter->bound.empty() || bound) && (counter->length.empty() || length != fast.lists.end()))
+                {
+                    check = builder->CreateAnd(check, GuardInteger(*var, counter->name, fast.integers));
+                    if (bound)
+                    {
+                        check = builder->CreateAnd(check, GuardInteger(*bound, counter->bound, fast.integers));
+                    }
+
+                    // In the body the counter is in [start, bound) going up, (bound, start] going
+                    // down (the bound included for <= and >=): the lists it indexes need no
+                    // bounds check if this range is within their length.
+                    auto start = ReadLocalVar(current_block, fast.integers[counter->name]);
+                    Value* limit = bound ? ReadLocalVar(current_block, fast.integers[counter->bound]) :
+                        !counter->length.empty() ? length->second.length :
+                        builder->getInt64(static_cast<u64>(static_cast<i64>(counter->literal)));
+                    auto low = counter->up ? start : limit;
+                    auto high = counter->up ? limit : start;
+                    bool high_excluded = counter->up && !counter->inclusive;
+                    auto min = builder->getInt64(static_cast<u64>(counter->up || counter->inclusive ? 0 : -1));
+                    fast.counter = counter->name;
+                    for (auto name : numeric->CounterIndexed())
+                    {
+                        if (auto list = fast.lists.find(name); list != fast.lists.end())
+                        {
+                            auto in_range = builder->CreateAnd(builder->CreateICmpSGE(low, min),
+                                high_excluded ? builder->CreateICmpSLE(high, list->second.length) :
+                                    builder->CreateICmpSLT(high, list->second.length), "in.range");
+                            check = builder->CreateAnd(check, in_range);
+                            fast.in_range.insert(name);
+                        }
+                    }
+                }
+            }
+
+            BasicBlock* fast_bb = BasicBlock::Create(*context, "loop.fast", current_func);
+            builder->CreateCondBr(check, fast_bb, generic_bb, Likely());
+
+            SetCurrentBlock(fast_bb);
+            SealBlock(fast_bb);
+            fast_loops.push_back(std::move(fast));
+            GenerateLoop(*node, exit_bb);
+            fast_loops.pop_back();
+
+            generic_bb->insertInto(current_func);
+            SetCurrentBlock(generic_bb);
+            SealBlock(generic_bb);
+            GenerateLoop(*node, exit_bb);
+        }
+
+        exit_bb->insertInto(current_func);
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+    }
+
+
+    auto LLVMVisitor::GuardInteger(u32 var, std::string_view name,
+        std::unordered_map<std::string_view, u32>& integers)
+        -> llvm::Value*
+    {
+        using namespace llvm;
+
+        auto value = ToNumber(ReadLocalVar(current_block, var));
+        auto in_range = builder->CreateFCmpOLE(
+            builder->CreateUnaryIntrinsic(Intrinsic::fabs, value),
+            ConstantFP::get(builder->getDoubleTy(), NumericLoop::max_integer), "int.range");
+        // Poison when the value is out of range: frozen, the check of the range fails anyway.
+        auto integer = builder->CreateFreeze(builder->CreateFPToSI(value, builder->getInt64Ty()), "int");
+        // The bits are compared: -0 == 0, but the integer 0 would print 0 and make 1/i +inf.
+        auto exact = builder->CreateICmpEQ(
+            builder->CreateBitCast(builder->CreateSIToFP(integer, builder->getDoubleTy()), builder->getInt64Ty()),
+            builder->CreateBitCast(value, builder->getInt64Ty()), "int.exact");
+
+        // The integer variable has no GC slot and no scope: it is found by IntegerVar().
+        auto id = static_cast<u32>(variables.size());
+        variables.push_back(VarInfo{name, 0});
+        WriteLocalVar(current_block, id, integer);
+        integers[name] = id;
+        return builder->CreateAnd(in_range, exact);
+    }
+
+
+    auto LLVMVisitor::IsNumericVar(std::string_view name) const
+        -> bool
+    {
+        return std::any_of(fast_loops.begin(), fast_loops.end(), [name](const FastLoop& fast)
+        {
+            return fast.loop->IsNumeric(name);
+        });
+    }
+
+
+    auto LLVMVisitor::IntegerVar(std::string_view name) const
+        -> std::optional<u32>
+    {
+        for (auto fast = fast_loops.rbegin(); fast != fast_loops.rend(); ++fast)
+        {
+            if (auto it = fast->integers.find(name); it != fast->integers.end())
+            {
+                return it->second;
+            }
+        }
+        return std::nullopt;
+    }
+
+
+    auto LLVMVisitor::IntegerConstant(f64 value)
+        -> llvm::Value*
+    {
+        if (fast_loops.empty() || !(value >= -NumericLoop::max_integer && value <= NumericLoop::max_integer) ||
+            std::floor(value) != value)
+        {
+            return nullptr;
+        }
+        return builder->getInt64(static_cast<u64>(static_cast<i64>(value)));
+    }
+
+
+    auto LLVMVisitor::GenerateLoop(const WhileStmtNode& node, llvm::BasicBlock* exit_bb)
+        -> void
+    {
+        using namespace llvm;
+
+        // Create basic blocks for the condition and the body of the while.
         BasicBlock* cond_bb = BasicBlock::Create(*context, "while.cond", current_func);
         BasicBlock* body_bb = BasicBlock::Create(*context, "while.body", current_func);
-        BasicBlock* exit_bb = BasicBlock::Create(*context, "while.exit", current_func);
 
         // Create a branch to the while conditional block. 
-        builder->SetInsertPoint(current_block);
         builder->CreateBr(cond_bb);
         
+        // The conditional block is sealed only after the back edge from the body is created.
         SetCurrentBlock(cond_bb);
-        Visit(node->condition);
-        auto condition = current_value;
-        // TODO: does condition need to be truncated? What's the type?
+        Visit(node.condition);
+        auto condition = ToCondition(current_value);
         builder->CreateCondBr(condition, body_bb, exit_bb);
 
         SetCurrentBlock(body_bb);
-        Visit(node->body);
+        SealBlock(body_bb);
+        Visit(node.body);
         builder->CreateBr(cond_bb);
-        SetCurrentBlock(exit_bb);
+        SealBlock(cond_bb);
+    }
+
+
+    auto LLVMVisitor::operator()(const ClassStmtNodePtr& node)
+        -> void
+    {
+        using namespace llvm;
+
+        auto name = node->name.Lexeme();
+        if (classes.contains(name))
+        {
+            ErrorAt(node->name, "Redefinition of classes is not supported.");
+        }
+        for (auto declared : lazy_function_nodes)
+        {
+            if (declared->name.Lexeme() == name)
+            {
+                ErrorAt(node->name, "Redefinition of functions is not supported.");
+            }
+        }
+
+        // The constructor calls init of the class or the inherited one.
+        const FunStmtNode* init = nullptr;
+        Constant* superclass = ConstantPointerNull::get(builder->getInt8PtrTy());
+        if (node->superclass)
+        {
+            auto it = classes.find(node->superclass->Lexeme());
+            if (it == classes.end())
+            {
+                ErrorAt(*node->superclass, "Superclass must be a class.");
+            }
+            init = it->second;
+            superclass = ConstantExpr::getBitCast(ClassDescriptor(it->first), builder->getInt8PtrTy());
+        }
+
+        // The methods are functions named Class.method: generated now or lazily, like the
+        // other functions.
+        auto method_type = StructType::get(builder->getInt8PtrTy(), builder->getInt64Ty(), builder->getInt8PtrTy());
+        std::vector<Constant*> methods;
+        for (const auto& method : node->methods)
+        {
+            auto method_name = method->name.Lexeme().substr(name.size() + 1);
+            if (method_name == "init")
+            {
+                init = method.get();
+            }
+            (*this)(method);
+            auto func = DeclareFunction(method->name, method->parameters.size());
+            methods.push_back(ConstantStruct::get(method_type, {
+                GlobalName(method_name),
+                builder->getInt64(method->parameters.size() - 1),
+                ConstantExpr::getBitCast(func, builder->getInt8PtrTy())
+            }));
+        }
+
+        auto table_type = ArrayType::get(method_type, methods.size());
+        auto table = new GlobalVariable(*mod, table_type, true, GlobalValue::PrivateLinkage,
+            ConstantArray::get(table_type, methods), ".methods");
+        auto descriptor = ClassDescriptor(name);
+        descriptor->setInitializer(ConstantStruct::get(ClassType(), {
+            GlobalName(name),
+            superclass,
+            ConstantExpr::getBitCast(table, builder->getInt8PtrTy()),
+            builder->getInt32(static_cast<u32>(methods.size())),
+            builder->getInt32(static_cast<u32>(node->fields.size())),
+            ConstantPointerNull::get(builder->getInt8PtrTy())
+        }));
+
+        classes[name] = init;
+        DefineConstructor(*node, init);
     }
 
     
@@ -239,37 +2268,103 @@ namespace lox
     auto LLVMVisitor::operator()(const BinaryExprNodePtr& node)
         -> void
     {
-        Log("Binary");
+        using namespace llvm;
+
         Visit(node->left);
-        auto left = current_value;
+        // Reading a variable in the right operand can replace a trivial phi.
+        TrackingVH<Value> left = current_value;
+        bool left_number = current_number;
+        WeakTrackingVH left_int = current_int;
         Visit(node->right);
-        auto right = current_value;
+        Value* right = current_value;
+        bool both_numbers = left_number && current_number;
+
+        // Step of a counter: an integer variable plus or minus a small literal stays within
+        // +-(2^52 + 2^31), a chain of them could exceed the exact doubles.
+        auto type = node->op.Type();
+        auto is_var = [](const ExprNode& n)
+        {
+            const ExprNode* e = &n;
+            while (auto g = std::get_if<GroupingNodePtr>(e))
+            {
+                e = &(*g)->expr;
+            }
+            return std::holds_alternative<VarExprNodePtr>(*e);
+        };
+        if ((type == TokenType::Plus || type == TokenType::Minus) && left_int && current_int &&
+            ((is_var(node->left) && IsStepConstant(current_int)) ||
+            (type == TokenType::Plus && is_var(node->right) && IsStepConstant(left_int))))
+        {
+            current_int = type == TokenType::Plus ?
+                builder->CreateNSWAdd(left_int, current_int, "add.int") :
+                builder->CreateNSWSub(left_int, current_int, "sub.int");
+            current_value = FromNumber(builder->CreateSIToFP(current_int, builder->getDoubleTy()));
+            current_number = true;
+            return;
+        }
+        current_int = nullptr;
+
+        if (node->op.Type() == TokenType::Plus && both_numbers)
+        {
+            current_value = FromNumber(builder->CreateFAdd(ToNumber(left), ToNumber(right), "add"));
+            current_number = true;
+            return;
+        }
 
-        if (!left || !right)
+        if (node->op.Type() == TokenType::Plus)
         {
-            // Error 
-            Error("Left or right operand in binary expression is null.");
+            // The slow path handles the operands that are not numbers.
+            auto both = builder->CreateAnd(IsNumber(left), IsNumber(right));
+            BasicBlock* fast_bb = BasicBlock::Create(*context, "add.fast", current_func);
+            BasicBlock* slow_bb = BasicBlock::Create(*context, "add.slow", current_func);
+            BasicBlock* exit_bb = BasicBlock::Create(*context, "add.exit", current_func);
+            builder->CreateCondBr(both, fast_bb, slow_bb, Likely());
+
+            SetCurrentBlock(fast_bb);
+            SealBlock(fast_bb);
+            auto sum = FromNumber(builder->CreateFAdd(ToNumber(left), ToNumber(right), "add"));
+            builder->CreateBr(exit_bb);
+
+            SetCurrentBlock(slow_bb);
+            SealBlock(slow_bb);
+            auto add = RuntimeFunction("lox_add", FunctionType::get(builder->getInt64Ty(),
+                {builder->getInt64Ty(), builder->getInt64Ty(), builder->getInt32Ty()}, false));
+            auto slow_sum = builder->CreateCall(add, {left, right,
+                builder->getInt32(static_cast<u32>(node->op.Line()))});
+            Root(slow_sum);
+            builder->CreateBr(exit_bb);
+
+            SetCurrentBlock(exit_bb);
+            SealBlock(exit_bb);
+            auto phi = builder->CreatePHI(builder->getInt64Ty(), 2, "sum");
+            phi->addIncoming(sum, fast_bb);
+            phi->addIncoming(slow_sum, slow_bb);
+            current_value = phi;
+            current_number = false;
+            return;
         }
 
+        if (!both_numbers)
+        {
+            CheckNumbers({left, right}, node->op);
+        }
+        auto l = ToNumber(left);
+        auto r = ToNumber(right);
+        current_number = true;
+
         switch (node->op.Type())
         {
-        case TokenType::Plus:   // + 
-            Log("+");
-            current_value = builder->CreateFAdd(left, right, "add");
-            break; 
         case TokenType::Minus:  // -
-            current_value = builder->CreateFSub(left, right, "sub");
+            current_value = FromNumber(builder->CreateFSub(l, r, "sub"));
             break;
         case TokenType::Star:   // *
-            current_value = builder->CreateFMul(left, right, "mul");
+            current_value = FromNumber(builder->CreateFMul(l, r, "mul"));
             break;
         case TokenType::Slash:  // /
-            current_value = builder->CreateFDiv(left, right, "div");
+            current_value = FromNumber(builder->CreateFDiv(l, r, "div"));
             break;
         default:
-            // log error
-            current_value = nullptr;
-            break;
+            ErrorAt(node->op, "Unsupported binary operation.");
         }
     }
 
@@ -277,28 +2372,25 @@ namespace lox
     auto LLVMVisitor::operator()(const UnaryExprNodePtr& node)
         -> void
     {
-        Log("Unary");
         Visit(node->right);
         auto right = current_value;
-        if (!right)
-        {
-            // Error
-            Error("Right operand in unary is null.");
-        }
 
         switch (node->op.Type())
         {
         case TokenType::Bang:   // !
-            // TODO
-            Error("Unsupported '!' unary operation.");
-            current_value = nullptr;
+            current_value = FromBool(builder->CreateNot(ToCondition(right), "not"));
+            current_number = false;
             break;
         case TokenType::Minus:  // -
-            current_value = builder->CreateFNeg(right, "neg");
+            if (!current_number)
+            {
+                CheckNumbers({right}, node->op);
+            }
+            current_value = FromNumber(builder->CreateFNeg(ToNumber(right), "neg"));
+            current_number = true;
             break; 
         default:
-            current_value = nullptr;
-            break;
+            ErrorAt(node->op, "Unsupported unary operation.");
         }
     }
 
@@ -313,142 +2405,616 @@ namespace lox
     auto LLVMVisitor::operator()(const AssignExprNodePtr& node)
         -> void
     {
-        // Check if the name is a variable. Otherwise throw exception.
+        auto var = ResolveVar(node->name);
+        Visit(node->expr);
+        if (auto integer = IntegerVar(node->name.Lexeme()))
+        {
+            // NumericLoop allows only the steps of the counter, which are exact integers (the
+            // value of a duplicate expression has no current_int, see VisitShared()).
+            if (!current_int)
+            {
+                current_int = builder->CreateFPToSI(ToNumber(current_value), builder->getInt64Ty());
+            }
+            WriteLocalVar(current_block, *integer, current_int);
+        }
+        WriteVar(var, current_value, current_number);
+        // The value of the assignment is the assigned value.
     }
 
 
     auto LLVMVisitor::operator()(const VarExprNodePtr& node)
         -> void
     {
-        // variables.emplace(
-        //     std::make_pair(std::string{node->name.Lexeme})
-        //     );
+        if (auto integer = IntegerVar(node->name.Lexeme()))
+        {
+            // Counter of a fast loop: used as a double only where it is needed.
+            current_int = ReadLocalVar(current_block, *integer);
+            current_value = FromNumber(builder->CreateSIToFP(current_int, builder->getDoubleTy()));
+            current_number = true;
+            return;
+        }
+        auto name = node->name.Lexeme();
+        if (auto var = FindVar(name))
+        {
+            current_value = ReadVar(*var);
+            current_number = IsNumericVar(name);
+            return;
+        }
+        if (IsNativeName(name))
+        {
+            ErrorAt(node->name, "Native functions can't be used as values.");
+        }
+
+        // A global function (or the constructor of a class) used as a value. The top-level code
+        // knows the functions declared before it.
+        if (closures && declarations && !declarations->functions.contains(name))
+        {
+            ErrorAt(node->name, "Undefined variable.");
+        }
+        if (!closures)
+        {
+            auto func = mod->getFunction(FunctionSymbol(name));
+            bool lazy = std::any_of(lazy_function_nodes.begin(), lazy_function_nodes.end(),
+                [name](const FunStmtNode* declared)
+                {
+                    return declared->name.Lexeme() == name;
+                });
+            if (!lazy && !classes.contains(name) && (!func || func->isDeclaration()))
+            {
+                ErrorAt(node->name, "Undefined variable.");
+            }
+        }
+        current_value = FunctionValue(name);
+        current_number = false;
     }
 
 
     auto LLVMVisitor::operator()(const LogicalExprNodePtr& node)
         -> void
     {
-        Log("BinaryLogical");
-        Visit(node->left);
-        auto left = current_value;
-        Visit(node->right);
-        auto right = current_value;
+        using namespace llvm;
 
-        if (!left || !right)
+        if (node->op.Type() != TokenType::And && node->op.Type() != TokenType::Or)
         {
-            // Error 
-            Error("Left or right operand in binary logical is null.");
+            ErrorAt(node->op, "Unsupported logical operation.");
         }
+        bool is_and = node->op.Type() == TokenType::And;
 
-        // TODO: check if the types are boolean or raise an error.
-    
-        switch (node->op.Type())
+        // The right operand is evaluated only if the left one doesn't decide the result:
+        // the result is the left operand if it is falsey (and) or truthy (or).
+        BasicBlock* right_bb = BasicBlock::Create(*context, is_and ? "and.right" : "or.right", current_func);
+        BasicBlock* exit_bb = BasicBlock::Create(*context, is_and ? "and.exit" : "or.exit");
+
+        Visit(node->left);
+        // Reading a variable in the right operand can replace a trivial phi.
+        TrackingVH<Value> left = current_value;
+        bool left_number = current_number;
+        BasicBlock* left_bb = current_block;
+        auto truthy = ToCondition(left);
+        if (is_and)
         {
-        case TokenType::And:      // <=
-            Log("and");
-            current_value = builder->CreateAnd(left, right, "and");
-            break;
-        case TokenType::Or:           // <
-            Log("or");
-            current_value = builder->CreateOr(left, right, "or");
-            break;
-        default:
-            // log error
-            current_value = nullptr;
-            break;
+            builder->CreateCondBr(truthy, right_bb, exit_bb);
+        }
+        else
+        {
+            builder->CreateCondBr(truthy, exit_bb, right_bb);
         }
+
+        SetCurrentBlock(right_bb);
+        SealBlock(right_bb);
+        Visit(node->right);
+        Value* right = current_value;
+        // The right operand can end in a different block (nested and/or).
+        right_bb = current_block;
+        builder->CreateBr(exit_bb);
+
+        exit_bb->insertInto(current_func);
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+        auto phi = builder->CreatePHI(builder->getInt64Ty(), 2, is_and ? "and" : "or");
+        phi->addIncoming(left, left_bb);
+        phi->addIncoming(right, right_bb);
+        current_value = phi;
+        current_number = left_number && current_number;
     }
 
 
     auto LLVMVisitor::operator()(const CallExprNodePtr& node)
         -> void
     {
-        using namespace llvm;
-
-        // Function* callee = mod->getFunction(node->)
+        if (IsNative(*node))
+        {
+            GenerateNative(*node);
+            return;
+        }
+        current_value = GenerateCall(*node, false);
+        current_number = false;
+        Root(current_value);
     }
 
 
     auto LLVMVisitor::operator()(const CmpExprNodePtr& node)
         -> void
     {
-        Log("BinaryComp");
         Visit(node->left);
-        auto left = current_value;
+        // Reading a variable in the right operand can replace a trivial phi.
+        llvm::TrackingVH<llvm::Value> left = current_value;
+        bool left_number = current_number;
+        llvm::WeakTrackingVH left_int = current_int;
         Visit(node->right);
-        auto right = current_value;
+        llvm::Value* right = current_value;
+        bool both_numbers = left_number && current_number;
+        llvm::Value* right_int = current_int;
+        current_number = false;
+        current_int = nullptr;
+
+        auto type = node->op.Type();
+        if (left_int && right_int)
+        {
+            // The integers of a fast loop are exact doubles: same result.
+            llvm::CmpInst::Predicate predicate;
+            switch (type)
+            {
+            case TokenType::EqualEqual:     predicate = llvm::CmpInst::ICMP_EQ; break;
+            case TokenType::BangEqual:      predicate = llvm::CmpInst::ICMP_NE; break;
+            case TokenType::LessEqual:      predicate = llvm::CmpInst::ICMP_SLE; break;
+            case TokenType::Less:           predicate = llvm::CmpInst::ICMP_SLT; break;
+            case TokenType::GreaterEqual:   predicate = llvm::CmpInst::ICMP_SGE; break;
+            case TokenType::Greater:        predicate = llvm::CmpInst::ICMP_SGT; break;
+            default:
+                ErrorAt(node->op, "Unsupported comparison.");
+            }
+            current_value = FromBool(builder->CreateICmp(predicate, left_int, right_int, "cmp.int"));
+            return;
+        }
 
-        if (!left || !right)
+        if (type == TokenType::EqualEqual || type == TokenType::BangEqual)
         {
-            // Error 
-            Error("Left or right operand in binary comparison is null.");
+            // Numbers are compared as doubles (NaN != NaN, 0 == -0), the other values by their
+            // bits (objects by identity, small strings by value), then two different objects
+            // by lox_equal (strings with the same chars).
+            llvm::Value* eq = builder->CreateFCmpOEQ(ToNumber(left), ToNumber(right), "eq");
+            if (!both_numbers)
+            {
+                eq = builder->CreateSelect(builder->CreateAnd(IsNumber(left), IsNumber(right)), eq,
+                    EqualObjects(left, right), "eq");
+            }
+            if (type == TokenType::BangEqual)
+            {
+                eq = builder->CreateNot(eq, "ne");
+            }
+            current_value = FromBool(eq);
+            return;
         }
-    
-        switch (node->op.Type())
+
+        if (!both_numbers)
+        {
+            CheckNumbers({left, right}, node->op);
+        }
+        auto l = ToNumber(left);
+        auto r = ToNumber(right);
+
+        switch (type)
         {
         case TokenType::LessEqual:      // <=
-            Log("<=");
-            current_value = builder->CreateFCmpOLE(left, right, "le");
+            current_value = FromBool(builder->CreateFCmpOLE(l, r, "le"));
             break;
         case TokenType::Less:           // <
-            Log("<");
-            current_value = builder->CreateFCmpOLT(left, right, "lt");
+            current_value = FromBool(builder->CreateFCmpOLT(l, r, "lt"));
             break;
         case TokenType::GreaterEqual:   // >=
-            Log(">=");
-            current_value = builder->CreateFCmpOGE(left, right, "ge");
+            current_value = FromBool(builder->CreateFCmpOGE(l, r, "ge"));
             break;
         case TokenType::Greater:        // > 
-            Log(">=");
-            current_value = builder->CreateFCmpOGT(left, right, "gt");
-            break;
-        case TokenType::EqualEqual:     // ==
-            Log("==");
-            current_value = builder->CreateFCmpOEQ(left, right, "eq");
-            break;
-        case TokenType::BangEqual:      // != 
-            Log("!=");
-            current_value = builder->CreateFCmpONE(left, right, "ne");
+            current_value = FromBool(builder->CreateFCmpOGT(l, r, "gt"));
             break;
-
         default:
-            // log error
-            current_value = nullptr;
-            break;
+            ErrorAt(node->op, "Unsupported comparison.");
+        }
+    }
+
+    auto LLVMVisitor::operator()(const GetExprNodePtr& node)
+        -> void
+    {
+        using namespace llvm;
+
+        Visit(node->object);
+        Value* object = current_value;
+
+        auto cache = NewInlineCache(node->name.Lexeme());
+        BasicBlock* miss_bb = BasicBlock::Create(*context, "get.miss");
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "get.exit");
+
+        auto ptr = CheckShape(object, cache, miss_bb);
+        auto offset = CacheEntry(cache, 2, builder->getInt64Ty());
+        auto field = builder->CreateLoad(builder->getInt64Ty(), FieldAddress(ptr, offset, builder->getInt64Ty()), "field");
+        BasicBlock* hit_bb = current_block;
+        builder->CreateBr(exit_bb);
+
+        miss_bb->insertInto(current_func);
+        SetCurrentBlock(miss_bb);
+        SealBlock(miss_bb);
+        auto get = RuntimeFunction("lox_get_property", FunctionType::get(builder->getInt64Ty(),
+            {builder->getInt64Ty(), builder->getInt8PtrTy(), builder->getInt32Ty()}, false));
+        auto property = builder->CreateCall(get, {object, builder->CreateBitCast(cache, builder->getInt8PtrTy()),
+            builder->getInt32(static_cast<u32>(node->name.Line()))}, "property");
+        builder->CreateBr(exit_bb);
+
+        exit_bb->insertInto(current_func);
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+        auto phi = builder->CreatePHI(builder->getInt64Ty(), 2, "get");
+        phi->addIncoming(field, hit_bb);
+        phi->addIncoming(property, miss_bb);
+        current_value = phi;
+        current_number = false;
+        // A call can replace the field while the value is still in use.
+        Root(current_value);
+    }
+
+
+    auto LLVMVisitor::operator()(const SetExprNodePtr& node)
+        -> void
+    {
+        using namespace llvm;
+
+        Visit(node->object);
+        // Reading a variable in the value can replace a trivial phi.
+        TrackingVH<Value> object = current_value;
+        Visit(node->value);
+        Value* value = current_value;
+        bool value_number = current_number;
+
+        auto cache = NewInlineCache(node->name.Lexeme());
+        BasicBlock* miss_bb = BasicBlock::Create(*context, "set.miss");
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "set.exit");
+
+        // The entry has the shape after the store (a transition if the field is new).
+        auto ptr = CheckShape(object, cache, miss_bb);
+        auto offset = CacheEntry(cache, 2, builder->getInt64Ty());
+        auto next_shape = CacheEntry(cache, 1, builder->getInt8PtrTy());
+        builder->CreateStore(value, FieldAddress(ptr, offset, builder->getInt64Ty()));
+        builder->CreateStore(next_shape,
+            FieldAddress(ptr, builder->getInt64(offsetof(ObjInstance, shape)), builder->getInt8PtrTy()));
+        if (!value_number)
+        {
+            WriteBarrier(ptr, value);
+        }
+        builder->CreateBr(exit_bb);
+
+        miss_bb->insertInto(current_func);
+        SetCurrentBlock(miss_bb);
+        SealBlock(miss_bb);
+        auto set = RuntimeFunction("lox_set_property", FunctionType::get(builder->getVoidTy(),
+            {builder->getInt64Ty(), builder->getInt64Ty(), builder->getInt8PtrTy(), builder->getInt32Ty()}, false));
+        builder->CreateCall(set, {object, value, builder->CreateBitCast(cache, builder->getInt8PtrTy()),
+            builder->getInt32(static_cast<u32>(node->name.Line()))});
+        builder->CreateBr(exit_bb);
+
+        exit_bb->insertInto(current_func);
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+        // The value of the assignment is the assigned value.
+        current_value = value;
+        current_number = value_number;
+        current_int = nullptr;
+    }
+
+
+    auto LLVMVisitor::operator()(const InvokeExprNodePtr& node)
+        -> void
+    {
+        using namespace llvm;
+
+        Visit(node->object);
+        // Reading a variable in an argument can replace a trivial phi.
+        SmallVector<TrackingVH<Value>, 4> tracked{current_value};
+        for (const auto& arg : node->arguments)
+        {
+            Visit(arg);
+            tracked.emplace_back(current_value);
+        }
+        SmallVector<Value*, 4> args{tracked.begin(), tracked.end()};
+        auto argc = static_cast<u32>(node->arguments.size());
+
+        // The target of the entry is the function of the method, its arity is checked by the
+        // runtime when it is added.
+        auto cache = NewInlineCache(node->name.Lexeme());
+        BasicBlock* miss_bb = BasicBlock::Create(*context, "invoke.miss");
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "invoke.exit");
+
+        CheckShape(args[0], cache, miss_bb);
+        auto cached = CacheEntry(cache, 1, builder->getInt8PtrTy());
+        BasicBlock* hit_bb = current_block;
+        builder->CreateBr(exit_bb);
+
+        miss_bb->insertInto(current_func);
+        SetCurrentBlock(miss_bb);
+        SealBlock(miss_bb);
+        auto find = RuntimeFunction("lox_find_method", FunctionType::get(builder->getInt8PtrTy(),
+            {builder->getInt64Ty(), builder->getInt8PtrTy(), builder->getInt32Ty(), builder->getInt32Ty()}, false));
+        auto found = builder->CreateCall(find, {args[0], builder->CreateBitCast(cache, builder->getInt8PtrTy()),
+            builder->getInt32(argc), builder->getInt32(static_cast<u32>(node->paren.Line()))}, "method");
+        builder->CreateBr(exit_bb);
+
+        exit_bb->insertInto(current_func);
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+        auto method = builder->CreatePHI(builder->getInt8PtrTy(), 2, "method");
+        method->addIncoming(cached, hit_bb);
+        method->addIncoming(found, miss_bb);
+
+        current_value = CallMethod(method, args);
+        current_number = false;
+        Root(current_value);
+    }
+
+
+    auto LLVMVisitor::operator()(const SuperInvokeExprNodePtr& node)
+        -> void
+    {
+        using namespace llvm;
+
+        Token self{"this", TokenType::This, node->keyword.Line()};
+        SmallVector<TrackingVH<Value>, 4> tracked{ReadVar(ResolveVar(self))};
+        for (const auto& arg : node->arguments)
+        {
+            Visit(arg);
+            tracked.emplace_back(current_value);
         }
+        SmallVector<Value*, 4> args{tracked.begin(), tracked.end()};
+
+        // The method of the superclass is the same for every call: found once.
+        auto site = new GlobalVariable(*mod, builder->getInt8PtrTy(), false, GlobalValue::PrivateLinkage,
+            ConstantPointerNull::get(builder->getInt8PtrTy()), ".super");
+        BasicBlock* find_bb = BasicBlock::Create(*context, "super.find", current_func);
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "super.exit", current_func);
+
+        auto cached = builder->CreateLoad(builder->getInt8PtrTy(), site, "super.method");
+        BasicBlock* hit_bb = current_block;
+        builder->CreateCondBr(builder->CreateIsNotNull(cached), exit_bb, find_bb, Likely());
+
+        SetCurrentBlock(find_bb);
+        SealBlock(find_bb);
+        auto find = RuntimeFunction("lox_find_super_method", FunctionType::get(builder->getInt8PtrTy(),
+            {builder->getInt8PtrTy(), builder->getInt8PtrTy(), builder->getInt32Ty(), builder->getInt32Ty()}, false));
+        auto klass = ConstantExpr::getBitCast(ClassDescriptor(node->klass.Lexeme()), builder->getInt8PtrTy());
+        auto found = builder->CreateCall(find, {klass, GlobalName(node->method.Lexeme()),
+            builder->getInt32(static_cast<u32>(node->arguments.size())),
+            builder->getInt32(static_cast<u32>(node->paren.Line()))}, "method");
+        builder->CreateStore(found, site);
+        builder->CreateBr(exit_bb);
+
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+        auto method = builder->CreatePHI(builder->getInt8PtrTy(), 2, "method");
+        method->addIncoming(cached, hit_bb);
+        method->addIncoming(found, find_bb);
+
+        current_value = CallMethod(method, args);
+        current_number = false;
+        Root(current_value);
     }
 
+
     // ******************************** VISIT EXPRESSIONS *************************************
 
 
     // ************************* VISIT LITERAL ***********************
 
-    auto LLVMVisitor::operator()(const LoxNil& value)
+    auto LLVMVisitor::operator()(const ListExprNodePtr& node)
         -> void
     {
-        // I don't know if this is correct.
-        current_value = llvm::ConstantPointerNull::get(llvm::PointerType::get(*context, 0));
+        using namespace llvm;
+
+        // Reading a variable in an element can replace a trivial phi used by a previous one.
+        SmallVector<TrackingVH<Value>, 8> elements;
+        for (const auto& element : node->elements)
+        {
+            Visit(element);
+            elements.emplace_back(current_value);
+        }
+
+        // The runtime copies the values from an array in the frame of the function.
+        auto values_type = PointerType::getUnqual(builder->getInt64Ty());
+        Value* values = ConstantPointerNull::get(values_type);
+        if (!elements.empty())
+        {
+            auto& entry = current_func->getEntryBlock();
+            IRBuilder<> b{&entry, entry.begin()};
+            auto array = b.CreateAlloca(b.getInt64Ty(), b.getInt32(static_cast<u32>(elements.size())), "list.values");
+            for (std::size_t i = 0; i < elements.size(); ++i)
+            {
+                builder->CreateStore(elements[i],
+                    builder->CreateConstInBoundsGEP1_32(builder->getInt64Ty(), array, static_cast<unsigned>(i)));
+            }
+            values = array;
+        }
+        auto list_new = RuntimeFunction("lox_list_new", FunctionType::get(builder->getInt64Ty(),
+            {values_type, builder->getInt32Ty()}, false));
+        current_value = builder->CreateCall(list_new,
+            {values, builder->getInt32(static_cast<u32>(elements.size()))}, "list");
+        current_number = false;
+        Root(current_value);
     }
-        
-    auto LLVMVisitor::operator()(const std::string& value)
+
+
+    auto LLVMVisitor::operator()(const IndexExprNodePtr& node)
+        -> void
+    {
+        using namespace llvm;
+
+        // An element of a packed list is a number: a load of the double, not rooted.
+        if (auto packed = FindPackedList(NumericLoop::VarName(node->object)))
+        {
+            Visit(node->index);
+            auto address = PackedAddress(*packed, NumericLoop::VarName(node->object), node->index,
+                current_value, current_int, node->bracket);
+            auto element = builder->CreateLoad(builder->getDoubleTy(), address, "element");
+            element->setMetadata(LLVMContext::MD_tbaa, AccessTag("element"));
+            current_value = FromNumber(element);
+            current_number = true;
+            current_int = nullptr;
+            return;
+        }
+
+        Visit(node->object);
+        // Reading a variable in the index can replace a trivial phi.
+        TrackingVH<Value> list = current_value;
+        Visit(node->index);
+        Value* index = current_value;
+
+        BasicBlock* slow_bb = BasicBlock::Create(*context, "index.slow");
+        BasicBlock* exit_bb = BasicBlock::Create(*context, "index.exit");
+        auto [address, elements] = ElementAddress(list, index, current_int, slow_bb);
+        auto element = builder->CreateLoad(builder->getInt64Ty(), address, "element");
+        element->setMetadata(LLVMContext::MD_tbaa, AccessTag("element"));
+        auto element_bb = builder->GetInsertBlock();
+        builder->CreateBr(exit_bb);
+
+        // The maps and the errors.
+        slow_bb->insertInto(current_func);
+        SetCurrentBlock(slow_bb);
+        SealBlock(slow_bb);
+        auto get = RuntimeFunction("lox_index_get", FunctionType::get(builder->getInt64Ty(),
+            {builder->getInt64Ty(), builder->getInt64Ty(), builder->getInt32Ty()}, false));
+        auto slow_value = builder->CreateCall(get,
+            {list, index, builder->getInt32(static_cast<u32>(node->bracket.Line()))}, "value");
+        builder->CreateBr(exit_bb);
+
+        exit_bb->insertInto(current_func);
+        SetCurrentBlock(exit_bb);
+        SealBlock(exit_bb);
+        auto phi = builder->CreatePHI(builder->getInt64Ty(), 2, "element");
+        phi->addIncoming(element, element_bb);
+        phi->addIncoming(slow_value, slow_bb);
+        current_value = phi;
+        current_number = false;
+        current_int = nullptr;
+        // A call can replace the element while the value is still in use.
+        Root(current_value);
+    }
+
+
+    auto LLVMVisitor::operator()(const IndexSetExprNodePtr& node)
+        -> void
+    {
+        using namespace llvm;
+
+        auto name = NumericLoop::VarName(node->object);
+        auto packed = FindPackedList(name);
+        TrackingVH<Value> list;
+        if (!packed)
+        {
+            Visit(node->object);
+            list = current_value;
+        }
+        // Reading a variable in the value can replace a trivial phi.
+        Visit(node->index);
+        TrackingVH<Value> index = current_value;
+        WeakTrackingVH index_int = current_int;
+        Visit(node->value);
+        Value* value = current_value;
+        bool value_number = current_number;
+
+        if (packed)
+        {
+            // The loop only stores numbers in the packed lists (NumericLoop).
+            auto address = PackedAddress(*packed, name, node->index, index, index_int, node->bracket);
+            auto store = builder->CreateStore(ToNumber(value), address);
+            store->setMetadata(LLVMContext::MD_tbaa, AccessTag("element"));
+        }
+        else
+        {
+            BasicBlock* slow_bb = BasicBlock::Create(*context, "index.slow");
+            BasicBlock* exit_bb = BasicBlock::Create(*context, "index.exit");
+            auto [address, elements] = ElementAddress(list, index, index_int, slow_bb);
+            if (!value_number)
+            {
+                // Any value but a number makes the buffer generic (see list_object.hpp).
+                auto storage = builder->CreateLoad(builder->getInt8Ty(), elements, "storage");
+                storage->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+                auto type = builder->CreateSelect(IsNumber(value), storage,
+                    builder->getInt8(static_cast<u8>(ObjType::Slots)), "storage");
+                builder->CreateStore(type, elements)->setMetadata(LLVMContext::MD_tbaa, AccessTag("list"));
+            }
+            auto store = builder->CreateStore(value, address);
+            store->setMetadata(LLVMContext::MD_tbaa, AccessTag("element"));
+            if (!value_number)
+            {
+                WriteBarrier(elements, value);
+            }
+            builder->CreateBr(exit_bb);
+
+            // The maps and the errors.
+            slow_bb->insertInto(current_func);
+            SetCurrentBlock(slow_bb);
+            SealBlock(slow_bb);
+            auto set = RuntimeFunction("lox_index_set", FunctionType::get(builder->getVoidTy(),
+                {builder->getInt64Ty(), builder->getInt64Ty(), builder->getInt64Ty(), builder->getInt32Ty()}, false));
+            builder->CreateCall(set, {list, index, value, builder->getInt32(static_cast<u32>(node->bracket.Line()))});
+            builder->CreateBr(exit_bb);
+
+            exit_bb->insertInto(current_func);
+            SetCurrentBlock(exit_bb);
+            SealBlock(exit_bb);
+        }
+
+        // The value of the assignment is the assigned value.
+        current_value = value;
+        current_number = value_number;
+        current_int = nullptr;
+    }
+
+
+    auto LLVMVisitor::operator()(const LoxNil&)
+        -> void
+    {
+        current_value = BoxedConstant(LoxValue::Nil());
+    }
+    auto LLVMVisitor::operator()(const StringId& value)
         -> void
     {   
-        // TODO
+        using namespace llvm;
+
+        // Each literal is a small string or a constant ObjString (see value.hpp), emitted once.
+        auto& constant = string_constants[value.value];
+        if (!constant && strings->Get(value).size() <= LoxValue::small_string_max)
+        {
+            constant = BoxedConstant(LoxValue::SmallString(strings->Get(value)));
+        }
+        else if (!constant)
+        {
+            auto s = strings->Get(value);
+            auto chars = builder->CreateGlobalString(StringRef{s.data(), s.size()}, ".str", 0, mod.get());
+            auto string_type = StructType::get(builder->getInt8Ty(), builder->getInt8Ty(),
+                builder->getInt32Ty(), builder->getInt8PtrTy());
+            auto object = ConstantStruct::get(string_type, {
+                builder->getInt8(static_cast<u8>(ObjType::String)),
+                builder->getInt8(0),
+                builder->getInt32(static_cast<u32>(s.size())),
+                ConstantExpr::getBitCast(chars, builder->getInt8PtrTy())
+            });
+            auto global = new GlobalVariable(*mod, string_type, true, GlobalValue::PrivateLinkage,
+                object, ".obj");
+            constant = ConstantExpr::getOr(ConstantExpr::getPtrToInt(global, builder->getInt64Ty()),
+                builder->getInt64(LoxValue::object_bits));
+        }
+        current_value = constant;
     }
 
     auto LLVMVisitor::operator()(const f64& value)
         -> void
     {
-        Log("Double");
-        current_value = llvm::ConstantFP::get(builder->getDoubleTy(), value);
+        current_value = BoxedConstant(LoxValue::Number(value));
+        current_number = true;
+        current_int = IntegerConstant(value);
     }
 
     auto LLVMVisitor::operator()(const bool& value)
         -> void
     {
-        // TODO: i1 or i8?
-        current_value = builder->getInt1(value ? 1 : 0);
+        current_value = BoxedConstant(LoxValue::Bool(value));
     }
 
     // ************************* VISIT LITERAL ***********************
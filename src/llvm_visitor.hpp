@@ -9,7 +9,86 @@ PURPOSE: Implementation of a visitor for the AST node to produce llvm IR.
 CLASSES:
 
 DESCRIPTION:
-
+    The local variables are not stored in memory: the visitor builds the SSA form directly while
+    generating the code, following Braun et al. Each basic block records the last value written to
+    each variable; reading a variable not defined in the block looks it up in the predecessors,
+    creating phi nodes where the control flow merges. Blocks with unknown predecessors (loop headers
+    before the back edge is generated) are not sealed: reads create incomplete phis that are
+    completed when the block is sealed. Trivial phis are removed on the fly.
+
+    Every Lox value is a NaN-boxed i64 (LoxValue, see value.hpp). The arithmetic checks the tags
+    inline and works on doubles; the operands that are not numbers branch to a cold call of the
+    runtime (lox_add for strings, lox_error for the type errors). String literals are small
+    strings or constant ObjString globals, and == calls lox_equal only for two different objects
+    (see string_object.hpp). The objects allocated at run time are garbage collected: each
+    function keeps the values that can refer to them in the slots of its frame of the shadow
+    stack (gc.hpp).
+
+    The visitor knows when an expression is a number (the result of -, * and /, number literals,
+    see current_number) and then skips the check of its tag. The loops are versioned: when
+    NumericLoop finds variables that stay numbers for the whole loop, the loop is generated twice.
+    Before the loop, a guard checks that those variables hold numbers: if they do, the copy of the
+    loop where they are known to be numbers runs (only double arithmetic, no GC roots for them),
+    otherwise the generic copy. The guard is the only check, so the fast copy never has to fall
+    back in the middle of an iteration. The loops inside a fast copy are versioned too, up to
+    max_fast_depth nested fast copies (the innermost loop has 2^depth copies).
+    The counter of the loop (NumericLoop::Counter) and its bound are integers in the fast copy:
+    the guard also checks that they hold integers, and the counter is kept in an i64 variable
+    (a separate SSA variable, with the integer of the bound) so LLVM sees an integer induction
+    variable. Reading the counter converts it to a double; the additions of integer literals to
+    it and its comparisons with the bound stay integer (current_int).
+
+    The Lox functions use the tail calling convention (tailcc) and `return f(...)` is a musttail
+    call, whatever the numbers of parameters of the caller and the callee: tailcc lets the
+    callee pop its arguments, so every tail call is guaranteed and the tail recursion (mutual
+    too) runs in constant stack. musttail also keeps the optimizer, the inliner included, from
+    moving code after the call.
+    For the on-stack replacement of the tiered mode, GenerateLoopEntry() generates a copy of a
+    function that starts at the header of one of its loops: the variables live there are its
+    parameters, and the statements before the loop (already executed by the interpreter) are
+    skipped.
+
+    Classes: a class is a constant descriptor (LoxClass, the global lox.class.Name) with the table
+    of its methods, which are Lox functions (Class.method, with this as first parameter), and its
+    constructor is the function with the name of the class, so `Point(1, 2)` is a plain call.
+    Each property access has its own inline cache (see shape.hpp): the shape of the object is
+    compared with the first entry inline, so a monomorphic get is a load of the shape, a compare
+    and a load of the field at the cached offset; a set also stores the next shape and runs the
+    write barrier (gc.hpp) if the value can be an object. The misses call the runtime.
+
+    Closures: every function declared in a function is a closure, bound in its enclosing scope:
+    ClosureAnalysis (closure_analysis.hpp) finds the variables it captures (maybe none). A
+    closure is an internal function (enclosing.name) that takes
+    its record as first parameter and loads the captured values from it at the entry: the
+    record is an ObjClosure (value.hpp) allocated by the runtime if the closure escapes, or an
+    alloca with the same layout if it doesn't. A variable that holds a closure and is never
+    assigned is known (VarInfo::known): its calls are direct, with the arity checked at compile time.
+    The other calls of a local variable check the type and the arity inline and call the
+    function of the closure indirectly. A shared variable (captured and assigned) is stored in
+    a box on the heap, or in its GC slot when no escaping closure captures it (Storage); the
+    other captured variables are copied. Using a global function as a value gives its constant
+    closure (ValueSymbol()), whose function is an adapter that ignores the record.
+
+    Global variables: the variables of the top-level code used by the functions (see
+    Declarations in node.hpp) live in module-level storage, an i64 global (GlobalSymbol())
+    defined by the module of lox_main, and rooted by it (lox_gc_add_root()). The functions and
+    lox_main hold its address, like the shared variables in a GC slot (Storage::Pointer).
+
+    Lists (see list_object.hpp): the elements are read and written inline, after checking that
+    the value is a list and that the index is an integer below its length (one runtime call
+    otherwise, for the maps and the errors).
+    len() and append() are native functions, len() of a list is inline. In the fast copy of a
+    loop, the packed lists (NumericLoop::Lists()) are checked by the guard, which loads their
+    buffer and length once: an element is a load or a store of a double, with a bounds check
+    against the length in a register, and none for the counter when the guard checked that its
+    range is within the length. A loop over packed lists is then plain double arithmetic on
+    arrays, which LLVM can vectorize. The accesses to the lists and to the GC slots have TBAA
+    tags (AccessTag()).
+
+    Maps (see map_object.hpp): map[key] is generated like a list access, whose slow path
+    (taken when the value is not a list or the index not within its length) calls the runtime,
+    which probes the table of a map or reports the error. map(), has(), remove() and keys() are
+    native functions that call the runtime.
 
 TODO:
     - support for nested loops continue break (need to keep tracks of the loops using a stack).
@@ -28,6 +107,8 @@ TODO:
 #include <llvm/IR/ValueHandle.h> // TrackingVH
 #include <llvm/ADT/StringMap.h>
 #include <llvm/IR/Instructions.h> // PHINode
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/APFloat.h>
@@ -36,6 +117,12 @@ TODO:
 
 #include "common.hpp"
 #include "node.hpp"
+#include "string_pool.hpp"
+#include "expr_cse.hpp"
+#include "value.hpp"
+#include "numeric_loop.hpp"
+#include "closure_analysis.hpp"
+#include "list_object.hpp"
 
 #include <variant>
 #include <unordered_map>
@@ -45,6 +132,10 @@ TODO:
 #include <iostream>
 #include <string_view>
 #include <concepts>
+#include <exception>
+#include <initializer_list>
+#include <optional>
+#include <unordered_set>
 
 
 namespace lox
@@ -53,16 +144,54 @@ namespace lox
     {
     public:
 
-        // Create the main function.
-        explicit LLVMVisitor();
+        // Create the main function (lox_main, called by the runtime).
+        // The pool is the one used to parse the AST (for string literals).
+        explicit LLVMVisitor(non_owned_ptr<const StringPool> strings_);
+
+        // Create an empty module, for the code of the functions compiled lazily (GenerateFunction()).
+        LLVMVisitor(non_owned_ptr<const StringPool> strings_, std::string_view module_name);
 
         // ~LLVMVisitor();
         
-        // End the main function.
+        // End the main function. Without lazy functions the module is the whole program, and
+        // the functions get internal linkage.
         auto End()
             -> void;
 
 
+        // True if an error was reported: the module is not valid.
+        auto HadError() const noexcept
+            -> bool
+        {
+            return had_error;
+        }
+
+
+        // Print the errors on stdout, like the interpreters (default), or only record them.
+        auto SetReportErrors(bool report)
+            -> void
+        {
+            report_errors = report;
+        }
+
+
+        // Module with the generated code.
+        auto Module() noexcept
+            -> llvm::Module&
+        {
+            return *mod;
+        }
+
+
+        // Give the module (with its context) to the caller, for example to execute it in the JIT.
+        // The visitor can't be used anymore.
+        auto TakeModule()
+            -> llvm::orc::ThreadSafeModule
+        {
+            return llvm::orc::ThreadSafeModule{std::move(mod), std::move(context)};
+        }
+
+
         // Print the code in the console.
         auto Print()
             -> void
@@ -71,11 +200,118 @@ namespace lox
         }
 
 
-        // Generate IR code.
+        // Generate IR code. Errors are reported and the statement is skipped.
         auto Generate(const StmtNode& ast) 
             -> void;
 
 
+        // Generate the code of the function in the module (the functions it calls are only
+        // declared). Errors are reported and the function is removed.
+        auto GenerateFunction(const FunStmtNode& node)
+            -> void;
+
+
+        // Generate a function that calls the Lox function passing the arguments from an array:
+        // f64 entry(const f64* args). It lets C++ call functions of any arity.
+        auto GenerateEntry(const FunStmtNode& node)
+            -> void;
+
+
+        // Variables live at the header of the loop, in order of declaration: the parameters of
+        // the function, then the variables declared before the loop by the blocks that contain
+        // it. None if the loop is not reached through blocks only (it is nested in an if or in
+        // another loop) or if a function or a class is declared before it.
+        static auto LoopVariables(const FunStmtNode& node, const WhileStmtNode& loop)
+            -> std::optional<std::vector<std::string_view>>;
+
+
+        // On-stack replacement: generate the function that continues the function from the
+        // header of the loop, taking the values of LoopVariables(), and its entry (see
+        // GenerateEntry()), symbol + ".entry". The entry returns what the function returns.
+        auto GenerateLoopEntry(const FunStmtNode& node, const WhileStmtNode& loop, const std::string& symbol)
+            -> void;
+
+
+        // Only declare the functions, instead of generating their code. The nodes are collected
+        // and can be passed later to GenerateFunction() of another visitor.
+        auto SetLazyFunctions(bool lazy)
+            -> void
+        {
+            lazy_functions = lazy;
+        }
+
+        // Check the calls of the global functions with the declarations of the whole program:
+        // an undefined function or a wrong number of arguments is an error, even when the
+        // visitor generates one function (without, a call declares the function it calls).
+        // The global variables are in module-level storage (without, the functions can't use
+        // the variables of the top-level code).
+        auto SetDeclarations(non_owned_ptr<const Declarations> declarations_)
+            -> void
+        {
+            declarations = declarations_;
+            // The functions can change them.
+            shared_names.insert(declarations->variables.begin(), declarations->variables.end());
+        }
+
+        // Functions declared in lazy mode, in order of declaration.
+        auto LazyFunctions() const noexcept
+            -> const std::vector<non_owned_ptr<const FunStmtNode>>&
+        {
+            return lazy_function_nodes;
+        }
+
+
+        // Name of the symbol of a Lox function. The prefix avoids clashes with the C symbols
+        // (and lox_main).
+        static auto FunctionSymbol(std::string_view name)
+            -> std::string
+        {
+            return "lox." + std::string{name};
+        }
+
+
+        // Name of the storage of a global variable (var is a keyword: no class has this name).
+        static auto GlobalSymbol(std::string_view name)
+            -> std::string
+        {
+            return "lox.var." + std::string{name};
+        }
+
+
+        static auto EntrySymbol(std::string_view name)
+            -> std::string
+        {
+            return FunctionSymbol(name) + ".entry";
+        }
+
+
+        // Name of the function generated by GenerateLoopEntry() for a loop of the function
+        // (while is a keyword: no function or class has this name).
+        static auto LoopSymbol(std::string_view name, u64 index)
+            -> std::string
+        {
+            return "lox.while." + std::string{name} + "." + std::to_string(index);
+        }
+
+
+        // Name of the constant closure of a global function (its value), defined by the module
+        // of the function. Empty for the methods, which are not values.
+        static auto ValueSymbol(std::string_view name)
+            -> std::string
+        {
+            return name.find('.') == std::string_view::npos ? "lox.fun." + std::string{name} : std::string{};
+        }
+
+
+        // Reuse the value of the duplicate expressions found by the analysis (optional).
+        // The analysis must be done on the same AST passed to Generate().
+        auto SetCSE(non_owned_ptr<const ExprCSE> cse_)
+            -> void
+        {
+            cse = cse_;
+        }
+
+
     public:
         // Visitor for expressions. Expressions always return a value (saved inside current_value).
 
@@ -106,6 +342,27 @@ namespace lox
         auto operator()(const CmpExprNodePtr& node)
             -> void;
 
+        auto operator()(const GetExprNodePtr& node)
+            -> void;
+
+        auto operator()(const SetExprNodePtr& node)
+            -> void;
+
+        auto operator()(const InvokeExprNodePtr& node)
+            -> void;
+
+        auto operator()(const SuperInvokeExprNodePtr& node)
+            -> void;
+
+        auto operator()(const ListExprNodePtr& node)
+            -> void;
+
+        auto operator()(const IndexExprNodePtr& node)
+            -> void;
+
+        auto operator()(const IndexSetExprNodePtr& node)
+            -> void;
+
 
 
         // Visitor for statements. 
@@ -134,13 +391,16 @@ namespace lox
         auto operator()(const WhileStmtNodePtr& node)
             -> void;
 
+        auto operator()(const ClassStmtNodePtr& node)
+            -> void;
+
 
         // Visit for Literal.
 
-        auto operator()(const LoxNil& value)
+        auto operator()(const LoxNil&)
             -> void;
         
-        auto operator()(const std::string& value)
+        auto operator()(const StringId& value)
             -> void;
 
         auto operator()(const f64& value)
@@ -158,9 +418,23 @@ namespace lox
         auto Visit(const T& node)
             -> void
         {
+            if constexpr (std::same_as<T, ExprNode>)
+            {
+                current_number = false;
+                current_int = nullptr;
+                if (cse)
+                {
+                    VisitShared(node);
+                    return;
+                }
+            }
             std::visit(*this, node);
         }
 
+        // Visit an expression reusing the value of its canonical node if it is a duplicate.
+        auto VisitShared(const ExprNode& node)
+            -> void;
+
 
         // Set the current basic block and insert point.
         auto SetCurrentBlock(llvm::BasicBlock* bb)
@@ -170,73 +444,611 @@ namespace lox
             builder->SetInsertPoint(current_block);
         }
 
-        
-        // auto WriteLocalVar(llvm::BasicBlock* bb, std::string_view name, llvm::Value* value)
-        //     -> void
-        // {
-        //     current_def[bb].defs[name] = value;
-        // }
 
+        // Report the error and abort the generation of the current statement.
+        [[noreturn]] auto ErrorAt(const Token& t, const std::string_view msg)
+            -> void;
+
+
+        // Return the function with this name, declaring it if it doesn't exist yet.
+        // Functions take and return boxed values (i64, see value.hpp).
+        auto DeclareFunction(const Token& name, std::size_t arity)
+            -> llvm::Function*;
+
+        // Give internal linkage to the functions defined in the module, so the optimizer can
+        // inline and specialize them. Only for a module that is the whole program (not lazy).
+        auto InternalizeFunctions()
+            -> void;
+
+        // Generate the call. A tail call pops the frame of the current function before the call
+        // and must be followed by the return of its value.
+        auto GenerateCall(const CallExprNode& node, bool tail)
+            -> llvm::CallInst*;
+
+        // Return the call if the returned expression is a call (in tail position).
+        static auto TailCall(const ExprNode& node) noexcept
+            -> const CallExprNode*;
+
+        // Native functions (see list_object.hpp and map_object.hpp): len(), append(), map(),
+        // has(), remove() and keys(), unless a local variable has the name. Their names can't be
+        // used by the global functions and the classes.
+        static auto IsNativeName(std::string_view name) noexcept
+            -> bool
+        {
+            return lox::IsNativeName(name);
+        }
+
+        auto IsNative(const CallExprNode& node) const
+            -> bool
+        {
+            return IsNativeName(node.callee.Lexeme()) && !FindVar(node.callee.Lexeme());
+        }
+
+        // Generate the call of a native function (inline for len() of a list).
+        auto GenerateNative(const CallExprNode& node)
+            -> void;
+
+        // Generate the body of the function, of a closure if closure_context is not null. The
+        // state of the current function is restored after.
+        struct ClosureContext;
+        auto DefineFunction(const FunStmtNode& node, const ClosureContext* closure_context = nullptr)
+            -> void;
+
+        // Function generated by GenerateLoopEntry(): its arguments are the parameters, then the
+        // variables declared before the loop (next_arg is the first one not declared yet).
+        struct LoopEntry
+        {
+            llvm::Function* function;
+            non_owned_ptr<const WhileStmtNode> loop;
+            unsigned next_arg;
+        };
+
+        // Generate the statements from the loop: the variables declared before it take the
+        // next arguments, the other statements before it are skipped. Return false if the
+        // statements don't contain the loop.
+        auto GenerateFromLoop(const std::vector<StmtNode>& statements, LoopEntry& entry)
+            -> bool;
+
+        // Define the entry with this symbol that calls func with the arguments of an array.
+        auto DefineEntry(llvm::Function* func, const std::string& symbol)
+            -> void;
+
+        // Generate the closure of the nested function and declare its variable.
+        auto DefineClosure(const FunStmtNode& node, const ClosureAnalysis::Closure& closure)
+            -> void;
+
+        // Generate the call of the closure held by the local variable.
+        auto GenerateClosureCall(const CallExprNode& node, u32 var, bool tail)
+            -> llvm::CallInst*;
+
+        // Type of ObjClosure, without the captured values.
+        auto ClosureType()
+            -> llvm::StructType*;
+
+        // Type of the functions of the closures with this arity: i64 (i8* record, i64 x arity).
+        auto ClosureFunctionType(std::size_t arity)
+            -> llvm::FunctionType*;
+
+        // Define the storage of the global variables and root it, at the entry of lox_main.
+        auto DefineGlobals()
+            -> void;
+
+        // Bind the global variable in the current scope, to its storage (declared if it isn't
+        // in the module).
+        auto BindGlobal(std::string_view name)
+            -> u32;
+
+        // Return the boxed constant closure of the global function, declaring it if it isn't
+        // in the module.
+        auto FunctionValue(std::string_view name)
+            -> llvm::Constant*;
+
+        // Define the constant closure of the global function: its function is an adapter with
+        // the signature of the closures that calls func. The value of a class is the closure of
+        // its constructor with the type Class.
+        auto DefineFunctionValue(std::string_view name, llvm::Function* func, ObjType type = ObjType::Closure)
+            -> void;
+
+        // Return the function of the runtime with this name and type.
+        auto RuntimeFunction(llvm::StringRef name, llvm::FunctionType* type)
+            -> llvm::FunctionCallee
+        {
+            return mod->getOrInsertFunction(name, type);
+        }
 
-        // auto AddEmptyPhi(llvm::BasicBlock* bb, std::string_view name)
-        //     -> llvm::PHINode*
-        // {
-        //     // return bb->empty() ? 
-        //     //         llvm::PHINode::Create()
-        // }
 
-        // auto ReadLocalVarRecursive(llvm::BasicBlock* bb, std::string_view name)
-        //     -> llvm::Value*;
+        // Convert a value to the i1 used by a conditional branch (Lox truthiness: nil and false
+        // are false, everything else is true).
+        auto ToCondition(llvm::Value* value)
+            -> llvm::Value*;
 
 
-        // auto ReadLocalVar(llvm::BasicBlock* bb, std::string_view name)
-        //     -> llvm::Value*
-        // {
-        //     if (auto value = current_def[bb].defs.find(name); value != current_def[bb].defs.end())
-        //     {
-        //         return value->second;
-        //     }
+        // Boxed values (see value.hpp).
 
-        //     // Recurse through outer basic block to check if the name is defined outside.
-        //     return ReadLocalVarRecutrsive(bb, name);
-        // }
+        auto BoxedConstant(LoxValue value)
+            -> llvm::Constant*
+        {
+            return builder->getInt64(value.Bits());
+        }
+
+        auto IsNumber(llvm::Value* value)
+            -> llvm::Value*
+        {
+            auto qnan = builder->getInt64(LoxValue::qnan);
+            return builder->CreateICmpNE(builder->CreateAnd(value, qnan), qnan, "is.num");
+        }
+
+        auto ToNumber(llvm::Value* value)
+            -> llvm::Value*
+        {
+            return builder->CreateBitCast(value, builder->getDoubleTy());
+        }
+
+        auto FromNumber(llvm::Value* value)
+            -> llvm::Value*
+        {
+            return builder->CreateBitCast(value, builder->getInt64Ty());
+        }
+
+        auto FromBool(llvm::Value* value)
+            -> llvm::Value*
+        {
+            return builder->CreateAdd(BoxedConstant(LoxValue::Bool(false)),
+                builder->CreateZExt(value, builder->getInt64Ty()), "bool");
+        }
+
+        // Branch weights of a condition that is almost always true.
+        auto Likely()
+            -> llvm::MDNode*
+        {
+            return llvm::MDBuilder(*context).createBranchWeights(2000, 1);
+        }
+
+        auto Unlikely()
+            -> llvm::MDNode*
+        {
+            return llvm::MDBuilder(*context).createBranchWeights(1, 2000);
+        }
+
+        // Continue in a new block if all the values are numbers, otherwise report a runtime error.
+        auto CheckNumbers(std::initializer_list<llvm::Value*> values, const Token& t)
+            -> void;
+
+        // Generate the call of the runtime that reports the error and exits (ends the block).
+        auto RuntimeError(std::string_view msg, const Token& t)
+            -> void;
+
+
+        // Shadow stack of the GC roots (see gc.hpp).
+
+        // Create the frame of the current function, at the beginning of the entry block.
+        // It is sized and pushed by FinishFrame(), when the number of slots is known.
+        auto StartFrame()
+            -> void;
+
+        auto FinishFrame()
+            -> void;
+
+        // Pop the frame, before returning from the function.
+        auto PopFrame()
+            -> void;
+
+        // Store the value in the slot, so the object it refers to (if any) stays alive.
+        auto StoreRoot(u32 slot, llvm::Value* value)
+            -> void;
+
+        // Store the value in a new slot.
+        auto Root(llvm::Value* value)
+            -> void
+        {
+            StoreRoot(frame_slots++, value);
+        }
+
+        auto GCTop()
+            -> llvm::Constant*
+        {
+            return mod->getOrInsertGlobal("lox_gc_top", builder->getInt8PtrTy());
+        }
+
+
+        // Classes and instances (see shape.hpp).
+
+        static auto ClassSymbol(std::string_view name)
+            -> std::string
+        {
+            return "lox.class." + std::string{name};
+        }
+
+        // Type of LoxClass.
+        auto ClassType()
+            -> llvm::StructType*;
+
+        // Type of InlineCache.
+        auto CacheType()
+            -> llvm::StructType*;
+
+        // Return the descriptor of the class, declaring it if it isn't in the module.
+        auto ClassDescriptor(std::string_view name)
+            -> llvm::GlobalVariable*;
+
+        // Return the null terminated string, emitted once.
+        auto GlobalName(std::string_view name)
+            -> llvm::Constant*;
+
+        // Return a new empty inline cache for the property.
+        auto NewInlineCache(std::string_view name)
+            -> llvm::GlobalVariable*;
+
+        // Load a field (shape, target, offset) of the first entry of the cache.
+        auto CacheEntry(llvm::GlobalVariable* cache, unsigned field, llvm::Type* type)
+            -> llvm::Value*;
+
+        // Pointer to the value of the type at offset bytes from the object.
+        auto FieldAddress(llvm::Value* object, llvm::Value* offset, llvm::Type* type)
+            -> llvm::Value*;
+
+        // Continue in a new block if the value is an object with the shape of the first entry
+        // of the cache, otherwise branch to miss_bb. Return the pointer to the object.
+        auto CheckShape(llvm::Value* value, llvm::GlobalVariable* cache, llvm::BasicBlock* miss_bb)
+            -> llvm::Value*;
+
+        // Write barrier after storing the value in the object.
+        auto WriteBarrier(llvm::Value* object, llvm::Value* value)
+            -> void;
+
+        // TBAA tag of the memory of the lists accessed by the generated code: "list" for the
+        // headers of the lists and of their buffers, "element" for the elements, and "slot" for
+        // the GC slots of the frames. The accesses with different tags don't alias, so LLVM can
+        // keep the length and the buffer of a list in registers across the stores of the
+        // elements and of the roots.
+        auto AccessTag(llvm::StringRef name)
+            -> llvm::MDNode*;
+
+
+        // Lists (see list_object.hpp).
+
+        // The list and the i64 index if the index is an integer below the length: i1 check.
+        auto ListIndex(llvm::Value* index, llvm::Value* index_int, llvm::Value* length)
+            -> std::pair<llvm::Value*, llvm::Value*>;
+
+        // Continue in a new block if the value is a list and the index is within its length,
+        // otherwise branch to slow_bb (a map, or an error). Return the address of the element
+        // (i64*) and the buffer.
+        auto ElementAddress(llvm::Value* list, llvm::Value* index, llvm::Value* index_int,
+            llvm::BasicBlock* slow_bb)
+            -> std::pair<llvm::Value*, llvm::Value*>;
+
+        // Address of the element (f64*) of a packed list of a fast loop, with the bounds check
+        // unless the index is the counter in range.
+        struct PackedList;
+        auto PackedAddress(const PackedList& list, std::string_view name, const ExprNode& index_node,
+            llvm::Value* index, llvm::Value* index_int, const Token& t)
+            -> llvm::Value*;
+
+        // Continue in a new block if the variable holds a list with a Doubles buffer, otherwise
+        // branch to generic_bb. Load its buffer and its length (in the guard of a fast loop).
+        auto GuardList(u32 var, llvm::BasicBlock* generic_bb)
+            -> PackedList;
+
+        // Packed list of the fast copies of loops being generated, null if the name isn't one.
+        auto FindPackedList(std::string_view name) const
+            -> const PackedList*;
+
+        // Call the runtime that reports the error of list[index] (ends the block).
+        auto IndexError(llvm::Value* list, llvm::Value* index, const Token& t)
+            -> void;
+
+        // i1, true if the boxed values have the same bits or are strings with the same chars
+        // (the numbers are not compared as doubles).
+        auto EqualObjects(llvm::Value* left, llvm::Value* right)
+            -> llvm::Value*;
+
+        // Call the function of a method with this and the arguments.
+        auto CallMethod(llvm::Value* function, llvm::ArrayRef<llvm::Value*> args)
+            -> llvm::CallInst*;
+
+        // Generate the constructor of the class: it allocates the instance and calls init (of
+        // the class or of a superclass) if there is one.
+        auto DefineConstructor(const ClassStmtNode& node, const FunStmtNode* init)
+            -> void;
+
+
+        // Scopes.
+
+        auto BeginScope()
+            -> void
+        {
+            scopes.emplace_back();
+        }
+
+        auto EndScope()
+            -> void
+        {
+            scopes.pop_back();
+        }
+
+        // Declare a new variable in the innermost scope, initialized with the value, and
+        // return its id. A number is not stored in the GC slot of the variable. A shared
+        // variable gets the storage chosen by the analysis.
+        auto DeclareVar(const Token& name, llvm::Value* value, bool number = false)
+            -> u32;
+
+        // Add the variable to the innermost scope, with its SSA variable holding value (the
+        // value, its box or its address, depending on the storage). Not rooted.
+        enum class Storage
+        {
+            // In its SSA variable.
+            Value,
+
+            // Shared: in a box, the SSA variable holds the (boxed) ObjSlots.
+            Box,
+
+            // Shared: in its GC slot, the SSA variable holds the address of the slot.
+            Pointer,
+        };
+
+        auto AddVar(std::string_view name, llvm::Value* value, Storage storage)
+            -> u32;
+
+        // Read and write the value of a variable, in its SSA variable or in its storage.
+        auto ReadVar(u32 var)
+            -> llvm::Value*;
+
+        auto WriteVar(u32 var, llvm::Value* value, bool number)
+            -> void;
+
+        // Pointer to the value of the box or of the slot of a shared variable.
+        auto SharedAddress(u32 var)
+            -> llvm::Value*;
+
+        // Return the id of the variable visible with this name.
+        auto ResolveVar(const Token& name)
+            -> u32;
+
+        auto FindVar(std::string_view name) const
+            -> std::optional<u32>;
+
+        // True if the variable is known to hold a number (in the fast copy of a loop).
+        auto IsNumericVar(std::string_view name) const
+            -> bool;
+
+        // Integer SSA variable of a counter (or of its bound) of a fast copy of a loop.
+        auto IntegerVar(std::string_view name) const
+            -> std::optional<u32>;
+
+        // Check that the variable holds an integer within +-2^52 (not -0) and return the i64, in
+        // the integer variable created for it (added to integers). Return the check.
+        auto GuardInteger(u32 var, std::string_view name,
+            std::unordered_map<std::string_view, u32>& integers)
+            -> llvm::Value*;
+
+        // Return the i64 constant of a number literal of a fast loop, or nullptr if it is
+        // not an integer within +-2^52.
+        auto IntegerConstant(f64 value)
+            -> llvm::Value*;
+
+        // True if the integer is a constant usable as the step of a counter.
+        static auto IsStepConstant(llvm::Value* value)
+            -> bool
+        {
+            auto constant = llvm::dyn_cast<llvm::ConstantInt>(value);
+            return constant && NumericLoop::IsStep(static_cast<f64>(constant->getSExtValue()));
+        }
+
+
+        // Generate the condition and the body of the loop, starting from the current block and
+        // leaving it by exit_bb (not inserted in the function).
+        auto GenerateLoop(const WhileStmtNode& node, llvm::BasicBlock* exit_bb)
+            -> void;
+
+
+        // SSA construction (Braun et al. "Simple and Efficient Construction of Static Single
+        // Assignment Form"). 
+
+        auto WriteLocalVar(llvm::BasicBlock* bb, u32 var, llvm::Value* value)
+            -> void
+        {
+            current_def[bb].defs[var] = value;
+        }
+
+        auto ReadLocalVar(llvm::BasicBlock* bb, u32 var)
+            -> llvm::Value*
+        {
+            auto& defs = current_def[bb].defs;
+            if (auto value = defs.find(var); value != defs.end())
+            {
+                return value->second;
+            }
+
+            // Recurse through the predecessors to find the definition.
+            return ReadLocalVarRecursive(bb, var);
+        }
+
+        auto ReadLocalVarRecursive(llvm::BasicBlock* bb, u32 var)
+            -> llvm::Value*;
+
+        auto AddEmptyPhi(llvm::BasicBlock* bb, u32 var)
+            -> llvm::PHINode*;
+
+        // Add the value of the variable from each predecessor.
+        auto AddPhiOperands(u32 var, llvm::PHINode* phi)
+            -> llvm::Value*;
+
+        // Remove the phi if all its operands are the same value (or the phi itself).
+        auto TryRemoveTrivialPhi(llvm::PHINode* phi)
+            -> llvm::Value*;
+
+        // Mark the block as sealed: all its predecessors are known, so the incomplete phis
+        // can be completed.
+        auto SealBlock(llvm::BasicBlock* bb)
+            -> void;
 
     // Utility classes for internal usage.
     private:
-
-        // // This struct keeps track of declaration of names inside a basic block.
-        // struct BasicBlockDef
-        // {
-        //     // It's safe to use a string_view because we are referring to a string
-        //     // in the source code (it is freed after the llvm pass). 
-        //     llvm::DenseMap<std::string_view, llvm::TrackingVH<llvm::Value>> defs;
-        //     llvm::DenseMap<llvm::PHINode*, std::string_view> incomplete_phis;
+        // This struct keeps track of the definitions of the variables inside a basic block.
+        struct BasicBlockDef
+        {
+            // TrackingVH follows the value when a trivial phi is replaced. 
+            llvm::DenseMap<u32, llvm::TrackingVH<llvm::Value>> defs;
+            llvm::DenseMap<llvm::PHINode*, u32> incomplete_phis;
             
-        //     // true if we know all the predecessors of this block, false otherwise.
-        //     bool sealed = false;
-        // };
+            // true if we know all the predecessors of this block, false otherwise.
+            bool sealed = false;
+        };
+
+        // List of a fast loop whose buffer and length don't change (NumericLoop::Lists()),
+        // loaded by the guard.
+        struct PackedList
+        {
+            // Boxed list (reading a variable can replace a trivial phi).
+            llvm::TrackingVH<llvm::Value> value;
+
+            // Address of the first element (f64*) and length (i64).
+            llvm::Value* elements;
+            llvm::Value* length;
+        };
+
+        // Loop whose fast copy is being generated (see operator()(WhileStmtNodePtr)).
+        struct FastLoop
+        {
+            // Its numeric variables hold numbers.
+            non_owned_ptr<const NumericLoop> loop;
+
+            // Name -> integer variable of the counter and of its bound.
+            std::unordered_map<std::string_view, u32> integers;
+
+            // Name -> packed list.
+            std::unordered_map<std::string_view, PackedList> lists;
+
+            // The lists indexed by the counter without bounds checks: the guard checked that
+            // its range is within their length.
+            std::string_view counter;
+            std::unordered_set<std::string_view> in_range;
+        };
+
+        // A closure whose function is known at compile time.
+        struct KnownClosure
+        {
+            llvm::Function* function;
+            std::size_t arity;
+
+            // The record is an object on the heap (tagged value) or an alloca (raw address).
+            bool escapes;
+
+            // The record is an alloca of the current function: the calls can't be tail calls.
+            bool local;
+        };
+
+        struct VarInfo
+        {
+            // It's safe to use a string_view because we are referring to a string
+            // in the source code (it is freed after the llvm pass). 
+            std::string_view name;
+
+            // Slot of the shadow stack frame that keeps the value alive for the GC.
+            u32 slot;
+
+            Storage storage{Storage::Value};
+
+            // The closure held by the variable, if it is never assigned.
+            std::optional<KnownClosure> known{};
+        };
+
+        struct ClosureContext
+        {
+            llvm::Function* function;
+            const ClosureAnalysis::Closure* closure;
+
+            // The variables of the enclosing function captured, in the order of the record.
+            std::vector<u32> captured;
+        };
+
+        class CodegenError : public std::exception
+        {
+        public:
+            const char* what() const noexcept override 
+            {
+                return "Codegen error.";
+            }
+        };
 
 
     private:
         std::unique_ptr<llvm::LLVMContext> context;
         std::unique_ptr<llvm::Module> mod;
         std::unique_ptr<llvm::IRBuilder<>> builder;
-        
-        // llvm::StringMap<llvm::Value*> name_vars;
 
+        non_owned_ptr<const StringPool> strings;
+
+        // Boxed constant (small string or ObjString) of each string literal, indexed by
+        // StringId. Each unique string is emitted once, the first time it is used.
+        std::vector<llvm::Constant*> string_constants;
+
+        // Message -> global string of the runtime errors reported by the generated code.
+        llvm::StringMap<llvm::GlobalVariable*> error_messages;
+
+        non_owned_ptr<const ExprCSE> cse{nullptr};
+
+        // Value of the canonical nodes shared by some duplicate expression.
+        llvm::DenseMap<const void*, llvm::TrackingVH<llvm::Value>> shared_values;
+        
         // Map basic blocks to definitions inside the block
-        // llvm::DenseMap<llvm::BasicBlock*, BasicBlockDef> current_def;
+        llvm::DenseMap<llvm::BasicBlock*, BasicBlockDef> current_def;
+
+        // Each declaration gets a unique id (the index in this vector), so shadowed
+        // variables are different variables for the SSA construction.
+        std::vector<VarInfo> variables;
+
+        // Name -> id of the variables declared in each scope (the innermost is the last).
+        std::vector<std::unordered_map<std::string_view, u32>> scopes;
+
+        bool had_error{false};
+        bool report_errors{true};
+
+        // Name -> init of the classes declared in the module (of the class or of a superclass,
+        // nullptr if none).
+        std::unordered_map<std::string_view, non_owned_ptr<const FunStmtNode>> classes;
+
+        // Names of the classes and of the properties, by value.
+        llvm::StringMap<llvm::Constant*> names;
+
+        // Closures and shared variables of the current function, null in the top-level code.
+        non_owned_ptr<const ClosureAnalysis> closures{nullptr};
+        std::unordered_set<std::string_view> shared_names;
+
+        // Functions declared but not generated (see SetLazyFunctions()).
+        bool lazy_functions{false};
+        std::vector<non_owned_ptr<const FunStmtNode>> lazy_function_nodes;
+
+        // See SetDeclarations().
+        non_owned_ptr<const Declarations> declarations{nullptr};
+
+        // Set by GenerateLoopEntry() for the next DefineFunction().
+        non_owned_ptr<LoopEntry> loop_entry{nullptr};
 
 
 
         // Last value produced.
         llvm::Value* current_value{nullptr};
 
+        // True if current_value is known to be a number, and its i64 if it is an integer of
+        // a fast copy of a loop (reset by Visit() of an expression).
+        bool current_number{false};
+        llvm::Value* current_int{nullptr};
+
+        // Fast copies of loops being generated, the innermost is the last.
+        static constexpr std::size_t max_fast_depth = 3;
+        std::vector<FastLoop> fast_loops;
+
         // Current function.
         llvm::Function* current_func{nullptr};
 
         // Current block.
         llvm::BasicBlock* current_block{nullptr};
+
+        // Shadow stack frame of the current function (see gc.hpp) and number of its slots.
+        llvm::AllocaInst* frame{nullptr};
+        u32 frame_slots{0};
     };
 } // namespace lox
 
@@ -4,19 +4,482 @@
 #include "node.hpp"
 #include "parser.hpp"
 #include "ast_printer.hpp"
-// #include "llvm_visitor.hpp"
+#include "ast_stats.hpp"
+#include "string_pool.hpp"
+#include "expr_cse.hpp"
+#include "llvm_visitor.hpp"
+#include "optimizer.hpp"
+#include "jit.hpp"
+#include "aot.hpp"
+#include "runtime.hpp"
+#include "gc.hpp"
+#include "parallel_codegen.hpp"
+#include "object_cache.hpp"
+#include "interpreter.hpp"
+#include "background_compiler.hpp"
+#include "bytecode_compiler.hpp"
+#include "vm.hpp"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/ADT/SmallString.h>
 
 #include <string_view>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+
+// What the driver does with the program.
+enum class Command : lox::u8
+{
+    // Dump the AST (or the statistics, or the IR).
+    Dump,
+
+    // Compile the program with the JIT and execute it.
+    Run,
+
+    // Compile the program to a native executable.
+    Build,
+};
+
+
+// Options of the driver.
+struct Options
+{
+    Command command{Command::Dump};
+
+    std::string_view filename;
+
+    // Executable written by the build command.
+    std::string_view output{"a.out"};
+
+    // Used to find the runtime library, next to the lox executable.
+    const char* argv0{nullptr};
+
+    // Format used to dump the AST.
+    lox::ASTFormat ast_format{lox::ASTFormat::SExpr};
+
+    // Report memory and shape statistics of the AST instead of dumping it.
+    bool ast_stats{false};
+
+    // Report the duplicate expressions found by the CSE analysis instead of dumping the AST.
+    bool cse_stats{false};
+
+    // Print the LLVM IR of the program instead of dumping the AST.
+    bool emit_llvm{false};
+
+    // Reuse the value of duplicate expressions in the generated code.
+    bool cse{false};
+
+    lox::OptLevel opt_level{lox::OptLevel::O0};
+
+    // Report the time spent in each optimization pass.
+    bool time_passes{false};
+
+    // Report the time spent in each phase of the run and build commands.
+    bool time{false};
+
+    // Report the statistics of the garbage collector after running the compiled program.
+    bool gc_stats{false};
+
+    // Generate code for the CPU of the host (build command).
+    bool native_cpu{false};
+
+    // Compile all the functions before running the program, instead of on their first call.
+    bool eager{false};
+
+    // Start in the interpreter and compile only the hot functions (run command).
+    bool tiered{false};
+
+    // Execute the program with the bytecode VM instead of LLVM (run command).
+    bool vm{false};
+
+    // Print the bytecode of the program instead of dumping the AST.
+    bool emit_bytecode{false};
+
+    // Threads that compile the functions before running or building (1: no parallel codegen).
+    unsigned jobs{1};
+
+    // Reuse the object code of the functions compiled by the previous runs and builds.
+    bool cache{false};
+
+    // Calls plus loop iterations after which a function is compiled (tiered mode).
+    lox::u64 jit_threshold{1000};
+};
+
+
+// Exit status of the driver (see sysexits.h): the program has an error, or failed while running.
+// The compiled code exits with exit_runtime_error too (see lox_error()).
+constexpr int exit_compile_error = 65;
+constexpr int exit_runtime_error = 70;
+
+
+using Clock = std::chrono::steady_clock;
+
+static auto Milliseconds(Clock::time_point begin, Clock::time_point end)
+    -> double
+{
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
 
-static void RunFile(std::string_view filename)
+
+// Analyze the program for --cse, nullptr without it. The analysis covers the functions too:
+// the visitors that generate them (lazy, parallel, cached or tiered) must use it as well.
+static auto AnalyzeCSE(const Options& options, const std::vector<lox::StmtNode>& root, lox::ExprCSE& cse)
+    -> lox::non_owned_ptr<const lox::ExprCSE>
+{
+    if (!options.cse)
+    {
+        return nullptr;
+    }
+    cse.Analyze(root);
+    return &cse;
+}
+
+
+// Generate the IR of the program. Return false if there was an error.
+static auto Codegen(const std::vector<lox::StmtNode>& root, lox::LLVMVisitor& llvm_visitor,
+    lox::non_owned_ptr<const lox::ExprCSE> cse)
+    -> bool
+{
+    llvm_visitor.SetCSE(cse);
+    for (const auto& node : root)
+    {
+        llvm_visitor.Generate(node);
+    }
+    llvm_visitor.End();
+    return !llvm_visitor.HadError();
+}
+
+
+// Compile the program to bytecode and execute it with the VM. Return the exit status.
+static auto RunVM(const Options& options, const std::vector<lox::StmtNode>& root,
+    const lox::StringPool& strings)
+    -> int
+{
+    auto begin = Clock::now();
+    lox::BytecodeCompiler compiler;
+    compiler.Compile(root);
+    if (compiler.HadError())
+    {
+        return exit_compile_error;
+    }
+    auto compile_end = Clock::now();
+
+    lox::VM vm{&strings};
+    lox_rt_init();
+    bool ok = vm.Run(compiler.Program());
+    lox_rt_shutdown();
+    auto run_end = Clock::now();
+
+    if (options.time)
+    {
+        std::fprintf(stderr, "compile:      %10.3f ms\n", Milliseconds(begin, compile_end));
+        std::fprintf(stderr, "execution:    %10.3f ms\n", Milliseconds(compile_end, run_end));
+    }
+    return ok ? 0 : exit_runtime_error;
+}
+
+
+// Interpret the program, compiling the hot functions in background. Return the exit status.
+static auto RunTiered(const Options& options, const std::vector<lox::StmtNode>& root,
+    const lox::StringPool& strings)
+    -> int
+{
+    // The interpreter runs the subset of the VM: the programs it can't finish don't start.
+    lox::BytecodeCompiler check{"the interpreter"};
+    check.Compile(root);
+    if (check.HadError())
+    {
+        return exit_compile_error;
+    }
+
+    auto begin = Clock::now();
+    lox::ExprCSE cse;
+    lox::BackgroundCompiler compiler{&strings, root, options.opt_level, AnalyzeCSE(options, root, cse)};
+    lox::Interpreter interpreter{&strings, &compiler, options.jit_threshold};
+
+    lox_rt_init();
+    bool ok = interpreter.Run(root);
+    lox_rt_shutdown();
+    auto run_end = Clock::now();
+
+    if (options.time)
+    {
+        std::fprintf(stderr, "execution:    %10.3f ms\n", Milliseconds(begin, run_end));
+        std::fprintf(stderr, "calls:        %llu interpreted, %llu native\n",
+            static_cast<unsigned long long>(interpreter.InterpretedCalls()),
+            static_cast<unsigned long long>(interpreter.NativeCalls()));
+        std::fprintf(stderr, "jit compile:  %10.3f ms in background (%llu functions)\n",
+            compiler.CompileTime(), static_cast<unsigned long long>(compiler.Compiled()));
+    }
+    return ok ? 0 : exit_runtime_error;
+}
+
+
+// Compile the program for the host with the JIT and call its main function. Return the exit
+// status: a runtime error exits from the compiled code.
+static auto Run(const Options& options, const std::vector<lox::StmtNode>& root,
+    const lox::StringPool& strings)
+    -> int
 {
-    std::ifstream file{filename.data()};
+    auto begin = Clock::now();
+    auto declarations = lox::DeclaredNames(root);
+    lox::ExprCSE cse_analysis;
+    auto cse = AnalyzeCSE(options, root, cse_analysis);
+    lox::LLVMVisitor llvm_visitor{&strings};
+    llvm_visitor.SetDeclarations(&declarations);
+    // In parallel mode the functions are collected like the lazy ones, but compiled before running.
+    // The eager functions are cached one at a time, like in parallel mode.
+    bool parallel = options.jobs > 1 || (options.eager && options.cache);
+    llvm_visitor.SetLazyFunctions(!options.eager || parallel);
+    if (!Codegen(root, llvm_visitor, cse))
+    {
+        return exit_compile_error;
+    }
+    auto codegen_end = Clock::now();
+
+    try
+    {
+        lox::JIT jit{options.opt_level, options.cache ? lox::ObjectCache::DefaultDirectory() : std::string{}};
+        lox::ParallelCodegen parallel_codegen{&strings, options.opt_level, options.jobs, jit.Cache()};
+
+        // The other threads compile the functions while this one optimizes main.
+        if (parallel)
+        {
+            parallel_codegen.Start(llvm_visitor.LazyFunctions(), &declarations, cse, [&jit]()
+            {
+                return jit.CreateTargetMachine();
+            });
+        }
+
+        // Each function gets its own module, generated the first time it is called.
+        for (auto function : parallel ? std::vector<lox::non_owned_ptr<const lox::FunStmtNode>>{} :
+            llvm_visitor.LazyFunctions())
+        {
+            auto name = lox::LLVMVisitor::FunctionSymbol(function->name.Lexeme());
+            auto key = jit.Cache() ? jit.Cache()->Key(*function, strings, &declarations, cse) : std::string{};
+            jit.AddLazy(name, [&options, &strings, &declarations, &jit, cse, function, name]()
+            {
+                // The output of the program so far comes before the errors of the function.
+                lox_flush();
+                lox::LLVMVisitor function_visitor{&strings, name};
+                function_visitor.SetDeclarations(&declarations);
+                function_visitor.SetCSE(cse);
+                function_visitor.GenerateFunction(*function);
+                if (function_visitor.HadError())
+                {
+                    return llvm::orc::ThreadSafeModule{};
+                }
+                jit.Prepare(function_visitor.Module());
+                lox::Optimizer optimizer{options.opt_level, false, &jit.TargetMachine()};
+                optimizer.Run(function_visitor.Module());
+                return function_visitor.TakeModule();
+            }, std::move(key), lox::LLVMVisitor::ValueSymbol(function->name.Lexeme()));
+        }
+        auto setup_end = Clock::now();
+
+        jit.Prepare(llvm_visitor.Module());
+        lox::Optimizer optimizer{options.opt_level, options.time_passes, &jit.TargetMachine()};
+        optimizer.Run(llvm_visitor.Module());
+        auto opt_end = Clock::now();
+
+        if (parallel)
+        {
+            std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects;
+            if (!parallel_codegen.Wait(objects))
+            {
+                return exit_compile_error;
+            }
+            for (auto& object : objects)
+            {
+                jit.AddObject(std::move(object));
+            }
+        }
+        auto parallel_end = Clock::now();
+
+        // The machine code is generated when main is looked up.
+        jit.Add(llvm_visitor.TakeModule());
+        auto main_func = reinterpret_cast<void(*)()>(jit.Lookup("lox_main"));
+        auto compile_end = Clock::now();
+
+        lox_rt_init();
+        main_func();
+        lox_rt_shutdown();
+        auto run_end = Clock::now();
+
+        if (options.time_passes)
+        {
+            optimizer.Report(stderr);
+        }
+        if (options.time)
+        {
+            std::fprintf(stderr, "codegen:      %10.3f ms\n", Milliseconds(begin, codegen_end));
+            std::fprintf(stderr, "jit setup:    %10.3f ms\n", Milliseconds(codegen_end, setup_end));
+            std::fprintf(stderr, "optimization: %10.3f ms\n", Milliseconds(setup_end, opt_end));
+            if (parallel)
+            {
+                std::fprintf(stderr, "functions:    %10.3f ms (%u threads, waited %.3f ms)\n",
+                    Milliseconds(codegen_end, parallel_end), options.jobs, Milliseconds(opt_end, parallel_end));
+            }
+            std::fprintf(stderr, "jit compile:  %10.3f ms\n", Milliseconds(parallel_end, compile_end));
+            std::fprintf(stderr, "lazy compile: %10.3f ms (%llu functions)\n", jit.LazyCompileTime(),
+                static_cast<unsigned long long>(jit.LazyCompiled()));
+            if (jit.Cache())
+            {
+                std::fprintf(stderr, "cache:        %llu hits, %llu compiled\n",
+                    static_cast<unsigned long long>(jit.Cache()->Hits()),
+                    static_cast<unsigned long long>(jit.Cache()->Misses()));
+            }
+            std::fprintf(stderr, "execution:    %10.3f ms\n",
+                Milliseconds(compile_end, run_end) - jit.LazyCompileTime());
+        }
+        if (options.gc_stats)
+        {
+            lox_gc_report();
+        }
+    }
+    catch (const lox::JITError& e)
+    {
+        std::cerr << "JIT error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+
+// Compile the program to an object file and link it with the runtime in an executable. Return
+// the exit status.
+static auto Build(const Options& options, const std::vector<lox::StmtNode>& root,
+    const lox::StringPool& strings)
+    -> int
+{
+    auto begin = Clock::now();
+    auto declarations = lox::DeclaredNames(root);
+    lox::ExprCSE cse_analysis;
+    auto cse = AnalyzeCSE(options, root, cse_analysis);
+    lox::LLVMVisitor llvm_visitor{&strings};
+    llvm_visitor.SetDeclarations(&declarations);
+    // The functions are cached one at a time, like in parallel mode.
+    bool parallel = options.jobs > 1 || options.cache;
+    llvm_visitor.SetLazyFunctions(parallel);
+    if (!Codegen(root, llvm_visitor, cse))
+    {
+        return exit_compile_error;
+    }
+    auto codegen_end = Clock::now();
+
+    std::string output{options.output};
+    std::string object{output + ".o"};
+    std::vector<std::string> objects{object};
+    // Objects of the cache, linked but not removed.
+    std::vector<std::string> cached_objects;
+    auto remove_objects = [&objects]()
+    {
+        for (const auto& path : objects)
+        {
+            llvm::sys::fs::remove(path);
+        }
+    };
+
+    llvm::SmallString<256> runtime{llvm::sys::fs::getMainExecutable(options.argv0,
+        reinterpret_cast<void*>(&Build))};
+    llvm::sys::path::remove_filename(runtime);
+    llvm::sys::path::append(runtime, "liblox_rt.a");
+
+    try
+    {
+        lox::AOT aot{options.opt_level, options.native_cpu};
+        std::unique_ptr<lox::ObjectCache> cache;
+        if (options.cache)
+        {
+            cache = std::make_unique<lox::ObjectCache>(lox::ObjectCache::DefaultDirectory(),
+                aot.TargetMachine(), options.opt_level);
+        }
+        lox::ParallelCodegen parallel_codegen{&strings, options.opt_level, options.jobs, cache.get()};
+        if (parallel)
+        {
+            parallel_codegen.Start(llvm_visitor.LazyFunctions(), &declarations, cse, [&aot]()
+            {
+                return aot.CreateTargetMachine();
+            });
+        }
+
+        aot.Prepare(llvm_visitor.Module());
+        lox::Optimizer optimizer{options.opt_level, options.time_passes, &aot.TargetMachine()};
+        optimizer.Run(llvm_visitor.Module());
+        auto opt_end = Clock::now();
+
+        aot.EmitObject(llvm_visitor.Module(), object);
+        if (parallel)
+        {
+            std::vector<std::unique_ptr<llvm::MemoryBuffer>> buffers;
+            if (!parallel_codegen.Wait(buffers))
+            {
+                remove_objects();
+                return exit_compile_error;
+            }
+            for (const auto& buffer : buffers)
+            {
+                // The objects loaded from the cache are linked from there.
+                if (auto path = cache ? cache->FileOf(*buffer) : std::string{}; !path.empty())
+                {
+                    cached_objects.push_back(std::move(path));
+                    continue;
+                }
+                objects.push_back(output + "." + std::to_string(objects.size()) + ".o");
+                lox::AOT::WriteObject(*buffer, objects.back());
+            }
+        }
+        auto emit_end = Clock::now();
+
+        auto linked = objects;
+        linked.insert(linked.end(), cached_objects.begin(), cached_objects.end());
+        lox::AOT::Link(linked, std::string{runtime.str()}, output);
+        remove_objects();
+        auto link_end = Clock::now();
+
+        if (options.time_passes)
+        {
+            optimizer.Report(stderr);
+        }
+        if (options.time)
+        {
+            std::fprintf(stderr, "codegen:      %10.3f ms\n", Milliseconds(begin, codegen_end));
+            std::fprintf(stderr, "optimization: %10.3f ms\n", Milliseconds(codegen_end, opt_end));
+            std::fprintf(stderr, "emit object:  %10.3f ms\n", Milliseconds(opt_end, emit_end));
+            std::fprintf(stderr, "link:         %10.3f ms\n", Milliseconds(emit_end, link_end));
+            if (cache)
+            {
+                std::fprintf(stderr, "cache:        %llu hits, %llu compiled\n",
+                    static_cast<unsigned long long>(cache->Hits()),
+                    static_cast<unsigned long long>(cache->Misses()));
+            }
+        }
+    }
+    catch (const lox::AOTError& e)
+    {
+        remove_objects();
+        std::cerr << "Build error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+
+// Execute the command on the file. Return the exit status.
+static auto RunFile(const Options& options)
+    -> int
+{
+    std::ifstream file{options.filename.data()};
     if (!file)
     {
-        return;
+        std::cerr << "Could not open file " << options.filename << std::endl;
+        return EXIT_FAILURE;
     }
 
     std::stringstream buffer;
@@ -34,33 +497,228 @@ static void RunFile(std::string_view filename)
     // scanner.Reset();
 
 
-    lox::Parser parser{&scanner};
+    lox::StringPool strings;
+    lox::Parser parser{&scanner, &strings};
     auto root = parser.Parse();
+    // The parser has reported the errors.
+    if (parser.HadError())
+    {
+        return exit_compile_error;
+    }
 
-    lox::ASTPrinter printer;
-    for (const auto& node : root)
+    if (options.ast_stats)
     {
-        std::cout << "Node:\n";
-        std::cout << printer.Visit(node) << "\n";
-        std::cout << std::endl;
+        lox::ASTStats stats;
+        stats.Collect(root);
+        stats.Collect(strings);
+        stats.Report(stdout);
+        return 0;
     }
 
-    // lox::LLVMVisitor llvm_visitor;
-    // for (const auto& node : root)
-    // {
-    //     llvm_visitor.Generate(node);
-    // }
-    // llvm_visitor.End();
-    // llvm_visitor.Print();
+    if (options.command == Command::Run)
+    {
+        if (options.vm)
+        {
+            return RunVM(options, root, strings);
+        }
+        if (options.tiered)
+        {
+            return RunTiered(options, root, strings);
+        }
+        return Run(options, root, strings);
+    }
+
+    if (options.command == Command::Build)
+    {
+        return Build(options, root, strings);
+    }
+
+    if (options.emit_bytecode)
+    {
+        lox::BytecodeCompiler compiler;
+        compiler.Compile(root);
+        if (compiler.HadError())
+        {
+            return exit_compile_error;
+        }
+        const auto& program = compiler.Program();
+        lox::Disassemble(program.script.chunk, "<script>", stdout);
+        for (const auto& function : program.functions)
+        {
+            lox::Disassemble(function.chunk, function.name, stdout);
+        }
+        return 0;
+    }
+
+    if (options.cse_stats)
+    {
+        lox::ExprCSE cse;
+        cse.Analyze(root);
+        cse.Report(stdout);
+        return 0;
+    }
+
+    if (options.emit_llvm)
+    {
+        auto declarations = lox::DeclaredNames(root);
+        lox::ExprCSE cse;
+        lox::LLVMVisitor llvm_visitor{&strings};
+        llvm_visitor.SetDeclarations(&declarations);
+        if (!Codegen(root, llvm_visitor, AnalyzeCSE(options, root, cse)))
+        {
+            return exit_compile_error;
+        }
+
+        lox::Optimizer optimizer{options.opt_level, options.time_passes};
+        optimizer.Run(llvm_visitor.Module());
+        llvm_visitor.Print();
+        if (options.time_passes)
+        {
+            optimizer.Report(stderr);
+        }
+        return 0;
+    }
+
+    lox::ASTPrinter printer{stdout, strings, options.ast_format};
+    printer.Print(root);
+    return 0;
+}
+
+
+static void Usage()
+{
+    std::cerr << "Usage: lox [--ast-json | --ast-stats | --cse-stats | --emit-bytecode | --emit-llvm [--cse] [-O<n>] [--time-passes]] <file>\n"
+        << "       lox run [--cse] [-O<n>] [--cache] [--eager | -j <n> | --tiered [--jit-threshold <n>] | --vm] [--time-passes] [--time] [--gc-stats] <file>\n"
+        << "       lox build [--cse] [-O<n>] [-march=native] [-j <n>] [--cache] [--time-passes] [--time] [-o <output>] <file>\n"
+        << "    run           compile the program for the host with the JIT and execute it.\n"
+        << "    build         compile the program to a native executable (default a.out).\n"
+        << "    --ast-json    dump the AST in JSON format instead of S-expressions.\n"
+        << "    --ast-stats   report node counts, bytes allocated, depth and fan-out of the AST.\n"
+        << "    --cse-stats   report the duplicate side-effect-free expressions.\n"
+        << "    --emit-bytecode print the bytecode of the program.\n"
+        << "    --emit-llvm   print the LLVM IR of the program.\n"
+        << "    --cse         reuse the value of duplicate expressions in the generated code.\n"
+        << "    -O0 .. -O3    optimization level (default -O0).\n"
+        << "    --time-passes report the time spent in each optimization pass.\n"
+        << "    --eager       compile all the functions before running (run compiles them on the first call).\n"
+        << "    -j <n>        generate and compile the functions on n threads before running or building.\n"
+        << "    --cache       reuse the functions compiled by the previous runs and builds (in $LOX_CACHE_DIR,\n"
+        << "                  default ~/.cache/lox).\n"
+        << "    --tiered      interpret the program and compile the hot functions in background.\n"
+        << "    --jit-threshold <n> calls plus loop iterations that make a function hot (default 1000).\n"
+        << "    --vm          execute the program with the bytecode VM (no LLVM).\n"
+        << "    --time        report the time of each phase of run and build.\n"
+        << "    --gc-stats    report the collections and the heap size (run, LOX_GC_STATS=1 for build).\n"
+        << "    -march=native generate code for the CPU of the host (build, run always does).\n";
 }
 
 
 int main(int argc, char** argv)
 {
-    if (argc > 1)
+    Options options;
+    options.argv0 = argv[0];
+    int first = 1;
+    if (argc > 1 && std::string_view{argv[1]} == "run")
     {
-        RunFile(argv[1]);
+        options.command = Command::Run;
+        first = 2;
+    }
+    else if (argc > 1 && std::string_view{argv[1]} == "build")
+    {
+        options.command = Command::Build;
+        first = 2;
+    }
+
+    for (int i = first; i < argc; ++i)
+    {
+        std::string_view arg{argv[i]};
+        if (arg == "--ast-json")
+        {
+            options.ast_format = lox::ASTFormat::Json;
+        }
+        else if (arg == "--ast-stats")
+        {
+            options.ast_stats = true;
+        }
+        else if (arg == "--cse-stats")
+        {
+            options.cse_stats = true;
+        }
+        else if (arg == "--emit-llvm")
+        {
+            options.emit_llvm = true;
+        }
+        else if (arg == "--cse")
+        {
+            options.cse = true;
+        }
+        else if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' && arg[2] <= '3')
+        {
+            options.opt_level = static_cast<lox::OptLevel>(arg[2] - '0');
+        }
+        else if (arg == "--time-passes")
+        {
+            options.time_passes = true;
+        }
+        else if (arg == "--time")
+        {
+            options.time = true;
+        }
+        else if (arg == "--gc-stats")
+        {
+            options.gc_stats = true;
+        }
+        else if (arg == "--eager")
+        {
+            options.eager = true;
+        }
+        else if (arg == "--vm")
+        {
+            options.vm = true;
+        }
+        else if (arg == "--emit-bytecode")
+        {
+            options.emit_bytecode = true;
+        }
+        else if (arg == "--cache")
+        {
+            options.cache = true;
+        }
+        else if (arg == "--tiered")
+        {
+            options.tiered = true;
+        }
+        else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc)
+        {
+            options.jobs = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--jit-threshold" && i + 1 < argc)
+        {
+            options.jit_threshold = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "-march=native")
+        {
+            options.native_cpu = true;
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            options.output = argv[++i];
+        }
+        else if (arg.starts_with("-"))
+        {
+            Usage();
+            return 1;
+        }
+        else
+        {
+            options.filename = arg;
+        }
+    }
+
+    if (!options.filename.empty())
+    {
+        return RunFile(options);
     }
 
     return 0;
-}
\ No newline at end of file
+}
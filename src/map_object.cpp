@@ -0,0 +1,414 @@
+#include "map_object.hpp"
+#include "gc.hpp"
+#include "string_object.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <new>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace lox
+{
+    // Control bytes: a full entry has the h2 of its key (0 to 127), the others the high bit.
+    constexpr u8 ctrl_empty = 0x80;
+    constexpr u8 ctrl_deleted = 0xfe;
+
+#if defined(__SSE2__)
+    // A bit for each control byte.
+    constexpr u32 mask_shift = 0;
+#else
+    // The high bit of each control byte.
+    constexpr u32 mask_shift = 3;
+#endif
+
+
+    // Positions of the control bytes of a group that match, from the first one.
+    struct GroupMask
+    {
+        u64 bits;
+
+        explicit operator bool() const noexcept
+        {
+            return bits != 0;
+        }
+
+        auto First() const noexcept
+            -> u32
+        {
+            return static_cast<u32>(std::countr_zero(bits)) >> mask_shift;
+        }
+
+        auto Next() noexcept
+            -> void
+        {
+            bits &= bits - 1;
+        }
+    };
+
+
+    // The map_group control bytes probed at once.
+    class Group
+    {
+    public:
+#if defined(__SSE2__)
+        explicit Group(const u8* control) noexcept :
+            ctrl{_mm_loadu_si128(reinterpret_cast<const __m128i*>(control))}
+        {
+        }
+
+        auto Match(u8 h2) const noexcept
+            -> GroupMask
+        {
+            return Mask(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(h2))));
+        }
+
+        auto MatchEmpty() const noexcept
+            -> GroupMask
+        {
+            return Mask(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(ctrl_empty))));
+        }
+
+        // The empty and the deleted entries.
+        auto MatchFree() const noexcept
+            -> GroupMask
+        {
+            return Mask(ctrl);
+        }
+
+    private:
+        static auto Mask(__m128i bytes) noexcept
+            -> GroupMask
+        {
+            return GroupMask{static_cast<u32>(_mm_movemask_epi8(bytes))};
+        }
+
+        __m128i ctrl;
+#else
+        explicit Group(const u8* control) noexcept
+        {
+            std::memcpy(&ctrl, control, sizeof(ctrl));
+        }
+
+        // Can also match a full entry that follows a match: the keys are compared anyway.
+        auto Match(u8 h2) const noexcept
+            -> GroupMask
+        {
+            auto x = ctrl ^ (lsbs * h2);
+            return GroupMask{(x - lsbs) & ~x & msbs};
+        }
+
+        // Bit 1 is set in a deleted byte, not in an empty one.
+        auto MatchEmpty() const noexcept
+            -> GroupMask
+        {
+            return GroupMask{ctrl & ~(ctrl << 6) & msbs};
+        }
+
+        auto MatchFree() const noexcept
+            -> GroupMask
+        {
+            return GroupMask{ctrl & msbs};
+        }
+
+    private:
+        static constexpr u64 lsbs = 0x0101010101010101;
+        static constexpr u64 msbs = 0x8080808080808080;
+
+        u64 ctrl;
+#endif
+    };
+
+
+    // Finalizer of splitmix64: every bit of the result depends on every bit of x.
+    static auto Mix(u64 x) noexcept
+        -> u64
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
+
+
+    static auto HashChars(std::string_view chars) noexcept
+        -> u64
+    {
+        constexpr u64 multiplier = 0x9e3779b97f4a7c15;
+        u64 hash = chars.size();
+        std::size_t i = 0;
+        for (; i + sizeof(u64) <= chars.size(); i += sizeof(u64))
+        {
+            u64 word;
+            std::memcpy(&word, chars.data() + i, sizeof(word));
+            hash = std::rotl((hash ^ word) * multiplier, 29);
+        }
+        u64 word = 0;
+        std::memcpy(&word, chars.data() + i, chars.size() - i);
+        return Mix((hash ^ word) * multiplier);
+    }
+
+
+    // The key is a flat string if it is a string (see Flatten()).
+    static auto Hash(LoxValue key) noexcept
+        -> u64
+    {
+        if (key.IsNumber())
+        {
+            // -0 == 0.
+            return Mix(key.AsNumber() == 0 ? 0 : key.Bits());
+        }
+        // A small string has a single representation: its bits.
+        if (key.IsObject() && key.IsString())
+        {
+            return HashChars(key.AsString());
+        }
+        return Mix(key.Bits());
+    }
+
+
+    // ==, without flattening: the keys are flat strings if they are strings.
+    static auto KeysEqual(LoxValue left, LoxValue right) noexcept
+        -> bool
+    {
+        if (left.IsNumber() || right.IsNumber())
+        {
+            return left.IsNumber() && right.IsNumber() && left.AsNumber() == right.AsNumber();
+        }
+        return StringsEqual(left, right);
+    }
+
+
+    // Flatten a rope key, so its chars can be hashed and compared. Can run a collection.
+    static auto Flatten(LoxValue key)
+        -> LoxValue
+    {
+        if (key.IsObject() && key.IsString())
+        {
+            StringChars(key);
+        }
+        return key;
+    }
+
+
+    static auto H1(u64 hash) noexcept
+        -> u32
+    {
+        return static_cast<u32>(hash >> 7);
+    }
+
+
+    static auto H2(u64 hash) noexcept
+        -> u8
+    {
+        return static_cast<u8>(hash & 0x7f);
+    }
+
+
+    // Index of the entry of the key, capacity if the table doesn't have it.
+    static auto Find(ObjTable* table, LoxValue key, u64 hash) noexcept
+        -> u32
+    {
+        auto groups_mask = table->capacity / map_group - 1;
+        auto group = H1(hash) & groups_mask;
+        auto h2 = H2(hash);
+        for (u32 step = 1;; ++step)
+        {
+            auto first = group * map_group;
+            Group control{table->Control() + first};
+            for (auto match = control.Match(h2); match; match.Next())
+            {
+                auto i = first + match.First();
+                if (KeysEqual(LoxValue{table->Entries()[2 * i]}, key))
+                {
+                    return i;
+                }
+            }
+            // The key would have been added to this group.
+            if (control.MatchEmpty())
+            {
+                return table->capacity;
+            }
+            group = (group + step) & groups_mask;
+        }
+    }
+
+
+    // Add the key, which the table doesn't have, to the first free entry of its probe sequence.
+    // The table must have a free entry left (growth_left > 0 or a deleted entry).
+    static auto Insert(ObjTable* table, LoxValue key, LoxValue value, u64 hash) noexcept
+        -> void
+    {
+        auto groups_mask = table->capacity / map_group - 1;
+        auto group = H1(hash) & groups_mask;
+        for (u32 step = 1;; ++step)
+        {
+            auto first = group * map_group;
+            if (auto match = Group{table->Control() + first}.MatchFree())
+            {
+                auto i = first + match.First();
+                auto& control = table->Control()[i];
+                if (control == ctrl_empty)
+                {
+                    --table->growth_left;
+                }
+                else
+                {
+                    --table->deleted;
+                }
+                control = H2(hash);
+                table->Entries()[2 * i] = key.Bits();
+                table->Entries()[2 * i + 1] = value.Bits();
+                return;
+            }
+            group = (group + step) & groups_mask;
+        }
+    }
+
+
+    // An empty table. Can run a collection.
+    static auto NewTable(u32 capacity)
+        -> ObjTable*
+    {
+        auto table = reinterpret_cast<ObjTable*>(GlobalHeap().Allocate(ObjType::Table,
+            sizeof(ObjTable) + u64{capacity} * (1 + 2 * sizeof(u64))));
+        table->capacity = capacity;
+        // At most 7/8 of the entries are used.
+        table->growth_left = capacity - capacity / 8;
+        table->deleted = 0;
+        std::fill_n(table->Control(), capacity, ctrl_empty);
+        std::fill_n(table->Entries(), 2 * u64{capacity}, LoxValue::nil_bits);
+        return table;
+    }
+
+
+    // Move the entries to a new table with room for one more. The deleted entries are dropped,
+    // so the capacity can stay the same. Can run a collection.
+    static auto Rehash(ObjMap* map)
+        -> void
+    {
+        u64 capacity = map_min_capacity;
+        while ((u64{map->count} + 1) * 8 > capacity * 7)
+        {
+            capacity *= 2;
+        }
+        if (capacity > UINT32_MAX)
+        {
+            throw std::bad_alloc{};
+        }
+
+        // The old table is reachable from the map.
+        auto table = NewTable(static_cast<u32>(capacity));
+        auto old = map->table;
+        for (u32 i = 0; i < old->capacity; ++i)
+        {
+            if (old->InUse(i))
+            {
+                LoxValue key{old->Entries()[2 * i]};
+                Insert(table, key, LoxValue{old->Entries()[2 * i + 1]}, Hash(key));
+            }
+        }
+        map->table = table;
+
+        auto& heap = GlobalHeap();
+        heap.Remember(&map->obj);
+        // A large table is old from the start.
+        heap.Remember(&table->obj);
+    }
+
+
+    auto NewMap()
+        -> ObjMap*
+    {
+        // The table is not reachable while the map is allocated.
+        LocalRoots<1> roots;
+        auto table = NewTable(map_min_capacity);
+        roots.slots[0] = LoxValue::Object(&table->obj).Bits();
+
+        auto map = reinterpret_cast<ObjMap*>(GlobalHeap().Allocate(ObjType::Map, sizeof(ObjMap)));
+        map->count = 0;
+        map->table = table;
+        return map;
+    }
+
+
+    auto MapGet(ObjMap* map, LoxValue key)
+        -> LoxValue
+    {
+        key = Flatten(key);
+        auto table = map->table;
+        auto i = Find(table, key, Hash(key));
+        return i == table->capacity ? LoxValue::Nil() : LoxValue{table->Entries()[2 * i + 1]};
+    }
+
+
+    auto MapHas(ObjMap* map, LoxValue key)
+        -> bool
+    {
+        key = Flatten(key);
+        return Find(map->table, key, Hash(key)) != map->table->capacity;
+    }
+
+
+    auto MapSet(ObjMap* map, LoxValue key, LoxValue value)
+        -> void
+    {
+        key = Flatten(key);
+        auto hash = Hash(key);
+        auto i = Find(map->table, key, hash);
+        if (i != map->table->capacity)
+        {
+            map->table->Entries()[2 * i + 1] = value.Bits();
+        }
+        else
+        {
+            if (map->table->growth_left == 0)
+            {
+                Rehash(map);
+            }
+            Insert(map->table, key, value, hash);
+            ++map->count;
+        }
+
+        if (key.IsObject() || value.IsObject())
+        {
+            GlobalHeap().Remember(&map->table->obj);
+        }
+    }
+
+
+    auto MapRemove(ObjMap* map, LoxValue key)
+        -> bool
+    {
+        key = Flatten(key);
+        auto table = map->table;
+        auto i = Find(table, key, Hash(key));
+        if (i == table->capacity)
+        {
+            return false;
+        }
+
+        // A probe stops at a group with an empty entry, so no key was added after it: the
+        // entry can be empty again. Otherwise it stays in the probe sequences.
+        auto& control = table->Control()[i];
+        if (Group{table->Control() + i / map_group * map_group}.MatchEmpty())
+        {
+            control = ctrl_empty;
+            ++table->growth_left;
+        }
+        else
+        {
+            control = ctrl_deleted;
+            ++table->deleted;
+        }
+        table->Entries()[2 * i] = LoxValue::nil_bits;
+        table->Entries()[2 * i + 1] = LoxValue::nil_bits;
+        --map->count;
+        return true;
+    }
+} // namespace lox
@@ -0,0 +1,76 @@
+#ifndef LOX_MAP_OBJECT_HPP
+#define LOX_MAP_OBJECT_HPP
+
+/*
+map_object.hpp
+
+PURPOSE: Hash maps of the compiled code: open addressing tables probed by groups of control bytes.
+
+CLASSES:
+
+DESCRIPTION:
+    A map (map(), see value.hpp) associates keys to values. Two keys are the same key if they
+    are equal for ==: the numbers by value, the strings by their chars, the other values by
+    identity. m[key] is the value of the key (nil if the map doesn't have it), m[key] = value
+    adds or replaces it. has(m, key), remove(m, key), keys(m) and len(m) are native functions.
+
+    The table (ObjTable) is a Swiss table: a control byte for each entry, empty, deleted or
+    full. A full entry keeps the low 7 bits of the hash of its key (h2), the other bits (h1)
+    choose the first group of map_group entries to probe. A lookup loads the control bytes of a
+    whole group at once (SSE2, or 8 bytes in a u64 without it) and compares them with h2 in
+    parallel: only the entries whose byte matches compare their keys, and the probe stops at
+    the first group with an empty entry. The groups are probed in triangular order, which
+    visits every group of the table. At most 7/8 of the entries are used: a full table is
+    rehashed into one sized for its count, so the tables with many deleted entries are cleaned
+    without growing.
+
+    Hashing doesn't allocate: a number is hashed from its bits (-0 as 0), a small string too
+    (its chars are in the value, see string_object.hpp), a flat string from its chars, the
+    other objects from their address. A rope is flattened first, once. The keys are usually
+    string literals (constant ObjString of the generated code): the bits of the key match
+    before the chars are compared.
+
+    The generated code doesn't read the tables: m[key] is a list access whose slow path
+    (lox_index_get and lox_index_set) finds the map.
+*/
+
+#include "common.hpp"
+#include "value.hpp"
+
+namespace lox
+{
+    // Number of the control bytes probed at once.
+#if defined(__SSE2__)
+    constexpr u32 map_group = 16;
+#else
+    constexpr u32 map_group = 8;
+#endif
+
+    // Initial capacity of the table of a map.
+    constexpr u32 map_min_capacity = 16;
+
+    static_assert(map_min_capacity % map_group == 0);
+
+    // An empty map. Can run a collection.
+    auto NewMap()
+        -> ObjMap*;
+
+    // The value of the key, nil if the map doesn't have it. Can flatten the key (see
+    // string_object.hpp): the map and the key must be reachable from the roots.
+    auto MapGet(ObjMap* map, LoxValue key)
+        -> LoxValue;
+
+    auto MapHas(ObjMap* map, LoxValue key)
+        -> bool;
+
+    // Add the key with the value, or replace its value. Can run a collection: the map, the key
+    // and the value must be reachable from the roots.
+    auto MapSet(ObjMap* map, LoxValue key, LoxValue value)
+        -> void;
+
+    // Remove the key, false if the map doesn't have it. Can flatten the key.
+    auto MapRemove(ObjMap* map, LoxValue key)
+        -> bool;
+} // namespace lox
+
+#endif
@@ -1 +1,89 @@
 #include "node.hpp"
+#include "closure_analysis.hpp"
+
+namespace lox
+{
+    // The variables the function uses and doesn't declare (the ones of its closures too).
+    static auto Use(const FunStmtNode& function, GlobalVariables& used)
+        -> void
+    {
+        ClosureAnalysis analysis{function, {}};
+        for (const auto& variable : analysis.FreeVariables())
+        {
+            used.insert(variable.name);
+        }
+    }
+
+
+    static auto Declare(const StmtNode& node, FunctionArities& arities, GlobalVariables& used)
+        -> void
+    {
+        if (auto function = std::get_if<FunStmtNodePtr>(&node))
+        {
+            arities.try_emplace((*function)->name.Lexeme(), static_cast<u32>((*function)->parameters.size()));
+            Use(**function, used);
+        }
+        else if (auto klass = std::get_if<ClassStmtNodePtr>(&node))
+        {
+            // The constructor takes the parameters of init (without this), its own or the
+            // inherited one.
+            auto name = (*klass)->name.Lexeme();
+            u32 arity = 0;
+            if (const auto& superclass = (*klass)->superclass)
+            {
+                if (auto it = arities.find(superclass->Lexeme()); it != arities.end())
+                {
+                    arity = it->second;
+                }
+            }
+            for (const auto& method : (*klass)->methods)
+            {
+                Use(*method, used);
+                if (method->name.Lexeme().substr(name.size() + 1) == "init")
+                {
+                    arity = static_cast<u32>(method->parameters.size() - 1);
+                }
+            }
+            arities.try_emplace(name, arity);
+        }
+        else if (auto block = std::get_if<BlockStmtNodePtr>(&node))
+        {
+            for (const auto& statement : (*block)->statements)
+            {
+                Declare(statement, arities, used);
+            }
+        }
+        else if (auto if_node = std::get_if<IfStmtNodePtr>(&node))
+        {
+            Declare((*if_node)->then_branch, arities, used);
+            if ((*if_node)->else_branch)
+            {
+                Declare(*(*if_node)->else_branch, arities, used);
+            }
+        }
+        else if (auto while_node = std::get_if<WhileStmtNodePtr>(&node))
+        {
+            Declare((*while_node)->body, arities, used);
+        }
+    }
+
+
+    auto DeclaredNames(const std::vector<StmtNode>& program)
+        -> Declarations
+    {
+        Declarations declarations;
+        GlobalVariables used;
+        for (const auto& node : program)
+        {
+            Declare(node, declarations.functions, used);
+        }
+        for (const auto& node : program)
+        {
+            if (auto var = std::get_if<VarStmtNodePtr>(&node); var && used.contains((*var)->name.Lexeme()))
+            {
+                declarations.variables.insert((*var)->name.Lexeme());
+            }
+        }
+        return declarations;
+    }
+} // namespace lox
@@ -16,6 +16,13 @@ CLASSES:
     LogicalExprNode:    node for logical operators.
     CallExprNode:       node for function call.
     CompExprNode:       node for binary comparison
+    GetExprNode:        node for property access (object.name).
+    SetExprNode:        node for property assignment (object.name = value).
+    InvokeExprNode:     node for method call (object.name(args)).
+    SuperInvokeExprNode: node for call of a method of the superclass (super.name(args)).
+    ListExprNode:       node for list literal ([a, b, c]).
+    IndexExprNode:      node for element access (object[index]).
+    IndexSetExprNode:   node for element assignment (object[index] = value).
 
     ExprStmtNode:       node for expression statement.
     PrintStmtNode:      node for print statement.
@@ -25,6 +32,8 @@ CLASSES:
     ReturnStmtNode:     node for return statement.
     IfStmtNode:         node for if/then/else statement.
     WhileStmtNode:      node for while statetement. This node is also used for the for statement after some change (check the parser).
+    ClassStmtNode:      node for class declaration. The methods are functions named Class.method
+                        with `this` as first parameter (check the parser).
 
 DESCRIPTION:
     The implementation is based on std::variant to explore building an AST (and traverse it) and avoid dynamic dispatch.
@@ -39,6 +48,9 @@ DESCRIPTION:
 #include <vector>
 #include <initializer_list>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "token.hpp"
 #include "types.hpp"
@@ -54,6 +66,13 @@ namespace lox
     struct LogicalExprNode;
     struct CallExprNode;
     struct CmpExprNode;
+    struct GetExprNode;
+    struct SetExprNode;
+    struct InvokeExprNode;
+    struct SuperInvokeExprNode;
+    struct ListExprNode;
+    struct IndexExprNode;
+    struct IndexSetExprNode;
 
     using BinaryExprNodePtr = std::unique_ptr<BinaryExprNode>;
     using UnaryExprNodePtr = std::unique_ptr<UnaryExprNode>;
@@ -64,12 +83,21 @@ namespace lox
     using LogicalExprNodePtr = std::unique_ptr<LogicalExprNode>;
     using CallExprNodePtr = std::unique_ptr<CallExprNode>;
     using CmpExprNodePtr = std::unique_ptr<CmpExprNode>;
+    using GetExprNodePtr = std::unique_ptr<GetExprNode>;
+    using SetExprNodePtr = std::unique_ptr<SetExprNode>;
+    using InvokeExprNodePtr = std::unique_ptr<InvokeExprNode>;
+    using SuperInvokeExprNodePtr = std::unique_ptr<SuperInvokeExprNode>;
+    using ListExprNodePtr = std::unique_ptr<ListExprNode>;
+    using IndexExprNodePtr = std::unique_ptr<IndexExprNode>;
+    using IndexSetExprNodePtr = std::unique_ptr<IndexSetExprNode>;
 
 
     using ExprNode = std::variant<BinaryExprNodePtr, UnaryExprNodePtr,
                         LiteralNodePtr, GroupingNodePtr,
                         AssignExprNodePtr, VarExprNodePtr, LogicalExprNodePtr,
-                        CallExprNodePtr, CmpExprNodePtr>;
+                        CallExprNodePtr, CmpExprNodePtr, GetExprNodePtr,
+                        SetExprNodePtr, InvokeExprNodePtr, SuperInvokeExprNodePtr,
+                        ListExprNodePtr, IndexExprNodePtr, IndexSetExprNodePtr>;
 
 
     struct ExprStmtNode;
@@ -80,6 +108,7 @@ namespace lox
     struct ReturnStmtNode;
     struct IfStmtNode;
     struct WhileStmtNode;
+    struct ClassStmtNode;
 
     using ExprStmtNodePtr = std::unique_ptr<ExprStmtNode>;
     using PrintStmtNodePtr = std::unique_ptr<PrintStmtNode>;
@@ -89,12 +118,14 @@ namespace lox
     using ReturnStmtNodePtr = std::unique_ptr<ReturnStmtNode>;
     using IfStmtNodePtr = std::unique_ptr<IfStmtNode>;
     using WhileStmtNodePtr = std::unique_ptr<WhileStmtNode>;
+    using ClassStmtNodePtr = std::unique_ptr<ClassStmtNode>;
 
     
 
     using StmtNode = std::variant<ExprStmtNodePtr, PrintStmtNodePtr,
                         VarStmtNodePtr, BlockStmtNodePtr, FunStmtNodePtr,
-                        ReturnStmtNodePtr, IfStmtNodePtr, WhileStmtNodePtr>;
+                        ReturnStmtNodePtr, IfStmtNodePtr, WhileStmtNodePtr,
+                        ClassStmtNodePtr>;
 
 
     // ********************** EXPRESSION NODE *************************************
@@ -172,13 +203,13 @@ namespace lox
 
     struct CallExprNode
     {
-        explicit CallExprNode(Token paren_, std::string callee_, std::vector<ExprNode> args) :
+        explicit CallExprNode(Token paren_, Token callee_, std::vector<ExprNode> args) :
             paren(std::move(paren_)), callee(std::move(callee_)), arguments(std::move(args)) { }
 
         // This token is stored to report errors at runtime or during compilation in case 
         // the function call is not right.
         Token paren;
-        std::string callee;
+        Token callee;
         std::vector<ExprNode> arguments;
     };
 
@@ -194,6 +225,92 @@ namespace lox
     };
 
 
+    struct GetExprNode
+    {
+        explicit GetExprNode(ExprNode object_, Token name_) :
+            object(std::move(object_)), name(std::move(name_)) { }
+
+        ExprNode object;
+        Token name;
+    };
+
+
+    struct SetExprNode
+    {
+        explicit SetExprNode(ExprNode object_, Token name_, ExprNode value_) :
+            object(std::move(object_)), name(std::move(name_)), value(std::move(value_)) { }
+
+        ExprNode object;
+        Token name;
+        ExprNode value;
+    };
+
+
+    // A method is never read as a property: it can only be called, so the call is a node.
+    struct InvokeExprNode
+    {
+        explicit InvokeExprNode(ExprNode object_, Token name_, Token paren_, std::vector<ExprNode> args) :
+            object(std::move(object_)), name(std::move(name_)), paren(std::move(paren_)),
+            arguments(std::move(args)) { }
+
+        ExprNode object;
+        Token name;
+        Token paren;
+        std::vector<ExprNode> arguments;
+    };
+
+
+    struct SuperInvokeExprNode
+    {
+        explicit SuperInvokeExprNode(Token keyword_, Token klass_, Token method_, Token paren_,
+            std::vector<ExprNode> args) :
+            keyword(std::move(keyword_)), klass(std::move(klass_)), method(std::move(method_)),
+            paren(std::move(paren_)), arguments(std::move(args)) { }
+
+        Token keyword;
+        // The class declaring the method that contains the call.
+        Token klass;
+        Token method;
+        Token paren;
+        std::vector<ExprNode> arguments;
+    };
+
+
+    struct ListExprNode
+    {
+        explicit ListExprNode(Token bracket_, std::vector<ExprNode> elements_) :
+            bracket(std::move(bracket_)), elements(std::move(elements_)) { }
+
+        // The opening bracket, for the errors.
+        Token bracket;
+        std::vector<ExprNode> elements;
+    };
+
+
+    struct IndexExprNode
+    {
+        explicit IndexExprNode(ExprNode object_, Token bracket_, ExprNode index_) :
+            object(std::move(object_)), bracket(std::move(bracket_)), index(std::move(index_)) { }
+
+        ExprNode object;
+        Token bracket;
+        ExprNode index;
+    };
+
+
+    struct IndexSetExprNode
+    {
+        explicit IndexSetExprNode(ExprNode object_, Token bracket_, ExprNode index_, ExprNode value_) :
+            object(std::move(object_)), bracket(std::move(bracket_)), index(std::move(index_)),
+            value(std::move(value_)) { }
+
+        ExprNode object;
+        Token bracket;
+        ExprNode index;
+        ExprNode value;
+    };
+
+
     // ************************ STATEMENT NODE **************************************
 
     struct ExprStmtNode
@@ -305,6 +422,45 @@ namespace lox
         StmtNode body;
     };
 
+
+    struct ClassStmtNode
+    {
+        explicit ClassStmtNode(Token name_, std::optional<Token> superclass_,
+            std::vector<FunStmtNodePtr> methods_, std::vector<std::string_view> fields_) :
+            name(std::move(name_)), superclass(std::move(superclass_)), methods(std::move(methods_)),
+            fields(std::move(fields_)) { }
+
+        Token name;
+        std::optional<Token> superclass;
+        std::vector<FunStmtNodePtr> methods;
+
+        // Names of the fields the methods assign through this (`this.x = ...`), the expected
+        // size of the instances.
+        std::vector<std::string_view> fields;
+    };
+
+
+    // Number of parameters of the global functions (declared by the top-level code, in blocks
+    // too) and of the constructors of the classes, by name. The code generated one function
+    // at a time checks its calls with it. A name declared twice keeps its first arity (the
+    // redefinition is an error).
+    using FunctionArities = std::unordered_map<std::string_view, u32>;
+
+    // Names of the variables of the top-level code (not declared in a block) used by the
+    // functions and the methods. They live in module-level storage, so the code generated one
+    // function at a time reaches them by name.
+    using GlobalVariables = std::unordered_set<std::string_view>;
+
+    // The declarations of the top-level code the functions can use.
+    struct Declarations
+    {
+        FunctionArities functions;
+        GlobalVariables variables;
+    };
+
+    auto DeclaredNames(const std::vector<StmtNode>& program)
+        -> Declarations;
+
 } // namespace lox
 
 
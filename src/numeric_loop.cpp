@@ -0,0 +1,576 @@
+#include "numeric_loop.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+namespace lox
+{
+    NumericLoop::NumericLoop(const WhileStmtNode& loop, const std::unordered_set<std::string_view>& shared)
+    {
+        Visit(loop.condition);
+        Visit(loop.body);
+        std::erase_if(numeric, [&shared](std::string_view name)
+        {
+            return shared.contains(name);
+        });
+
+        // A variable named len hides the native function.
+        if (declared.contains("len"))
+        {
+            other_calls = other_calls || length_calls;
+            length_calls = false;
+        }
+        if (!other_calls)
+        {
+            for (auto name : indexed)
+            {
+                if (!assigned.contains(name) && !declared.contains(name) && !shared.contains(name))
+                {
+                    lists.insert(name);
+                }
+            }
+        }
+
+        // Assume the lists are packed, then check the values stored in them.
+        auto reads = numeric;
+        std::erase_if(numeric, [this](std::string_view name)
+        {
+            return lists.contains(name);
+        });
+        RemoveNotNumbers();
+        if (!std::ranges::all_of(stored, [this](const ExprNode* value) { return IsNumber(*value); }))
+        {
+            lists.clear();
+            numeric = std::move(reads);
+            RemoveNotNumbers();
+        }
+
+        FindCounter(loop.condition);
+        if (counter && AssignedAtEnd(loop.body))
+        {
+            for (auto [list, index] : var_indexes)
+            {
+                if (index == counter->name && lists.contains(list))
+                {
+                    counter_indexed.insert(list);
+                }
+            }
+        }
+    }
+
+
+    auto NumericLoop::RemoveNotNumbers()
+        -> void
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            std::erase_if(numeric, [this, &changed](std::string_view name)
+            {
+                auto it = assigned.find(name);
+                if (it == assigned.end())
+                {
+                    return false;
+                }
+                for (auto value : it->second)
+                {
+                    if (!IsNumber(*value))
+                    {
+                        changed = true;
+                        return true;
+                    }
+                }
+                return false;
+            });
+        }
+    }
+
+
+    // Skip the grouping nodes.
+    static auto Unwrap(const ExprNode& node)
+        -> const ExprNode&
+    {
+        const ExprNode* n = &node;
+        while (auto g = std::get_if<GroupingNodePtr>(n))
+        {
+            n = &(*g)->expr;
+        }
+        return *n;
+    }
+
+
+    auto NumericLoop::VarName(const ExprNode& node) noexcept
+        -> std::string_view
+    {
+        auto var = std::get_if<VarExprNodePtr>(&Unwrap(node));
+        if (!var || (*var)->name.Type() == TokenType::This)
+        {
+            return {};
+        }
+        return (*var)->name.Lexeme();
+    }
+
+
+    auto NumericLoop::IsLength(const CallExprNode& call) const
+        -> bool
+    {
+        return call.callee.Lexeme() == "len" && call.arguments.size() == 1 && !declared.contains("len");
+    }
+
+
+    auto NumericLoop::AssignedAtEnd(const StmtNode& body) const
+        -> bool
+    {
+        auto block = std::get_if<BlockStmtNodePtr>(&body);
+        if (!block || (*block)->statements.empty())
+        {
+            return false;
+        }
+        auto statement = std::get_if<ExprStmtNodePtr>(&(*block)->statements.back());
+        if (!statement)
+        {
+            return false;
+        }
+        auto assign = std::get_if<AssignExprNodePtr>(&Unwrap((*statement)->expr));
+        auto it = assigned.find(counter->name);
+        return assign && (*assign)->name.Lexeme() == counter->name && it != assigned.end() &&
+            it->second.size() == 1;
+    }
+
+
+    auto NumericLoop::FindCounter(const ExprNode& condition)
+        -> void
+    {
+        auto cmp = std::get_if<CmpExprNodePtr>(&Unwrap(condition));
+        if (!cmp)
+        {
+            return;
+        }
+
+        // Direction of the counter: up for i < n and n > i.
+        bool up = false;
+        switch ((*cmp)->op.Type())
+        {
+        case TokenType::Less:
+        case TokenType::LessEqual:
+            up = true;
+            break;
+        case TokenType::Greater:
+        case TokenType::GreaterEqual:
+            up = false;
+            break;
+        default:
+            return;
+        }
+        bool inclusive = (*cmp)->op.Type() == TokenType::LessEqual || (*cmp)->op.Type() == TokenType::GreaterEqual;
+
+        auto var = std::get_if<VarExprNodePtr>(&Unwrap((*cmp)->left));
+        const ExprNode* bound = &Unwrap((*cmp)->right);
+        if (!var || !IsNumeric((*var)->name.Lexeme()))
+        {
+            var = std::get_if<VarExprNodePtr>(&Unwrap((*cmp)->right));
+            bound = &Unwrap((*cmp)->left);
+            up = !up;
+        }
+        if (!var)
+        {
+            return;
+        }
+
+        Counter c{(*var)->name.Lexeme(), {}, {}, 0.0, up, inclusive};
+        if (!IsNumeric(c.name) || declared.contains(c.name) || assigned_in_nested_loop.contains(c.name))
+        {
+            return;
+        }
+
+        if (auto b = std::get_if<VarExprNodePtr>(bound))
+        {
+            c.bound = (*b)->name.Lexeme();
+            if (c.bound == c.name || !IsNumeric(c.bound) || declared.contains(c.bound) ||
+                assigned.contains(c.bound))
+            {
+                return;
+            }
+        }
+        else if (auto literal = std::get_if<LiteralNodePtr>(bound))
+        {
+            auto value = std::get_if<f64>(&(*literal)->literal);
+            if (!value || !(*value >= -max_integer && *value <= max_integer) || std::floor(*value) != *value)
+            {
+                return;
+            }
+            c.literal = *value;
+        }
+        else if (auto call = std::get_if<CallExprNodePtr>(bound); call && IsLength(**call))
+        {
+            // The length of a packed list doesn't change in the loop.
+            c.length = VarName((*call)->arguments[0]);
+            if (!lists.contains(c.length))
+            {
+                return;
+            }
+        }
+        else
+        {
+            return;
+        }
+
+        if (auto it = assigned.find(c.name); it != assigned.end())
+        {
+            for (auto value : it->second)
+            {
+                auto step = Step(c.name, *value);
+                if (step == 0.0 || (step > 0.0) != up)
+                {
+                    return;
+                }
+            }
+        }
+        counter = c;
+    }
+
+
+    auto NumericLoop::Step(std::string_view name, const ExprNode& value)
+        -> f64
+    {
+        auto binary = std::get_if<BinaryExprNodePtr>(&Unwrap(value));
+        if (!binary)
+        {
+            return 0.0;
+        }
+        auto type = (*binary)->op.Type();
+        if (type != TokenType::Plus && type != TokenType::Minus)
+        {
+            return 0.0;
+        }
+
+        auto is_counter = [name](const ExprNode& n)
+        {
+            auto var = std::get_if<VarExprNodePtr>(&Unwrap(n));
+            return var && (*var)->name.Lexeme() == name;
+        };
+        auto literal_step = [](const ExprNode& n)
+        {
+            auto literal = std::get_if<LiteralNodePtr>(&Unwrap(n));
+            auto value = literal ? std::get_if<f64>(&(*literal)->literal) : nullptr;
+            return value && IsStep(*value) ? *value : 0.0;
+        };
+
+        if (is_counter((*binary)->left))
+        {
+            auto step = literal_step((*binary)->right);
+            return type == TokenType::Plus ? step : -step;
+        }
+        if (type == TokenType::Plus && is_counter((*binary)->right))
+        {
+            return literal_step((*binary)->left);
+        }
+        return 0.0;
+    }
+
+
+    auto NumericLoop::IsNumber(const ExprNode& node) const
+        -> bool
+    {
+        return std::visit([this](const auto& n) -> bool
+        {
+            using T = std::decay_t<decltype(n)>;
+            if constexpr (std::is_same_v<T, LiteralNodePtr>)
+            {
+                return std::holds_alternative<f64>(n->literal);
+            }
+            else if constexpr (std::is_same_v<T, VarExprNodePtr>)
+            {
+                return IsNumeric(n->name.Lexeme());
+            }
+            else if constexpr (std::is_same_v<T, BinaryExprNodePtr>)
+            {
+                return n->op.Type() != TokenType::Plus || (IsNumber(n->left) && IsNumber(n->right));
+            }
+            else if constexpr (std::is_same_v<T, UnaryExprNodePtr>)
+            {
+                return n->op.Type() == TokenType::Minus;
+            }
+            else if constexpr (std::is_same_v<T, GroupingNodePtr> || std::is_same_v<T, AssignExprNodePtr>)
+            {
+                return IsNumber(n->expr);
+            }
+            else if constexpr (std::is_same_v<T, SetExprNodePtr>)
+            {
+                return IsNumber(n->value);
+            }
+            else if constexpr (std::is_same_v<T, LogicalExprNodePtr>)
+            {
+                return IsNumber(n->left) && IsNumber(n->right);
+            }
+            else if constexpr (std::is_same_v<T, IndexExprNodePtr>)
+            {
+                return lists.contains(VarName(n->object));
+            }
+            else if constexpr (std::is_same_v<T, IndexSetExprNodePtr>)
+            {
+                return IsNumber(n->value);
+            }
+            else if constexpr (std::is_same_v<T, CallExprNodePtr>)
+            {
+                // len() returns a number or exits with a runtime error.
+                return IsLength(*n);
+            }
+            else
+            {
+                // Other calls, comparisons, properties and lists.
+                return false;
+            }
+        }, node);
+    }
+
+
+    auto NumericLoop::operator()(const BinaryExprNodePtr& n)
+        -> void
+    {
+        Visit(n->left);
+        Visit(n->right);
+    }
+
+
+    auto NumericLoop::operator()(const UnaryExprNodePtr& n)
+        -> void
+    {
+        Visit(n->right);
+    }
+
+
+    auto NumericLoop::operator()(const LiteralNodePtr&)
+        -> void
+    {
+    }
+
+
+    auto NumericLoop::operator()(const GroupingNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+    }
+
+
+    auto NumericLoop::operator()(const AssignExprNodePtr& n)
+        -> void
+    {
+        assigned[n->name.Lexeme()].push_back(&n->expr);
+        if (depth > 0)
+        {
+            assigned_in_nested_loop.insert(n->name.Lexeme());
+        }
+        Visit(n->expr);
+    }
+
+
+    auto NumericLoop::operator()(const VarExprNodePtr& n)
+        -> void
+    {
+        // this is always an instance.
+        if (n->name.Type() != TokenType::This)
+        {
+            numeric.insert(n->name.Lexeme());
+        }
+    }
+
+
+    auto NumericLoop::operator()(const LogicalExprNodePtr& n)
+        -> void
+    {
+        Visit(n->left);
+        Visit(n->right);
+    }
+
+
+    auto NumericLoop::operator()(const CallExprNodePtr& n)
+        -> void
+    {
+        if (n->callee.Lexeme() == "len" && n->arguments.size() == 1)
+        {
+            // The length of a variable doesn't need it to be a number.
+            length_calls = true;
+            if (VarName(n->arguments[0]).empty())
+            {
+                Visit(n->arguments[0]);
+            }
+            return;
+        }
+
+        other_calls = true;
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+    }
+
+
+    auto NumericLoop::operator()(const CmpExprNodePtr& n)
+        -> void
+    {
+        Visit(n->left);
+        Visit(n->right);
+    }
+
+
+    auto NumericLoop::operator()(const GetExprNodePtr& n)
+        -> void
+    {
+        Visit(n->object);
+    }
+
+
+    auto NumericLoop::operator()(const SetExprNodePtr& n)
+        -> void
+    {
+        Visit(n->object);
+        Visit(n->value);
+    }
+
+
+    auto NumericLoop::operator()(const InvokeExprNodePtr& n)
+        -> void
+    {
+        other_calls = true;
+        Visit(n->object);
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+    }
+
+
+    auto NumericLoop::operator()(const SuperInvokeExprNodePtr& n)
+        -> void
+    {
+        other_calls = true;
+        for (const auto& arg : n->arguments)
+        {
+            Visit(arg);
+        }
+    }
+
+
+    auto NumericLoop::operator()(const ListExprNodePtr& n)
+        -> void
+    {
+        for (const auto& element : n->elements)
+        {
+            Visit(element);
+        }
+    }
+
+
+    auto NumericLoop::operator()(const IndexExprNodePtr& n)
+        -> void
+    {
+        // The list is not read as a number.
+        if (auto name = VarName(n->object); !name.empty())
+        {
+            indexed.insert(name);
+            var_indexes.emplace_back(name, VarName(n->index));
+        }
+        else
+        {
+            Visit(n->object);
+        }
+        Visit(n->index);
+    }
+
+
+    auto NumericLoop::operator()(const IndexSetExprNodePtr& n)
+        -> void
+    {
+        if (auto name = VarName(n->object); !name.empty())
+        {
+            indexed.insert(name);
+            var_indexes.emplace_back(name, VarName(n->index));
+        }
+        else
+        {
+            Visit(n->object);
+        }
+        Visit(n->index);
+        stored.push_back(&n->value);
+        Visit(n->value);
+    }
+
+
+    auto NumericLoop::operator()(const ExprStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+    }
+
+
+    auto NumericLoop::operator()(const PrintStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->expr);
+    }
+
+
+    auto NumericLoop::operator()(const VarStmtNodePtr& n)
+        -> void
+    {
+        assigned[n->name.Lexeme()].push_back(&n->initializer);
+        declared.insert(n->name.Lexeme());
+        Visit(n->initializer);
+    }
+
+
+    auto NumericLoop::operator()(const BlockStmtNodePtr& n)
+        -> void
+    {
+        for (const auto& s : n->statements)
+        {
+            Visit(s);
+        }
+    }
+
+
+    auto NumericLoop::operator()(const FunStmtNodePtr& n)
+        -> void
+    {
+        // The closure is a variable of the loop.
+        declared.insert(n->name.Lexeme());
+    }
+
+
+    auto NumericLoop::operator()(const ReturnStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->value);
+    }
+
+
+    auto NumericLoop::operator()(const IfStmtNodePtr& n)
+        -> void
+    {
+        Visit(n->condition);
+        Visit(n->then_branch);
+        if (n->else_branch)
+        {
+            Visit(*n->else_branch);
+        }
+    }
+
+
+    auto NumericLoop::operator()(const WhileStmtNodePtr& n)
+        -> void
+    {
+        ++depth;
+        Visit(n->condition);
+        Visit(n->body);
+        --depth;
+    }
+
+
+    auto NumericLoop::operator()(const ClassStmtNodePtr&)
+        -> void
+    {
+    }
+} // namespace lox
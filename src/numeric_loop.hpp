@@ -0,0 +1,305 @@
+#ifndef LOX_NUMERIC_LOOP_HPP
+#define LOX_NUMERIC_LOOP_HPP
+
+/*
+numeric_loop.hpp
+
+PURPOSE: Find the variables of a loop that stay numbers (or integers, or lists of numbers) for
+the whole loop.
+
+CLASSES:
+    NumericLoop: visitor that analyzes a while loop (the for loops are while loops in the AST).
+
+DESCRIPTION:
+    A variable read by the loop is numeric if every value the loop assigns to it (assignments and
+    declarations in the condition and in the body) is a number whenever the numeric variables
+    hold numbers. Then, if the numeric variables hold numbers when the loop starts, they hold
+    numbers at every iteration: LLVMVisitor checks them once before the loop and runs a copy of
+    the loop without the checks of their tags (see LLVMVisitor::operator()(WhileStmtNodePtr)).
+
+    An expression is a number:
+        - a number literal.
+        - a numeric variable.
+        - -, *, / and unary minus: they either return a number or exit with a runtime error.
+        - + if both operands are numbers (otherwise it can concatenate strings).
+        - an assignment if its value is (also to a property or an element), and/or if both
+          operands are (the value is one of them).
+        - an element of a packed list (a[i]) and len().
+    Other calls, comparisons and properties are not numbers, and `this` is never numeric. The set of
+    the numeric variables starts with all the variables read by the loop and the variables with
+    an assignment that is not a number are removed until nothing changes.
+
+    Packed lists: the variables indexed by the loop (a[i], a[i] = x) whose list keeps a Doubles
+    buffer (see list_object.hpp) and its length for the whole loop, so LLVMVisitor checks them
+    before the loop and reads the doubles without checks. The loop must not assign or declare
+    them, nor call anything but len() (a call can append to a list or store any value in it, and
+    so can a method), and every value it stores in an element must be a number. As the elements
+    read are numbers, this is a fixpoint too: the numeric variables are computed assuming the
+    lists are packed, and if a stored value is then not a number there is no packed list and the
+    numeric variables are computed again.
+
+    The variables are identified by name: a name is numeric only if all the variables with that
+    name visible in the loop are. The bodies of the functions declared in the loop are skipped:
+    the closures get copies of the variables of the loop, except the shared ones (assigned by a
+    closure or after it captured them, see closure_analysis.hpp), which are never numeric since a
+    call can change them. The methods can't see the variables of the loop.
+
+    Counter: a numeric variable that holds exact integers for the whole loop, so LLVMVisitor can
+    keep it in an i64 (an induction variable LLVM can compute the trip count of), converted to
+    a double only where the value is used as a number. The condition of the loop must compare
+    it with a bound (`i < n`, `i <= 10`, `n > i`, `i < len(a)`, ...): a number literal, a numeric
+    variable the loop doesn't assign or the length of a packed list. The loop must change it only by `i = i + c` or `i = i - c`, with c
+    an integer literal moving it toward the bound, and not in a nested loop. If the counter and
+    the bound start as integers within +-2^52 (checked by the guard of the loop), the counter
+    stays between its start and the bound plus a few steps: every value is an integer a double
+    represents exactly, so the i64 arithmetic gives the same results as the double one. If the
+    last statement of the body is the only assignment of the counter, the body only sees values
+    between the start and the bound: a packed list indexed by the counter (a[i]) needs no bounds
+    check once the guard has checked that this range is within its length.
+*/
+
+#include "node.hpp"
+#include "common.hpp"
+
+#include <cmath>
+#include <concepts>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace lox
+{
+    class NumericLoop
+    {
+    public:
+        // Limits of the integers of a counter (see the description).
+        static constexpr f64 max_integer = 4503599627370496.0; // 2^52
+        static constexpr f64 max_step = 2147483648.0; // 2^31
+
+        struct Counter
+        {
+            std::string_view name;
+
+            // Variable of the bound, empty if the bound is a literal or a length.
+            std::string_view bound;
+
+            // Packed list whose length is the bound, empty otherwise.
+            std::string_view length;
+
+            // Value of the bound if it is a literal.
+            f64 literal;
+
+            // i < n or i <= n (up), i > n or i >= n (down), inclusive for <= and >=.
+            bool up;
+            bool inclusive;
+        };
+
+        // The shared variables are never numeric.
+        NumericLoop(const WhileStmtNode& loop, const std::unordered_set<std::string_view>& shared);
+
+        // True if the name is a numeric variable of the loop.
+        auto IsNumeric(std::string_view name) const
+            -> bool
+        {
+            return numeric.contains(name);
+        }
+
+        // Names of the numeric variables.
+        auto Variables() const noexcept
+            -> const std::unordered_set<std::string_view>&
+        {
+            return numeric;
+        }
+
+        // Names of the packed lists.
+        auto Lists() const noexcept
+            -> const std::unordered_set<std::string_view>&
+        {
+            return lists;
+        }
+
+        // Packed lists indexed by the counter where it is between its start and its bound.
+        auto CounterIndexed() const noexcept
+            -> const std::unordered_set<std::string_view>&
+        {
+            return counter_indexed;
+        }
+
+        // True if the loop calls len(), which must then be the native function.
+        auto CallsLength() const noexcept
+            -> bool
+        {
+            return length_calls;
+        }
+
+        auto Empty() const noexcept
+            -> bool
+        {
+            return numeric.empty() && lists.empty();
+        }
+
+        // True if the expression is a number when the numeric variables are.
+        auto IsNumber(const ExprNode& node) const
+            -> bool;
+
+        // The counter of the loop, if it has one.
+        auto IntegerCounter() const noexcept
+            -> const std::optional<Counter>&
+        {
+            return counter;
+        }
+
+        // Name of the variable if the expression is one (groupings skipped), empty otherwise.
+        static auto VarName(const ExprNode& node) noexcept
+            -> std::string_view;
+
+        // True if the number is an integer literal usable as a step of a counter.
+        static auto IsStep(f64 value) noexcept
+            -> bool
+        {
+            return value >= -max_step && value <= max_step && value != 0.0 && std::floor(value) == value;
+        }
+
+
+    public:
+        // Visitor that collects the reads and the assignments of the variables.
+
+        auto operator()(const BinaryExprNodePtr& n)
+            -> void;
+
+        auto operator()(const UnaryExprNodePtr& n)
+            -> void;
+
+        auto operator()(const LiteralNodePtr& n)
+            -> void;
+
+        auto operator()(const GroupingNodePtr& n)
+            -> void;
+
+        auto operator()(const AssignExprNodePtr& n)
+            -> void;
+
+        auto operator()(const VarExprNodePtr& n)
+            -> void;
+
+        auto operator()(const LogicalExprNodePtr& n)
+            -> void;
+
+        auto operator()(const CallExprNodePtr& n)
+            -> void;
+
+        auto operator()(const CmpExprNodePtr& n)
+            -> void;
+
+        auto operator()(const GetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const InvokeExprNodePtr& n)
+            -> void;
+
+        auto operator()(const SuperInvokeExprNodePtr& n)
+            -> void;
+
+        auto operator()(const ListExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexExprNodePtr& n)
+            -> void;
+
+        auto operator()(const IndexSetExprNodePtr& n)
+            -> void;
+
+        auto operator()(const ExprStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const PrintStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const VarStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const BlockStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const FunStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ReturnStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const IfStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const WhileStmtNodePtr& n)
+            -> void;
+
+        auto operator()(const ClassStmtNodePtr& n)
+            -> void;
+
+    private:
+        template <typename T>
+            requires std::same_as<T, ExprNode> || std::same_as<T, StmtNode>
+        auto Visit(const T& node)
+            -> void
+        {
+            std::visit(*this, node);
+        }
+
+        // Remove the variables with an assignment that is not a number from numeric.
+        auto RemoveNotNumbers()
+            -> void;
+
+        // Find the counter compared by the condition.
+        auto FindCounter(const ExprNode& condition)
+            -> void;
+
+        // True if the counter is assigned only by the last statement of the body.
+        auto AssignedAtEnd(const StmtNode& body) const
+            -> bool;
+
+        // True if the call is len(x), the native function.
+        auto IsLength(const CallExprNode& call) const
+            -> bool;
+
+        // Return the step of the assignment if it is `name = name + c` or `name = name - c`,
+        // or 0.
+        static auto Step(std::string_view name, const ExprNode& value)
+            -> f64;
+
+    private:
+        std::unordered_set<std::string_view> numeric;
+
+        // Values assigned to each variable by the loop.
+        std::unordered_map<std::string_view, std::vector<const ExprNode*>> assigned;
+
+        // Variables declared in the loop, and assigned inside a nested loop.
+        std::unordered_set<std::string_view> declared;
+        std::unordered_set<std::string_view> assigned_in_nested_loop;
+
+        // Variables indexed by the loop (a[i] and a[i] = x), with the variables indexing them,
+        // and the values stored in the elements.
+        std::unordered_set<std::string_view> indexed;
+        std::vector<std::pair<std::string_view, std::string_view>> var_indexes;
+        std::vector<const ExprNode*> stored;
+
+        // Calls of len() with one argument, and the other calls (methods included).
+        bool length_calls{false};
+        bool other_calls{false};
+
+        // Depth of the nested loops being visited.
+        u32 depth{0};
+
+        std::unordered_set<std::string_view> lists;
+        std::unordered_set<std::string_view> counter_indexed;
+        std::optional<Counter> counter;
+    };
+} // namespace lox
+
+#endif
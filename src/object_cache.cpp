@@ -0,0 +1,526 @@
+#include "object_cache.hpp"
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/ADT/SmallString.h>
+
+#include <bit>
+#include <concepts>
+#include <cstdio>
+#include <cstdlib>
+#include <variant>
+
+namespace lox
+{
+    // Change it when the code generated for the same AST changes.
+    static constexpr u64 cache_version = 11;
+
+
+    // 64 bit FNV-1a hash of a sequence of values. Unlike std::hash, it is the same in every
+    // build of lox and on every host.
+    class StableHash
+    {
+    public:
+        auto Add(u64 value) noexcept
+            -> void
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 0x100000001b3ull;
+            }
+        }
+
+        auto Add(std::string_view s) noexcept
+            -> void
+        {
+            // The length separates the strings that follow each other.
+            Add(s.size());
+            for (auto c : s)
+            {
+                hash = (hash ^ static_cast<u8>(c)) * 0x100000001b3ull;
+            }
+        }
+
+        auto Add(const Token& token) noexcept
+            -> void
+        {
+            Add(token.TypeInt());
+            Add(token.Line());
+            Add(token.Lexeme());
+        }
+
+        auto Value() const noexcept
+            -> u64
+        {
+            return hash;
+        }
+
+    private:
+        u64 hash{0xcbf29ce484222325ull};
+    };
+
+
+    // Hash of the structure of the AST, with the tokens and the values of the literals.
+    class ASTHash
+    {
+    public:
+        // The declarations are the ones the visitor checks the calls with (see
+        // LLVMVisitor::SetDeclarations()), cse whether it reuses the duplicate expressions.
+        ASTHash(const StringPool& strings_, non_owned_ptr<const Declarations> declared_, bool cse) :
+            strings(strings_), declared(declared_)
+        {
+            hash.Add(u64{cse});
+        }
+
+        // The index of the alternative of the variant is the kind of the node.
+        template <typename T>
+            requires std::same_as<T, ExprNode> || std::same_as<T, StmtNode>
+        auto Visit(const T& node)
+            -> void
+        {
+            hash.Add(node.index());
+            std::visit(*this, node);
+        }
+
+        auto Value() const noexcept
+            -> u64
+        {
+            return hash.Value();
+        }
+
+    public:
+        // Visitor for expressions.
+
+        auto operator()(const BinaryExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->op);
+            Visit(n->left);
+            Visit(n->right);
+        }
+
+        auto operator()(const UnaryExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->op);
+            Visit(n->right);
+        }
+
+        auto operator()(const LiteralNodePtr& n)
+            -> void
+        {
+            hash.Add(n->literal.index());
+            if (auto s = std::get_if<StringId>(&n->literal))
+            {
+                hash.Add(strings.Get(*s));
+            }
+            else if (auto number = std::get_if<f64>(&n->literal))
+            {
+                hash.Add(std::bit_cast<u64>(*number));
+            }
+            else if (auto b = std::get_if<bool>(&n->literal))
+            {
+                hash.Add(*b ? 1 : 0);
+            }
+        }
+
+        auto operator()(const GroupingNodePtr& n)
+            -> void
+        {
+            Visit(n->expr);
+        }
+
+        auto operator()(const AssignExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->name);
+            AddDeclaration(n->name.Lexeme());
+            Visit(n->expr);
+        }
+
+        auto operator()(const VarExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->name);
+            AddDeclaration(n->name.Lexeme());
+        }
+
+        auto operator()(const LogicalExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->op);
+            Visit(n->left);
+            Visit(n->right);
+        }
+
+        auto operator()(const CallExprNodePtr& n)
+            -> void
+        {
+            // The name and the number of arguments are the signature of the callee. The call
+            // compiles only if the callee is declared with the same number of parameters.
+            hash.Add(n->paren);
+            hash.Add(n->callee);
+            hash.Add(n->arguments.size());
+            if (declared)
+            {
+                auto it = declared->functions.find(n->callee.Lexeme());
+                hash.Add(it == declared->functions.end() ? UINT64_MAX : u64{it->second});
+            }
+            for (const auto& arg : n->arguments)
+            {
+                Visit(arg);
+            }
+        }
+
+        auto operator()(const CmpExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->op);
+            Visit(n->left);
+            Visit(n->right);
+        }
+
+        auto operator()(const GetExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->name);
+            Visit(n->object);
+        }
+
+        auto operator()(const SetExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->name);
+            Visit(n->object);
+            Visit(n->value);
+        }
+
+        auto operator()(const InvokeExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->paren);
+            hash.Add(n->name);
+            Visit(n->object);
+            hash.Add(n->arguments.size());
+            for (const auto& arg : n->arguments)
+            {
+                Visit(arg);
+            }
+        }
+
+        auto operator()(const SuperInvokeExprNodePtr& n)
+            -> void
+        {
+            // The class names the descriptor the method is looked up from.
+            hash.Add(n->paren);
+            hash.Add(n->klass);
+            hash.Add(n->method);
+            hash.Add(n->arguments.size());
+            for (const auto& arg : n->arguments)
+            {
+                Visit(arg);
+            }
+        }
+
+        auto operator()(const ListExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->bracket);
+            hash.Add(n->elements.size());
+            for (const auto& element : n->elements)
+            {
+                Visit(element);
+            }
+        }
+
+        auto operator()(const IndexExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->bracket);
+            Visit(n->object);
+            Visit(n->index);
+        }
+
+        auto operator()(const IndexSetExprNodePtr& n)
+            -> void
+        {
+            hash.Add(n->bracket);
+            Visit(n->object);
+            Visit(n->index);
+            Visit(n->value);
+        }
+
+
+        // Visitor for statements.
+
+        auto operator()(const ExprStmtNodePtr& n)
+            -> void
+        {
+            Visit(n->expr);
+        }
+
+        auto operator()(const PrintStmtNodePtr& n)
+            -> void
+        {
+            Visit(n->expr);
+        }
+
+        auto operator()(const VarStmtNodePtr& n)
+            -> void
+        {
+            hash.Add(n->name);
+            Visit(n->initializer);
+        }
+
+        auto operator()(const BlockStmtNodePtr& n)
+            -> void
+        {
+            hash.Add(n->statements.size());
+            for (const auto& s : n->statements)
+            {
+                Visit(s);
+            }
+        }
+
+        auto operator()(const FunStmtNodePtr& n)
+            -> void
+        {
+            Function(*n);
+        }
+
+        auto operator()(const ReturnStmtNodePtr& n)
+            -> void
+        {
+            hash.Add(n->keyword);
+            Visit(n->value);
+        }
+
+        auto operator()(const IfStmtNodePtr& n)
+            -> void
+        {
+            Visit(n->condition);
+            Visit(n->then_branch);
+            hash.Add(n->else_branch.has_value());
+            if (n->else_branch)
+            {
+                Visit(*n->else_branch);
+            }
+        }
+
+        auto operator()(const WhileStmtNodePtr& n)
+            -> void
+        {
+            Visit(n->condition);
+            Visit(n->body);
+        }
+
+        auto operator()(const ClassStmtNodePtr& n)
+            -> void
+        {
+            hash.Add(n->name);
+            hash.Add(n->superclass.has_value());
+            if (n->superclass)
+            {
+                hash.Add(*n->superclass);
+            }
+            hash.Add(n->methods.size());
+            for (const auto& method : n->methods)
+            {
+                Function(*method);
+            }
+        }
+
+
+        auto Function(const FunStmtNode& n)
+            -> void
+        {
+            hash.Add(n.name);
+            hash.Add(n.parameters.size());
+            for (const auto& param : n.parameters)
+            {
+                hash.Add(param);
+            }
+            (*this)(n.body);
+        }
+
+    private:
+        // A name the function doesn't declare is a global variable (in module-level storage),
+        // a global function or undefined (an error).
+        auto AddDeclaration(std::string_view name)
+            -> void
+        {
+            if (declared)
+            {
+                hash.Add(u64{declared->variables.contains(name)} + 2 * u64{declared->functions.contains(name)});
+            }
+        }
+
+        const StringPool& strings;
+        non_owned_ptr<const Declarations> declared;
+        StableHash hash;
+    };
+
+
+    static auto Hex(u64 value)
+        -> std::string
+    {
+        char buffer[17];
+        std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+        return buffer;
+    }
+
+
+    ObjectCache::ObjectCache(std::string directory_, const llvm::TargetMachine& target, OptLevel level) :
+        directory(std::move(directory_))
+    {
+        // FileOf() compares the directory with the parent path of the file.
+        while (directory.size() > 1 && llvm::sys::path::is_separator(directory.back()))
+        {
+            directory.pop_back();
+        }
+
+        StableHash hash;
+        hash.Add(cache_version);
+        hash.Add(LLVM_VERSION_STRING);
+        hash.Add(target.getTargetTriple().str());
+        hash.Add(target.getTargetCPU());
+        hash.Add(target.getTargetFeatureString());
+        hash.Add(static_cast<u64>(target.getRelocationModel()));
+        hash.Add(static_cast<u64>(target.getCodeModel()));
+        hash.Add(static_cast<u64>(level));
+        target_hash = hash.Value();
+
+        // Errors are ignored: then the objects are just never stored.
+        llvm::sys::fs::create_directories(directory);
+    }
+
+
+    auto ObjectCache::DefaultDirectory()
+        -> std::string
+    {
+        if (auto dir = std::getenv("LOX_CACHE_DIR"); dir && *dir)
+        {
+            return dir;
+        }
+
+        llvm::SmallString<256> path;
+        if (!llvm::sys::path::cache_directory(path))
+        {
+            llvm::sys::fs::current_path(path);
+            llvm::sys::path::append(path, ".cache");
+        }
+        llvm::sys::path::append(path, "lox");
+        return std::string{path.str()};
+    }
+
+
+    auto ObjectCache::Key(const FunStmtNode& function, const StringPool& strings,
+        non_owned_ptr<const Declarations> declared, non_owned_ptr<const ExprCSE> cse) const
+        -> std::string
+    {
+        ASTHash hash{strings, declared, cse != nullptr};
+        hash.Function(function);
+        return Hex(hash.Value()) + Hex(target_hash);
+    }
+
+
+    auto ObjectCache::Path(const std::string& key) const
+        -> std::string
+    {
+        llvm::SmallString<256> path{directory};
+        llvm::sys::path::append(path, key + ".o");
+        return std::string{path.str()};
+    }
+
+
+    auto ObjectCache::FileOf(const llvm::MemoryBuffer& object) const
+        -> std::string
+    {
+        auto path = object.getBufferIdentifier();
+        if (llvm::sys::path::parent_path(path) != directory || !path.endswith(".o"))
+        {
+            return {};
+        }
+        return path.str();
+    }
+
+
+    auto ObjectCache::Load(const std::string& key)
+        -> std::unique_ptr<llvm::MemoryBuffer>
+    {
+        auto buffer = llvm::MemoryBuffer::getFile(Path(key), false, false);
+        if (!buffer)
+        {
+            return nullptr;
+        }
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return std::move(*buffer);
+    }
+
+
+    auto ObjectCache::Store(const std::string& key, llvm::MemoryBufferRef object)
+        -> void
+    {
+        using namespace llvm;
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+
+        SmallString<256> model{directory};
+        sys::path::append(model, key + ".%%%%%%.tmp");
+        int fd = -1;
+        SmallString<256> temp;
+        if (sys::fs::createUniqueFile(model, fd, temp))
+        {
+            return;
+        }
+
+        {
+            raw_fd_ostream out{fd, true};
+            out << object.getBuffer();
+            out.close();
+            if (out.has_error())
+            {
+                out.clear_error();
+                sys::fs::remove(temp);
+                return;
+            }
+        }
+
+        if (sys::fs::rename(temp, Path(key)))
+        {
+            sys::fs::remove(temp);
+        }
+    }
+
+
+    auto ObjectCache::ModuleKey(const llvm::Module& mod)
+        -> std::string
+    {
+        llvm::StringRef name{mod.getModuleIdentifier()};
+        if (!name.startswith(llvm::StringRef{module_prefix.data(), module_prefix.size()}))
+        {
+            return {};
+        }
+        return name.drop_front(module_prefix.size()).str();
+    }
+
+
+    auto ObjectCache::notifyObjectCompiled(const llvm::Module* mod, llvm::MemoryBufferRef object)
+        -> void
+    {
+        if (auto key = ModuleKey(*mod); !key.empty())
+        {
+            Store(key, object);
+        }
+    }
+
+
+    auto ObjectCache::getObject(const llvm::Module* mod)
+        -> std::unique_ptr<llvm::MemoryBuffer>
+    {
+        auto key = ModuleKey(*mod);
+        return key.empty() ? nullptr : Load(key);
+    }
+} // namespace lox
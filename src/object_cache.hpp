@@ -0,0 +1,140 @@
+#ifndef LOX_OBJECT_CACHE_HPP
+#define LOX_OBJECT_CACHE_HPP
+
+/*
+object_cache.hpp
+
+PURPOSE: Keep the object code of the functions on disk, to reuse it in the next runs and builds.
+
+CLASSES:
+    ObjectCache: Directory of object files, one for each function, named by a key computed from
+        the AST of the function and from the options of the target machine.
+
+DESCRIPTION:
+    The code generated for a function depends only on its own AST (the other functions are
+    called by name, and a call in the AST has the name and the number of arguments of the callee,
+    which is all the signature of a Lox function), on the declarations of the program (the arity
+    of each callee, since a call with another number of arguments doesn't compile, and whether a
+    name is a global variable or a global function), on the target machine, on the optimization
+    level and on --cse (the analysis of a function depends only on its body, see expr_cse.hpp). The key of a function is a hash of all of them: a function whose key is
+    found is not generated, optimized nor compiled again.
+    The hash of the AST includes the line of the tokens (the errors reported at runtime have the
+    line in their message), the contents of the string literals (not their StringId, which depends
+    on the other literals of the program) and the version of the cache, to change when the
+    generated code changes. The hash of the target includes the triple, the CPU and its features,
+    the relocation model, the optimization level and the version of LLVM.
+
+    The cache is used in two ways:
+        - the JIT compiler calls getObject() and notifyObjectCompiled() (llvm::ObjectCache) for
+          each module it compiles: the modules named by ModuleName() of a key are cached.
+        - the callers that compile the modules themselves (AOT, parallel codegen) and the lazy
+          functions, which must skip the generation of the module on a hit, use Load() and
+          Store().
+    The files are written to a temporary file, then renamed: the processes (and the threads)
+    that share the directory never read a partial object. The errors writing the cache are
+    ignored, since the cache is only an optimization. Nothing is ever removed from the directory.
+*/
+
+#include "common.hpp"
+#include "node.hpp"
+#include "string_pool.hpp"
+#include "expr_cse.hpp"
+#include "optimizer.hpp"
+
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace lox
+{
+    class ObjectCache : public llvm::ObjectCache, private NonCopyable
+    {
+    public:
+        // Cache the objects compiled by the target machine (or by one with the same options)
+        // at the level in the directory, created if it doesn't exist.
+        ObjectCache(std::string directory_, const llvm::TargetMachine& target, OptLevel level);
+
+        // $LOX_CACHE_DIR, or lox in the cache directory of the user (~/.cache/lox).
+        static auto DefaultDirectory()
+            -> std::string;
+
+        // Key of the object code of the function, generated with the declarations of the
+        // program (see LLVMVisitor::SetDeclarations()) and with or without the CSE analysis.
+        auto Key(const FunStmtNode& function, const StringPool& strings,
+            non_owned_ptr<const Declarations> declared, non_owned_ptr<const ExprCSE> cse) const
+            -> std::string;
+
+        // Name to give to the module of the function with the key, so the JIT compiler caches
+        // its object.
+        static auto ModuleName(const std::string& key)
+            -> std::string
+        {
+            return std::string{module_prefix} + key;
+        }
+
+        // Return the object of the key, or nullptr. The identifier of the buffer is the path
+        // of the file.
+        auto Load(const std::string& key)
+            -> std::unique_ptr<llvm::MemoryBuffer>;
+
+        // Store the object of the key.
+        auto Store(const std::string& key, llvm::MemoryBufferRef object)
+            -> void;
+
+        // Path of the file of the object of the key.
+        auto Path(const std::string& key) const
+            -> std::string;
+
+        // Return the path of the file of an object returned by Load(), or an empty string if
+        // the object is not from the cache.
+        auto FileOf(const llvm::MemoryBuffer& object) const
+            -> std::string;
+
+        // Objects found by Load().
+        auto Hits() const noexcept
+            -> u64
+        {
+            return hits.load(std::memory_order_relaxed);
+        }
+
+        // Objects compiled and stored.
+        auto Misses() const noexcept
+            -> u64
+        {
+            return misses.load(std::memory_order_relaxed);
+        }
+
+    public:
+        // llvm::ObjectCache, called by the JIT compiler (from any thread).
+
+        auto notifyObjectCompiled(const llvm::Module* mod, llvm::MemoryBufferRef object)
+            -> void override;
+
+        auto getObject(const llvm::Module* mod)
+            -> std::unique_ptr<llvm::MemoryBuffer> override;
+
+    private:
+        static constexpr std::string_view module_prefix{"lox.cached."};
+
+        // Return the key of the module, or an empty string if it is not cached.
+        static auto ModuleKey(const llvm::Module& mod)
+            -> std::string;
+
+    private:
+        std::string directory;
+
+        // Hash of the options of the target machine.
+        u64 target_hash;
+
+        std::atomic<u64> hits{0};
+        std::atomic<u64> misses{0};
+    };
+} // namespace lox
+
+#endif
@@ -0,0 +1,128 @@
+#include "optimizer.hpp"
+
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace lox
+{
+    auto CodeGenLevel(OptLevel level) noexcept
+        -> llvm::CodeGenOpt::Level
+    {
+        switch (level)
+        {
+        case OptLevel::O0: return llvm::CodeGenOpt::None;
+        case OptLevel::O1: return llvm::CodeGenOpt::Less;
+        case OptLevel::O2: return llvm::CodeGenOpt::Default;
+        case OptLevel::O3: return llvm::CodeGenOpt::Aggressive;
+        }
+        return llvm::CodeGenOpt::Default;
+    }
+
+
+    auto Optimizer::Run(llvm::Module& mod)
+        -> void
+    {
+        using namespace llvm;
+
+        PassInstrumentationCallbacks pic;
+        if (time_passes)
+        {
+            pic.registerBeforeNonSkippedPassCallback([this](StringRef name, Any) { BeginPass(name); });
+            pic.registerAfterPassCallback([this](StringRef, Any, const PreservedAnalyses&) { EndPass(); });
+            pic.registerAfterPassInvalidatedCallback([this](StringRef, const PreservedAnalyses&) { EndPass(); });
+            pic.registerBeforeAnalysisCallback([this](StringRef name, Any) { BeginPass(name); });
+            pic.registerAfterAnalysisCallback([this](StringRef, Any) { EndPass(); });
+        }
+
+        // The analysis managers must be declared in this order, so they are destroyed in
+        // the right order.
+        LoopAnalysisManager lam;
+        FunctionAnalysisManager fam;
+        CGSCCAnalysisManager cgam;
+        ModuleAnalysisManager mam;
+
+        PassBuilder pb{target, PipelineTuningOptions{}, None, &pic};
+        pb.registerModuleAnalyses(mam);
+        pb.registerCGSCCAnalyses(cgam);
+        pb.registerFunctionAnalyses(fam);
+        pb.registerLoopAnalyses(lam);
+        pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+        ModulePassManager mpm;
+        switch (level)
+        {
+        case OptLevel::O0:
+            mpm = pb.buildO0DefaultPipeline(OptimizationLevel::O0);
+            break;
+        case OptLevel::O1:
+            mpm = pb.buildPerModuleDefaultPipeline(OptimizationLevel::O1);
+            break;
+        case OptLevel::O2:
+            mpm = pb.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+            break;
+        case OptLevel::O3:
+            mpm = pb.buildPerModuleDefaultPipeline(OptimizationLevel::O3);
+            break;
+        }
+
+        mpm.run(mod, mam);
+    }
+
+
+    auto Optimizer::Report(std::FILE* file) const
+        -> void
+    {
+        std::vector<std::pair<llvm::StringRef, PassTiming>> sorted;
+        f64 total = 0;
+        for (const auto& entry : timings)
+        {
+            sorted.emplace_back(entry.getKey(), entry.getValue());
+            total += entry.getValue().seconds;
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b)
+        {
+            return a.second.seconds > b.second.seconds;
+        });
+
+        std::fprintf(file, "%12s %8s %8s  %s\n", "time (ms)", "%", "runs", "pass");
+        for (const auto& [name, timing] : sorted)
+        {
+            std::fprintf(file, "%12.3f %8.2f %8llu  %.*s\n", timing.seconds * 1000.0,
+                total == 0 ? 0.0 : timing.seconds / total * 100.0,
+                static_cast<unsigned long long>(timing.runs),
+                static_cast<int>(name.size()), name.data());
+        }
+        std::fprintf(file, "%12.3f %8.2f %8s  %s\n", total * 1000.0, 100.0, "", "total");
+    }
+
+
+    auto Optimizer::BeginPass(llvm::StringRef name)
+        -> void
+    {
+        running.push_back(RunningPass{name, Clock::now()});
+    }
+
+
+    auto Optimizer::EndPass()
+        -> void
+    {
+        auto pass = running.back();
+        running.pop_back();
+
+        auto elapsed = std::chrono::duration<f64>(Clock::now() - pass.start).count();
+        auto& timing = timings[pass.name];
+        timing.seconds += elapsed - pass.nested;
+        ++timing.runs;
+
+        if (!running.empty())
+        {
+            running.back().nested += elapsed;
+        }
+    }
+} // namespace lox
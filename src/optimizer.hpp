@@ -0,0 +1,98 @@
+#ifndef LOX_OPTIMIZER_HPP
+#define LOX_OPTIMIZER_HPP
+
+/*
+optimizer.hpp
+
+PURPOSE: Run the LLVM optimization pipeline on the generated module.
+
+CLASSES:
+    OptLevel: Enum for the optimization level (-O0 to -O3).
+    Optimizer: Build and run the default pipeline of the new pass manager for a level.
+
+DESCRIPTION:
+    The pipeline is the default one built by llvm::PassBuilder for the level (the same used by
+    clang). When the timing is enabled, the pass instrumentation callbacks measure the time spent
+    in each pass and analysis. The time is exclusive: the time of the nested passes run by a pass
+    manager or an adaptor is not counted in the time of the parent, so the report shows where the
+    compile time really goes.
+*/
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "common.hpp"
+
+#include <chrono>
+#include <vector>
+#include <cstdio>
+
+namespace lox
+{
+    enum class OptLevel : u8
+    {
+        O0, O1, O2, O3
+    };
+
+
+    // Optimization level of the code generator (instruction selection, scheduling, register
+    // allocation) matching the level of the IR pipeline.
+    auto CodeGenLevel(OptLevel level) noexcept
+        -> llvm::CodeGenOpt::Level;
+
+
+    class Optimizer
+    {
+    public:
+        // The target machine (optional) gives the passes the cost model of the target.
+        explicit Optimizer(OptLevel level_, bool time_passes_ = false,
+            non_owned_ptr<llvm::TargetMachine> target_ = nullptr) :
+            level(level_), time_passes(time_passes_), target(target_) { }
+
+        // Optimize the module.
+        auto Run(llvm::Module& mod)
+            -> void;
+
+        // Write the time spent in each pass, slowest first.
+        auto Report(std::FILE* file) const
+            -> void;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct PassTiming
+        {
+            // Exclusive time in seconds.
+            f64 seconds{0};
+            u64 runs{0};
+        };
+
+        struct RunningPass
+        {
+            llvm::StringRef name;
+            Clock::time_point start;
+
+            // Time spent in the nested passes.
+            f64 nested{0};
+        };
+
+        auto BeginPass(llvm::StringRef name)
+            -> void;
+
+        auto EndPass()
+            -> void;
+
+    private:
+        OptLevel level;
+        bool time_passes;
+        non_owned_ptr<llvm::TargetMachine> target;
+
+        llvm::StringMap<PassTiming> timings;
+
+        // Stack of the passes running (a pass manager runs nested passes).
+        std::vector<RunningPass> running;
+    };
+} // namespace lox
+
+#endif
@@ -0,0 +1,79 @@
+#include "output.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+
+namespace lox
+{
+    auto OutputBuffer::Current()
+        -> OutputBuffer&
+    {
+        // Flushed by the destructor when the thread exits (std::exit included).
+        static thread_local OutputBuffer output;
+        return output;
+    }
+
+
+    auto OutputBuffer::WriteNumber(f64 value)
+        -> void
+    {
+        // Longest output: sign, 17 digits, point and exponent (-2.2250738585072014e-308).
+        constexpr std::size_t max_length = 32;
+        if (buffer_size - size < max_length)
+        {
+            Flush();
+        }
+
+        auto first = buffer.data() + size;
+        auto last = buffer.data() + buffer_size;
+        char* end = nullptr;
+        if (std::isnan(value))
+        {
+            // The sign of a NaN depends on the operation that produced it.
+            std::memcpy(first, "nan", 3);
+            end = first + 3;
+        }
+        else if (std::abs(value) < 9007199254740992.0 && std::trunc(value) == value &&
+            !(value == 0.0 && std::signbit(value)))
+        {
+            // Exact: the digits of the integer (-0 is not one).
+            end = std::to_chars(first, last, static_cast<i64>(value)).ptr;
+        }
+        else
+        {
+            end = std::to_chars(first, last, value).ptr;
+        }
+        size = static_cast<std::size_t>(end - buffer.data());
+    }
+
+
+    auto OutputBuffer::Flush()
+        -> void
+    {
+        if (size != 0)
+        {
+            std::fwrite(buffer.data(), 1, size, stdout);
+            size = 0;
+        }
+    }
+
+
+    auto OutputBuffer::WriteLong(std::string_view s)
+        -> void
+    {
+        // Fill the buffer, then write the rest directly if it is still too long.
+        auto n = buffer_size - size;
+        std::memcpy(buffer.data() + size, s.data(), n);
+        size = buffer_size;
+        Flush();
+        s.remove_prefix(n);
+        if (s.size() >= buffer_size)
+        {
+            std::fwrite(s.data(), 1, s.size(), stdout);
+            return;
+        }
+        std::memcpy(buffer.data(), s.data(), s.size());
+        size = s.size();
+    }
+} // namespace lox
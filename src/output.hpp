@@ -0,0 +1,92 @@
+#ifndef LOX_OUTPUT_HPP
+#define LOX_OUTPUT_HPP
+
+/*
+output.hpp
+
+PURPOSE: Buffered output of the print statements.
+
+CLASSES:
+    OutputBuffer: Buffer of the standard output of a thread.
+
+DESCRIPTION:
+    The print statements of the compiled code and of the interpreters don't call stdio for each
+    value: they append the text to the buffer of their thread, which is written to stdout with
+    a single fwrite when it is full and when it is flushed (lox_flush(): at the end of the
+    program, before the runtime errors are reported and when the thread exits), so the output
+    keeps its order with the messages written by printf and std::cout.
+
+    The numbers are printed with the shortest digits that read back as the same double
+    (std::to_chars without a precision, a Ryu-style algorithm): no locale and no parsing of a
+    format string. The integers below 2^53, the most common case, are printed as integers (not
+    1e+06), and every NaN as nan, whatever its sign. The strings are copied with their length,
+    never scanned for a terminator.
+*/
+
+#include "common.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+namespace lox
+{
+    class OutputBuffer : private NonCopyable
+    {
+    public:
+        static constexpr std::size_t buffer_size = 64 * 1024;
+
+        // The buffer of the current thread.
+        static auto Current()
+            -> OutputBuffer&;
+
+        OutputBuffer() = default;
+
+        ~OutputBuffer()
+        {
+            Flush();
+        }
+
+        auto Write(std::string_view s)
+            -> void
+        {
+            if (s.size() > buffer_size - size)
+            {
+                WriteLong(s);
+                return;
+            }
+            std::memcpy(buffer.data() + size, s.data(), s.size());
+            size += s.size();
+        }
+
+        auto Write(char c)
+            -> void
+        {
+            if (size == buffer_size)
+            {
+                Flush();
+            }
+            buffer[size++] = c;
+        }
+
+        // Write the shortest number that round trips (see above).
+        auto WriteNumber(f64 value)
+            -> void;
+
+        // Write the content of the buffer to stdout.
+        auto Flush()
+            -> void;
+
+    private:
+        // Slow path of Write(), the string doesn't fit in the buffer.
+        auto WriteLong(std::string_view s)
+            -> void;
+
+    private:
+        std::array<char, buffer_size> buffer;
+        std::size_t size{0};
+    };
+} // namespace lox
+
+#endif
@@ -0,0 +1,143 @@
+#include "parallel_codegen.hpp"
+
+#include "llvm_visitor.hpp"
+#include "aot.hpp"
+
+#include <string>
+#include <string_view>
+
+namespace lox
+{
+    auto ParallelCodegen::Start(const std::vector<non_owned_ptr<const FunStmtNode>>& functions,
+        non_owned_ptr<const Declarations> declared_, non_owned_ptr<const ExprCSE> cse_,
+        const TargetFactory& create_target)
+        -> void
+    {
+        declared = declared_;
+        cse = cse_;
+        parts.clear();
+        parts.resize(jobs);
+        for (auto function : functions)
+        {
+            auto hash = std::hash<std::string_view>{}(function->name.Lexeme());
+            parts[hash % jobs].functions.push_back(function);
+        }
+
+        for (auto& part : parts)
+        {
+            if (!part.functions.empty())
+            {
+                part.target = create_target();
+            }
+        }
+
+        for (unsigned i = 0; i < jobs; ++i)
+        {
+            if (!parts[i].functions.empty())
+            {
+                threads.emplace_back([this, i]() { Compile(parts[i], i); });
+            }
+        }
+    }
+
+
+    auto ParallelCodegen::Wait(std::vector<std::unique_ptr<llvm::MemoryBuffer>>& objects)
+        -> bool
+    {
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        threads.clear();
+
+        bool ok = true;
+        for (auto& part : parts)
+        {
+            if (part.exception)
+            {
+                std::rethrow_exception(part.exception);
+            }
+            ok = ok && !part.had_error;
+            for (auto& object : part.objects)
+            {
+                objects.push_back(std::move(object));
+            }
+        }
+        return ok;
+    }
+
+
+    auto ParallelCodegen::Compile(Part& part, unsigned index)
+        -> void
+    {
+        try
+        {
+            if (cache)
+            {
+                CompileCached(part);
+                return;
+            }
+
+            LLVMVisitor visitor{strings, "lox.part." + std::to_string(index)};
+            visitor.SetDeclarations(declared);
+            visitor.SetCSE(cse);
+            for (auto function : part.functions)
+            {
+                visitor.GenerateFunction(*function);
+            }
+            if (auto object = Emit(part, visitor))
+            {
+                part.objects.push_back(std::move(object));
+            }
+        }
+        catch (...)
+        {
+            part.exception = std::current_exception();
+        }
+    }
+
+
+    auto ParallelCodegen::CompileCached(Part& part)
+        -> void
+    {
+        for (auto function : part.functions)
+        {
+            auto key = cache->Key(*function, *strings, declared, cse);
+            if (auto object = cache->Load(key))
+            {
+                part.objects.push_back(std::move(object));
+                continue;
+            }
+
+            LLVMVisitor visitor{strings, LLVMVisitor::FunctionSymbol(function->name.Lexeme())};
+            visitor.SetDeclarations(declared);
+            visitor.SetCSE(cse);
+            visitor.GenerateFunction(*function);
+            auto object = Emit(part, visitor);
+            if (!object)
+            {
+                return;
+            }
+            cache->Store(key, object->getMemBufferRef());
+            part.objects.push_back(std::move(object));
+        }
+    }
+
+
+    auto ParallelCodegen::Emit(Part& part, LLVMVisitor& visitor)
+        -> std::unique_ptr<llvm::MemoryBuffer>
+    {
+        if (visitor.HadError())
+        {
+            part.had_error = true;
+            return nullptr;
+        }
+
+        auto& mod = visitor.Module();
+        mod.setDataLayout(part.target->createDataLayout());
+        mod.setTargetTriple(part.target->getTargetTriple().str());
+        Optimizer optimizer{level, false, part.target.get()};
+        optimizer.Run(mod);
+        return AOT::Compile(*part.target, mod);
+    }
+} // namespace lox
@@ -0,0 +1,132 @@
+#ifndef LOX_PARALLEL_CODEGEN_HPP
+#define LOX_PARALLEL_CODEGEN_HPP
+
+/*
+parallel_codegen.hpp
+
+PURPOSE: Generate, optimize and compile the functions of the program on several threads.
+
+CLASSES:
+    ParallelCodegen: Split the functions in parts and compile each part to an object file on its
+        own thread.
+
+DESCRIPTION:
+    An LLVMContext (with its modules) can be used by only one thread at a time, so each part gets
+    its own LLVMVisitor (context, module and builder), its own target machine and its own
+    optimizer: the threads share nothing but the AST, the StringPool, the declarations and the
+    CSE analysis, which are read only.
+    The main module (lox_main, generated by the caller with the functions declared only, see
+    LLVMVisitor::SetLazyFunctions()) refers to the functions by name, like the parts refer to
+    each other: the object files are linked together by the JIT or by the system linker.
+
+    A function goes to the part chosen by the hash of its name. The parts get about the same
+    number of functions, and the redefinitions of a function end in the same module, where
+    LLVMVisitor reports them.
+    The functions are optimized one part at a time: there is no inlining between parts.
+
+    With an object cache, each function of a part is loaded from the cache or compiled in its own
+    module (and stored in the cache), so a change to a function compiles that function only.
+    The modules are smaller, so there are more of them to generate and compile when the cache
+    is cold.
+*/
+
+#include "common.hpp"
+#include "node.hpp"
+#include "string_pool.hpp"
+#include "expr_cse.hpp"
+#include "optimizer.hpp"
+#include "object_cache.hpp"
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace lox
+{
+    class LLVMVisitor;
+
+
+    class ParallelCodegen : private NonCopyable
+    {
+    public:
+        // Create a target machine for a thread (see JIT::CreateTargetMachine()).
+        using TargetFactory = std::function<std::unique_ptr<llvm::TargetMachine>()>;
+
+        // The cache (optional) must be for the target machines of Start() and the level.
+        ParallelCodegen(non_owned_ptr<const StringPool> strings_, OptLevel level_, unsigned jobs_,
+            non_owned_ptr<ObjectCache> cache_ = nullptr) :
+            strings(strings_), level(level_), jobs(jobs_ ? jobs_ : 1), cache(cache_) { }
+
+        // Wait for the threads still running (after an exception of the caller).
+        ~ParallelCodegen()
+        {
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        // Start the threads, one for each part. The target machines are created on the calling
+        // thread. The functions, the declarations (see LLVMVisitor::SetDeclarations()) and the
+        // CSE analysis of the program (optional, see LLVMVisitor::SetCSE()) must outlive Wait().
+        auto Start(const std::vector<non_owned_ptr<const FunStmtNode>>& functions,
+            non_owned_ptr<const Declarations> declared_, non_owned_ptr<const ExprCSE> cse_,
+            const TargetFactory& create_target)
+            -> void;
+
+        // Wait for the threads and return the object files of the parts (or of the functions,
+        // with a cache). Return false if there was an error generating a function (reported
+        // by LLVMVisitor).
+        auto Wait(std::vector<std::unique_ptr<llvm::MemoryBuffer>>& objects)
+            -> bool;
+
+        auto Jobs() const noexcept
+            -> unsigned
+        {
+            return jobs;
+        }
+
+    private:
+        struct Part
+        {
+            std::vector<non_owned_ptr<const FunStmtNode>> functions;
+            std::unique_ptr<llvm::TargetMachine> target;
+            std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects;
+            bool had_error{false};
+
+            // The exception of the thread (AOTError), rethrown by Wait().
+            std::exception_ptr exception;
+        };
+
+        // Body of the thread of a part.
+        auto Compile(Part& part, unsigned index)
+            -> void;
+
+        // Compile the functions of the part one at a time, using the cache.
+        auto CompileCached(Part& part)
+            -> void;
+
+        // Optimize the module generated by the visitor and return its object file. Return
+        // nullptr if there was an error generating a function.
+        auto Emit(Part& part, LLVMVisitor& visitor)
+            -> std::unique_ptr<llvm::MemoryBuffer>;
+
+    private:
+        non_owned_ptr<const StringPool> strings;
+        OptLevel level;
+        unsigned jobs;
+        non_owned_ptr<ObjectCache> cache;
+        non_owned_ptr<const Declarations> declared{nullptr};
+        non_owned_ptr<const ExprCSE> cse{nullptr};
+
+        std::vector<Part> parts;
+        std::vector<std::thread> threads;
+    };
+} // namespace lox
+
+#endif
@@ -7,6 +7,8 @@
 #include <charconv>
 #include <iostream>
 #include <optional>
+#include <algorithm>
+#include <utility>
 
 namespace lox
 {
@@ -28,6 +30,9 @@ namespace lox
             }
             catch (const ParseError& e)
             {
+                current_class = nullptr;
+                in_initializer = false;
+                block_depth = 0;
                 Synchronize();
             }
         }
@@ -49,6 +54,10 @@ namespace lox
         {
             return FunDeclaration();
         }
+        if (Match(TokenType::Class))
+        {
+            return ClassDeclaration();
+        }
         else
         {
             return Statement();
@@ -78,10 +87,78 @@ namespace lox
     {
         Consume(TokenType::Identifier, "Expect a function name.");
         auto fun_name = prev;
-        
+
+        // A function declared in a method captures this (see closure_analysis.hpp), but it can
+        // return a value even in init.
+        auto enclosing_initializer = std::exchange(in_initializer, false);
+        auto function = Function(std::move(fun_name), {});
+        in_initializer = enclosing_initializer;
+        return function;
+    }
+
+
+    auto Parser::ClassDeclaration()
+        -> StmtNode
+    {
+        if (block_depth > 0)
+        {
+            ErrorAt(prev, "Classes must be declared at the top level.");
+        }
+        Consume(TokenType::Identifier, "Expect class name.");
+        auto name = prev;
+
+        std::optional<Token> superclass;
+        if (Match(TokenType::Less))
+        {
+            Consume(TokenType::Identifier, "Expect superclass name.");
+            if (prev.Lexeme() == name.Lexeme())
+            {
+                ErrorAt(prev, "A class can't inherit from itself.");
+            }
+            superclass = prev;
+        }
+        Consume(TokenType::LeftBrace, "Expect '{' before class body.");
+
+        ClassState state{name, superclass.has_value(), {}};
+        current_class = &state;
+
+        std::vector<FunStmtNodePtr> methods;
+        while (!(IsAtEnd() || Check(TokenType::RightBrace)))
+        {
+            Consume(TokenType::Identifier, "Expect method name.");
+            auto method = prev;
+
+            // The method is the function Class.method: the name is kept in the pool, which
+            // outlives the AST.
+            std::string qualified{name.Lexeme()};
+            qualified += '.';
+            qualified += method.Lexeme();
+            Token fun_name{strings->Get(strings->Intern(qualified)), TokenType::Identifier, method.Line()};
+
+            in_initializer = method.Lexeme() == "init";
+            methods.emplace_back(Function(std::move(fun_name), {Token{"this", TokenType::This, method.Line()}}));
+            if (in_initializer)
+            {
+                // init returns this, also when its body ends.
+                Token keyword{"return", TokenType::Return, prev.Line()};
+                methods.back()->body->statements.emplace_back(std::make_unique<ReturnStmtNode>(
+                    std::move(keyword), std::make_unique<VarExprNode>(Token{"this", TokenType::This, prev.Line()})));
+            }
+            in_initializer = false;
+        }
+        Consume(TokenType::RightBrace, "Expect '}' after class body.");
+        current_class = nullptr;
+
+        return std::make_unique<ClassStmtNode>(std::move(name), std::move(superclass),
+            std::move(methods), std::move(state.fields));
+    }
+
+
+    auto Parser::Function(Token name, std::vector<Token> params)
+        -> FunStmtNodePtr
+    {
         Consume(TokenType::LeftParen, "Expect '(' after function name.");
 
-        std::vector<Token> params;
         // Check for function parameters.
         if (!Check(TokenType::RightParen))
         {
@@ -98,8 +175,8 @@ namespace lox
         // It is safe to cast directly the variant because we know the result of BlockStatement().
         auto bodyvar = BlockStatement();
         auto& body = *std::get_if<BlockStmtNodePtr>(&bodyvar);
-        return std::make_unique<FunStmtNode>(std::move(fun_name),
-            std::move(params), std::move(body));    
+        return std::make_unique<FunStmtNode>(std::move(name),
+            std::move(params), std::move(body));
     }
 
 
@@ -262,10 +339,12 @@ namespace lox
         -> StmtNode
     {
         std::vector<StmtNode> statements;
+        ++block_depth;
         while (!(IsAtEnd() || Check(TokenType::RightBrace)))
         {
             statements.emplace_back(Declaration());
         }
+        --block_depth;
         Consume(TokenType::RightBrace, "Expect '}' after block.");
         return std::make_unique<BlockStmtNode>(std::move(statements));
     }
@@ -291,8 +370,16 @@ namespace lox
         // Check if the return returns a value 
         if (!Check(TokenType::Semicolon))
         {
+            if (in_initializer)
+            {
+                ErrorAt(keyword, "Can't return a value from an initializer.");
+            }
             expr = Expression();
         }
+        else if (in_initializer)
+        {
+            expr = std::make_unique<VarExprNode>(Token{"this", TokenType::This, keyword.Line()});
+        }
         Consume(TokenType::Semicolon, "Expect ';' after return value.");
         return std::make_unique<ReturnStmtNode>(std::move(keyword), std::move(expr));
     }
@@ -313,10 +400,8 @@ namespace lox
     {
         auto expr = LogicOr();
 
-        // TODO: support for class setter
         // If we match the "=" we need to check if the variable is a field of an instance.
-        // and do the parsing with the right precedence even for nested access like
-        // instance_a.b.c = 4;
+        // The object of a nested access like instance_a.b.c = 4 is parsed by Call().
         if (Match(TokenType::Equal))
         {
             auto equals = prev;
@@ -327,7 +412,28 @@ namespace lox
             // Check if expr is a variableexpr (an identifier)
             if (auto v = std::get_if<VarExprNodePtr>(&expr))
             {
-                return std::make_unique<AssignExprNode>((*v)->name, std::move(value));
+                if ((*v)->name.Type() == TokenType::Identifier)
+                {
+                    return std::make_unique<AssignExprNode>((*v)->name, std::move(value));
+                }
+            }
+            else if (auto get = std::get_if<GetExprNodePtr>(&expr))
+            {
+                auto& object = (*get)->object;
+                auto& name = (*get)->name;
+                auto var = std::get_if<VarExprNodePtr>(&object);
+                if (current_class && var && (*var)->name.Type() == TokenType::This &&
+                    std::find(current_class->fields.begin(), current_class->fields.end(), name.Lexeme()) ==
+                        current_class->fields.end())
+                {
+                    current_class->fields.push_back(name.Lexeme());
+                }
+                return std::make_unique<SetExprNode>(std::move(object), std::move(name), std::move(value));
+            }
+            else if (auto index = std::get_if<IndexExprNodePtr>(&expr))
+            {
+                return std::make_unique<IndexSetExprNode>(std::move((*index)->object), std::move((*index)->bracket),
+                    std::move((*index)->index), std::move(value));
             }
 
             // report an error if the left side of the assignment is not an identifier.
@@ -466,48 +572,76 @@ namespace lox
         -> ExprNode
     {
         auto expr = Primary();
-        // Parse function arguments.
-        // TODO: add support for properties when classes will be supported.
-        while (Match(TokenType::LeftParen))
-        {
-            // TODO: This code is ugly, try to refactor it.
-            // Check if expr is a name (a string) because we can't call a boolean,
-            // a number or a nil value.
-            std::string fname;
-            if (auto it = std::get_if<LiteralNodePtr>(&expr))
-            {   
-                if (auto pt = std::get_if<std::string>(&(*it)->literal))
-                {   
-                    fname = std::move(*pt);
+        // Parse function arguments, properties and indexes.
+        while (true)
+        {
+            if (Match(TokenType::LeftParen))
+            {
+                // Only named functions can be called, we can't call a boolean,
+                // a number or a nil value.
+                Token callee;
+                auto it = std::get_if<VarExprNodePtr>(&expr);
+                if (it && (*it)->name.Type() == TokenType::Identifier)
+                {
+                    callee = (*it)->name;
                 }
                 else
                 {
-                    ErrorAtCurrent("Function name must be a string.");
+                    ErrorAtCurrent("Function name must be an identifier.");
                 }
+
+                auto args = Arguments();
+                auto paren = prev;
+                expr = std::make_unique<CallExprNode>(std::move(paren),
+                    std::move(callee), std::move(args));
             }
-            else
+            else if (Match(TokenType::Dot))
+            {
+                Consume(TokenType::Identifier, "Expect property name after '.'.");
+                auto name = prev;
+                if (Match(TokenType::LeftParen))
+                {
+                    auto args = Arguments();
+                    auto paren = prev;
+                    expr = std::make_unique<InvokeExprNode>(std::move(expr), std::move(name),
+                        std::move(paren), std::move(args));
+                }
+                else
+                {
+                    expr = std::make_unique<GetExprNode>(std::move(expr), std::move(name));
+                }
+            }
+            else if (Match(TokenType::LeftBracket))
             {
-                ErrorAtCurrent("Function name must be a string.");
+                auto bracket = prev;
+                auto index = Expression();
+                Consume(TokenType::RightBracket, "Expect ']' after index.");
+                expr = std::make_unique<IndexExprNode>(std::move(expr), std::move(bracket), std::move(index));
             }
-
-
-            std::vector<ExprNode> args;
-            if (!Check(TokenType::RightParen))
+            else
             {
-                do
-                {
-                    args.emplace_back(Expression());
-                } while (Match(TokenType::Comma));
+                break;
             }
+        }
+
+        return expr;
+    }
 
 
-            Consume(TokenType::RightParen, "Expect ')' after arguments.");
-            auto paren = prev;
-            expr = std::make_unique<CallExprNode>(std::move(paren),
-                std::move(fname), std::move(args));
+    auto Parser::Arguments()
+        -> std::vector<ExprNode>
+    {
+        std::vector<ExprNode> args;
+        if (!Check(TokenType::RightParen))
+        {
+            do
+            {
+                args.emplace_back(Expression());
+            } while (Match(TokenType::Comma));
         }
 
-        return expr;
+        Consume(TokenType::RightParen, "Expect ')' after arguments.");
+        return args;
     }
 
 
@@ -534,20 +668,67 @@ namespace lox
         }
         else if (Match(TokenType::String))
         {
-            Log("string");
-            Log(prev.Lexeme());
-            return std::make_unique<LiteralNode>(std::string{prev.Lexeme()});
+            // Strip the quotes.
+            auto lexeme = prev.Lexeme();
+            return std::make_unique<LiteralNode>(strings->Intern(lexeme.substr(1, lexeme.size() - 2)));
         }
         else if (Match(TokenType::Identifier))
         {
-            Log("we are here");
-            Log(prev.Lexeme());
             return std::make_unique<VarExprNode>(prev);
         }  
+        else if (Match(TokenType::This))
+        {
+            if (!current_class)
+            {
+                ErrorAt(prev, "Can't use 'this' outside of a class.");
+            }
+            return std::make_unique<VarExprNode>(prev);
+        }
+        else if (Match(TokenType::Super))
+        {
+            auto keyword = prev;
+            if (!current_class)
+            {
+                ErrorAt(keyword, "Can't use 'super' outside of a class.");
+            }
+            if (!current_class->has_superclass)
+            {
+                ErrorAt(keyword, "Can't use 'super' in a class with no superclass.");
+            }
+            Consume(TokenType::Dot, "Expect '.' after 'super'.");
+            Consume(TokenType::Identifier, "Expect superclass method name.");
+            auto method = prev;
+            // The methods are not values: super.method must be called.
+            Consume(TokenType::LeftParen, "Expect '(' after superclass method name.");
+            auto args = Arguments();
+            auto paren = prev;
+            return std::make_unique<SuperInvokeExprNode>(std::move(keyword), current_class->name,
+                std::move(method), std::move(paren), std::move(args));
+        }
         else if (Match(TokenType::Nil))
         {
             return std::make_unique<LiteralNode>(LoxNil{});
         }
+        else if (Match(TokenType::LeftParen))
+        {
+            auto expr = Expression();
+            Consume(TokenType::RightParen, "Expect ')' after expression.");
+            return std::make_unique<GroupingNode>(std::move(expr));
+        }
+        else if (Match(TokenType::LeftBracket))
+        {
+            auto bracket = prev;
+            std::vector<ExprNode> elements;
+            if (!Check(TokenType::RightBracket))
+            {
+                do
+                {
+                    elements.emplace_back(Expression());
+                } while (Match(TokenType::Comma));
+            }
+            Consume(TokenType::RightBracket, "Expect ']' after list elements.");
+            return std::make_unique<ListExprNode>(std::move(bracket), std::move(elements));
+        }
         else
         {
             // Error, not supported type or invalid token.
@@ -645,6 +826,12 @@ namespace lox
     auto Parser::Synchronize()
         -> void
     {
+        // Skip the token of the error, otherwise an error at a token that can't start a
+        // statement (the } of a method) is reported forever.
+        if (current.Type() != TokenType::Eof)
+        {
+            Advance();
+        }
         while (current.Type() != TokenType::Eof) 
         {
             if (prev.Type() == TokenType::Semicolon) return;
@@ -23,6 +23,7 @@ https://craftinginterpreters.com/appendix-i.html
 #include "scanner.hpp"
 #include "common.hpp"
 #include "node.hpp"
+#include "string_pool.hpp"
 
 #include <string_view>
 #include <initializer_list>
@@ -35,15 +36,23 @@ namespace lox
     class Parser
     {
     public:
-        explicit Parser(non_owned_ptr<Scanner> scanner_) :
-            scanner(scanner_)
+        // String literals are interned inside the pool, which must outlive the AST.
+        explicit Parser(non_owned_ptr<Scanner> scanner_, non_owned_ptr<StringPool> strings_) :
+            scanner(scanner_), strings(strings_)
         {
             Advance();
         }
 
+        // The program is empty if there was an error.
         auto Parse()
             -> std::vector<StmtNode>;
 
+        auto HadError() const noexcept
+            -> bool
+        {
+            return had_error;
+        }
+
 
     // Parser internal methods to handle tokens.
     private:
@@ -109,6 +118,14 @@ namespace lox
         auto FunDeclaration()
             -> StmtNode;
 
+        auto ClassDeclaration()
+            -> StmtNode;
+
+        // Parse the parameters and the body of a function (after its name). The methods
+        // start with the parameter this.
+        auto Function(Token name, std::vector<Token> params)
+            -> FunStmtNodePtr;
+
         // Statements
         
         auto Statement()
@@ -172,6 +189,10 @@ namespace lox
         auto Primary() 
             -> ExprNode;
 
+        // Parse the arguments of a call after the '('.
+        auto Arguments()
+            -> std::vector<ExprNode>;
+
     private:
         class ParseError : public std::exception
         {
@@ -182,11 +203,29 @@ namespace lox
             }
         };
 
+        // Class whose methods are being parsed.
+        struct ClassState
+        {
+            Token name;
+            bool has_superclass;
+            // Fields assigned through this (see ClassStmtNode).
+            std::vector<std::string_view> fields;
+        };
+
     private:
         non_owned_ptr<Scanner> scanner;
+        non_owned_ptr<StringPool> strings;
         Token current;
         Token prev;
 
+        // Null outside of the methods (and in the functions declared inside them, which can't
+        // see this).
+        non_owned_ptr<ClassState> current_class{nullptr};
+        // True in the body of an init method.
+        bool in_initializer{false};
+        // Blocks being parsed: the classes are declared only at the top level.
+        u32 block_depth{0};
+
         // Signal an error during parsing.
         bool had_error{ false };
 
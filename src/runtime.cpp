@@ -0,0 +1,646 @@
+#include "runtime.hpp"
+#include "value.hpp"
+#include "gc.hpp"
+#include "shape.hpp"
+#include "output.hpp"
+#include "string_object.hpp"
+#include "list_object.hpp"
+#include "map_object.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+namespace lox
+{
+    // The inline slot or the overflow slot of the instance.
+    static auto Slot(ObjInstance* instance, u32 slot) noexcept
+        -> u64&
+    {
+        return slot < instance->capacity ? instance->Fields()[slot] :
+            instance->overflow->Values()[slot - instance->capacity];
+    }
+
+
+    static auto At(ObjInstance* instance, u64 offset) noexcept
+        -> u64&
+    {
+        return *reinterpret_cast<u64*>(reinterpret_cast<char*>(instance) + offset);
+    }
+
+
+    // Make room for count overflow slots. Can run a collection: the instance must be in the
+    // roots.
+    static auto GrowOverflow(ObjInstance* instance, u32 count)
+        -> void
+    {
+        auto old = instance->overflow;
+        u32 old_capacity = old ? old->capacity : 0;
+        if (count <= old_capacity)
+        {
+            return;
+        }
+
+        auto capacity = std::max({count, 2 * old_capacity, ClassInfo::min_capacity});
+        auto& heap = GlobalHeap();
+        auto slots = reinterpret_cast<ObjSlots*>(heap.Allocate(ObjType::Slots,
+            sizeof(ObjSlots) + capacity * sizeof(u64)));
+        slots->capacity = capacity;
+        auto values = slots->Values();
+        std::fill(values, values + capacity, LoxValue::nil_bits);
+        if (old)
+        {
+            std::copy(old->Values(), old->Values() + old_capacity, values);
+        }
+        instance->overflow = slots;
+        heap.Remember(&instance->obj);
+    }
+
+
+    // Write the value like the print statement, without the newline. The lists and the maps
+    // being written are in path: a list that contains itself is written [...], a map {...}.
+    static auto WriteValue(OutputBuffer& output, LoxValue value, std::vector<const Obj*>& path)
+        -> void
+    {
+        if (value.IsNumber())
+        {
+            output.WriteNumber(value.AsNumber());
+        }
+        else if (value.IsBool())
+        {
+            output.Write(value.AsBool() ? "true" : "false");
+        }
+        else if (value.IsString())
+        {
+            output.Write(StringChars(value));
+        }
+        else if (value.IsInstance())
+        {
+            output.Write(value.AsInstance()->shape->Class().Name());
+            output.Write(" instance");
+        }
+        else if (value.IsClass())
+        {
+            output.Write(value.AsClosure()->name);
+        }
+        else if (value.IsClosure())
+        {
+            output.Write("<fn ");
+            output.Write(value.AsClosure()->name);
+            output.Write('>');
+        }
+        else if (value.IsList())
+        {
+            auto list = value.AsList();
+            if (std::find(path.begin(), path.end(), &list->obj) != path.end())
+            {
+                output.Write("[...]");
+                return;
+            }
+            path.push_back(&list->obj);
+            output.Write('[');
+            for (u32 i = 0; i < list->length; ++i)
+            {
+                if (i != 0)
+                {
+                    output.Write(", ");
+                }
+                WriteValue(output, LoxValue{list->elements->Values()[i]}, path);
+            }
+            output.Write(']');
+            path.pop_back();
+        }
+        else if (value.IsMap())
+        {
+            auto map = value.AsMap();
+            if (std::find(path.begin(), path.end(), &map->obj) != path.end())
+            {
+                output.Write("{...}");
+                return;
+            }
+            path.push_back(&map->obj);
+            output.Write('{');
+            auto table = map->table;
+            bool first = true;
+            for (u32 i = 0; i < table->capacity; ++i)
+            {
+                if (table->InUse(i))
+                {
+                    if (!first)
+                    {
+                        output.Write(", ");
+                    }
+                    first = false;
+                    WriteValue(output, LoxValue{table->Entries()[2 * i]}, path);
+                    output.Write(": ");
+                    WriteValue(output, LoxValue{table->Entries()[2 * i + 1]}, path);
+                }
+            }
+            output.Write('}');
+            path.pop_back();
+        }
+        else
+        {
+            output.Write("nil");
+        }
+    }
+
+
+    [[noreturn]] static auto UndefinedProperty(const char* name, u32 line)
+        -> void
+    {
+        std::string msg{"Undefined property '"};
+        msg += name;
+        msg += "'.";
+        lox_error(msg.c_str(), line);
+    }
+} // namespace lox
+
+extern "C"
+{
+    auto lox_rt_init()
+        -> void
+    {
+    }
+
+
+    auto lox_rt_shutdown()
+        -> void
+    {
+        lox_flush();
+        std::fflush(stdout);
+    }
+
+
+    auto lox_flush()
+        -> void
+    {
+        lox::OutputBuffer::Current().Flush();
+    }
+
+
+    auto lox_print(lox::u64 bits)
+        -> void
+    {
+        using namespace lox;
+
+        auto& output = OutputBuffer::Current();
+        std::vector<const Obj*> path;
+        WriteValue(output, LoxValue{bits}, path);
+        output.Write('\n');
+    }
+
+
+    auto lox_add(lox::u64 left, lox::u64 right, lox::u32 line)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        LoxValue l{left};
+        LoxValue r{right};
+        if (!l.IsString() || !r.IsString())
+        {
+            lox_error("Operands must be two numbers or two strings.", line);
+        }
+
+        if (u64{StringLength(l)} + StringLength(r) > UINT32_MAX)
+        {
+            lox_error("String too long.", line);
+        }
+
+        // The operands are in the roots of the caller, they survive the allocation.
+        return Concatenate(l, r).Bits();
+    }
+
+
+    auto lox_equal(lox::u64 left, lox::u64 right)
+        -> lox::u32
+    {
+        return lox::StringsEqual(lox::LoxValue{left}, lox::LoxValue{right});
+    }
+
+
+    auto lox_instance_new(lox::LoxClass* klass)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        auto& shape = ClassInfo::Of(*klass).Root();
+        auto capacity = shape.Capacity();
+        auto instance = reinterpret_cast<ObjInstance*>(GlobalHeap().Allocate(ObjType::Instance,
+            sizeof(ObjInstance) + capacity * sizeof(u64)));
+        instance->capacity = capacity;
+        instance->shape = &shape;
+        instance->overflow = nullptr;
+        std::fill(instance->Fields(), instance->Fields() + capacity, LoxValue::nil_bits);
+        return LoxValue::Object(&instance->obj).Bits();
+    }
+
+
+    auto lox_get_property(lox::u64 object, lox::InlineCache* cache, lox::u32 line)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        LoxValue value{object};
+        if (!value.IsInstance())
+        {
+            lox_error("Only instances have properties.", line);
+        }
+        auto instance = value.AsInstance();
+        auto shape = instance->shape;
+        if (auto entry = cache->Find(shape))
+        {
+            return At(instance, entry->offset);
+        }
+
+        auto name = cache->Name();
+        auto slot = shape->Find(name);
+        if (!slot)
+        {
+            if (shape->Class().FindMethod(name))
+            {
+                lox_error("Methods are not values, they can only be called.", line);
+            }
+            UndefinedProperty(cache->name, line);
+        }
+        if (*slot < instance->capacity)
+        {
+            cache->Insert({shape, nullptr, SlotOffset(*slot)});
+        }
+        return Slot(instance, *slot);
+    }
+
+
+    auto lox_set_property(lox::u64 object, lox::u64 value, lox::InlineCache* cache, lox::u32 line)
+        -> void
+    {
+        using namespace lox;
+
+        LoxValue v{object};
+        if (!v.IsInstance())
+        {
+            lox_error("Only instances have fields.", line);
+        }
+        auto instance = v.AsInstance();
+        auto shape = instance->shape;
+        auto& heap = GlobalHeap();
+        if (auto entry = cache->Find(shape))
+        {
+            At(instance, entry->offset) = value;
+            instance->shape = static_cast<Shape*>(const_cast<void*>(entry->target));
+            if (LoxValue{value}.IsObject())
+            {
+                heap.Remember(&instance->obj);
+            }
+            return;
+        }
+
+        auto name = cache->Name();
+        auto next = shape;
+        auto slot = shape->Find(name);
+        if (!slot)
+        {
+            next = shape->Add(name);
+            slot = next->Count() - 1;
+            if (*slot >= instance->capacity)
+            {
+                // The caller keeps the instance and the value in its roots.
+                GrowOverflow(instance, *slot - instance->capacity + 1);
+                shape->Class().Overflow(*shape, next->Count());
+            }
+        }
+
+        Slot(instance, *slot) = value;
+        instance->shape = next;
+        if (LoxValue{value}.IsObject())
+        {
+            heap.Remember(*slot < instance->capacity ? &instance->obj : &instance->overflow->obj);
+        }
+        if (*slot < instance->capacity)
+        {
+            cache->Insert({shape, next, SlotOffset(*slot)});
+        }
+    }
+
+
+    auto lox_find_method(lox::u64 object, lox::InlineCache* cache, lox::u32 argc, lox::u32 line)
+        -> const void*
+    {
+        using namespace lox;
+
+        LoxValue value{object};
+        if (!value.IsInstance())
+        {
+            lox_error("Only instances have methods.", line);
+        }
+        auto shape = value.AsInstance()->shape;
+        if (auto entry = cache->Find(shape))
+        {
+            return entry->target;
+        }
+
+        auto name = cache->Name();
+        if (shape->Find(name))
+        {
+            // A field shadows the method, and only functions and classes can be called.
+            lox_error("Can only call functions and classes.", line);
+        }
+        auto method = shape->Class().FindMethod(name);
+        if (!method)
+        {
+            UndefinedProperty(cache->name, line);
+        }
+        if (method->arity != argc)
+        {
+            auto msg = "Expected " + std::to_string(method->arity) + " arguments but got " +
+                std::to_string(argc) + ".";
+            lox_error(msg.c_str(), line);
+        }
+        cache->Insert({shape, method->function, 0});
+        return method->function;
+    }
+
+
+    auto lox_find_super_method(lox::LoxClass* klass, const char* name, lox::u32 argc, lox::u32 line)
+        -> const void*
+    {
+        using namespace lox;
+
+        // The parser allows super only in the classes with a superclass.
+        auto superclass = ClassInfo::Of(*klass).Superclass();
+        auto method = superclass->FindMethod(InternSymbol(name));
+        if (!method)
+        {
+            UndefinedProperty(name, line);
+        }
+        if (method->arity != argc)
+        {
+            auto msg = "Expected " + std::to_string(method->arity) + " arguments but got " +
+                std::to_string(argc) + ".";
+            lox_error(msg.c_str(), line);
+        }
+        return method->function;
+    }
+
+
+    auto lox_closure_new(const void* function, const char* name, lox::u32 arity, lox::u32 count)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        auto& heap = GlobalHeap();
+        auto closure = reinterpret_cast<ObjClosure*>(heap.Allocate(ObjType::Closure,
+            sizeof(ObjClosure) + count * sizeof(u64)));
+        closure->count = static_cast<u16>(count);
+        closure->arity = arity;
+        closure->function = function;
+        closure->name = name;
+        std::fill(closure->Captured(), closure->Captured() + count, LoxValue::nil_bits);
+        // The generated code stores the captured values without a write barrier: a large
+        // closure is old from the start.
+        heap.Remember(&closure->obj);
+        return LoxValue::Object(&closure->obj).Bits();
+    }
+
+
+    auto lox_box_new(lox::u64 value)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        auto box = reinterpret_cast<ObjSlots*>(GlobalHeap().Allocate(ObjType::Slots,
+            sizeof(ObjSlots) + sizeof(u64)));
+        box->capacity = 1;
+        box->Values()[0] = value;
+        return LoxValue::Object(&box->obj).Bits();
+    }
+
+
+    auto lox_list_new(const lox::u64* values, lox::u32 count)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        return LoxValue::Object(&NewList(values, count)->obj).Bits();
+    }
+
+
+    auto lox_list_append(lox::u64 list, lox::u64 value, lox::u32 line)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        LoxValue l{list};
+        if (!l.IsList())
+        {
+            lox_error("Can only append to a list.", line);
+        }
+        if (l.AsList()->length == UINT32_MAX)
+        {
+            lox_error("List too long.", line);
+        }
+        // The operands are in the roots of the caller, they survive the allocation.
+        Append(l.AsList(), LoxValue{value});
+        return LoxValue::nil_bits;
+    }
+
+
+    auto lox_len(lox::u64 value, lox::u32 line)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        LoxValue v{value};
+        if (v.IsList())
+        {
+            return LoxValue::Number(v.AsList()->length).Bits();
+        }
+        if (v.IsMap())
+        {
+            return LoxValue::Number(v.AsMap()->count).Bits();
+        }
+        if (!v.IsString())
+        {
+            lox_error("Can only get the length of lists, maps and strings.", line);
+        }
+        return LoxValue::Number(StringLength(v)).Bits();
+    }
+
+
+    auto lox_index_error(lox::u64 object, lox::u64 index, lox::u32 line)
+        -> void
+    {
+        using namespace lox;
+
+        LoxValue l{object};
+        LoxValue i{index};
+        if (!l.IsList())
+        {
+            lox_error("Can only index lists and maps.", line);
+        }
+        if (!i.IsNumber() || std::trunc(i.AsNumber()) != i.AsNumber())
+        {
+            lox_error("List index must be an integer.", line);
+        }
+        lox_error("List index out of range.", line);
+    }
+
+
+    auto lox_index_get(lox::u64 object, lox::u64 index, lox::u32 line)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        LoxValue m{object};
+        if (!m.IsMap())
+        {
+            lox_index_error(object, index, line);
+        }
+        return MapGet(m.AsMap(), LoxValue{index}).Bits();
+    }
+
+
+    auto lox_index_set(lox::u64 object, lox::u64 index, lox::u64 value, lox::u32 line)
+        -> void
+    {
+        using namespace lox;
+
+        LoxValue m{object};
+        if (!m.IsMap())
+        {
+            lox_index_error(object, index, line);
+        }
+        // The operands are in the roots of the caller, they survive the allocation.
+        MapSet(m.AsMap(), LoxValue{index}, LoxValue{value});
+    }
+
+
+    auto lox_map_new()
+        -> lox::u64
+    {
+        using namespace lox;
+
+        return LoxValue::Object(&NewMap()->obj).Bits();
+    }
+
+
+    auto lox_map_has(lox::u64 map, lox::u64 key, lox::u32 line)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        LoxValue m{map};
+        if (!m.IsMap())
+        {
+            lox_error("Can only look up keys in a map.", line);
+        }
+        return LoxValue::Bool(MapHas(m.AsMap(), LoxValue{key})).Bits();
+    }
+
+
+    auto lox_map_remove(lox::u64 map, lox::u64 key, lox::u32 line)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        LoxValue m{map};
+        if (!m.IsMap())
+        {
+            lox_error("Can only remove keys from a map.", line);
+        }
+        return LoxValue::Bool(MapRemove(m.AsMap(), LoxValue{key})).Bits();
+    }
+
+
+    auto lox_map_keys(lox::u64 map, lox::u32 line)
+        -> lox::u64
+    {
+        using namespace lox;
+
+        LoxValue m{map};
+        if (!m.IsMap())
+        {
+            lox_error("Can only get the keys of a map.", line);
+        }
+        auto table = m.AsMap()->table;
+        std::vector<u64> keys;
+        keys.reserve(m.AsMap()->count);
+        for (u32 i = 0; i < table->capacity; ++i)
+        {
+            if (table->InUse(i))
+            {
+                keys.push_back(table->Entries()[2 * i]);
+            }
+        }
+        // The keys are reachable from the map, in the roots of the caller.
+        return LoxValue::Object(&NewList(keys.data(), static_cast<u32>(keys.size()))->obj).Bits();
+    }
+
+
+    auto lox_call_error(lox::u64 callee, lox::u32 argc, lox::u32 line)
+        -> void
+    {
+        using namespace lox;
+
+        LoxValue value{callee};
+        if (!value.IsClosure() && !value.IsClass())
+        {
+            lox_error("Can only call functions and classes.", line);
+        }
+        auto msg = "Expected " + std::to_string(value.AsClosure()->arity) + " arguments but got " +
+            std::to_string(argc) + ".";
+        lox_error(msg.c_str(), line);
+    }
+
+
+    auto lox_error(const char* msg, lox::u32 line)
+        -> void
+    {
+        // Same format of the errors reported by the interpreters (without the token).
+        lox_flush();
+        std::printf("[line %u] Error: %s\n", line, msg);
+        std::fflush(stdout);
+        std::exit(70);
+    }
+
+
+    auto lox_print_number(double value)
+        -> void
+    {
+        // Like %g: the integers without the decimal part, like clox.
+        auto& output = lox::OutputBuffer::Current();
+        output.WriteNumber(value);
+        output.Write('\n');
+    }
+
+
+    auto lox_print_bool(bool value)
+        -> void
+    {
+        lox::OutputBuffer::Current().Write(value ? "true\n" : "false\n");
+    }
+
+
+    auto lox_print_string(const char* value)
+        -> void
+    {
+        auto& output = lox::OutputBuffer::Current();
+        output.Write(value ? std::string_view{value} : "nil");
+        output.Write('\n');
+    }
+
+
+    auto lox_print_chars(const char* value, lox::u64 length)
+        -> void
+    {
+        auto& output = lox::OutputBuffer::Current();
+        output.Write(std::string_view{value, length});
+        output.Write('\n');
+    }
+}
@@ -0,0 +1,167 @@
+#ifndef LOX_RUNTIME_HPP
+#define LOX_RUNTIME_HPP
+
+/*
+runtime.hpp
+
+PURPOSE: Runtime support library of the compiled programs.
+
+CLASSES:
+
+DESCRIPTION:
+    The functions called by the generated code. They have C linkage, so the backend can declare
+    them by name. The runtime is linked in two ways:
+    - inside the lox executable, where the JIT resolves the calls of the generated code;
+    - as the static library liblox_rt.a, linked with the object file emitted by `lox build`.
+      The library also contains the C main function (runtime_main.cpp), which initializes the
+      runtime and calls the entry point of the program, lox_main.
+    The print statements write to a buffer, flushed by lox_rt_shutdown() and lox_error() (see
+    output.hpp).
+    The compiled code passes the values boxed (LoxValue, see value.hpp) as u64. The objects
+    created at run time are allocated in the garbage collected heap (gc.hpp). The property
+    accesses of the instances and the elements of the lists are inlined by the generated code,
+    the runtime has their slow paths (see shape.hpp and list_object.hpp) and the maps (see
+    map_object.hpp).
+*/
+
+#include "common.hpp"
+
+namespace lox
+{
+    struct LoxClass;
+    struct InlineCache;
+}
+
+extern "C"
+{
+    // Entry point of the program (the top level code), generated by LLVMVisitor.
+    auto lox_main()
+        -> void;
+
+    // Must be called before running the program.
+    auto lox_rt_init()
+        -> void;
+
+    // Must be called after the program ended.
+    auto lox_rt_shutdown()
+        -> void;
+
+    // Write the output of the print statements of the thread (see output.hpp) to stdout. Called
+    // before anything else writes to stdout.
+    auto lox_flush()
+        -> void;
+
+
+    // Print statement of the compiled code.
+    auto lox_print(lox::u64 value)
+        -> void;
+
+    // Slow path of +, when the operands are not both numbers: concatenate two strings.
+    auto lox_add(lox::u64 left, lox::u64 right, lox::u32 line)
+        -> lox::u64;
+
+    // Slow path of ==, when the operands are different objects: 1 if they are strings with the
+    // same chars, 0 otherwise.
+    auto lox_equal(lox::u64 left, lox::u64 right)
+        -> lox::u32;
+
+    // Allocate an instance of the class, without fields.
+    auto lox_instance_new(lox::LoxClass* klass)
+        -> lox::u64;
+
+    // Slow paths of the inline caches (see shape.hpp), called when the first entry misses.
+    // They check the other entries, then look up the property and update the cache.
+
+    auto lox_get_property(lox::u64 object, lox::InlineCache* cache, lox::u32 line)
+        -> lox::u64;
+
+    auto lox_set_property(lox::u64 object, lox::u64 value, lox::InlineCache* cache, lox::u32 line)
+        -> void;
+
+    // Return the function of the method called with argc arguments (without this).
+    auto lox_find_method(lox::u64 object, lox::InlineCache* cache, lox::u32 argc, lox::u32 line)
+        -> const void*;
+
+    // Return the function of the method of the superclass of the class (super.name()).
+    auto lox_find_super_method(lox::LoxClass* klass, const char* name, lox::u32 argc, lox::u32 line)
+        -> const void*;
+
+    // Allocate a closure of the function, its count captured values are set by the caller.
+    auto lox_closure_new(const void* function, const char* name, lox::u32 arity, lox::u32 count)
+        -> lox::u64;
+
+    // Allocate the box of a shared variable, holding the value.
+    auto lox_box_new(lox::u64 value)
+        -> lox::u64;
+
+    // Allocate a list of the count values (see list_object.hpp).
+    auto lox_list_new(const lox::u64* values, lox::u32 count)
+        -> lox::u64;
+
+    // append(list, value): add the value at the end of the list, return nil.
+    auto lox_list_append(lox::u64 list, lox::u64 value, lox::u32 line)
+        -> lox::u64;
+
+    // len(value): the number of elements of a list, of keys of a map or of chars of a string.
+    // The generated code reads the length of the lists inline.
+    auto lox_len(lox::u64 value, lox::u32 line)
+        -> lox::u64;
+
+    // Error of the indexing of a value that is not a list or a map, or of a list with an index
+    // that is not an integer within its length: report it and exit.
+    [[noreturn]] auto lox_index_error(lox::u64 object, lox::u64 index, lox::u32 line)
+        -> void;
+
+    // Slow path of object[index], when the object is not a list or the index is not within its
+    // length: the value of a key of a map (see map_object.hpp), or the error.
+    auto lox_index_get(lox::u64 object, lox::u64 index, lox::u32 line)
+        -> lox::u64;
+
+    // Slow path of object[index] = value.
+    auto lox_index_set(lox::u64 object, lox::u64 index, lox::u64 value, lox::u32 line)
+        -> void;
+
+    // map(): a new empty map.
+    auto lox_map_new()
+        -> lox::u64;
+
+    // has(map, key): true if the map has the key.
+    auto lox_map_has(lox::u64 map, lox::u64 key, lox::u32 line)
+        -> lox::u64;
+
+    // remove(map, key): remove the key, true if the map had it.
+    auto lox_map_remove(lox::u64 map, lox::u64 key, lox::u32 line)
+        -> lox::u64;
+
+    // keys(map): a list of the keys of the map, in no particular order.
+    auto lox_map_keys(lox::u64 map, lox::u32 line)
+        -> lox::u64;
+
+    // Slow path of the call of a value that is not a closure with argc parameters: report the
+    // error and exit.
+    [[noreturn]] auto lox_call_error(lox::u64 callee, lox::u32 argc, lox::u32 line)
+        -> void;
+
+    // Report a runtime error and exit.
+    [[noreturn]] auto lox_error(const char* msg, lox::u32 line)
+        -> void;
+
+
+    // Print a value of the interpreters, one function for each type of value.
+
+    auto lox_print_number(double value)
+        -> void;
+
+    auto lox_print_bool(bool value)
+        -> void;
+
+    // nil is the null pointer.
+    auto lox_print_string(const char* value)
+        -> void;
+
+    // A string that is not null terminated.
+    auto lox_print_chars(const char* value, lox::u64 length)
+        -> void;
+}
+
+#endif
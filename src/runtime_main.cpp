@@ -0,0 +1,20 @@
+// Entry point of the executables built by `lox build`. Not linked in the lox executable.
+
+#include "runtime.hpp"
+#include "gc.hpp"
+
+#include <cstdlib>
+
+int main()
+{
+    lox_rt_init();
+    lox_main();
+    lox_rt_shutdown();
+
+    // Statistics of the garbage collector, like `lox run --gc-stats`.
+    if (std::getenv("LOX_GC_STATS"))
+    {
+        lox_gc_report();
+    }
+    return 0;
+}
@@ -166,6 +166,8 @@ namespace lox
             case ')': return MakeToken(TokenType::RightParen);
             case '{': return MakeToken(TokenType::LeftBrace);
             case '}': return MakeToken(TokenType::RightBrace);
+            case '[': return MakeToken(TokenType::LeftBracket);
+            case ']': return MakeToken(TokenType::RightBracket);
             case ';': return MakeToken(TokenType::Semicolon);
             case ',': return MakeToken(TokenType::Comma);
             case '.': return MakeToken(TokenType::Dot);
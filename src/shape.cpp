@@ -0,0 +1,76 @@
+#include "shape.hpp"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace lox
+{
+    auto InternSymbol(std::string_view name)
+        -> Symbol
+    {
+        // The nodes of the set are stable: the symbols are never freed.
+        static std::unordered_set<std::string> symbols;
+        return &*symbols.emplace(name).first;
+    }
+
+
+    auto Shape::Add(Symbol name)
+        -> Shape*
+    {
+        auto& child = transitions[name];
+        if (!child)
+        {
+            child = std::make_unique<Shape>(klass, capacity);
+            child->slots = slots;
+            child->slots.emplace(name, Count());
+        }
+        return child.get();
+    }
+
+
+    auto ClassInfo::Of(LoxClass& klass)
+        -> ClassInfo&
+    {
+        // Never freed, like the shapes.
+        if (!klass.info)
+        {
+            klass.info = new ClassInfo(klass);
+        }
+        return *klass.info;
+    }
+
+
+    ClassInfo::ClassInfo(LoxClass& klass) :
+        name(klass.name)
+    {
+        u32 capacity = klass.fields;
+        if (klass.superclass)
+        {
+            superclass = &Of(*klass.superclass);
+            methods = superclass->methods;
+            capacity += superclass->Root().Capacity();
+        }
+
+        for (u32 i = 0; i < klass.method_count; ++i)
+        {
+            const auto& method = klass.methods[i];
+            methods[InternSymbol(method.name)] = Method{method.function, static_cast<u32>(method.arity)};
+        }
+
+        roots.push_back(std::make_unique<Shape>(*this, std::clamp(capacity, min_capacity, max_capacity)));
+    }
+
+
+    auto ClassInfo::Overflow(const Shape& shape, u32 count)
+        -> void
+    {
+        // Grow once for each capacity: the instances of the older roots overflow anyway.
+        auto capacity = Root().Capacity();
+        if (shape.Capacity() != capacity || capacity == max_capacity)
+        {
+            return;
+        }
+        capacity = std::min(max_capacity, std::max(2 * capacity, count));
+        roots.push_back(std::make_unique<Shape>(*this, capacity));
+    }
+} // namespace lox
@@ -0,0 +1,242 @@
+#ifndef LOX_SHAPE_HPP
+#define LOX_SHAPE_HPP
+
+/*
+shape.hpp
+
+PURPOSE: Hidden classes of the instances and inline caches of the property accesses.
+
+CLASSES:
+    Shape: Layout of the fields of a set of instances (a hidden class).
+    ClassInfo: State of a class at run time: methods, shapes and capacity of the instances.
+    InlineCache: Cache of a property access or method call of the generated code.
+
+DESCRIPTION:
+    The instances of a class that got the same fields in the same order share a shape, which
+    maps each field to its slot. The shapes form a tree for each class: the root has no fields
+    and each child adds one (a transition), so the shape of an instance is found by following
+    the fields as they are set, and the slot of a field never changes. The shapes are never
+    freed, so a pointer to a shape identifies it forever.
+
+    Slack tracking: a new instance has room for capacity inline fields, starting from the
+    number of the fields its class (and the superclasses) assign through this. The fields after
+    them go to the overflow slots; when an instance overflows, the class grows the capacity of
+    the next instances (up to max_capacity), with a new root shape: each tree of shapes has a
+    single capacity.
+
+    The property names are interned in a table of symbols, so they are compared by address.
+
+    Inline caches: each get, set and method call of the generated code has an InlineCache, with
+    up to size entries (shape, target, offset):
+        - get: the field is at offset bytes from the instance.
+        - set: the field is at offset, and target is the shape after the store (the same shape
+          if the field exists, its transition if it is added).
+        - method call: target is the function of the method.
+    Only the fields stored inline are cached. The generated code checks the first entry
+    inline (monomorphic) and calls the runtime on a miss, which checks the others (polymorphic),
+    then does the full lookup and adds it as the first entry (the last one is dropped when the
+    cache is full). The layout of InlineCache is shared with LLVMVisitor.
+*/
+
+#include "common.hpp"
+#include "value.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace lox
+{
+    // Interned property name.
+    using Symbol = const std::string*;
+
+    auto InternSymbol(std::string_view name)
+        -> Symbol;
+
+
+    class Shape : private NonCopyable
+    {
+    public:
+        // Root shape: no fields and capacity inline slots.
+        Shape(ClassInfo& klass_, u32 capacity_) :
+            klass(klass_), capacity(capacity_) { }
+
+        // Slot of the field, if the instances of the shape have it.
+        auto Find(Symbol name) const
+            -> std::optional<u32>
+        {
+            auto it = slots.find(name);
+            return it == slots.end() ? std::nullopt : std::optional<u32>{it->second};
+        }
+
+        // Shape with the field added after the fields of this one (created the first time).
+        auto Add(Symbol name)
+            -> Shape*;
+
+        auto Count() const noexcept
+            -> u32
+        {
+            return static_cast<u32>(slots.size());
+        }
+
+        auto Capacity() const noexcept
+            -> u32
+        {
+            return capacity;
+        }
+
+        auto Class() const noexcept
+            -> ClassInfo&
+        {
+            return klass;
+        }
+
+    private:
+        ClassInfo& klass;
+        u32 capacity;
+
+        // Field -> slot, for all the fields of the shape.
+        std::unordered_map<Symbol, u32> slots;
+        std::unordered_map<Symbol, std::unique_ptr<Shape>> transitions;
+    };
+
+
+    struct Method
+    {
+        const void* function;
+        u32 arity;
+    };
+
+
+    class ClassInfo : private NonCopyable
+    {
+    public:
+        static constexpr u32 min_capacity = 4;
+        static constexpr u32 max_capacity = 64;
+
+        // The info of the class, created the first time.
+        static auto Of(LoxClass& klass)
+            -> ClassInfo&;
+
+        auto Name() const noexcept
+            -> std::string_view
+        {
+            return name;
+        }
+
+        auto Superclass() const noexcept
+            -> ClassInfo*
+        {
+            return superclass;
+        }
+
+        // The method of the class or of a superclass, or nullptr.
+        auto FindMethod(Symbol method) const
+            -> const Method*
+        {
+            auto it = methods.find(method);
+            return it == methods.end() ? nullptr : &it->second;
+        }
+
+        // Shape of the new instances.
+        auto Root() const noexcept
+            -> Shape&
+        {
+            return *roots.back();
+        }
+
+        // An instance of the shape needs count fields, more than its capacity.
+        auto Overflow(const Shape& shape, u32 count)
+            -> void;
+
+    private:
+        explicit ClassInfo(LoxClass& klass);
+
+    private:
+        std::string_view name;
+        ClassInfo* superclass{nullptr};
+
+        // The methods of the superclasses are copied, the class overrides them.
+        std::unordered_map<Symbol, Method> methods;
+
+        // One root for each capacity, the last one is used by the new instances. The old ones
+        // are kept for the instances that use them.
+        std::vector<std::unique_ptr<Shape>> roots;
+    };
+
+
+    struct InlineCache
+    {
+        static constexpr u32 size = 4;
+
+        struct Entry
+        {
+            // Null if the entry is empty.
+            const Shape* shape;
+            const void* target;
+            u64 offset;
+        };
+
+        Entry entries[size];
+
+        // Null terminated, set by LLVMVisitor.
+        const char* name;
+
+        // Interned name, null until the first miss.
+        Symbol symbol;
+
+        auto Name()
+            -> Symbol
+        {
+            if (!symbol)
+            {
+                symbol = InternSymbol(name);
+            }
+            return symbol;
+        }
+
+        auto Find(const Shape* shape) const noexcept
+            -> const Entry*
+        {
+            for (const auto& entry : entries)
+            {
+                if (entry.shape == shape)
+                {
+                    return &entry;
+                }
+            }
+            return nullptr;
+        }
+
+        // Add the entry first, dropping the last one.
+        auto Insert(const Entry& entry) noexcept
+            -> void
+        {
+            for (u32 i = size - 1; i > 0; --i)
+            {
+                entries[i] = entries[i - 1];
+            }
+            entries[0] = entry;
+        }
+    };
+
+    // Offsets used by the generated code.
+    static_assert(offsetof(InlineCache, entries) == 0);
+    static_assert(sizeof(InlineCache::Entry) == 24);
+    static_assert(offsetof(InlineCache, name) == InlineCache::size * sizeof(InlineCache::Entry));
+    static_assert(offsetof(ObjInstance, shape) == 8);
+
+
+    // Offset in bytes of the inline slot from the start of the instance.
+    constexpr auto SlotOffset(u32 slot) noexcept
+        -> u64
+    {
+        return sizeof(ObjInstance) + slot * sizeof(u64);
+    }
+} // namespace lox
+
+#endif
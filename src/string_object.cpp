@@ -0,0 +1,169 @@
+#include "string_object.hpp"
+#include "gc.hpp"
+
+#include <cstring>
+#include <vector>
+
+namespace lox
+{
+    static auto AsRope(LoxValue value) noexcept
+        -> ObjRope*
+    {
+        return reinterpret_cast<ObjRope*>(const_cast<Obj*>(value.AsObject()));
+    }
+
+
+    // The chars of a flat string or of a flattened rope, null for a rope not flattened.
+    static auto FlatChars(LoxValue value) noexcept
+        -> const char*
+    {
+        return reinterpret_cast<const ObjString*>(value.AsObject())->chars;
+    }
+
+
+    // A flat string of length chars, not initialized.
+    static auto NewString(u32 length)
+        -> ObjString*
+    {
+        auto object = reinterpret_cast<ObjString*>(GlobalHeap().Allocate(ObjType::String,
+            sizeof(ObjString) + length));
+        object->length = length;
+        object->chars = reinterpret_cast<char*>(object + 1);
+        return object;
+    }
+
+
+    auto StringLength(LoxValue value) noexcept
+        -> u32
+    {
+        if (value.IsSmallString())
+        {
+            return value.SmallLength();
+        }
+        return reinterpret_cast<const ObjString*>(value.AsObject())->length;
+    }
+
+
+    auto CopyChars(LoxValue value, char* out)
+        -> void
+    {
+        // The right children still to copy: the left child is copied first.
+        std::vector<u64> pending;
+        while (true)
+        {
+            if (value.IsSmallString())
+            {
+                auto chars = value.AsString();
+                std::memcpy(out, chars.data(), chars.size());
+                out += chars.size();
+            }
+            else if (auto chars = FlatChars(value))
+            {
+                auto length = StringLength(value);
+                std::memcpy(out, chars, length);
+                out += length;
+            }
+            else
+            {
+                auto rope = AsRope(value);
+                pending.push_back(rope->right);
+                value = LoxValue{rope->left};
+                continue;
+            }
+
+            if (pending.empty())
+            {
+                return;
+            }
+            value = LoxValue{pending.back()};
+            pending.pop_back();
+        }
+    }
+
+
+    auto CopyString(LoxValue value)
+        -> std::string
+    {
+        std::string s(StringLength(value), '\0');
+        CopyChars(value, s.data());
+        return s;
+    }
+
+
+    auto StringChars(const LoxValue& value)
+        -> std::string_view
+    {
+        if (value.IsSmallString() || FlatChars(value))
+        {
+            return value.AsString();
+        }
+
+        auto rope = AsRope(value);
+        auto flat = NewString(rope->string.length);
+        CopyChars(value, const_cast<char*>(flat->chars));
+        rope->string.chars = flat->chars;
+        rope->left = LoxValue::Object(&flat->obj).Bits();
+        rope->right = LoxValue::nil_bits;
+        // An old rope now refers to a young string.
+        GlobalHeap().Remember(&rope->string.obj);
+        return value.AsString();
+    }
+
+
+    auto Concatenate(LoxValue left, LoxValue right)
+        -> LoxValue
+    {
+        auto left_length = StringLength(left);
+        auto right_length = StringLength(right);
+        if (left_length == 0)
+        {
+            return right;
+        }
+        if (right_length == 0)
+        {
+            return left;
+        }
+
+        auto length = left_length + right_length;
+        if (length <= LoxValue::small_string_max)
+        {
+            char chars[LoxValue::small_string_max];
+            CopyChars(left, chars);
+            CopyChars(right, chars + left_length);
+            return LoxValue::SmallString(std::string_view{chars, length});
+        }
+        if (length < rope_min_length)
+        {
+            // Both operands are short, so they are not ropes.
+            auto object = NewString(length);
+            auto chars = const_cast<char*>(object->chars);
+            CopyChars(left, chars);
+            CopyChars(right, chars + left_length);
+            return LoxValue::Object(&object->obj);
+        }
+
+        auto rope = reinterpret_cast<ObjRope*>(GlobalHeap().Allocate(ObjType::Rope, sizeof(ObjRope)));
+        rope->string.length = length;
+        rope->string.chars = nullptr;
+        rope->left = left.Bits();
+        rope->right = right.Bits();
+        return LoxValue::Object(&rope->string.obj);
+    }
+
+
+    auto StringsEqual(LoxValue left, LoxValue right)
+        -> bool
+    {
+        if (left.Bits() == right.Bits())
+        {
+            return true;
+        }
+        // Two small strings with different bits are different.
+        if (!left.IsString() || !right.IsString() || (left.IsSmallString() && right.IsSmallString()) ||
+            StringLength(left) != StringLength(right))
+        {
+            return false;
+        }
+        return StringChars(left) == StringChars(right);
+    }
+} // namespace lox
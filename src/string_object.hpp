@@ -0,0 +1,69 @@
+#ifndef LOX_STRING_OBJECT_HPP
+#define LOX_STRING_OBJECT_HPP
+
+/*
+string_object.hpp
+
+PURPOSE: Strings of the compiled code: small strings, flat strings and ropes.
+
+CLASSES:
+
+DESCRIPTION:
+    A string value has one of three representations (see value.hpp), chosen by its length, so
+    each string has a single one:
+    - up to LoxValue::small_string_max chars: a small string, its chars inside the value. Small
+      strings are never allocated and are equal if their bits are equal, like the numbers.
+    - up to rope_min_length chars: a flat ObjString, its chars follow the object (a single
+      allocation). The string literals are constant ObjString emitted by LLVMVisitor.
+    - longer concatenations: an ObjRope, which points to the two strings concatenated.
+
+    Ropes: a + b allocates a node of fixed size instead of copying the chars, so building a
+    string in a loop (s = s + x) is linear. The rope is flattened the first time its chars are
+    needed (print, comparison): the chars are copied once into a flat string that replaces the
+    children of the rope, and the later uses of the rope (or of a longer rope built on it) copy
+    them directly. The ropes are traversed without recursion, so the long chains of a loop
+    don't overflow the stack.
+
+    Equality: the strings are equal if their bits are (the same object, or the same small
+    string). Otherwise the lengths are compared, then the chars: the slow path of == of the
+    generated code, only called when both operands are objects.
+*/
+
+#include "common.hpp"
+#include "value.hpp"
+
+#include <string>
+#include <string_view>
+
+namespace lox
+{
+    // Concatenations of at least rope_min_length chars are ropes.
+    constexpr u32 rope_min_length = 64;
+
+    // Length of the string value.
+    auto StringLength(LoxValue value) noexcept
+        -> u32;
+
+    // Copy the StringLength() chars of the string to out, without flattening the ropes.
+    auto CopyChars(LoxValue value, char* out)
+        -> void;
+
+    auto CopyString(LoxValue value)
+        -> std::string;
+
+    // The chars of the string (valid while the value lives), the rope is flattened. Can run a
+    // collection: the string must be reachable from the roots.
+    auto StringChars(const LoxValue& value)
+        -> std::string_view;
+
+    // Concatenation of the strings. Can run a collection: the operands must be reachable from
+    // the roots.
+    auto Concatenate(LoxValue left, LoxValue right)
+        -> LoxValue;
+
+    // True if the values are strings with the same chars. Can flatten the ropes.
+    auto StringsEqual(LoxValue left, LoxValue right)
+        -> bool;
+} // namespace lox
+
+#endif
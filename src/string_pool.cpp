@@ -0,0 +1,155 @@
+#include "string_pool.hpp"
+
+#include <algorithm>
+#include <new>
+
+namespace lox
+{
+    auto StringPool::Intern(std::string_view s)
+        -> StringId
+    {
+        if (auto it = ids.find(s); it != ids.end())
+        {
+            return StringId{it->second};
+        }
+
+        auto stored = Allocate(s);
+        auto id = static_cast<u32>(strings.size());
+        strings.emplace_back(stored);
+        ids.emplace(stored, id);
+        return StringId{id};
+    }
+
+
+    auto StringPool::Allocate(std::string_view s)
+        -> std::string_view
+    {
+        if (s.empty())
+        {
+            return {};
+        }
+
+        if (s.size() > free_size)
+        {
+            // Strings bigger than a block get a block of their own. The free space of the
+            // current block is kept for the next strings.
+            if (s.size() > block_size / 4)
+            {
+                auto& block = blocks.emplace_back(std::make_unique<char[]>(s.size()));
+                allocated += s.size();
+                std::copy(s.begin(), s.end(), block.get());
+                return std::string_view{block.get(), s.size()};
+            }
+
+            auto& block = blocks.emplace_back(std::make_unique<char[]>(block_size));
+            allocated += block_size;
+            free_begin = block.get();
+            free_size = block_size;
+        }
+
+        auto begin = free_begin;
+        std::copy(s.begin(), s.end(), begin);
+        free_begin += s.size();
+        free_size -= s.size();
+        return std::string_view{begin, s.size()};
+    }
+
+
+    auto RuntimeStrings::Intern(std::string_view s)
+        -> StringId
+    {
+        if (auto id = literals->Find(s))
+        {
+            return *id;
+        }
+        nodes.push_back(Node{leaf, leaves.Intern(s).value, s.size()});
+        return StringId{static_cast<u32>(first + nodes.size() - 1)};
+    }
+
+
+    auto RuntimeStrings::Concatenate(StringId left, StringId right)
+        -> StringId
+    {
+        auto left_length = Length(left);
+        auto right_length = Length(right);
+        if (left_length == 0)
+        {
+            return right;
+        }
+        if (right_length == 0)
+        {
+            return left;
+        }
+        if (first + nodes.size() >= leaf)
+        {
+            throw std::bad_alloc{};
+        }
+        nodes.push_back(Node{left.value, right.value, left_length + right_length});
+        return StringId{static_cast<u32>(first + nodes.size() - 1)};
+    }
+
+
+    auto RuntimeStrings::Chars(StringId id)
+        -> std::string_view
+    {
+        if (id.value < first)
+        {
+            return literals->Get(id);
+        }
+        Flatten(id, chars);
+        return chars;
+    }
+
+
+    auto RuntimeStrings::Equal(StringId left, StringId right)
+        -> bool
+    {
+        if (left == right)
+        {
+            return true;
+        }
+        if ((left.value < first && right.value < first) || Length(left) != Length(right))
+        {
+            return false;
+        }
+        Flatten(left, chars);
+        Flatten(right, other_chars);
+        return chars == other_chars;
+    }
+
+
+    auto RuntimeStrings::Length(StringId id) const noexcept
+        -> u64
+    {
+        return id.value < first ? literals->Get(id).size() : nodes[id.value - first].length;
+    }
+
+
+    auto RuntimeStrings::Flatten(StringId id, std::string& out)
+        -> void
+    {
+        out.clear();
+        out.reserve(Length(id));
+        // The parts left to copy, the next one last: a string built in a loop is as deep as
+        // the loop is long.
+        pending.assign(1, id.value);
+        while (!pending.empty())
+        {
+            auto part = pending.back();
+            pending.pop_back();
+            if (part < first)
+            {
+                out.append(literals->Get(StringId{part}));
+                continue;
+            }
+            const auto& node = nodes[part - first];
+            if (node.left == leaf)
+            {
+                out.append(leaves.Get(StringId{node.right}));
+                continue;
+            }
+            pending.push_back(node.right);
+            pending.push_back(node.left);
+        }
+    }
+} // namespace lox
@@ -0,0 +1,167 @@
+#ifndef LOX_STRING_POOL_HPP
+#define LOX_STRING_POOL_HPP
+
+/*
+string_pool.hpp
+
+PURPOSE: Deduplicate the string literals of the program.
+
+CLASSES:
+    StringId: Id of a string inside the pool.
+    StringPool: Arena of unique strings.
+
+DESCRIPTION:
+    The parser interns every string literal (without the quotes) and the AST stores only the
+    4 bytes id. Equal literals share the same id, so the backends can emit each unique string
+    constant once.
+    The characters are copied into big blocks of memory that are never moved or freed until the
+    pool is destroyed, so the string_view returned by Get() is valid for the lifetime of the pool.
+    The interpreter and the VM intern the strings they build in a RuntimeStrings, which extends
+    the pool of the literals without writing it.
+*/
+
+#include "common.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+namespace lox
+{
+    struct StringId
+    {
+        u32 value{0};
+
+        friend constexpr auto operator==(StringId, StringId) noexcept
+            -> bool = default;
+    };
+
+
+    class StringPool : private NonCopyable
+    {
+    public:
+        // Return the id of the string, copying it inside the pool if it is not already present.
+        auto Intern(std::string_view s)
+            -> StringId;
+
+        auto Get(StringId id) const noexcept
+            -> std::string_view
+        {
+            return strings[id.value];
+        }
+
+        // Return the id of the string if it is in the pool.
+        auto Find(std::string_view s) const
+            -> std::optional<StringId>
+        {
+            auto it = ids.find(s);
+            if (it == ids.end())
+            {
+                return std::nullopt;
+            }
+            return StringId{it->second};
+        }
+
+        // Number of unique strings.
+        auto Size() const noexcept
+            -> std::size_t
+        {
+            return strings.size();
+        }
+
+        // Memory allocated for the characters of the strings.
+        auto Bytes() const noexcept
+            -> std::size_t
+        {
+            return allocated;
+        }
+
+    private:
+        // Copy the string inside the arena.
+        auto Allocate(std::string_view s)
+            -> std::string_view;
+
+    private:
+        static constexpr std::size_t block_size = 4096;
+
+        std::vector<std::unique_ptr<char[]>> blocks;
+
+        // Free space in the last block.
+        non_owned_ptr<char> free_begin{nullptr};
+        std::size_t free_size{0};
+
+        std::size_t allocated{0};
+
+        // Indexed by StringId.
+        std::vector<std::string_view> strings;
+
+        // The keys point inside the arena.
+        std::unordered_map<std::string_view, u32> ids;
+    };
+
+
+    // The strings built by the interpreter and the VM: the literals keep their ids and a new
+    // string gets an id after them. A concatenation is a node with the ids of its two parts, so
+    // building a string in a loop doesn't copy it (like the ropes of the compiled code, see
+    // string_object.hpp); the chars are copied when the string is printed or compared. The
+    // strings are never freed. The pool of the literals is only read: the background compiler
+    // reads it at the same time.
+    class RuntimeStrings : private NonCopyable
+    {
+    public:
+        explicit RuntimeStrings(non_owned_ptr<const StringPool> literals_) :
+            literals(literals_), first(static_cast<u32>(literals_->Size())) { }
+
+        // A string with the chars (the id of the literal if there is one).
+        auto Intern(std::string_view s)
+            -> StringId;
+
+        // The id of left + right.
+        auto Concatenate(StringId left, StringId right)
+            -> StringId;
+
+        // The chars of the string, valid until the next call.
+        auto Chars(StringId id)
+            -> std::string_view;
+
+        // Different ids can have the same chars, unless both are literals.
+        auto Equal(StringId left, StringId right)
+            -> bool;
+
+    private:
+        auto Length(StringId id) const noexcept
+            -> u64;
+
+        // Copy the chars of the string in out.
+        auto Flatten(StringId id, std::string& out)
+            -> void;
+
+    private:
+        // Concatenation of two strings, or a string interned in leaves (left == leaf).
+        struct Node
+        {
+            u32 left;
+            u32 right;
+            u64 length;
+        };
+
+        static constexpr u32 leaf = UINT32_MAX;
+
+        non_owned_ptr<const StringPool> literals;
+        u32 first;
+
+        // Indexed by id - first.
+        std::vector<Node> nodes;
+        StringPool leaves;
+
+        // Reused by Flatten().
+        std::vector<u32> pending;
+        std::string chars;
+        std::string other_chars;
+    };
+} // namespace lox
+
+#endif
@@ -25,6 +25,7 @@ namespace lox
         // Single-character tokens.
         LeftParen, RightParen,
         LeftBrace, RightBrace,
+        LeftBracket, RightBracket,
         Comma, Dot, Minus, Plus,
         Semicolon, Slash, Star,
         // One or two character tokens.
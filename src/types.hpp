@@ -11,6 +11,7 @@ PURPOSE: Define the primitive Lox types.
 #include <variant>
 
 #include "common.hpp"
+#include "string_pool.hpp"
 
 
 namespace lox
@@ -36,7 +37,51 @@ namespace lox
     };
 
     // A literal in lox is a string, double, nil or bool. 
-    using Literal = std::variant<LoxNil, std::string, f64, bool>;
+    // Strings are stored inside the StringPool used by the parser.
+    using Literal = std::variant<LoxNil, StringId, f64, bool>;
+
+    static_assert(sizeof(Literal) == 16, "Literal must stay as small as a double plus the tag.");
+
+
+    // Lox truthiness: nil and false are false, everything else is true.
+    inline auto IsTruthy(const Literal& value) noexcept
+        -> bool
+    {
+        if (std::holds_alternative<LoxNil>(value))
+        {
+            return false;
+        }
+        if (auto b = std::get_if<bool>(&value))
+        {
+            return *b;
+        }
+        return true;
+    }
+
+
+    // Values of different types are different. Strings are interned, so equal strings have
+    // the same id.
+    inline auto Equal(const Literal& v1, const Literal& v2) noexcept
+        -> bool
+    {
+        if (v1.index() != v2.index())
+        {
+            return false;
+        }
+        if (std::holds_alternative<LoxNil>(v1))
+        {
+            return true;
+        }
+        if (auto id = std::get_if<StringId>(&v1))
+        {
+            return *id == std::get<StringId>(v2);
+        }
+        if (auto b = std::get_if<bool>(&v1))
+        {
+            return *b == std::get<bool>(v2);
+        }
+        return std::get<f64>(v1) == std::get<f64>(v2);
+    }
 } // namespace lox
 
 
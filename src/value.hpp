@@ -0,0 +1,518 @@
+#ifndef LOX_VALUE_HPP
+#define LOX_VALUE_HPP
+
+/*
+value.hpp
+
+PURPOSE: Representation of the Lox values in the compiled code (NaN boxing).
+
+CLASSES:
+    LoxValue: 64 bit value: a double, or a tagged nil, boolean, small string or object pointer.
+    ObjType: Type of a heap object.
+    Obj: Header of the heap objects.
+    ObjString: String object.
+    ObjRope: Concatenation of two strings, flattened when its chars are needed.
+    ObjInstance: Instance of a class, with its fields inline.
+    ObjSlots: Fields of an instance that don't fit inline, or the box of a shared variable.
+    ObjClosure: Function value: a function with the values it captured.
+    ObjList: List, its elements in an ObjSlots of numbers (Doubles) or of any values (Slots).
+    ObjMap: Hash map, its entries in an ObjTable.
+    ObjTable: Open addressing hash table of a map: control bytes and key/value entries.
+    LoxClass: Descriptor of a class, emitted by LLVMVisitor.
+
+DESCRIPTION:
+    A double is stored as it is. The other values are hidden inside the space of the quiet NaNs:
+    all the bits of qnan are set (the exponent, the quiet bit and one more bit, so the NaN
+    produced by the hardware is still a number).
+    - nil, false and true have the qnan bits and a small tag in the low bits;
+    - a string of up to small_string_max chars (a small string) has the qnan bits, bit 47, its
+      length in bits 40-42 and its chars in the low 40 bits;
+    - an object pointer has the qnan bits, the sign bit and the 48 bits of the address.
+    So a value is a number if (bits & qnan) != qnan, the check inlined by LLVMVisitor before
+    every arithmetic operation, and no value needs a heap allocation except the objects.
+    The layout of the objects is shared with the code generated by LLVMVisitor, which emits
+    the string literals as small strings or constant ObjString and the classes as LoxClass. The
+    other objects are allocated by the garbage collected Heap (gc.hpp).
+
+    A string is a small string if it is short enough, so two small strings are equal if their
+    bits are. The longer strings are ObjString, or ObjRope for the long concatenations (see
+    string_object.hpp).
+
+    An instance has a shape (shape.hpp) that maps the names of its fields to slots: the first
+    capacity slots are inline after the instance, at a fixed offset, the others in the overflow
+    ObjSlots. The generated code loads the shape at offset 8 of any object and compares it with
+    its inline caches: the chars of a string and the function of a closure are never a shape,
+    so it doesn't check the type.
+
+    A closure (see closure_analysis.hpp) is a function of the generated code that takes the
+    closure as first argument, followed by the arguments of the call, and finds the values it
+    captured after it. The global functions used as values are constant closures. The calls of
+    unknown closures check the type and the arity together, with one load of the first 8 bytes.
+
+    A list (see list_object.hpp) points to the buffer of its elements, an ObjSlots whose type
+    is its storage: Doubles while every element is a number (the GC doesn't scan it, and the
+    fast copies of the loops read the doubles directly, without checks), Slots once an element
+    is not. The buffer is never null, and offset 8 of a list is the buffer, never a shape.
+
+    A map (see map_object.hpp) points to its table, an ObjTable with a control byte for each
+    entry followed by the entries (key and value). Like the buffer of a list, the table is never
+    null, and offset 8 of a map is the table, never a shape.
+*/
+
+#include "common.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <string_view>
+
+namespace lox
+{
+    enum class ObjType : u8
+    {
+        // The value of a class is the closure of its constructor (a constant ObjClosure) with
+        // the type Class. The calls of the closures accept both: they differ in the lowest bit.
+        Closure,
+        Class,
+
+        String,
+        Instance,
+        Slots,
+        Rope,
+        List,
+
+        // An ObjSlots holding only numbers.
+        Doubles,
+
+        Map,
+        Table,
+
+        // Free bytes of a block of the heap (ObjFree), never a value.
+        Free,
+    };
+
+
+    struct Obj
+    {
+        // Bits of gc.
+        static constexpr u8 gc_marked = 1;
+        static constexpr u8 gc_heap = 2;     // Allocated by the Heap (not a constant).
+        static constexpr u8 gc_large = 4;    // Allocated individually (see gc.hpp).
+        static constexpr u8 gc_old = 8;      // In the old generation.
+        static constexpr u8 gc_remembered = 16;  // In the remembered set of the heap.
+
+        ObjType type;
+        u8 gc;
+    };
+
+
+    struct ObjString
+    {
+        Obj obj;
+        u32 length;
+
+        // Not null terminated. Null in a rope not flattened yet.
+        const char* chars;
+    };
+
+
+    // A run of free bytes in a block of the heap (see gc.hpp), so the block can be walked.
+    struct ObjFree
+    {
+        Obj obj;
+        u32 size;
+    };
+
+
+    struct ObjRope
+    {
+        // Its chars are the ones of the flat string, once the rope is flattened.
+        ObjString string;
+
+        // The strings concatenated (boxed). After the rope is flattened left is the flat
+        // string and right is nil, so the strings concatenated can be freed.
+        u64 left;
+        u64 right;
+    };
+
+    static_assert(offsetof(ObjRope, string) == 0);
+
+
+    class Shape;
+    class ClassInfo;
+
+
+    struct ObjSlots
+    {
+        Obj obj;
+        u32 capacity;
+
+        // The capacity values follow the object.
+        auto Values() noexcept
+            -> u64*
+        {
+            return reinterpret_cast<u64*>(this + 1);
+        }
+    };
+
+
+    struct ObjInstance
+    {
+        Obj obj;
+
+        // Number of the inline fields.
+        u32 capacity;
+        Shape* shape;
+
+        // Null until the instance has more fields than its capacity.
+        ObjSlots* overflow;
+
+        // The inline fields follow the object.
+        auto Fields() noexcept
+            -> u64*
+        {
+            return reinterpret_cast<u64*>(this + 1);
+        }
+    };
+
+    static_assert(sizeof(ObjInstance) == 24);
+
+
+    struct ObjClosure
+    {
+        Obj obj;
+
+        // Number of the captured values.
+        u16 count;
+        u32 arity;
+
+        // u64 (ObjClosure*, u64 x arity), with the fast calling convention.
+        const void* function;
+
+        // Null terminated.
+        const char* name;
+
+        // The captured values follow the object.
+        auto Captured() noexcept
+            -> u64*
+        {
+            return reinterpret_cast<u64*>(this + 1);
+        }
+    };
+
+    // Offsets used by the generated code.
+    static_assert(offsetof(ObjClosure, count) == 2);
+    static_assert(offsetof(ObjClosure, arity) == 4);
+    static_assert(offsetof(ObjClosure, function) == 8);
+    static_assert(sizeof(ObjClosure) == 24);
+    static_assert((static_cast<u8>(ObjType::Closure) | 1) == static_cast<u8>(ObjType::Class));
+    static_assert(sizeof(ObjSlots) == 8);
+
+
+    struct ObjList
+    {
+        Obj obj;
+        u32 length;
+
+        // Its capacity is at least length, the values after length are 0.
+        ObjSlots* elements;
+    };
+
+    static_assert(offsetof(ObjList, length) == 4);
+    static_assert(offsetof(ObjList, elements) == 8);
+    static_assert(sizeof(ObjList) == 16);
+
+
+    struct ObjTable
+    {
+        Obj obj;
+
+        // A power of two, a multiple of the size of a group of control bytes.
+        u32 capacity;
+
+        // Number of the empty entries that can still be used before the table is full.
+        u32 growth_left;
+
+        // Number of the entries removed but still in the probe sequences (tombstones).
+        u32 deleted;
+
+        // The capacity control bytes follow the object, then the capacity entries.
+        auto Control() noexcept
+            -> u8*
+        {
+            return reinterpret_cast<u8*>(this + 1);
+        }
+
+        // Key and value of each entry. The entries not in use are nil.
+        auto Entries() noexcept
+            -> u64*
+        {
+            return reinterpret_cast<u64*>(Control() + capacity);
+        }
+
+        // The control byte of an entry in use has the high bit clear (see map_object.hpp).
+        auto InUse(u32 i) noexcept
+            -> bool
+        {
+            return (Control()[i] & 0x80) == 0;
+        }
+    };
+
+    static_assert(sizeof(ObjTable) == 16);
+
+
+    struct ObjMap
+    {
+        Obj obj;
+
+        // Number of the entries in use.
+        u32 count;
+        ObjTable* table;
+    };
+
+    static_assert(offsetof(ObjMap, count) == 4);
+    static_assert(offsetof(ObjMap, table) == 8);
+    static_assert(sizeof(ObjMap) == 16);
+
+
+    struct ClassMethod
+    {
+        // Null terminated.
+        const char* name;
+        // Without this.
+        u64 arity;
+        const void* function;
+    };
+
+
+    struct LoxClass
+    {
+        // Null terminated.
+        const char* name;
+        LoxClass* superclass;
+        const ClassMethod* methods;
+        u32 method_count;
+
+        // Number of the fields the methods assign through this, the initial capacity.
+        u32 fields;
+
+        // State of the runtime, created the first time the class is used.
+        ClassInfo* info;
+    };
+
+
+    class LoxValue
+    {
+    public:
+        static constexpr u64 qnan = 0x7ffc000000000000;
+        static constexpr u64 sign_bit = 0x8000000000000000;
+
+        static constexpr u64 tag_nil = 1;
+        static constexpr u64 tag_false = 2;
+        static constexpr u64 tag_true = 3;
+
+        static constexpr u64 nil_bits = qnan | tag_nil;
+        static constexpr u64 false_bits = qnan | tag_false;
+        static constexpr u64 true_bits = qnan | tag_true;
+
+        // Bits set in all the object pointers.
+        static constexpr u64 object_bits = sign_bit | qnan;
+
+        // Bits set in all the small strings (checked with the sign bit).
+        static constexpr u64 small_string_bits = qnan | 0x0000800000000000;
+        static constexpr u32 small_string_max = 5;
+        static constexpr u32 small_length_shift = 40;
+
+
+        constexpr explicit LoxValue(u64 bits_ = nil_bits) noexcept : bits(bits_) { }
+
+        static constexpr auto Nil() noexcept
+            -> LoxValue
+        {
+            return LoxValue{nil_bits};
+        }
+
+        static constexpr auto Bool(bool b) noexcept
+            -> LoxValue
+        {
+            return LoxValue{b ? true_bits : false_bits};
+        }
+
+        static constexpr auto Number(f64 number) noexcept
+            -> LoxValue
+        {
+            return LoxValue{std::bit_cast<u64>(number)};
+        }
+
+        static auto Object(const Obj* obj) noexcept
+            -> LoxValue
+        {
+            return LoxValue{object_bits | reinterpret_cast<u64>(obj)};
+        }
+
+        // At most small_string_max chars.
+        static constexpr auto SmallString(std::string_view chars) noexcept
+            -> LoxValue
+        {
+            u64 bits = small_string_bits | (u64{chars.size()} << small_length_shift);
+            for (std::size_t i = 0; i < chars.size(); ++i)
+            {
+                bits |= u64{static_cast<u8>(chars[i])} << (8 * i);
+            }
+            return LoxValue{bits};
+        }
+
+
+        constexpr auto IsNumber() const noexcept
+            -> bool
+        {
+            return (bits & qnan) != qnan;
+        }
+
+        constexpr auto IsNil() const noexcept
+            -> bool
+        {
+            return bits == nil_bits;
+        }
+
+        constexpr auto IsBool() const noexcept
+            -> bool
+        {
+            // false and true differ only in the last bit.
+            return (bits | 1) == true_bits;
+        }
+
+        constexpr auto IsObject() const noexcept
+            -> bool
+        {
+            return (bits & object_bits) == object_bits;
+        }
+
+        constexpr auto IsSmallString() const noexcept
+            -> bool
+        {
+            return (bits & (sign_bit | small_string_bits)) == small_string_bits;
+        }
+
+        auto IsString() const noexcept
+            -> bool
+        {
+            return IsSmallString() || (IsObject() &&
+                (AsObject()->type == ObjType::String || AsObject()->type == ObjType::Rope));
+        }
+
+        auto IsInstance() const noexcept
+            -> bool
+        {
+            return IsObject() && AsObject()->type == ObjType::Instance;
+        }
+
+        auto IsClosure() const noexcept
+            -> bool
+        {
+            return IsObject() && AsObject()->type == ObjType::Closure;
+        }
+
+        auto IsClass() const noexcept
+            -> bool
+        {
+            return IsObject() && AsObject()->type == ObjType::Class;
+        }
+
+        auto IsList() const noexcept
+            -> bool
+        {
+            return IsObject() && AsObject()->type == ObjType::List;
+        }
+
+        auto IsMap() const noexcept
+            -> bool
+        {
+            return IsObject() && AsObject()->type == ObjType::Map;
+        }
+
+        // nil and false are false, everything else is true.
+        constexpr auto IsTruthy() const noexcept
+            -> bool
+        {
+            return bits != nil_bits && bits != false_bits;
+        }
+
+
+        constexpr auto AsNumber() const noexcept
+            -> f64
+        {
+            return std::bit_cast<f64>(bits);
+        }
+
+        constexpr auto AsBool() const noexcept
+            -> bool
+        {
+            return bits == true_bits;
+        }
+
+        auto AsObject() const noexcept
+            -> const Obj*
+        {
+            return reinterpret_cast<const Obj*>(bits & ~object_bits);
+        }
+
+        auto AsInstance() const noexcept
+            -> ObjInstance*
+        {
+            return reinterpret_cast<ObjInstance*>(bits & ~object_bits);
+        }
+
+        auto AsClosure() const noexcept
+            -> ObjClosure*
+        {
+            return reinterpret_cast<ObjClosure*>(bits & ~object_bits);
+        }
+
+        auto AsList() const noexcept
+            -> ObjList*
+        {
+            return reinterpret_cast<ObjList*>(bits & ~object_bits);
+        }
+
+        auto AsMap() const noexcept
+            -> ObjMap*
+        {
+            return reinterpret_cast<ObjMap*>(bits & ~object_bits);
+        }
+
+        // The chars of a small string are in the value: the view is valid while it lives. A
+        // rope must be flattened before (see string_object.hpp).
+        auto AsString() const noexcept
+            -> std::string_view
+        {
+            if (IsSmallString())
+            {
+                return std::string_view{reinterpret_cast<const char*>(&bits), SmallLength()};
+            }
+            auto s = reinterpret_cast<const ObjString*>(AsObject());
+            return std::string_view{s->chars, s->length};
+        }
+
+        constexpr auto SmallLength() const noexcept
+            -> u32
+        {
+            return static_cast<u32>(bits >> small_length_shift) & 7;
+        }
+
+
+        constexpr auto Bits() const noexcept
+            -> u64
+        {
+            return bits;
+        }
+
+    private:
+        u64 bits;
+    };
+
+    static_assert(sizeof(LoxValue) == 8);
+    // The chars of the small strings are the first bytes of the value.
+    static_assert(std::endian::native == std::endian::little);
+} // namespace lox
+
+#endif
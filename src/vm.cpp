@@ -0,0 +1,392 @@
+#include "vm.hpp"
+#include "runtime.hpp"
+
+#include <cstdio>
+#include <iostream>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOX_COMPUTED_GOTO 1
+#else
+#define LOX_COMPUTED_GOTO 0
+#endif
+
+namespace lox
+{
+    VM::VM(non_owned_ptr<const StringPool> strings_) :
+        strings(strings_),
+        stack(stack_min),
+        frames(frames_min)
+    {
+    }
+
+
+    auto VM::Grow(Literal*& sp)
+        -> bool
+    {
+        if (frame_count == frames.size())
+        {
+            if (frames.size() == frames_max)
+            {
+                return false;
+            }
+            frames.resize(frames.size() * 2);
+        }
+
+        auto used = static_cast<std::size_t>(sp - stack.data());
+        if (stack.size() - used < 256)
+        {
+            if (stack.size() == stack_max)
+            {
+                return false;
+            }
+            stack.resize(stack.size() * 2);
+            sp = stack.data() + used;
+        }
+        return true;
+    }
+
+
+    auto VM::RuntimeError(const CallFrame& frame, std::string_view msg)
+        -> void
+    {
+        lox_flush();
+        std::fflush(stdout);
+
+        // The ip is after the instruction that failed.
+        auto offset = static_cast<std::size_t>(frame.ip - frame.function->chunk.code.data()) - 1;
+        std::cout << "[line " << frame.function->chunk.lines[offset] << "] Error: " << msg << std::endl;
+        // The innermost calls: a stack overflow has up to frames_max of them.
+        constexpr std::size_t trace_max = 64;
+        for (auto i = frame_count; i > 1 && frame_count - i < trace_max; --i)
+        {
+            std::cout << "    in " << frames[i - 1].function->name << "()" << std::endl;
+        }
+        if (frame_count - 1 > trace_max)
+        {
+            std::cout << "    ... " << frame_count - 1 - trace_max << " more calls" << std::endl;
+        }
+    }
+
+
+    auto VM::Print(const Literal& value)
+        -> void
+    {
+        if (auto number = std::get_if<f64>(&value))
+        {
+            lox_print_number(*number);
+        }
+        else if (auto b = std::get_if<bool>(&value))
+        {
+            lox_print_bool(*b);
+        }
+        else if (auto id = std::get_if<StringId>(&value))
+        {
+            // The chars are not null terminated.
+            auto s = strings.Chars(*id);
+            lox_print_chars(s.data(), s.size());
+        }
+        else
+        {
+            lox_print_string(nullptr);
+        }
+    }
+
+
+    auto VM::Equal(const Literal& left, const Literal& right)
+        -> bool
+    {
+        auto left_id = std::get_if<StringId>(&left);
+        auto right_id = std::get_if<StringId>(&right);
+        return left_id && right_id ? strings.Equal(*left_id, *right_id) : lox::Equal(left, right);
+    }
+
+
+    auto VM::Run(const BytecodeProgram& program)
+        -> bool
+    {
+        std::vector<Literal> globals(program.globals.size());
+        std::vector<u8> defined_globals(program.globals.size(), 0);
+
+        std::vector<non_owned_ptr<const BytecodeFunction>> functions;
+        functions.reserve(program.functions.size());
+        for (const auto& function : program.functions)
+        {
+            functions.push_back(&function);
+        }
+        std::vector<u8> defined_functions(program.functions.size(), 0);
+
+        // The state of the current frame is kept in locals, so it can stay in registers.
+        Literal* sp = stack.data();
+        const Literal* stack_end = stack.data() + stack.size();
+        frame_count = 1;
+        CallFrame* frame = &frames[0];
+        frame->function = &program.script;
+        frame->base = 0;
+        const u8* ip = program.script.chunk.code.data();
+        const Literal* constants = program.script.chunk.constants.data();
+        Literal* slots = sp;
+
+#define READ_BYTE() (*ip++)
+#define READ_U16() (ip += 2, static_cast<u32>(ip[-2] | (ip[-1] << 8)))
+#define VM_ERROR(msg) do { frame->ip = ip; RuntimeError(*frame, msg); return false; } while (false)
+
+#define VM_BINARY(op) \
+    { \
+        auto b = std::get_if<f64>(sp - 1); \
+        auto a = std::get_if<f64>(sp - 2); \
+        if (!a || !b) \
+        { \
+            VM_ERROR("Operands must be numbers."); \
+        } \
+        sp[-2] = *a op *b; \
+        --sp; \
+        VM_DISPATCH(); \
+    }
+
+#if LOX_COMPUTED_GOTO
+        // Same order of OpCode.
+        static const void* dispatch_table[] =
+        {
+            &&op_Constant, &&op_Nil, &&op_True, &&op_False, &&op_Pop,
+            &&op_GetLocal, &&op_SetLocal, &&op_GetGlobal, &&op_SetGlobal, &&op_DefineGlobal,
+            &&op_Add, &&op_Subtract, &&op_Multiply, &&op_Divide, &&op_Negate, &&op_Not,
+            &&op_Equal, &&op_NotEqual, &&op_Less, &&op_LessEqual, &&op_Greater, &&op_GreaterEqual,
+            &&op_Print, &&op_Jump, &&op_JumpIfFalse, &&op_Loop, &&op_DefineFunction, &&op_Call,
+            &&op_Return
+        };
+        static_assert(std::size(dispatch_table) == static_cast<std::size_t>(OpCode::Count));
+
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH() goto *dispatch_table[*ip++]
+#define VM_LOOP() VM_DISPATCH();
+#else
+#define VM_CASE(name) case OpCode::name:
+#define VM_DISPATCH() break
+#define VM_LOOP() for (;;) switch (static_cast<OpCode>(*ip++))
+#endif
+
+        VM_LOOP()
+        {
+            VM_CASE(Constant)
+            {
+                *sp++ = constants[READ_U16()];
+                VM_DISPATCH();
+            }
+            VM_CASE(Nil)
+            {
+                *sp++ = LoxNil{};
+                VM_DISPATCH();
+            }
+            VM_CASE(True)
+            {
+                *sp++ = true;
+                VM_DISPATCH();
+            }
+            VM_CASE(False)
+            {
+                *sp++ = false;
+                VM_DISPATCH();
+            }
+            VM_CASE(Pop)
+            {
+                --sp;
+                VM_DISPATCH();
+            }
+
+            VM_CASE(GetLocal)
+            {
+                *sp++ = slots[READ_U16()];
+                VM_DISPATCH();
+            }
+            VM_CASE(SetLocal)
+            {
+                slots[READ_U16()] = sp[-1];
+                VM_DISPATCH();
+            }
+            VM_CASE(GetGlobal)
+            {
+                auto index = READ_U16();
+                if (!defined_globals[index])
+                {
+                    VM_ERROR("Undefined variable.");
+                }
+                *sp++ = globals[index];
+                VM_DISPATCH();
+            }
+            VM_CASE(SetGlobal)
+            {
+                auto index = READ_U16();
+                if (!defined_globals[index])
+                {
+                    VM_ERROR("Undefined variable.");
+                }
+                globals[index] = sp[-1];
+                VM_DISPATCH();
+            }
+            VM_CASE(DefineGlobal)
+            {
+                auto index = READ_U16();
+                globals[index] = *--sp;
+                defined_globals[index] = 1;
+                VM_DISPATCH();
+            }
+
+            VM_CASE(Add)
+            {
+                auto b = std::get_if<f64>(sp - 1);
+                auto a = std::get_if<f64>(sp - 2);
+                if (a && b)
+                {
+                    sp[-2] = *a + *b;
+                }
+                else if (auto left = std::get_if<StringId>(sp - 2), right = std::get_if<StringId>(sp - 1);
+                    left && right)
+                {
+                    sp[-2] = strings.Concatenate(*left, *right);
+                }
+                else
+                {
+                    VM_ERROR("Operands must be two numbers or two strings.");
+                }
+                --sp;
+                VM_DISPATCH();
+            }
+            VM_CASE(Subtract) VM_BINARY(-)
+            VM_CASE(Multiply) VM_BINARY(*)
+            VM_CASE(Divide) VM_BINARY(/)
+
+            VM_CASE(Negate)
+            {
+                auto number = std::get_if<f64>(sp - 1);
+                if (!number)
+                {
+                    VM_ERROR("Operand must be a number.");
+                }
+                sp[-1] = -*number;
+                VM_DISPATCH();
+            }
+            VM_CASE(Not)
+            {
+                sp[-1] = !IsTruthy(sp[-1]);
+                VM_DISPATCH();
+            }
+
+            VM_CASE(Equal)
+            {
+                sp[-2] = Equal(sp[-2], sp[-1]);
+                --sp;
+                VM_DISPATCH();
+            }
+            VM_CASE(NotEqual)
+            {
+                sp[-2] = !Equal(sp[-2], sp[-1]);
+                --sp;
+                VM_DISPATCH();
+            }
+            VM_CASE(Less) VM_BINARY(<)
+            VM_CASE(LessEqual) VM_BINARY(<=)
+            VM_CASE(Greater) VM_BINARY(>)
+            VM_CASE(GreaterEqual) VM_BINARY(>=)
+
+            VM_CASE(Print)
+            {
+                Print(*--sp);
+                VM_DISPATCH();
+            }
+
+            VM_CASE(Jump)
+            {
+                auto offset = READ_U16();
+                ip += offset;
+                VM_DISPATCH();
+            }
+            VM_CASE(JumpIfFalse)
+            {
+                auto offset = READ_U16();
+                if (!IsTruthy(sp[-1]))
+                {
+                    ip += offset;
+                }
+                VM_DISPATCH();
+            }
+            VM_CASE(Loop)
+            {
+                auto offset = READ_U16();
+                ip -= offset;
+                VM_DISPATCH();
+            }
+
+            VM_CASE(DefineFunction)
+            {
+                defined_functions[READ_U16()] = 1;
+                VM_DISPATCH();
+            }
+            VM_CASE(Call)
+            {
+                auto index = READ_U16();
+                auto argc = READ_BYTE();
+                if (!defined_functions[index])
+                {
+                    VM_ERROR("Undefined function.");
+                }
+                auto callee = functions[index];
+                if (argc != callee->arity)
+                {
+                    VM_ERROR("Wrong number of arguments.");
+                }
+                // Every frame can use up to 256 slots without checks.
+                if (frame_count == frames.size() || stack_end - sp < 256)
+                {
+                    bool grown = Grow(sp);
+                    frame = &frames[frame_count - 1];
+                    stack_end = stack.data() + stack.size();
+                    if (!grown)
+                    {
+                        VM_ERROR("Stack overflow.");
+                    }
+                }
+
+                frame->ip = ip;
+                frame = &frames[frame_count++];
+                frame->function = callee;
+                frame->base = static_cast<std::size_t>(sp - stack.data()) - argc;
+                ip = callee->chunk.code.data();
+                constants = callee->chunk.constants.data();
+                slots = stack.data() + frame->base;
+                VM_DISPATCH();
+            }
+            VM_CASE(Return)
+            {
+                auto result = sp[-1];
+                if (--frame_count == 0)
+                {
+                    return true;
+                }
+
+                // Pop the arguments and the locals of the callee.
+                sp = stack.data() + frame->base;
+                *sp++ = result;
+                frame = &frames[frame_count - 1];
+                ip = frame->ip;
+                constants = frame->function->chunk.constants.data();
+                slots = stack.data() + frame->base;
+                VM_DISPATCH();
+            }
+
+#if !LOX_COMPUTED_GOTO
+            default:
+                VM_ERROR("Invalid instruction.");
+#endif
+        }
+
+#undef READ_BYTE
+#undef READ_U16
+#undef VM_ERROR
+#undef VM_BINARY
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_LOOP
+
+        return false;
+    }
+} // namespace lox
@@ -0,0 +1,84 @@
+#ifndef LOX_VM_HPP
+#define LOX_VM_HPP
+
+/*
+vm.hpp
+
+PURPOSE: Execute the bytecode.
+
+CLASSES:
+    VM: stack based virtual machine.
+
+DESCRIPTION:
+    The dispatch loop uses computed goto (labels as values) when the compiler supports it: each
+    instruction jumps directly to the handler of the next one, so every handler has its own
+    indirect branch that the CPU can predict. Otherwise it falls back to a switch in a loop.
+    A call only pushes a frame with the index of its arguments, already on the value stack. The
+    stack and the frames start small and double when a call could overflow them, up to
+    stack_max values and frames_max frames (deep recursion runs, like in the compiled code);
+    the frames refer to the stack by index, so they stay valid when it moves.
+*/
+
+#include "common.hpp"
+#include "types.hpp"
+#include "bytecode.hpp"
+#include "string_pool.hpp"
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace lox
+{
+    class VM : private NonCopyable
+    {
+    public:
+        explicit VM(non_owned_ptr<const StringPool> strings_);
+
+        // Execute the program. Return false if there was a runtime error.
+        auto Run(const BytecodeProgram& program)
+            -> bool;
+
+    private:
+        struct CallFrame
+        {
+            non_owned_ptr<const BytecodeFunction> function;
+
+            // Next instruction.
+            non_owned_ptr<const u8> ip;
+
+            // Index of the first slot of the frame (the first argument) in the stack.
+            std::size_t base;
+        };
+
+        // Report the error with the line of the instruction being executed and the call stack.
+        auto RuntimeError(const CallFrame& frame, std::string_view msg)
+            -> void;
+
+        // Make room for one more frame and for the 256 slots it can use, from sp (moved with
+        // the stack). Return false if the stack is at its maximum size.
+        auto Grow(Literal*& sp)
+            -> bool;
+
+        auto Print(const Literal& value)
+            -> void;
+
+        // ==, comparing the chars of the strings built by the program.
+        auto Equal(const Literal& left, const Literal& right)
+            -> bool;
+
+    private:
+        static constexpr std::size_t frames_min = 256;
+        static constexpr std::size_t frames_max = std::size_t{1} << 18;
+        static constexpr std::size_t stack_min = frames_min * 256;
+        static constexpr std::size_t stack_max = std::size_t{1} << 24;
+
+        RuntimeStrings strings;
+
+        std::vector<Literal> stack;
+        std::vector<CallFrame> frames;
+        std::size_t frame_count{0};
+    };
+} // namespace lox
+
+#endif
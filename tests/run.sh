@@ -0,0 +1,165 @@
+#!/bin/sh
+
+# Run the test programs with each backend and compare their output and exit status.
+# Usage: sh run.sh [path to lox]   (default ../src/lox, run from the tests directory)
+#
+# A test lists its expected output lines in "// expect: <line>" comments, the message of its
+# error in a "// error: <message>" comment and its exit status in a "// exit: <status>"
+# comment (default 0). "// options: <flags>" adds flags to run and build, for example --cse.
+# "// backends: <names>" restricts it to some of the backends: jit (lazy, eager -O2 and
+# parallel), aot (-O2), vm and tiered (default all of them), or selects the dumps of the program
+# instead of its output: ast-json (which must also be a valid JSON document), ast-stats and
+# cse-stats. The cache backend runs and builds it with --cache and also checks the hits and the
+# functions compiled reported by --time. The errors are reported on stdout, "[line N] Error: <message>" (the interpreters
+# add the token): only the message is compared. stderr is not.
+
+LOX="${1:-../src/lox}"
+OUT="${TMPDIR:-/tmp}/lox-tests.$$"
+mkdir -p "$OUT"
+trap 'rm -rf "$OUT"' EXIT
+
+passed=0
+failed=0
+
+# Compare the output, the error and the status of the last run with the expected ones of the test.
+check()
+{
+    grep -v '^\[line [0-9]*\] Error' "$OUT/output" > "$OUT/actual"
+    actual_error=`sed -n 's|^\[line [0-9]*\] Error[^:]*: ||p' "$OUT/output"`
+    if [ "$status" = "$exit" ] && [ "$actual_error" = "$error" ] && cmp -s "$OUT/expected" "$OUT/actual"
+    then
+        passed=$((passed + 1))
+    else
+        failed=$((failed + 1))
+        printf "FAIL %-20s %-8s exit %s (expected %s)\n" "$program" "$1" "$status" "$exit"
+        if [ "$actual_error" != "$error" ]
+        then
+            printf "    error \"%s\" (expected \"%s\")\n" "$actual_error" "$error"
+        fi
+        diff "$OUT/expected" "$OUT/actual" | sed 's/^/    /'
+    fi
+}
+
+# Run (or build and run) the file with the cache, in $OUT/cache, and check the hits and the
+# functions compiled reported by --time, "<hits> <compiled>", with the pattern.
+cached()
+{
+    if [ "$1" = run ]
+    then
+        # Eager, so all the functions are compiled or loaded.
+        LOX_CACHE_DIR="$OUT/cache" "$LOX" run --eager --cache --time "$2" > "$OUT/output" 2> "$OUT/time"
+        status=$?
+    elif LOX_CACHE_DIR="$OUT/cache" "$LOX" build --cache --time -o "$OUT/program" "$2" > "$OUT/output" 2> "$OUT/time"
+    then
+        "$OUT/program" > "$OUT/output" 2> /dev/null
+        status=$?
+    else
+        status=$?
+    fi
+    counts=`sed -n 's|^cache: *\([0-9]*\) hits, \([0-9]*\) compiled$|\1 \2|p' "$OUT/time"`
+    case "$counts" in
+    $3)
+        ;;
+    *)
+        status="$status, cache \"$counts\" (expected \"$3\")"
+        ;;
+    esac
+}
+
+# Run the program with a backend: jit, aot, vm, tiered or cache, or dump it (ast-json,
+# ast-stats, cse-stats).
+run()
+{
+    case "$1" in
+    jit)
+        "$LOX" run $options "$program" > "$OUT/output" 2> /dev/null
+        status=$?
+        check jit
+        "$LOX" run $options --eager -O2 "$program" > "$OUT/output" 2> /dev/null
+        status=$?
+        check jit-O2
+        "$LOX" run $options -O2 -j 2 "$program" > "$OUT/output" 2> /dev/null
+        status=$?
+        check jit-j2
+        ;;
+    aot)
+        # The compile errors are reported by the build.
+        if "$LOX" build $options -O2 -o "$OUT/program" "$program" > "$OUT/output" 2> /dev/null
+        then
+            "$OUT/program" > "$OUT/output" 2> /dev/null
+            status=$?
+        else
+            status=$?
+        fi
+        check aot
+        ;;
+    vm)
+        "$LOX" run $options --vm "$program" > "$OUT/output" 2> /dev/null
+        status=$?
+        check vm
+        ;;
+    tiered)
+        # A low threshold, so the hot functions are compiled while the program runs.
+        "$LOX" run $options --tiered --jit-threshold 10 "$program" > "$OUT/output" 2> /dev/null
+        status=$?
+        check tiered
+        ;;
+    cache)
+        # The first run compiles the functions, the second one loads them all. The lines of a
+        # function are part of its key (its runtime errors report them): moving it compiles it
+        # again, adding a function compiles only that one. build has its own objects.
+        rm -rf "$OUT/cache"
+        cached run "$program" "0 [1-9]*"
+        check cache-cold
+        functions="${counts#0 }"
+        cached run "$program" "$functions 0"
+        check cache-warm
+        { echo; cat "$program"; } > "$OUT/moved.lox"
+        cached run "$OUT/moved.lox" "0 $functions"
+        check cache-moved
+        { cat "$program"; echo "fun cache_added() { return 1; }"; } > "$OUT/added.lox"
+        cached run "$OUT/added.lox" "$functions 1"
+        check cache-added
+        cached build "$program" "0 $functions"
+        check cache-build
+        cached build "$program" "$functions 0"
+        check cache-build-warm
+        ;;
+    ast-json)
+        "$LOX" --ast-json "$program" > "$OUT/output" 2> /dev/null
+        status=$?
+        if [ "$status" = 0 ] && ! python3 -c 'import json, sys; json.load(sys.stdin)' < "$OUT/output" 2> /dev/null
+        then
+            status="invalid JSON"
+        fi
+        check ast-json
+        ;;
+    ast-stats)
+        "$LOX" --ast-stats "$program" > "$OUT/output" 2> /dev/null
+        status=$?
+        check ast-stats
+        ;;
+    cse-stats)
+        "$LOX" --cse-stats "$program" > "$OUT/output" 2> /dev/null
+        status=$?
+        check cse-stats
+        ;;
+    esac
+}
+
+for program in *.lox
+do
+    sed -n 's|^// expect: \{0,1\}||p' "$program" > "$OUT/expected"
+    error=`sed -n 's|^// error: ||p' "$program"`
+    exit=`sed -n 's|^// exit: ||p' "$program"`
+    exit="${exit:-0}"
+    options=`sed -n 's|^// options: ||p' "$program"`
+    backends=`sed -n 's|^// backends: ||p' "$program"`
+    for backend in ${backends:-jit aot vm tiered}
+    do
+        run "$backend"
+    done
+done
+
+printf "%d passed, %d failed\n" "$passed" "$failed"
+[ "$failed" -eq 0 ]